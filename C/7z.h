@@ -206,6 +206,14 @@ SRes SzArEx_Open(CSzArEx *p, ILookInStreamPtr inStream,
 void SzAr_SetPassword(const Byte *password, size_t passwordSize);
 int SzAr_HasPassword(void);
 
+/*
+  Number of threads for LZMA2 decoding (default: 1).
+  It's used only if 7zDec.c was compiled with Z7_LZMA2_DEC_MT
+  (that requires Lzma2DecMt.c, MtDec.c and Threads.c).
+  The wasm build defines it with WASM7Z_THREADS=1, and wasm7z_set_threads() calls it.
+*/
+void SzAr_SetNumThreads(UInt32 numThreads);
+
 EXTERN_C_END
 
 #endif
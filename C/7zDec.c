@@ -8,6 +8,7 @@
 #include <string.h>
 
 /* #define Z7_PPMD_SUPPORT */
+/* #define Z7_LZMA2_DEC_MT */
 
 #include "7z.h"
 #include "Aes.h"
@@ -21,6 +22,12 @@
 #include "LzmaDec.h"
 #include "Lzma2Dec.h"
 #include "zstd.h"
+#if defined(Z7_LZMA2_DEC_MT) && (defined(Z7_ST) || defined(Z7_NO_METHOD_LZMA2))
+#undef Z7_LZMA2_DEC_MT
+#endif
+#ifdef Z7_LZMA2_DEC_MT
+#include "Lzma2DecMt.h"
+#endif
 #ifdef Z7_PPMD_SUPPORT
 #include "Ppmd7.h"
 #endif
@@ -77,6 +84,7 @@
 static Byte *g_7zPassword = NULL;
 static size_t g_7zPasswordSize = 0;
 static int g_7zCryptoReady = 0;
+static UInt32 g_7zNumThreads = 1;
 
 static SRes SzDecodeLzma(const Byte *props, unsigned propsSize, UInt64 inSize, ILookInStreamPtr inStream,
     Byte *outBuffer, SizeT outSize, ISzAllocPtr allocMain);
@@ -139,6 +147,11 @@ int SzAr_HasPassword(void)
   return g_7zPassword && g_7zPasswordSize != 0;
 }
 
+void SzAr_SetNumThreads(UInt32 numThreads)
+{
+  g_7zNumThreads = (numThreads == 0 ? 1 : numThreads);
+}
+
 typedef struct
 {
   ILookInStream vt;
@@ -666,6 +679,93 @@ static SRes SzDecodeLzma(const Byte *props, unsigned propsSize, UInt64 inSize, I
 }
 
 
+#ifdef Z7_LZMA2_DEC_MT
+
+/* Lzma2DecMt splits the stream at chunks that reset the dictionary (the
+   multi-threaded LZMA2 encoder writes such chunks between its blocks) and
+   decodes the blocks in parallel. Streams without such chunks are decoded
+   by Lzma2DecMt in single-thread mode. */
+
+#define k_Lzma2Mt_OutSizeMin ((SizeT)1 << 22)
+
+typedef struct
+{
+  ISeqInStream vt;
+  ILookInStreamPtr inStream;
+  UInt64 rem;
+} CSzLimSeqInStream;
+
+static SRes CSzLimSeqInStream_Read(ISeqInStreamPtr pp, void *buf, size_t *size)
+{
+  CSzLimSeqInStream *p = (CSzLimSeqInStream *)(void *)pp;
+  if (*size > p->rem)
+    *size = (size_t)p->rem;
+  if (*size == 0)
+    return SZ_OK;
+  RINOK(ILookInStream_Read(p->inStream, buf, size))
+  p->rem -= *size;
+  return SZ_OK;
+}
+
+typedef struct
+{
+  ISeqOutStream vt;
+  Byte *buf;
+  SizeT rem;
+} CSzBufSeqOutStream;
+
+static size_t CSzBufSeqOutStream_Write(ISeqOutStreamPtr pp, const void *data, size_t size)
+{
+  CSzBufSeqOutStream *p = (CSzBufSeqOutStream *)(void *)pp;
+  if (size > p->rem)
+    size = p->rem;
+  memcpy(p->buf, data, size);
+  p->buf += size;
+  p->rem -= size;
+  return size;
+}
+
+static SRes SzDecodeLzma2Mt(Byte prop, UInt64 inSize, ILookInStreamPtr inStream,
+    Byte *outBuffer, SizeT outSize, ISzAllocPtr allocMain)
+{
+  CLzma2DecMtProps props;
+  CLzma2DecMtHandle dec;
+  CSzLimSeqInStream inLim;
+  CSzBufSeqOutStream outBuf;
+  UInt64 outSize64 = outSize;
+  UInt64 inProcessed = 0;
+  int isMT = False;
+  SRes res;
+
+  dec = Lzma2DecMt_Create(allocMain, allocMain);
+  if (!dec)
+    return SZ_ERROR_MEM;
+
+  Lzma2DecMtProps_Init(&props);
+  props.numThreads = g_7zNumThreads;
+
+  inLim.vt.Read = CSzLimSeqInStream_Read;
+  inLim.inStream = inStream;
+  inLim.rem = inSize;
+  outBuf.vt.Write = CSzBufSeqOutStream_Write;
+  outBuf.buf = outBuffer;
+  outBuf.rem = outSize;
+
+  res = Lzma2DecMt_Decode(dec, prop, &props, &outBuf.vt, &outSize64, 1, // finishMode
+      &inLim.vt, &inProcessed, &isMT, NULL);
+  Lzma2DecMt_Destroy(dec);
+
+  // the output buffer is sized from the folder header, so a write overflow is a data error
+  if (res == SZ_ERROR_WRITE)
+    res = SZ_ERROR_DATA;
+  if (res == SZ_OK && (outBuf.rem != 0 || inProcessed != inSize))
+    res = SZ_ERROR_DATA;
+  return res;
+}
+
+#endif
+
+
 #ifndef Z7_NO_METHOD_LZMA2
 
 static SRes SzDecodeLzma2(const Byte *props, unsigned propsSize, UInt64 inSize, ILookInStreamPtr inStream,
@@ -677,6 +777,10 @@ static SRes SzDecodeLzma2(const Byte *props, unsigned propsSize, UInt64 inSize,
   Lzma2Dec_CONSTRUCT(&state)
   if (propsSize != 1)
     return SZ_ERROR_DATA;
+ #ifdef Z7_LZMA2_DEC_MT
+  if (g_7zNumThreads > 1 && outSize >= k_Lzma2Mt_OutSizeMin)
+    return SzDecodeLzma2Mt(props[0], inSize, inStream, outBuffer, outSize, allocMain);
+ #endif
   RINOK(Lzma2Dec_AllocateProbs(&state, props[0], allocMain))
   state.decoder.dic = outBuffer;
   state.decoder.dicBufSize = outSize;
@@ -718,7 +718,6 @@ BoolInt CPU_IsSupported_AVX2(void)
   }
 }
 
-#if 0
 BoolInt CPU_IsSupported_AVX512F_AVX512VL(void)
 {
   if (!CPU_IsSupported_AVX())
@@ -745,7 +744,6 @@ BoolInt CPU_IsSupported_AVX512F_AVX512VL(void)
         & (BoolInt)(bm >> 7); // ZMM16 ... ZMM31
   }
 }
-#endif
 
 BoolInt CPU_IsSupported_VAES_AVX2(void)
 {
@@ -13,6 +13,9 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include "../Compiler.h"
+#include "../CpuArch.h"
+
 #include "blake3.h"
 
 const char *blake3_version(void) { return BLAKE3_VERSION_STRING; }
@@ -178,7 +181,7 @@ INLINE size_t left_len(size_t content_len) {
 INLINE size_t compress_chunks_parallel(const uint8_t *input, size_t input_len,
                                        const uint32_t key[8],
                                        uint64_t chunk_counter, uint8_t flags,
-                                       uint8_t *out) {
+                                       size_t degree, uint8_t *out) {
 #if defined(BLAKE3_TESTING)
   assert(0 < input_len);
   assert(input_len <= MAX_SIMD_DEGREE * BLAKE3_CHUNK_LEN);
@@ -195,7 +198,7 @@ INLINE size_t compress_chunks_parallel(const uint8_t *input, size_t input_len,
 
   blake3_hash_many(chunks_array, chunks_array_len,
                    BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN, key, chunk_counter,
-                   true, flags, CHUNK_START, CHUNK_END, out);
+                   true, flags, CHUNK_START, CHUNK_END, out, degree);
 
   // Hash the remaining partial chunk, if there is one. Note that the empty
   // chunk (meaning the empty message) is a different codepath.
@@ -222,7 +225,7 @@ INLINE size_t compress_chunks_parallel(const uint8_t *input, size_t input_len,
 INLINE size_t compress_parents_parallel(const uint8_t *child_chaining_values,
                                         size_t num_chaining_values,
                                         const uint32_t key[8], uint8_t flags,
-                                        uint8_t *out) {
+                                        size_t degree, uint8_t *out) {
 #if defined(BLAKE3_TESTING)
   assert(2 <= num_chaining_values);
   assert(num_chaining_values <= 2 * MAX_SIMD_DEGREE_OR_2);
@@ -241,7 +244,7 @@ INLINE size_t compress_parents_parallel(const uint8_t *child_chaining_values,
                    false, flags | PARENT,
                    0, // Parents have no start flags.
                    0, // Parents have no end flags.
-                   out);
+                   out, degree);
 
   // If there's an odd child left over, it becomes an output.
   if (num_chaining_values > 2 * parents_array_len) {
@@ -256,7 +259,7 @@ INLINE size_t compress_parents_parallel(const uint8_t *child_chaining_values,
 
 // The wide helper function returns (writes out) an array of chaining values
 // and returns the length of that array. The number of chaining values returned
-// is the dyanmically detected SIMD degree, at most MAX_SIMD_DEGREE. Or fewer,
+// is the SIMD degree of the hasher, at most MAX_SIMD_DEGREE. Or fewer,
 // if the input is shorter than that many chunks. The reason for maintaining a
 // wide array of chaining values going back up the tree, is to allow the
 // implementation to hash as many parents in parallel as possible.
@@ -275,14 +278,15 @@ static size_t blake3_compress_subtree_wide(const uint8_t *input,
                                            size_t input_len,
                                            const uint32_t key[8],
                                            uint64_t chunk_counter,
-                                           uint8_t flags, uint8_t *out) {
+                                           uint8_t flags, size_t simd_degree,
+                                           uint8_t *out) {
   // Note that the single chunk case does *not* bump the SIMD degree up to 2
   // when it is 1. If this implementation adds multi-threading in the future,
   // this gives us the option of multi-threading even the 2-chunk case, which
   // can help performance on smaller platforms.
-  if (input_len <= blake3_simd_degree() * BLAKE3_CHUNK_LEN) {
+  if (input_len <= simd_degree * BLAKE3_CHUNK_LEN) {
     return compress_chunks_parallel(input, input_len, key, chunk_counter, flags,
-                                    out);
+                                    simd_degree, out);
   }
 
   // With more than simd_degree chunks, we need to recurse. Start by dividing
@@ -299,7 +303,7 @@ static size_t blake3_compress_subtree_wide(const uint8_t *input,
   // account for the special case of returning 2 outputs when the SIMD degree
   // is 1.
   uint8_t cv_array[2 * MAX_SIMD_DEGREE_OR_2 * BLAKE3_OUT_LEN];
-  size_t degree = blake3_simd_degree();
+  size_t degree = simd_degree;
   if (left_input_len > BLAKE3_CHUNK_LEN && degree == 1) {
     // The special case: We always use a degree of at least two, to make
     // sure there are two outputs. Except, as noted above, at the chunk
@@ -311,10 +315,12 @@ static size_t blake3_compress_subtree_wide(const uint8_t *input,
 
   // Recurse! If this implementation adds multi-threading support in the
   // future, this is where it will go.
-  size_t left_n = blake3_compress_subtree_wide(input, left_input_len, key,
-                                               chunk_counter, flags, cv_array);
-  size_t right_n = blake3_compress_subtree_wide(
-      right_input, right_input_len, key, right_chunk_counter, flags, right_cvs);
+  size_t left_n = blake3_compress_subtree_wide(
+      input, left_input_len, key, chunk_counter, flags, simd_degree, cv_array);
+  size_t right_n =
+      blake3_compress_subtree_wide(right_input, right_input_len, key,
+                                   right_chunk_counter, flags, simd_degree,
+                                   right_cvs);
 
   // The special case again. If simd_degree=1, then we'll have left_n=1 and
   // right_n=1. Rather than compressing them into a single output, return
@@ -327,7 +333,7 @@ static size_t blake3_compress_subtree_wide(const uint8_t *input,
   // Otherwise, do one layer of parent node compression.
   size_t num_chaining_values = left_n + right_n;
   return compress_parents_parallel(cv_array, num_chaining_values, key, flags,
-                                   out);
+                                   simd_degree, out);
 }
 
 // Hash a subtree with compress_subtree_wide(), and then condense the resulting
@@ -342,14 +348,15 @@ static size_t blake3_compress_subtree_wide(const uint8_t *input,
 // chunk or less. That's a different codepath.
 INLINE void compress_subtree_to_parent_node(
     const uint8_t *input, size_t input_len, const uint32_t key[8],
-    uint64_t chunk_counter, uint8_t flags, uint8_t out[2 * BLAKE3_OUT_LEN]) {
+    uint64_t chunk_counter, uint8_t flags, size_t simd_degree,
+    uint8_t out[2 * BLAKE3_OUT_LEN]) {
 #if defined(BLAKE3_TESTING)
   assert(input_len > BLAKE3_CHUNK_LEN);
 #endif
 
   uint8_t cv_array[MAX_SIMD_DEGREE_OR_2 * BLAKE3_OUT_LEN];
-  size_t num_cvs = blake3_compress_subtree_wide(input, input_len, key,
-                                                chunk_counter, flags, cv_array);
+  size_t num_cvs = blake3_compress_subtree_wide(
+      input, input_len, key, chunk_counter, flags, simd_degree, cv_array);
 
   // If MAX_SIMD_DEGREE is greater than 2 and there's enough input,
   // compress_subtree_wide() returns more than 2 chaining values. Condense
@@ -357,7 +364,8 @@ INLINE void compress_subtree_to_parent_node(
   uint8_t out_array[MAX_SIMD_DEGREE_OR_2 * BLAKE3_OUT_LEN / 2];
   while (num_cvs > 2) {
     num_cvs =
-        compress_parents_parallel(cv_array, num_cvs, key, flags, out_array);
+        compress_parents_parallel(cv_array, num_cvs, key, flags, simd_degree,
+                                  out_array);
     memcpy(cv_array, out_array, num_cvs * BLAKE3_OUT_LEN);
   }
   memcpy(out, cv_array, 2 * BLAKE3_OUT_LEN);
@@ -368,10 +376,19 @@ INLINE void hasher_init_base(blake3_hasher *self, const uint32_t key[8],
   memcpy(self->key, key, BLAKE3_KEY_LEN);
   chunk_state_init(&self->chunk, key, flags);
   self->cv_stack_len = 0;
+  self->simd_degree = (uint8_t)blake3_simd_degree();
 }
 
 void blake3_hasher_init(blake3_hasher *self) { hasher_init_base(self, IV, 0); }
 
+void blake3_hasher_set_simd_degree(blake3_hasher *self, size_t degree) {
+  const size_t detected = blake3_simd_degree();
+  if (degree == 0 || degree > detected) {
+    degree = detected;
+  }
+  self->simd_degree = (uint8_t)degree;
+}
+
 void blake3_hasher_init_keyed(blake3_hasher *self,
                               const uint8_t key[BLAKE3_KEY_LEN]) {
   uint32_t key_words[8];
@@ -543,7 +560,8 @@ void blake3_hasher_update(blake3_hasher *self, const void *input,
       uint8_t cv_pair[2 * BLAKE3_OUT_LEN];
       compress_subtree_to_parent_node(input_bytes, subtree_len, self->key,
                                       self->chunk.chunk_counter,
-                                      self->chunk.flags, cv_pair);
+                                      self->chunk.flags, self->simd_degree,
+                                      cv_pair);
       hasher_push_cv(self, cv_pair, self->chunk.chunk_counter);
       hasher_push_cv(self, &cv_pair[BLAKE3_OUT_LEN],
                      self->chunk.chunk_counter + (subtree_chunks / 2));
@@ -565,6 +583,36 @@ void blake3_hasher_update(blake3_hasher *self, const void *input,
   }
 }
 
+void blake3_hasher_subtree_cvs(const blake3_hasher *self, const void *input,
+                               size_t input_len, uint64_t chunk_counter,
+                               uint8_t cv_pair[2 * BLAKE3_OUT_LEN]) {
+#if defined(BLAKE3_TESTING)
+  assert(input_len > BLAKE3_CHUNK_LEN);
+  assert((input_len & (input_len - 1)) == 0);
+  assert((chunk_counter & (input_len / BLAKE3_CHUNK_LEN - 1)) == 0);
+#endif
+  compress_subtree_to_parent_node((const uint8_t *)input, input_len,
+                                  self->key, chunk_counter, self->chunk.flags,
+                                  self->simd_degree, cv_pair);
+}
+
+void blake3_hasher_push_subtree_cvs(blake3_hasher *self,
+                                    const uint8_t cv_pair[2 * BLAKE3_OUT_LEN],
+                                    size_t input_len) {
+#if defined(BLAKE3_TESTING)
+  assert(chunk_state_len(&self->chunk) == 0);
+#endif
+  // Same as the happy path of blake3_hasher_update(): the second CV stays
+  // unmerged, so the subtree can still turn out to be the root.
+  uint8_t cv[BLAKE3_OUT_LEN];
+  uint64_t subtree_chunks = input_len / BLAKE3_CHUNK_LEN;
+  memcpy(cv, cv_pair, BLAKE3_OUT_LEN);
+  hasher_push_cv(self, cv, self->chunk.chunk_counter);
+  memcpy(cv, &cv_pair[BLAKE3_OUT_LEN], BLAKE3_OUT_LEN);
+  hasher_push_cv(self, cv, self->chunk.chunk_counter + (subtree_chunks / 2));
+  self->chunk.chunk_counter += subtree_chunks;
+}
+
 void blake3_hasher_finalize(const blake3_hasher *self, uint8_t *out,
                             size_t out_len) {
   blake3_hasher_finalize_seek(self, 0, out, out_len);
@@ -755,11 +803,532 @@ INLINE void hash_one(const uint8_t *input, size_t blocks,
   store_cv_words(out, cv);
 }
 
+/*
+ * SIMD implementations of hash_many (7-Zip ZS):
+ * several chunks (or parents) are hashed at the same time, one chunk per
+ * 32-bit lane. The implementation is selected at runtime with the CPU
+ * feature detection of CpuArch.c. Define BLAKE3_NO_SSE41, BLAKE3_NO_AVX2,
+ * BLAKE3_NO_AVX512 or BLAKE3_NO_NEON to disable some of them.
+ */
+
+#if defined(IS_X86)
+  #if defined(_MSC_VER) && (_MSC_VER >= 1900) \
+     || defined(Z7_LLVM_CLANG_VERSION)  && (Z7_LLVM_CLANG_VERSION  >= 30800) \
+     || defined(Z7_APPLE_CLANG_VERSION) && (Z7_APPLE_CLANG_VERSION >= 80000) \
+     || defined(Z7_GCC_VERSION)         && (Z7_GCC_VERSION         >= 40900)
+    #ifndef BLAKE3_NO_SSE41
+      #define BLAKE3_USE_SSE41
+    #endif
+    #ifndef BLAKE3_NO_AVX2
+      #define BLAKE3_USE_AVX2
+    #endif
+  #endif
+  #if defined(IS_X86_64) && defined(BLAKE3_USE_AVX2) && !defined(BLAKE3_NO_AVX512) && ( \
+        defined(_MSC_VER) && (_MSC_VER >= 1920) \
+     || defined(Z7_LLVM_CLANG_VERSION)  && (Z7_LLVM_CLANG_VERSION  >= 30900) \
+     || defined(Z7_APPLE_CLANG_VERSION) && (Z7_APPLE_CLANG_VERSION >= 80100) \
+     || defined(Z7_GCC_VERSION)         && (Z7_GCC_VERSION         >= 50100))
+    #define BLAKE3_USE_AVX512
+  #endif
+  #if defined(__GNUC__) || defined(__clang__)
+    #define BLAKE3_ATTRIB_SSE41  __attribute__((__target__("sse4.1")))
+    #define BLAKE3_ATTRIB_AVX2   __attribute__((__target__("avx2")))
+    #define BLAKE3_ATTRIB_AVX512 __attribute__((__target__("avx512f,avx512vl,avx2")))
+  #else
+    #define BLAKE3_ATTRIB_SSE41
+    #define BLAKE3_ATTRIB_AVX2
+    #define BLAKE3_ATTRIB_AVX512
+  #endif
+#elif (defined(__aarch64__) || defined(_M_ARM64)) && !defined(__ARM_BIG_ENDIAN) \
+    && !defined(BLAKE3_NO_NEON)
+  #define BLAKE3_USE_NEON
+  #include <arm_neon.h>
+#endif
+
+/* the generic round: G function over the columns and diagonals of the state.
+   G(a,b,c,d,x,y) must be defined for the vector type before the use. */
+#define BLAKE3_ROUND_V(v, m, r) { \
+  const uint8_t *s = MSG_SCHEDULE[r]; \
+  G(v[0], v[4], v[8],  v[12], m[s[0]],  m[s[1]]) \
+  G(v[1], v[5], v[9],  v[13], m[s[2]],  m[s[3]]) \
+  G(v[2], v[6], v[10], v[14], m[s[4]],  m[s[5]]) \
+  G(v[3], v[7], v[11], v[15], m[s[6]],  m[s[7]]) \
+  G(v[0], v[5], v[10], v[15], m[s[8]],  m[s[9]]) \
+  G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]) \
+  G(v[2], v[7], v[8],  v[13], m[s[12]], m[s[13]]) \
+  G(v[3], v[4], v[9],  v[14], m[s[14]], m[s[15]]) }
+
+#define BLAKE3_ROUNDS_V(v, m) \
+  BLAKE3_ROUND_V(v, m, 0) \
+  BLAKE3_ROUND_V(v, m, 1) \
+  BLAKE3_ROUND_V(v, m, 2) \
+  BLAKE3_ROUND_V(v, m, 3) \
+  BLAKE3_ROUND_V(v, m, 4) \
+  BLAKE3_ROUND_V(v, m, 5) \
+  BLAKE3_ROUND_V(v, m, 6)
+
+INLINE void load_counters_n(uint64_t counter, bool increment_counter,
+                            size_t n, uint32_t *lo, uint32_t *hi) {
+  size_t i;
+  for (i = 0; i < n; i++) {
+    const uint64_t c = counter + (increment_counter ? i : 0);
+    lo[i] = counter_low(c);
+    hi[i] = counter_high(c);
+  }
+}
+
+#ifdef BLAKE3_USE_SSE41
+
+/* ---------- SSE4.1: 4 lanes ---------- */
+
+#define ROT16_128(x) _mm_shuffle_epi8(x, \
+    _mm_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2))
+#define ROT8_128(x) _mm_shuffle_epi8(x, \
+    _mm_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1))
+#define ROTN_128(x, n) _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - (n)))
+
+#define G(a, b, c, d, x, y) \
+  a = _mm_add_epi32(_mm_add_epi32(a, b), x); \
+  d = ROT16_128(_mm_xor_si128(d, a)); \
+  c = _mm_add_epi32(c, d); \
+  b = ROTN_128(_mm_xor_si128(b, c), 12); \
+  a = _mm_add_epi32(_mm_add_epi32(a, b), y); \
+  d = ROT8_128(_mm_xor_si128(d, a)); \
+  c = _mm_add_epi32(c, d); \
+  b = ROTN_128(_mm_xor_si128(b, c), 7);
+
+// (r0, r1, r2, r3) : 4 words of 4 lanes -> 4 vectors of same word of all lanes
+#define TRANSPOSE4_128(r0, r1, r2, r3) { \
+  const __m128i ab_01 = _mm_unpacklo_epi32(r0, r1); \
+  const __m128i ab_23 = _mm_unpackhi_epi32(r0, r1); \
+  const __m128i cd_01 = _mm_unpacklo_epi32(r2, r3); \
+  const __m128i cd_23 = _mm_unpackhi_epi32(r2, r3); \
+  r0 = _mm_unpacklo_epi64(ab_01, cd_01); \
+  r1 = _mm_unpackhi_epi64(ab_01, cd_01); \
+  r2 = _mm_unpacklo_epi64(ab_23, cd_23); \
+  r3 = _mm_unpackhi_epi64(ab_23, cd_23); }
+
+BLAKE3_ATTRIB_SSE41
+static void hash4_sse41(const uint8_t *const *inputs, size_t blocks,
+                        const uint32_t key[8], uint64_t counter,
+                        bool increment_counter, uint8_t flags,
+                        uint8_t flags_start, uint8_t flags_end, uint8_t *out) {
+  __m128i h[8];
+  uint32_t lo[4], hi[4];
+  size_t i, block;
+  uint8_t block_flags = flags | flags_start;
+  load_counters_n(counter, increment_counter, 4, lo, hi);
+  const __m128i counter_lo = _mm_loadu_si128((const __m128i *)(const void *)lo);
+  const __m128i counter_hi = _mm_loadu_si128((const __m128i *)(const void *)hi);
+  for (i = 0; i < 8; i++)
+    h[i] = _mm_set1_epi32((int)key[i]);
+
+  for (block = 0; block < blocks; block++) {
+    __m128i m[16], v[16];
+    const size_t offset = block * BLAKE3_BLOCK_LEN;
+    if (block + 1 == blocks)
+      block_flags |= flags_end;
+    for (i = 0; i < 4; i++) {
+      m[i * 4 + 0] = _mm_loadu_si128((const __m128i *)(const void *)(inputs[0] + offset + i * 16));
+      m[i * 4 + 1] = _mm_loadu_si128((const __m128i *)(const void *)(inputs[1] + offset + i * 16));
+      m[i * 4 + 2] = _mm_loadu_si128((const __m128i *)(const void *)(inputs[2] + offset + i * 16));
+      m[i * 4 + 3] = _mm_loadu_si128((const __m128i *)(const void *)(inputs[3] + offset + i * 16));
+      TRANSPOSE4_128(m[i * 4 + 0], m[i * 4 + 1], m[i * 4 + 2], m[i * 4 + 3])
+    }
+    for (i = 0; i < 8; i++)
+      v[i] = h[i];
+    v[8]  = _mm_set1_epi32((int)IV[0]);
+    v[9]  = _mm_set1_epi32((int)IV[1]);
+    v[10] = _mm_set1_epi32((int)IV[2]);
+    v[11] = _mm_set1_epi32((int)IV[3]);
+    v[12] = counter_lo;
+    v[13] = counter_hi;
+    v[14] = _mm_set1_epi32(BLAKE3_BLOCK_LEN);
+    v[15] = _mm_set1_epi32((int)block_flags);
+    BLAKE3_ROUNDS_V(v, m)
+    for (i = 0; i < 8; i++)
+      h[i] = _mm_xor_si128(v[i], v[i + 8]);
+    block_flags = flags;
+  }
+
+  TRANSPOSE4_128(h[0], h[1], h[2], h[3])
+  TRANSPOSE4_128(h[4], h[5], h[6], h[7])
+  for (i = 0; i < 4; i++) {
+    _mm_storeu_si128((__m128i *)(void *)(out + i * BLAKE3_OUT_LEN), h[i]);
+    _mm_storeu_si128((__m128i *)(void *)(out + i * BLAKE3_OUT_LEN + 16), h[i + 4]);
+  }
+}
+
+#undef G
+
+#endif // BLAKE3_USE_SSE41
+
+#ifdef BLAKE3_USE_AVX2
+
+/* ---------- AVX2: 8 lanes ---------- */
+
+#define ROT16_256(x) _mm256_shuffle_epi8(x, _mm256_set_epi8( \
+    13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2, \
+    13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2))
+#define ROT8_256(x) _mm256_shuffle_epi8(x, _mm256_set_epi8( \
+    12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1, \
+    12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1))
+#define ROTN_256(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+#define G(a, b, c, d, x, y) \
+  a = _mm256_add_epi32(_mm256_add_epi32(a, b), x); \
+  d = ROT16_256(_mm256_xor_si256(d, a)); \
+  c = _mm256_add_epi32(c, d); \
+  b = ROTN_256(_mm256_xor_si256(b, c), 12); \
+  a = _mm256_add_epi32(_mm256_add_epi32(a, b), y); \
+  d = ROT8_256(_mm256_xor_si256(d, a)); \
+  c = _mm256_add_epi32(c, d); \
+  b = ROTN_256(_mm256_xor_si256(b, c), 7);
+
+// r[8] : 8 words of 8 lanes -> 8 vectors of same word of all lanes
+BLAKE3_ATTRIB_AVX2
+INLINE void transpose8_256(__m256i r[8]) {
+  const __m256i ab_0145 = _mm256_unpacklo_epi32(r[0], r[1]);
+  const __m256i ab_2367 = _mm256_unpackhi_epi32(r[0], r[1]);
+  const __m256i cd_0145 = _mm256_unpacklo_epi32(r[2], r[3]);
+  const __m256i cd_2367 = _mm256_unpackhi_epi32(r[2], r[3]);
+  const __m256i ef_0145 = _mm256_unpacklo_epi32(r[4], r[5]);
+  const __m256i ef_2367 = _mm256_unpackhi_epi32(r[4], r[5]);
+  const __m256i gh_0145 = _mm256_unpacklo_epi32(r[6], r[7]);
+  const __m256i gh_2367 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+  const __m256i abcd_04 = _mm256_unpacklo_epi64(ab_0145, cd_0145);
+  const __m256i abcd_15 = _mm256_unpackhi_epi64(ab_0145, cd_0145);
+  const __m256i abcd_26 = _mm256_unpacklo_epi64(ab_2367, cd_2367);
+  const __m256i abcd_37 = _mm256_unpackhi_epi64(ab_2367, cd_2367);
+  const __m256i efgh_04 = _mm256_unpacklo_epi64(ef_0145, gh_0145);
+  const __m256i efgh_15 = _mm256_unpackhi_epi64(ef_0145, gh_0145);
+  const __m256i efgh_26 = _mm256_unpacklo_epi64(ef_2367, gh_2367);
+  const __m256i efgh_37 = _mm256_unpackhi_epi64(ef_2367, gh_2367);
+
+  r[0] = _mm256_permute2x128_si256(abcd_04, efgh_04, 0x20);
+  r[1] = _mm256_permute2x128_si256(abcd_15, efgh_15, 0x20);
+  r[2] = _mm256_permute2x128_si256(abcd_26, efgh_26, 0x20);
+  r[3] = _mm256_permute2x128_si256(abcd_37, efgh_37, 0x20);
+  r[4] = _mm256_permute2x128_si256(abcd_04, efgh_04, 0x31);
+  r[5] = _mm256_permute2x128_si256(abcd_15, efgh_15, 0x31);
+  r[6] = _mm256_permute2x128_si256(abcd_26, efgh_26, 0x31);
+  r[7] = _mm256_permute2x128_si256(abcd_37, efgh_37, 0x31);
+}
+
+// 16 message words of block of 8 inputs -> m[16]
+BLAKE3_ATTRIB_AVX2
+INLINE void load_msg8_256(const uint8_t *const *inputs, size_t offset, __m256i m[16]) {
+  size_t i;
+  for (i = 0; i < 8; i++) {
+    m[i]     = _mm256_loadu_si256((const __m256i *)(const void *)(inputs[i] + offset));
+    m[i + 8] = _mm256_loadu_si256((const __m256i *)(const void *)(inputs[i] + offset + 32));
+  }
+  transpose8_256(m);
+  transpose8_256(m + 8);
+}
+
+BLAKE3_ATTRIB_AVX2
+static void hash8_avx2(const uint8_t *const *inputs, size_t blocks,
+                       const uint32_t key[8], uint64_t counter,
+                       bool increment_counter, uint8_t flags,
+                       uint8_t flags_start, uint8_t flags_end, uint8_t *out) {
+  __m256i h[8];
+  uint32_t lo[8], hi[8];
+  size_t i, block;
+  uint8_t block_flags = flags | flags_start;
+  load_counters_n(counter, increment_counter, 8, lo, hi);
+  const __m256i counter_lo = _mm256_loadu_si256((const __m256i *)(const void *)lo);
+  const __m256i counter_hi = _mm256_loadu_si256((const __m256i *)(const void *)hi);
+  for (i = 0; i < 8; i++)
+    h[i] = _mm256_set1_epi32((int)key[i]);
+
+  for (block = 0; block < blocks; block++) {
+    __m256i m[16], v[16];
+    if (block + 1 == blocks)
+      block_flags |= flags_end;
+    load_msg8_256(inputs, block * BLAKE3_BLOCK_LEN, m);
+    for (i = 0; i < 8; i++)
+      v[i] = h[i];
+    v[8]  = _mm256_set1_epi32((int)IV[0]);
+    v[9]  = _mm256_set1_epi32((int)IV[1]);
+    v[10] = _mm256_set1_epi32((int)IV[2]);
+    v[11] = _mm256_set1_epi32((int)IV[3]);
+    v[12] = counter_lo;
+    v[13] = counter_hi;
+    v[14] = _mm256_set1_epi32(BLAKE3_BLOCK_LEN);
+    v[15] = _mm256_set1_epi32((int)block_flags);
+    BLAKE3_ROUNDS_V(v, m)
+    for (i = 0; i < 8; i++)
+      h[i] = _mm256_xor_si256(v[i], v[i + 8]);
+    block_flags = flags;
+  }
+
+  transpose8_256(h);
+  for (i = 0; i < 8; i++)
+    _mm256_storeu_si256((__m256i *)(void *)(out + i * BLAKE3_OUT_LEN), h[i]);
+}
+
+#undef G
+
+#endif // BLAKE3_USE_AVX2
+
+#ifdef BLAKE3_USE_AVX512
+
+/* ---------- AVX-512: 16 lanes ---------- */
+
+#define G(a, b, c, d, x, y) \
+  a = _mm512_add_epi32(_mm512_add_epi32(a, b), x); \
+  d = _mm512_ror_epi32(_mm512_xor_si512(d, a), 16); \
+  c = _mm512_add_epi32(c, d); \
+  b = _mm512_ror_epi32(_mm512_xor_si512(b, c), 12); \
+  a = _mm512_add_epi32(_mm512_add_epi32(a, b), y); \
+  d = _mm512_ror_epi32(_mm512_xor_si512(d, a), 8); \
+  c = _mm512_add_epi32(c, d); \
+  b = _mm512_ror_epi32(_mm512_xor_si512(b, c), 7);
+
+#define COMBINE_512(lo, hi) \
+  _mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1)
+
+BLAKE3_ATTRIB_AVX512
+static void hash16_avx512(const uint8_t *const *inputs, size_t blocks,
+                          const uint32_t key[8], uint64_t counter,
+                          bool increment_counter, uint8_t flags,
+                          uint8_t flags_start, uint8_t flags_end, uint8_t *out) {
+  __m512i h[8];
+  uint32_t lo[16], hi[16];
+  size_t i, block;
+  uint8_t block_flags = flags | flags_start;
+  load_counters_n(counter, increment_counter, 16, lo, hi);
+  const __m512i counter_lo = _mm512_loadu_si512((const void *)lo);
+  const __m512i counter_hi = _mm512_loadu_si512((const void *)hi);
+  for (i = 0; i < 8; i++)
+    h[i] = _mm512_set1_epi32((int)key[i]);
+
+  for (block = 0; block < blocks; block++) {
+    __m512i m[16], v[16];
+    __m256i m_lo[16], m_hi[16];
+    if (block + 1 == blocks)
+      block_flags |= flags_end;
+    // lanes 0-7 and lanes 8-15 are transposed as 8x8 blocks
+    load_msg8_256(inputs, block * BLAKE3_BLOCK_LEN, m_lo);
+    load_msg8_256(inputs + 8, block * BLAKE3_BLOCK_LEN, m_hi);
+    for (i = 0; i < 16; i++)
+      m[i] = COMBINE_512(m_lo[i], m_hi[i]);
+    for (i = 0; i < 8; i++)
+      v[i] = h[i];
+    v[8]  = _mm512_set1_epi32((int)IV[0]);
+    v[9]  = _mm512_set1_epi32((int)IV[1]);
+    v[10] = _mm512_set1_epi32((int)IV[2]);
+    v[11] = _mm512_set1_epi32((int)IV[3]);
+    v[12] = counter_lo;
+    v[13] = counter_hi;
+    v[14] = _mm512_set1_epi32(BLAKE3_BLOCK_LEN);
+    v[15] = _mm512_set1_epi32((int)block_flags);
+    BLAKE3_ROUNDS_V(v, m)
+    for (i = 0; i < 8; i++)
+      h[i] = _mm512_xor_si512(v[i], v[i + 8]);
+    block_flags = flags;
+  }
+
+  {
+    __m256i h_lo[8], h_hi[8];
+    for (i = 0; i < 8; i++) {
+      h_lo[i] = _mm512_castsi512_si256(h[i]);
+      h_hi[i] = _mm512_extracti64x4_epi64(h[i], 1);
+    }
+    transpose8_256(h_lo);
+    transpose8_256(h_hi);
+    for (i = 0; i < 8; i++) {
+      _mm256_storeu_si256((__m256i *)(void *)(out + i * BLAKE3_OUT_LEN), h_lo[i]);
+      _mm256_storeu_si256((__m256i *)(void *)(out + (i + 8) * BLAKE3_OUT_LEN), h_hi[i]);
+    }
+  }
+}
+
+#undef G
+
+#endif // BLAKE3_USE_AVX512
+
+#ifdef BLAKE3_USE_NEON
+
+/* ---------- NEON: 4 lanes ---------- */
+
+#define ROTN_NEON(x, n) vsriq_n_u32(vshlq_n_u32(x, 32 - (n)), x, n)
+#define ROT16_NEON(x) vreinterpretq_u32_u16(vrev32q_u16(vreinterpretq_u16_u32(x)))
+
+#define G(a, b, c, d, x, y) \
+  a = vaddq_u32(vaddq_u32(a, b), x); \
+  d = ROT16_NEON(veorq_u32(d, a)); \
+  c = vaddq_u32(c, d); \
+  b = ROTN_NEON(veorq_u32(b, c), 12); \
+  a = vaddq_u32(vaddq_u32(a, b), y); \
+  d = ROTN_NEON(veorq_u32(d, a), 8); \
+  c = vaddq_u32(c, d); \
+  b = ROTN_NEON(veorq_u32(b, c), 7);
+
+#define TRANSPOSE4_NEON(r0, r1, r2, r3) { \
+  const uint32x4x2_t t01 = vtrnq_u32(r0, r1); \
+  const uint32x4x2_t t23 = vtrnq_u32(r2, r3); \
+  r0 = vcombine_u32(vget_low_u32(t01.val[0]),  vget_low_u32(t23.val[0])); \
+  r1 = vcombine_u32(vget_low_u32(t01.val[1]),  vget_low_u32(t23.val[1])); \
+  r2 = vcombine_u32(vget_high_u32(t01.val[0]), vget_high_u32(t23.val[0])); \
+  r3 = vcombine_u32(vget_high_u32(t01.val[1]), vget_high_u32(t23.val[1])); }
+
+#define LOAD_NEON(p) vreinterpretq_u32_u8(vld1q_u8(p))
+#define STORE_NEON(p, x) vst1q_u8(p, vreinterpretq_u8_u32(x))
+
+static void hash4_neon(const uint8_t *const *inputs, size_t blocks,
+                       const uint32_t key[8], uint64_t counter,
+                       bool increment_counter, uint8_t flags,
+                       uint8_t flags_start, uint8_t flags_end, uint8_t *out) {
+  uint32x4_t h[8];
+  uint32_t lo[4], hi[4];
+  size_t i, block;
+  uint8_t block_flags = flags | flags_start;
+  load_counters_n(counter, increment_counter, 4, lo, hi);
+  const uint32x4_t counter_lo = vld1q_u32(lo);
+  const uint32x4_t counter_hi = vld1q_u32(hi);
+  for (i = 0; i < 8; i++)
+    h[i] = vdupq_n_u32(key[i]);
+
+  for (block = 0; block < blocks; block++) {
+    uint32x4_t m[16], v[16];
+    const size_t offset = block * BLAKE3_BLOCK_LEN;
+    if (block + 1 == blocks)
+      block_flags |= flags_end;
+    for (i = 0; i < 4; i++) {
+      m[i * 4 + 0] = LOAD_NEON(inputs[0] + offset + i * 16);
+      m[i * 4 + 1] = LOAD_NEON(inputs[1] + offset + i * 16);
+      m[i * 4 + 2] = LOAD_NEON(inputs[2] + offset + i * 16);
+      m[i * 4 + 3] = LOAD_NEON(inputs[3] + offset + i * 16);
+      TRANSPOSE4_NEON(m[i * 4 + 0], m[i * 4 + 1], m[i * 4 + 2], m[i * 4 + 3])
+    }
+    for (i = 0; i < 8; i++)
+      v[i] = h[i];
+    v[8]  = vdupq_n_u32(IV[0]);
+    v[9]  = vdupq_n_u32(IV[1]);
+    v[10] = vdupq_n_u32(IV[2]);
+    v[11] = vdupq_n_u32(IV[3]);
+    v[12] = counter_lo;
+    v[13] = counter_hi;
+    v[14] = vdupq_n_u32(BLAKE3_BLOCK_LEN);
+    v[15] = vdupq_n_u32(block_flags);
+    BLAKE3_ROUNDS_V(v, m)
+    for (i = 0; i < 8; i++)
+      h[i] = veorq_u32(v[i], v[i + 8]);
+    block_flags = flags;
+  }
+
+  TRANSPOSE4_NEON(h[0], h[1], h[2], h[3])
+  TRANSPOSE4_NEON(h[4], h[5], h[6], h[7])
+  for (i = 0; i < 4; i++) {
+    STORE_NEON(out + i * BLAKE3_OUT_LEN, h[i]);
+    STORE_NEON(out + i * BLAKE3_OUT_LEN + 16, h[i + 4]);
+  }
+}
+
+#undef G
+
+#endif // BLAKE3_USE_NEON
+
+#if defined(BLAKE3_USE_SSE41) || defined(BLAKE3_USE_AVX2) || defined(BLAKE3_USE_NEON)
+
+// 0 : not detected yet
+static unsigned g_blake3_simd_degree;
+
+static unsigned blake3_detect_simd_degree(void) {
+  unsigned degree = g_blake3_simd_degree;
+  if (degree != 0)
+    return degree;
+  degree = 1;
+#ifdef BLAKE3_USE_NEON
+  degree = 4;
+#endif
+#ifdef BLAKE3_USE_SSE41
+  if (CPU_IsSupported_SSE41())
+    degree = 4;
+#endif
+#ifdef BLAKE3_USE_AVX2
+  if (CPU_IsSupported_AVX2())
+    degree = 8;
+#endif
+#ifdef BLAKE3_USE_AVX512
+  if (CPU_IsSupported_AVX512F_AVX512VL())
+    degree = 16;
+#endif
+  g_blake3_simd_degree = degree;
+  return degree;
+}
+
+#endif
+
 void blake3_hash_many(const uint8_t *const *inputs, size_t num_inputs,
                                size_t blocks, const uint32_t key[8],
                                uint64_t counter, bool increment_counter,
                                uint8_t flags, uint8_t flags_start,
-                               uint8_t flags_end, uint8_t *out) {
+                               uint8_t flags_end, uint8_t *out,
+                               size_t degree) {
+  // (degree) is the SIMD degree of the caller: at most blake3_simd_degree()
+#if !defined(BLAKE3_USE_SSE41) && !defined(BLAKE3_USE_AVX2) && !defined(BLAKE3_USE_NEON)
+  (void)degree;
+#endif
+#ifdef BLAKE3_USE_AVX512
+  if (degree >= 16) {
+    while (num_inputs >= 16) {
+      hash16_avx512(inputs, blocks, key, counter, increment_counter, flags,
+                    flags_start, flags_end, out);
+      if (increment_counter) {
+        counter += 16;
+      }
+      inputs += 16;
+      num_inputs -= 16;
+      out = &out[16 * BLAKE3_OUT_LEN];
+    }
+  }
+#endif
+#ifdef BLAKE3_USE_AVX2
+  if (degree >= 8) {
+    while (num_inputs >= 8) {
+      hash8_avx2(inputs, blocks, key, counter, increment_counter, flags,
+                 flags_start, flags_end, out);
+      if (increment_counter) {
+        counter += 8;
+      }
+      inputs += 8;
+      num_inputs -= 8;
+      out = &out[8 * BLAKE3_OUT_LEN];
+    }
+  }
+#endif
+#ifdef BLAKE3_USE_SSE41
+  if (degree >= 4) {
+    while (num_inputs >= 4) {
+      hash4_sse41(inputs, blocks, key, counter, increment_counter, flags,
+                  flags_start, flags_end, out);
+      if (increment_counter) {
+        counter += 4;
+      }
+      inputs += 4;
+      num_inputs -= 4;
+      out = &out[4 * BLAKE3_OUT_LEN];
+    }
+  }
+#endif
+#ifdef BLAKE3_USE_NEON
+  if (degree >= 4) {
+    while (num_inputs >= 4) {
+      hash4_neon(inputs, blocks, key, counter, increment_counter, flags,
+                 flags_start, flags_end, out);
+      if (increment_counter) {
+        counter += 4;
+      }
+      inputs += 4;
+      num_inputs -= 4;
+      out = &out[4 * BLAKE3_OUT_LEN];
+    }
+  }
+#endif
   while (num_inputs > 0) {
     hash_one(inputs[0], blocks, key, counter, flags, flags_start,
                       flags_end, out);
@@ -774,5 +1343,9 @@ void blake3_hash_many(const uint8_t *const *inputs, size_t num_inputs,
 
 // The dynamically detected SIMD degree of the current platform.
 size_t blake3_simd_degree(void) {
+#if defined(BLAKE3_USE_SSE41) || defined(BLAKE3_USE_AVX2) || defined(BLAKE3_USE_NEON)
+  return blake3_detect_simd_degree();
+#else
   return 1;
+#endif
 }
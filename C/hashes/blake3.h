@@ -49,6 +49,8 @@ typedef struct {
   uint32_t key[8];
   blake3_chunk_state chunk;
   uint8_t cv_stack_len;
+  // SIMD degree used by this hasher: the detected degree or less (1 - portable code)
+  uint8_t simd_degree;
   // The stack size is MAX_DEPTH + 1 because we do lazy merging. For example,
   // with 7 chunks, we have 3 entries in the stack. Adding an 8th chunk
   // requires a 4th entry, rather than merging everything down to 1, because we
@@ -59,6 +61,8 @@ typedef struct {
 
 const char *blake3_version(void);
 void blake3_hasher_init(blake3_hasher *self);
+// (degree == 0) or degree above the detected SIMD degree selects the detected degree
+void blake3_hasher_set_simd_degree(blake3_hasher *self, size_t degree);
 void blake3_hasher_init_keyed(blake3_hasher *self,
                               const uint8_t key[BLAKE3_KEY_LEN]);
 void blake3_hasher_init_derive_key(blake3_hasher *self, const char *context);
@@ -71,6 +75,19 @@ void blake3_hasher_finalize(const blake3_hasher *self, uint8_t *out,
 void blake3_hasher_finalize_seek(const blake3_hasher *self, uint64_t seek,
                                  uint8_t *out, size_t out_len);
 
+// Multi-threaded update support. blake3_hasher_subtree_cvs() hashes a whole
+// subtree (a power of 2 number of chunks, at least 2, starting at a multiple
+// of that number) into its top two chaining values. It doesn't modify the
+// hasher, so several subtrees can be hashed concurrently. The results are
+// then appended in order with blake3_hasher_push_subtree_cvs(), which expects
+// the hasher to be at chunk_counter with no partial chunk buffered.
+void blake3_hasher_subtree_cvs(const blake3_hasher *self, const void *input,
+                               size_t input_len, uint64_t chunk_counter,
+                               uint8_t cv_pair[2 * BLAKE3_OUT_LEN]);
+void blake3_hasher_push_subtree_cvs(blake3_hasher *self,
+                                    const uint8_t cv_pair[2 * BLAKE3_OUT_LEN],
+                                    size_t input_len);
+
 // internal flags
 enum blake3_flags {
   CHUNK_START         = 1 << 0,
@@ -109,7 +126,9 @@ enum blake3_flags {
 
 // There are some places where we want a static size that's equal to the
 // MAX_SIMD_DEGREE, but also at least 2.
-#ifdef IS_X86_64
+#if defined(IS_X86_64)
+#define MAX_SIMD_DEGREE 16
+#elif defined(IS_X86)
 #define MAX_SIMD_DEGREE 8
 #else
 #define MAX_SIMD_DEGREE 4
@@ -237,7 +256,8 @@ void blake3_compress_xof(const uint32_t cv[8],
 void blake3_hash_many(const uint8_t *const *inputs, size_t num_inputs,
                       size_t blocks, const uint32_t key[8], uint64_t counter,
                       bool increment_counter, uint8_t flags,
-                      uint8_t flags_start, uint8_t flags_end, uint8_t *out);
+                      uint8_t flags_start, uint8_t flags_end, uint8_t *out,
+                      size_t degree);
 
 size_t blake3_simd_degree(void);
 
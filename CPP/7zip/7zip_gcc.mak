@@ -682,6 +682,8 @@ $O/TarRegister.o: ../../Archive/Tar/TarRegister.cpp
 	$(CXX) $(CXXFLAGS) $<
 $O/TarUpdate.o: ../../Archive/Tar/TarUpdate.cpp
 	$(CXX) $(CXXFLAGS) $<
+$O/TarZstd.o: ../../Archive/Tar/TarZstd.cpp
+	$(CXX) $(CXXFLAGS) $<
 
 $O/UdfHandler.o: ../../Archive/Udf/UdfHandler.cpp
 	$(CXX) $(CXXFLAGS) $<
@@ -887,6 +889,8 @@ $O/ArchiveName.o: ../../UI/Common/ArchiveName.cpp
 	$(CXX) $(CXXFLAGS) $<
 $O/ArchiveOpenCallback.o: ../../UI/Common/ArchiveOpenCallback.cpp
 	$(CXX) $(CXXFLAGS) $<
+$O/AsyncFileWriter.o: ../../UI/Common/AsyncFileWriter.cpp
+	$(CXX) $(CXXFLAGS) $<
 $O/Bench.o: ../../UI/Common/Bench.cpp
 	$(CXX) $(CXXFLAGS) $<
 $O/CompressCall.o: ../../UI/Common/CompressCall.cpp
@@ -123,8 +123,33 @@ Z7_CLASS_IMP_COM_0(
 )
 public:
   CMyComPtr<IInStream> Stream;
+  CMyComPtr<ISequentialInStreamBuf> StreamBuf; // if (Stream) is mapped to memory
   UInt64 Pos;
 
+  void SetStream(IInStream *stream)
+  {
+    Stream = stream;
+    StreamBuf.Release();
+    stream->QueryInterface(IID_ISequentialInStreamBuf, (void **)&StreamBuf);
+  }
+
+  HRESULT ReadBuf(UInt64 &pos, const Byte **data, UInt32 size, UInt32 *processedSize)
+  {
+    *data = NULL;
+    *processedSize = 0;
+    if (!StreamBuf)
+      return E_NOTIMPL;
+    if (pos != Pos)
+    {
+      RINOK(InStream_SeekSet(Stream, pos))
+      Pos = pos;
+    }
+    const HRESULT res = StreamBuf->ReadBuf(data, size, processedSize);
+    pos += *processedSize;
+    Pos = pos;
+    return res;
+  }
+
   #ifdef USE_MIXER_MT
   NWindows::NSynchronization::CCriticalSection CriticalSection;
   #endif
@@ -133,9 +158,10 @@ public:
 
 #ifdef USE_MIXER_MT
 
-Z7_CLASS_IMP_COM_1(
+Z7_CLASS_IMP_COM_2(
   CLockedSequentialInStreamMT
   , ISequentialInStream
+  , ISequentialInStreamBuf
 )
   CLockedInStream *_glob;
   UInt64 _pos;
@@ -168,14 +194,21 @@ Z7_COM7F_IMF(CLockedSequentialInStreamMT::Read(void *data, UInt32 size, UInt32 *
   return res;
 }
 
+Z7_COM7F_IMF(CLockedSequentialInStreamMT::ReadBuf(const Byte **data, UInt32 size, UInt32 *processedSize))
+{
+  NWindows::NSynchronization::CCriticalSectionLock lock(_glob->CriticalSection);
+  return _glob->ReadBuf(_pos, data, size, processedSize);
+}
+
 #endif
 
 
 #ifdef USE_MIXER_ST
 
-Z7_CLASS_IMP_COM_1(
+Z7_CLASS_IMP_COM_2(
   CLockedSequentialInStreamST
   , ISequentialInStream
+  , ISequentialInStreamBuf
 )
   CLockedInStream *_glob;
   UInt64 _pos;
@@ -206,6 +239,11 @@ Z7_COM7F_IMF(CLockedSequentialInStreamST::Read(void *data, UInt32 size, UInt32 *
   return res;
 }
 
+Z7_COM7F_IMF(CLockedSequentialInStreamST::ReadBuf(const Byte **data, UInt32 size, UInt32 *processedSize))
+{
+  return _glob->ReadBuf(_pos, data, size, processedSize);
+}
+
 #endif
 
 
@@ -500,6 +538,21 @@ HRESULT CDecoder::Decode(
     _mixer->SelectMainCoder(!fullUnpack);
   }
 
+  {
+    /* pack streams of folder are read sequentially.
+       If the archive is mapped to memory, we ask the kernel to start
+       reading the beginning of the folder and to use big read-ahead. */
+    Z7_DECL_CMyComPtr_QI_FROM(IStreamAdvise, advise, inStream)
+    if (advise)
+    {
+      const UInt64 pos = startPos + packPositions[0];
+      const UInt64 size = packPositions[folderInfo.PackStreams.Size()] - packPositions[0];
+      const UInt64 kWillNeedMax = (UInt64)1 << 24;
+      advise->Advise(pos, size, NStreamAdvise::kSequential);
+      advise->Advise(pos, MyMin(size, kWillNeedMax), NStreamAdvise::kWillNeed);
+    }
+  }
+
   CObjectVector< CMyComPtr<ISequentialInStream> > inStreams;
   
   CMyComPtr2_Create<IUnknown, CLockedInStream> lockedInStream;
@@ -515,7 +568,7 @@ HRESULT CDecoder::Decode(
     // lockedInStream.Pos = (UInt64)(Int64)-1;
     // RINOK(InStream_GetPos(inStream, lockedInStream.Pos))
     RINOK(inStream->Seek((Int64)(startPos + packPositions[0]), STREAM_SEEK_SET, &lockedInStream->Pos))
-    lockedInStream->Stream = inStream;
+    lockedInStream->SetStream(inStream);
 
     #ifdef USE_MIXER_MT
     #ifdef USE_MIXER_ST
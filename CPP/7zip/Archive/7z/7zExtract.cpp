@@ -7,6 +7,12 @@
 #include "../../../Common/ComTry.h"
 
 #include "../../Common/ProgressUtils.h"
+#include "../../Common/StreamObjects.h"
+#include "../../Common/StreamUtils.h"
+
+#ifndef Z7_ST
+#include "../../Common/VirtThread.h"
+#endif
 
 #include "7zDecode.h"
 #include "7zHandler.h"
@@ -225,6 +231,360 @@ Z7_COM7F_IMF(CFolderOutStream::GetSubStreamSize(UInt64 subStream, UInt64 *value)
 }
 */
 
+#ifndef Z7_ST
+
+/*
+  Parallel decoding of folders:
+  If the items are stored in many folders (non-solid archive or solid archive
+  with many solid blocks), small folders are decoded by worker threads to
+  memory buffers. The main thread writes the buffers to CFolderOutStream in
+  the order of items, so IArchiveExtractCallback is called from one thread
+  and in the same order as in sequential mode.
+  Big folders and encrypted folders are decoded by the main thread.
+  The total size of decoded but not yet written folders is limited.
+*/
+
+static const UInt64 k_ParFolder_SizeMax = (UInt64)1 << 25;
+static const UInt32 k_ParFolder_NumThreadsMax = 64;
+
+struct CLockedInStreamGlob
+{
+  CMyComPtr<IInStream> Stream;
+  CMyComPtr<ISequentialInStreamBuf> StreamBuf; // if (Stream) is mapped to memory
+  UInt64 Pos;
+  UInt64 Size;
+  NWindows::NSynchronization::CCriticalSection CS;
+
+  void SetStream(IInStream *stream)
+  {
+    Stream = stream;
+    StreamBuf.Release();
+    stream->QueryInterface(IID_ISequentialInStreamBuf, (void **)&StreamBuf);
+  }
+};
+
+// each decoder gets own view with own position over the shared archive stream
+Z7_class_final(CLockedInStreamView) :
+  public IInStream,
+  public ISequentialInStreamBuf,
+  public CMyUnknownImp
+{
+  Z7_IFACES_IMP_UNK_3(ISequentialInStream, IInStream, ISequentialInStreamBuf)
+
+  CLockedInStreamGlob *_glob;
+  UInt64 _pos;
+public:
+  void Init(CLockedInStreamGlob *glob)
+  {
+    _glob = glob;
+    _pos = 0;
+  }
+};
+
+Z7_COM7F_IMF(CLockedInStreamView::Read(void *data, UInt32 size, UInt32 *processedSize))
+{
+  if (processedSize)
+    *processedSize = 0;
+  NWindows::NSynchronization::CCriticalSectionLock lock(_glob->CS);
+  if (_pos != _glob->Pos)
+  {
+    _glob->Pos = (UInt64)(Int64)-1;
+    RINOK(InStream_SeekSet(_glob->Stream, _pos))
+    _glob->Pos = _pos;
+  }
+  UInt32 realProcessedSize = 0;
+  const HRESULT res = _glob->Stream->Read(data, size, &realProcessedSize);
+  _pos += realProcessedSize;
+  _glob->Pos = _pos;
+  if (processedSize)
+    *processedSize = realProcessedSize;
+  return res;
+}
+
+Z7_COM7F_IMF(CLockedInStreamView::Seek(Int64 offset, UInt32 seekOrigin, UInt64 *newPosition))
+{
+  switch (seekOrigin)
+  {
+    case STREAM_SEEK_SET: break;
+    case STREAM_SEEK_CUR: offset += _pos; break;
+    case STREAM_SEEK_END: offset += _glob->Size; break;
+    default: return STG_E_INVALIDFUNCTION;
+  }
+  if (offset < 0)
+    return HRESULT_WIN32_ERROR_NEGATIVE_SEEK;
+  _pos = (UInt64)offset;
+  if (newPosition)
+    *newPosition = (UInt64)offset;
+  return S_OK;
+}
+
+Z7_COM7F_IMF(CLockedInStreamView::ReadBuf(const Byte **data, UInt32 size, UInt32 *processedSize))
+{
+  *data = NULL;
+  *processedSize = 0;
+  if (!_glob->StreamBuf)
+    return E_NOTIMPL;
+  NWindows::NSynchronization::CCriticalSectionLock lock(_glob->CS);
+  if (_pos != _glob->Pos)
+  {
+    _glob->Pos = (UInt64)(Int64)-1;
+    RINOK(InStream_SeekSet(_glob->Stream, _pos))
+    _glob->Pos = _pos;
+  }
+  const HRESULT res = _glob->StreamBuf->ReadBuf(data, size, processedSize);
+  _pos += *processedSize;
+  _glob->Pos = _pos;
+  return res;
+}
+
+
+struct CParFolderJob
+{
+  UInt32 ItemIndex; // index of first item of folder in (indices)
+  CNum FolderIndex;
+  UInt64 UnpackSize;
+
+  bool Finished;
+  bool Skipped; // the main thread doesn't need the data, so it's not decoded
+  bool DataAfterEnd_Error;
+  HRESULT Result;
+  size_t Size;
+  CByteBuffer Buf;
+};
+
+class CParFolderDecoder;
+
+class CParFolderThread Z7_final: public CVirtThread
+{
+public:
+  CParFolderDecoder *Parent;
+  CDecoder Decoder;
+  CMyComPtr<IInStream> InStream;
+
+  CParFolderThread(bool useMixerMT): Decoder(useMixerMT) {}
+  ~CParFolderThread() Z7_DESTRUCTOR_override
+  {
+    CVirtThread::WaitThreadFinish();
+  }
+private:
+  virtual void Execute() Z7_override;
+};
+
+class CParFolderDecoder
+{
+  unsigned _nextDecodeJob;
+  UInt64 _bufferedSize;
+  UInt64 _bufferLimit;
+  bool _stop;
+  NWindows::NSynchronization::CCriticalSection _cs;
+  NWindows::NSynchronization::CManualResetEvent _canDecodeEvent;
+  NWindows::NSynchronization::CManualResetEvent _jobFinishedEvent;
+  CObjectVector<CParFolderThread> _threads;
+public:
+  CObjectVector<CParFolderJob> Jobs;
+  unsigned NextJob; // next job for the main thread
+
+  CLockedInStreamGlob Glob;
+  const CDbEx *Db;
+  UInt64 StartPos;
+  UInt64 MemUsage;
+  DECL_EXTERNAL_CODECS_LOC_VARS_DECL
+
+  CParFolderDecoder():
+      _nextDecodeJob(0),
+      _bufferedSize(0),
+      _bufferLimit(0),
+      _stop(false),
+      NextJob(0)
+      {}
+  ~CParFolderDecoder() { StopThreads(); }
+
+  bool IsStarted() const { return !_threads.IsEmpty(); }
+  CParFolderJob *GetJob(UInt32 itemIndex)
+  {
+    if (NextJob < Jobs.Size() && Jobs[NextJob].ItemIndex == itemIndex)
+      return &Jobs[NextJob];
+    return NULL;
+  }
+
+  WRes StartThreads(bool useMixerMT, UInt32 numThreads, UInt64 bufferLimit);
+  void StopThreads();
+  void DecodeJobs(CParFolderThread &thread);
+  WRes WaitJob();
+  void ReleaseJob();
+  WRes SkipJobs(UInt32 itemIndex);
+};
+
+void CParFolderThread::Execute()
+{
+  Parent->DecodeJobs(*this);
+}
+
+WRes CParFolderDecoder::StartThreads(bool useMixerMT, UInt32 numThreads, UInt64 bufferLimit)
+{
+  _bufferLimit = bufferLimit;
+  RINOK_WRes(_canDecodeEvent.CreateIfNotCreated_Reset())
+  RINOK_WRes(_jobFinishedEvent.CreateIfNotCreated_Reset())
+  for (UInt32 i = 0; i < numThreads; i++)
+  {
+    VECTOR_ADD_NEW_OBJECT(_threads, CParFolderThread(useMixerMT))
+    CParFolderThread &t = _threads.Back();
+    t.Parent = this;
+    CLockedInStreamView *viewSpec = new CLockedInStreamView;
+    t.InStream = viewSpec;
+    viewSpec->Init(&Glob);
+    WRes wres = t.Create();
+    if (wres == 0)
+      wres = t.Start();
+    if (wres != 0)
+    {
+      StopThreads();
+      return wres;
+    }
+  }
+  return 0;
+}
+
+void CParFolderDecoder::StopThreads()
+{
+  if (_threads.IsEmpty())
+    return;
+  {
+    NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+    _stop = true;
+    _canDecodeEvent.Set();
+  }
+  FOR_VECTOR (i, _threads)
+    _threads[i].WaitExecuteFinish();
+  _threads.Clear();
+}
+
+void CParFolderDecoder::DecodeJobs(CParFolderThread &thread)
+{
+  for (;;)
+  {
+    CParFolderJob *job;
+    _cs.Enter();
+    for (;;)
+    {
+      if (_stop || _nextDecodeJob == Jobs.Size())
+      {
+        _cs.Leave();
+        return;
+      }
+      job = &Jobs[_nextDecodeJob];
+      if (job->Skipped)
+      {
+        _nextDecodeJob++;
+        continue;
+      }
+      /* if nothing is buffered, the main thread waits for this job,
+         so it's allowed even if it exceeds the limit */
+      if (_bufferedSize == 0 || _bufferedSize + job->UnpackSize <= _bufferLimit)
+        break;
+      _canDecodeEvent.Reset();
+      _cs.Leave();
+      _canDecodeEvent.Lock();
+      _cs.Enter();
+    }
+    _nextDecodeJob++;
+    _bufferedSize += job->UnpackSize;
+    _cs.Leave();
+
+    job->Size = 0;
+    job->DataAfterEnd_Error = false;
+    try
+    {
+      job->Buf.Alloc((size_t)job->UnpackSize);
+      CMyComPtr2_Create<ISequentialOutStream, CBufPtrSeqOutStream> outStream;
+      outStream->Init(job->Buf, (size_t)job->UnpackSize);
+      
+      #ifndef Z7_NO_CRYPTO
+        ICryptoGetTextPassword *getTextPassword = NULL;
+        bool isEncrypted = false;
+        bool passwordIsDefined = false;
+        UString_Wipe password;
+      #endif
+
+      job->Result = thread.Decoder.Decode(
+          EXTERNAL_CODECS_LOC_VARS
+          thread.InStream,
+          StartPos,
+          *Db, job->FolderIndex,
+          &job->UnpackSize,
+          outStream,
+          NULL, // compressProgress
+          NULL, // *inStreamMainRes
+          job->DataAfterEnd_Error
+          Z7_7Z_DECODER_CRYPRO_VARS
+          , true, 1, MemUsage
+          );
+      job->Size = outStream->GetPos();
+    }
+    catch(...)
+    {
+      job->Result = E_OUTOFMEMORY;
+    }
+
+    {
+      NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+      job->Finished = true;
+      _jobFinishedEvent.Set();
+    }
+  }
+}
+
+WRes CParFolderDecoder::WaitJob()
+{
+  const CParFolderJob &job = Jobs[NextJob];
+  for (;;)
+  {
+    {
+      NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+      if (job.Finished)
+        return 0;
+      _jobFinishedEvent.Reset();
+    }
+    RINOK_WRes(_jobFinishedEvent.Lock())
+  }
+}
+
+void CParFolderDecoder::ReleaseJob()
+{
+  CParFolderJob &job = Jobs[NextJob];
+  job.Buf.Free();
+  NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+  _bufferedSize -= job.UnpackSize;
+  NextJob++;
+  _canDecodeEvent.Set();
+}
+
+/* releases the jobs of items before (itemIndex) that the main thread didn't use.
+   The job that was not started yet is not decoded at all.
+   The started job is waited for, and its buffer is freed,
+   so it doesn't hold the buffer limit for next jobs. */
+
+WRes CParFolderDecoder::SkipJobs(UInt32 itemIndex)
+{
+  while (NextJob < Jobs.Size() && Jobs[NextJob].ItemIndex < itemIndex)
+  {
+    {
+      NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+      if (NextJob >= _nextDecodeJob)
+      {
+        Jobs[NextJob].Skipped = true;
+        NextJob++;
+        continue;
+      }
+    }
+    RINOK_WRes(WaitJob())
+    ReleaseJob();
+  }
+  return 0;
+}
+
+#endif
+
 
 Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
     Int32 testModeSpec, IArchiveExtractCallback *extractCallbackSpec))
@@ -274,7 +634,7 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
   CMyComPtr2_Create<ICompressProgressInfo, CLocalProgress> lps;
   lps->Init(extractCallback, false);
 
-  CDecoder decoder(
+  const bool useMixerMT =
     #if !defined(USE_MIXER_MT)
       false
     #elif !defined(USE_MIXER_ST)
@@ -288,7 +648,9 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
     #else
       _useMultiThreadMixer
     #endif
-    );
+    ;
+
+  CDecoder decoder(useMixerMT);
 
   UInt64 curPacked, curUnpacked;
 
@@ -303,6 +665,83 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
   folderOutStream->TestMode = (testModeSpec != 0);
   folderOutStream->CheckCrc = (_crcSize != 0);
 
+  CMyComPtr<IInStream> inStream = _inStream;
+
+  #ifndef Z7_ST
+  CParFolderDecoder parDecoder;
+  
+  if (_numThreads > 1)
+  {
+    // the folders for worker threads, grouped the same way as in main loop
+    for (UInt32 i = 0; i < numItems;)
+    {
+      const UInt32 fileIndex = allFilesMode ? i : indices[i];
+      const CNum folderIndex = _db.FileIndexToFolderIndexMap[fileIndex];
+      UInt32 k = i + 1;
+      if (folderIndex != kNumNoIndex)
+      {
+        UInt32 nextFile = fileIndex + 1;
+        for (; k < numItems; k++)
+        {
+          const UInt32 fileIndex2 = allFilesMode ? k : indices[k];
+          if (_db.FileIndexToFolderIndexMap[fileIndex2] != folderIndex
+              || fileIndex2 < nextFile)
+            break;
+          nextFile = fileIndex2 + 1;
+        }
+        UInt64 unpackSize = 0;
+        for (UInt32 f = _db.FolderStartFileIndex[folderIndex]; f < nextFile; f++)
+          unpackSize += _db.Files[f].Size;
+        if (unpackSize != 0
+            && unpackSize <= k_ParFolder_SizeMax
+            && !IsFolderEncrypted(folderIndex))
+        {
+          CParFolderJob &job = parDecoder.Jobs.AddNew();
+          job.ItemIndex = i;
+          job.FolderIndex = folderIndex;
+          job.UnpackSize = unpackSize;
+          job.Finished = false;
+          job.Skipped = false;
+        }
+      }
+      i = k;
+    }
+
+    if (parDecoder.Jobs.Size() > 1)
+    {
+      UInt32 numThreads = _numThreads;
+      if (numThreads > k_ParFolder_NumThreadsMax)
+        numThreads = k_ParFolder_NumThreadsMax;
+      if (numThreads > parDecoder.Jobs.Size())
+        numThreads = parDecoder.Jobs.Size();
+      UInt64 bufferLimit = (UInt64)numThreads * k_ParFolder_SizeMax * 2;
+      if (bufferLimit > _memUsage_Decompress / 2)
+        bufferLimit = _memUsage_Decompress / 2;
+
+      RINOK(InStream_GetSize_SeekToEnd(_inStream, parDecoder.Glob.Size))
+      parDecoder.Glob.SetStream(_inStream);
+      parDecoder.Glob.Pos = parDecoder.Glob.Size;
+      parDecoder.Db = &_db;
+      parDecoder.StartPos = _db.ArcInfo.DataStartPosition;
+      parDecoder.MemUsage = _memUsage_Decompress / (numThreads + 1);
+      #ifdef Z7_EXTERNAL_CODECS
+      parDecoder._externalCodecs = EXTERNAL_CODECS_VARS2;
+      #endif
+
+      if (parDecoder.StartThreads(useMixerMT, numThreads, bufferLimit) == 0)
+      {
+        // the main thread reads big folders via same lock as worker threads
+        CLockedInStreamView *viewSpec = new CLockedInStreamView;
+        inStream = viewSpec;
+        viewSpec->Init(&parDecoder.Glob);
+      }
+    }
+    // without threads all folders are decoded by the main thread
+    if (!parDecoder.IsStarted())
+      parDecoder.Jobs.Clear();
+  }
+  #endif
+
   for (UInt32 i = 0;; lps->OutSize += curUnpacked, lps->InSize += curPacked)
   {
     RINOK(lps->SetCur())
@@ -340,6 +779,7 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
         curUnpacked += _db.Files[k].Size;
     }
 
+    const UInt32 itemIndex = i;
     {
       const HRESULT result = folderOutStream->Init(fileIndex,
           allFilesMode ? NULL : indices + i,
@@ -354,6 +794,12 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
     {
       // for debug: to test zero size stream unpacking
       // if (folderIndex == kNumNoIndex)  // enable this check for debug
+      #ifndef Z7_ST
+      // the job of skipped folder is released, so its buffer doesn't block next jobs
+      const WRes wres = parDecoder.SkipJobs(i);
+      if (wres != 0)
+        return HRESULT_FROM_WIN32(wres);
+      #endif
       continue;
     }
 
@@ -375,10 +821,32 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
       #endif
 
       bool dataAfterEnd_Error = false;
+      HRESULT result;
 
-      const HRESULT result = decoder.Decode(
+      #ifndef Z7_ST
+      CParFolderJob *job = parDecoder.GetJob(itemIndex);
+      if (job)
+      {
+        {
+          const WRes wres = parDecoder.WaitJob();
+          if (wres != 0)
+            return HRESULT_FROM_WIN32(wres);
+        }
+        result = job->Result;
+        dataAfterEnd_Error = job->DataAfterEnd_Error;
+        if (job->Size != 0)
+        {
+          const HRESULT res2 = WriteStream(outStream, job->Buf, job->Size);
+          if (res2 != S_OK)
+            result = res2;
+        }
+        parDecoder.ReleaseJob();
+      }
+      else
+      #endif
+      result = decoder.Decode(
           EXTERNAL_CODECS_VARS
-          _inStream,
+          inStream,
           _db.ArcInfo.DataStartPosition,
           _db, folderIndex,
           &curUnpacked,
@@ -9,9 +9,19 @@
 namespace NArchive {
 namespace N7z {
 
+#ifndef Z7_ST
+#define FOLDER_IN_STREAM_LOCK  NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+#else
+#define FOLDER_IN_STREAM_LOCK
+#endif
+
 void CFolderInStream::Init(IArchiveUpdateCallback *updateCallback,
     const UInt32 *indexes, unsigned numFiles)
 {
+ #ifndef Z7_ST
+  ReadAhead_Stop();
+ #endif
+
   _updateCallback = updateCallback;
   _indexes = indexes;
   _numFiles = numFiles;
@@ -30,6 +40,12 @@ void CFolderInStream::Init(IArchiveUpdateCallback *updateCallback,
 
   // FolderCrc = CRC_INIT_VAL;
   _stream.Release();
+
+ #ifndef Z7_ST
+  // if the thread can't be started, we read the files in caller's thread
+  if (ReadAhead && numFiles != 0)
+    ReadAhead_Start();
+ #endif
 }
 
 void CFolderInStream::ClearFileInfo()
@@ -64,13 +80,16 @@ HRESULT CFolderInStream::OpenStream()
         if (getProps)
         {
           // access could be changed in first myx pass
-          if (getProps->GetProps(&_size,
+          UInt64 size = 0;
+          if (getProps->GetProps(&size,
               Need_CTime ? &_cTime : NULL,
               Need_ATime ? &_aTime : NULL,
               Need_MTime ? &_mTime : NULL,
               Need_Attrib ? &_attrib : NULL)
               == S_OK)
           {
+            FOLDER_IN_STREAM_LOCK
+            _size = size;
             _size_Defined = true;
             _times_Defined = true;
           }
@@ -82,8 +101,13 @@ HRESULT CFolderInStream::OpenStream()
         stream.QueryInterface(IID_IStreamGetSize, &streamGetSize);
         if (streamGetSize)
         {
-          if (streamGetSize->GetSize(&_size) == S_OK)
+          UInt64 size = 0;
+          if (streamGetSize->GetSize(&size) == S_OK)
+          {
+            FOLDER_IN_STREAM_LOCK
+            _size = size;
             _size_Defined = true;
+          }
         }
         return S_OK;
       }
@@ -121,15 +145,18 @@ HRESULT ReportItemProps(IArchiveUpdateCallbackArcProp *reportArcProp,
 HRESULT CFolderInStream::AddFileInfo(bool isProcessed)
 {
   // const UInt32 index = _indexes[Processed.Size()];
-  Processed.AddInReserved(isProcessed);
-  Sizes.AddInReserved(_pos);
-  CRCs.AddInReserved(CRC_GET_DIGEST(_crc));
-  if (Need_Attrib) Attribs.AddInReserved(_attrib);
-  TimesDefined.AddInReserved(_times_Defined);
-  if (Need_MTime) AddFt(MTimes, _mTime);
-  if (Need_CTime) AddFt(CTimes, _cTime);
-  if (Need_ATime) AddFt(ATimes, _aTime);
-  ClearFileInfo();
+  {
+    FOLDER_IN_STREAM_LOCK
+    Processed.AddInReserved(isProcessed);
+    Sizes.AddInReserved(_pos);
+    CRCs.AddInReserved(CRC_GET_DIGEST(_crc));
+    if (Need_Attrib) Attribs.AddInReserved(_attrib);
+    TimesDefined.AddInReserved(_times_Defined);
+    if (Need_MTime) AddFt(MTimes, _mTime);
+    if (Need_CTime) AddFt(CTimes, _cTime);
+    if (Need_ATime) AddFt(ATimes, _aTime);
+    ClearFileInfo();
+  }
   /*
   if (isProcessed && _reportArcProp)
     RINOK(ReportItemProps(_reportArcProp, index, _pos, &crc))
@@ -137,7 +164,7 @@ HRESULT CFolderInStream::AddFileInfo(bool isProcessed)
   return _updateCallback->SetOperationResult(NArchive::NUpdate::NOperationResult::kOK);
 }
 
-Z7_COM7F_IMF(CFolderInStream::Read(void *data, UInt32 size, UInt32 *processedSize))
+HRESULT CFolderInStream::ReadDirect(void *data, UInt32 size, UInt32 *processedSize)
 {
   if (processedSize)
     *processedSize = 0;
@@ -179,7 +206,10 @@ Z7_COM7F_IMF(CFolderInStream::Read(void *data, UInt32 size, UInt32 *processedSiz
         if (FolderCrc)
           FolderCrc = CrcUpdate(FolderCrc, data, cur);
         */
-        _pos += cur;
+        {
+          FOLDER_IN_STREAM_LOCK
+          _pos += cur;
+        }
         _totalSize_for_Coder += cur;
         if (processedSize)
           *processedSize = cur; // use +=cur, if continue is possible in loop
@@ -197,8 +227,151 @@ Z7_COM7F_IMF(CFolderInStream::Read(void *data, UInt32 size, UInt32 *processedSiz
   return S_OK;
 }
 
+
+#ifndef Z7_ST
+
+void CFolderReadAheadThread::Execute()
+{
+  Stream->ReadAhead_Thread();
+}
+
+bool CFolderInStream::ReadAhead_Start()
+{
+  const size_t bufSize = k_FolderInStream_NumSlots * k_FolderInStream_SlotSize;
+  if (_raBuf.Size() != bufSize)
+  {
+    _raBuf.Alloc(bufSize);
+    if (!_raBuf.IsAllocated())
+      return false;
+  }
+  if (_freeSem.OptCreateInit(k_FolderInStream_NumSlots, k_FolderInStream_NumSlots) != 0
+      || _filledSem.OptCreateInit(0, k_FolderInStream_NumSlots) != 0)
+    return false;
+  _raThread.Stream = this;
+  if (_raThread.Create() != 0)
+    return false;
+  _prodPos = 0;
+  _consPos = 0;
+  _curSlot = NULL;
+  _curSlotPos = 0;
+  _raStop = false;
+  _raFinished = false;
+  _raRes = S_OK;
+  if (_raThread.Start() != 0)
+    return false;
+  _raStarted = true;
+  return true;
+}
+
+void CFolderInStream::ReadAhead_Stop()
+{
+  if (!_raStarted)
+    return;
+  _raStarted = false;
+  _raStop = true;
+  // it wakes the thread, if it waits for free slot. The error is possible, if all slots are free
+  _freeSem.Release();
+  _raThread.WaitExecuteFinish();
+  _stream.Release();
+}
+
+void CFolderInStream::ReadAhead_Thread()
+{
+  for (;;)
+  {
+    if (_freeSem.Lock() != 0)
+      return;
+    if (_raStop)
+      return;
+    CSlot &slot = _slots[_prodPos];
+    Byte *buf = _raBuf + _prodPos * k_FolderInStream_SlotSize;
+    if (++_prodPos == k_FolderInStream_NumSlots)
+      _prodPos = 0;
+    slot.Size = 0;
+    slot.Eof = false;
+    slot.Res = S_OK;
+    while (slot.Size != k_FolderInStream_SlotSize)
+    {
+      UInt32 cur = 0;
+      try
+      {
+        slot.Res = ReadDirect(buf + slot.Size, (UInt32)(k_FolderInStream_SlotSize - slot.Size), &cur);
+      }
+      catch(...) { slot.Res = E_FAIL; }
+      if (slot.Res != S_OK)
+        break;
+      if (cur == 0)
+      {
+        slot.Eof = true;
+        break;
+      }
+      slot.Size += cur;
+    }
+    const bool finished = (slot.Eof || slot.Res != S_OK);
+    _filledSem.Release();
+    if (finished)
+      return;
+  }
+}
+
+HRESULT CFolderInStream::ReadAhead_Read(void *data, UInt32 size, UInt32 *processedSize)
+{
+  for (;;)
+  {
+    if (!_curSlot)
+    {
+      if (_raFinished)
+        return _raRes;
+      const WRes wres = _filledSem.Lock();
+      if (wres != 0)
+        return HRESULT_FROM_WIN32(wres);
+      _curSlot = &_slots[_consPos];
+      _curSlotPos = 0;
+    }
+    size_t rem = _curSlot->Size - _curSlotPos;
+    if (rem != 0)
+    {
+      if (rem > size)
+        rem = size;
+      memcpy(data, _raBuf + _consPos * k_FolderInStream_SlotSize + _curSlotPos, rem);
+      _curSlotPos += rem;
+      if (processedSize)
+        *processedSize = (UInt32)rem;
+      return S_OK;
+    }
+    if (_curSlot->Eof || _curSlot->Res != S_OK)
+    {
+      // the thread has finished already
+      _raFinished = true;
+      _raRes = _curSlot->Res;
+    }
+    _curSlot = NULL;
+    if (++_consPos == k_FolderInStream_NumSlots)
+      _consPos = 0;
+    _freeSem.Release();
+  }
+}
+
+#endif
+
+Z7_COM7F_IMF(CFolderInStream::Read(void *data, UInt32 size, UInt32 *processedSize))
+{
+ #ifndef Z7_ST
+  if (_raStarted)
+  {
+    if (processedSize)
+      *processedSize = 0;
+    if (size == 0)
+      return S_OK;
+    return ReadAhead_Read(data, size, processedSize);
+  }
+ #endif
+  return ReadDirect(data, size, processedSize);
+}
+
 Z7_COM7F_IMF(CFolderInStream::GetSubStreamSize(UInt64 subStream, UInt64 *value))
 {
+  FOLDER_IN_STREAM_LOCK
   *value = 0;
   if (subStream > Sizes.Size())
     return S_FALSE; // E_FAIL;
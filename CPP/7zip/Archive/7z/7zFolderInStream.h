@@ -9,12 +9,44 @@
 #include "../../../Common/MyVector.h"
 // #include "../Common/InStreamWithCRC.h"
 
+#ifndef Z7_ST
+#include "../../../Common/MyBuffer2.h"
+#include "../../../Windows/Synchronization.h"
+#include "../../Common/VirtThread.h"
+#endif
+
 #include "../../ICoder.h"
 #include "../IArchive.h"
 
 namespace NArchive {
 namespace N7z {
 
+#ifndef Z7_ST
+
+/*
+In read-ahead mode one background thread opens and reads the files of folder
+to the ring of buffers, and Read() copies the data from these buffers.
+So the coder doesn't wait for file opening, if reading is faster than coding.
+The background thread does all calls of IArchiveUpdateCallback for the folder
+in same order as before. Per-file information (sizes, CRCs, times) is ready,
+when Read() has returned the end of stream.
+*/
+
+const unsigned k_FolderInStream_NumSlots = 16;
+const size_t k_FolderInStream_SlotSize = (size_t)1 << 18;
+
+class CFolderInStream;
+
+struct CFolderReadAheadThread: public CVirtThread
+{
+  CFolderInStream *Stream;
+
+  void Execute() Z7_override;
+  ~CFolderReadAheadThread() Z7_DESTRUCTOR_override { WaitThreadFinish(); }
+};
+
+#endif
+
 Z7_CLASS_IMP_COM_2(
   CFolderInStream
   , ISequentialInStream
@@ -45,7 +77,38 @@ Z7_CLASS_IMP_COM_2(
   void ClearFileInfo();
   HRESULT OpenStream();
   HRESULT AddFileInfo(bool isProcessed);
+  HRESULT ReadDirect(void *data, UInt32 size, UInt32 *processedSize);
   // HRESULT CloseCrcStream();
+
+ #ifndef Z7_ST
+  struct CSlot
+  {
+    size_t Size;
+    bool Eof;
+    HRESULT Res;
+  };
+
+  // it protects (Sizes) and the size of current file for GetSubStreamSize() in read-ahead mode
+  NWindows::NSynchronization::CCriticalSection _cs;
+  NWindows::NSynchronization::CSemaphore _freeSem;
+  NWindows::NSynchronization::CSemaphore _filledSem;
+  CMidBuffer _raBuf;
+  CSlot _slots[k_FolderInStream_NumSlots];
+  unsigned _prodPos;
+  unsigned _consPos;
+  CSlot *_curSlot;
+  size_t _curSlotPos;
+  bool _raStarted;
+  bool _raStop;
+  bool _raFinished;
+  HRESULT _raRes;
+  // the thread is destroyed before other members
+  CFolderReadAheadThread _raThread;
+
+  bool ReadAhead_Start();
+  void ReadAhead_Stop();
+  HRESULT ReadAhead_Read(void *data, UInt32 size, UInt32 *processedSize);
+ #endif
 public:
   bool Need_MTime;
   bool Need_CTime;
@@ -54,6 +117,9 @@ public:
   // bool Need_Crc;
   // bool Need_FolderCrc;
   // unsigned AlignLog;
+ #ifndef Z7_ST
+  bool ReadAhead; // it must be set before Init()
+ #endif
   
   CRecordVector<bool> Processed;
   CRecordVector<UInt64> Sizes;
@@ -86,6 +152,9 @@ public:
   */
 
   CFolderInStream():
+      #ifndef Z7_ST
+      _raStarted(false),
+      #endif
       Need_MTime(false),
       Need_CTime(false),
       Need_ATime(false),
@@ -93,7 +162,14 @@ public:
       // , Need_Crc(true)
       // , Need_FolderCrc(false)
       // , AlignLog(0)
+      #ifndef Z7_ST
+      , ReadAhead(false)
+      #endif
       {}
+ #ifndef Z7_ST
+  ~CFolderInStream() { ReadAhead_Stop(); }
+  void ReadAhead_Thread();
+ #endif
 };
 
 }}
@@ -43,6 +43,8 @@ public:
   bool _numSolidBytesDefined;
   bool _solidExtension;
   bool _useTypeSorting;
+  bool _useContentSorting;
+  bool _recompress;
 
   bool _compressHeaders;
   bool _encryptHeadersSpecified;
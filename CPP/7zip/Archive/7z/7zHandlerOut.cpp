@@ -816,6 +816,8 @@ Z7_COM7F_IMF(CHandler::UpdateItems(ISequentialOutStream *outStream, UInt32 numIt
   options.NumSolidBytes = _numSolidBytes;
   options.SolidExtension = _solidExtension;
   options.UseTypeSorting = _useTypeSorting;
+  options.UseContentSorting = _useContentSorting;
+  options.Recompress = _recompress;
 
   options.RemoveSfxBlock = _removeSfxBlock;
   // options.VolumeMode = _volumeMode;
@@ -888,6 +890,8 @@ void COutHandler::InitProps7z()
 
   InitSolid();
   _useTypeSorting = false;
+  _useContentSorting = false;
+  _recompress = false;
 
   _decoderCompatibilityVersion = k_decoderCompatibilityVersion;
   _enabledFilters.Clear();
@@ -1060,6 +1064,8 @@ HRESULT COutHandler::SetProperty(const wchar_t *nameSpec, const PROPVARIANT &val
     if (name.IsEqualTo("mtf")) return PROPVARIANT_to_bool(value, _useMultiThreadMixer);
 
     if (name.IsEqualTo("qs")) return PROPVARIANT_to_bool(value, _useTypeSorting);
+    if (name.IsEqualTo("qc")) return PROPVARIANT_to_bool(value, _useContentSorting);
+    if (name.IsEqualTo("recompress")) return PROPVARIANT_to_bool(value, _recompress);
 
     if (name.IsPrefixedBy_Ascii_NoCase("yv"))
     {
@@ -11,6 +11,8 @@
 #include "../../Common/CreateCoder.h"
 #include "../../Common/LimitedStreams.h"
 #include "../../Common/ProgressUtils.h"
+#include "../../Common/StreamObjects.h"
+#include "../../Common/StreamUtils.h"
 
 #include "../../Compress/CopyCoder.h"
 
@@ -1218,6 +1220,263 @@ HRESULT CAnalysis::GetFilterGroup(UInt32 index, const CUpdateItem &ui, CFilterMo
   return S_OK;
 }
 
+
+/*
+CContentOrder reorders the files of solid group, so that the files with
+same or similar data are placed next to each other, and the coder can find
+the matches in its window:
+  - exact duplicates : same size and same CRC of full data.
+  - similar files    : same band of MinHash signature. The signature is
+      calculated for content-defined samples of data: the gear hash of
+      last 64 bytes is sampled, if its high bits are zero.
+The files of each cluster are moved to the position of the first file
+of cluster in sorted (by name or by type) order, and the duplicates of
+each file follow that file.
+It's an ordering hint only. The data is read again for compression,
+so hash collisions can't break the archive.
+
+Cost: each new file of solid group is read one extra time before compression
+(CRC and gear hash for each byte), and each sample costs (k_MinHash_Num = 16)
+calls of Mix64(). With (k_ContentSample_Bits = 6) there is one sample
+per 64 bytes on average, so the pass is slower than reading of file.
+Limitation: it works only, if the update callback supports
+IArchiveUpdateCallbackFile (opCallback), because the files are opened
+by GetStream2() with NUpdateNotifyOp::kAnalyze. Otherwise -mqc is ignored.
+*/
+
+static const unsigned k_MinHash_Num = 16;
+static const unsigned k_MinHash_BandSize = 4;
+static const unsigned k_ContentSample_Bits = 6;
+static const size_t k_ContentBufSize = (size_t)1 << 16;
+
+static UInt64 Mix64(UInt64 z)
+{
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+struct CContentPrint
+{
+  bool Defined;
+  bool HasSamples;
+  UInt32 Crc;
+  UInt64 Size;
+  UInt64 MinHash[k_MinHash_Num];
+};
+
+struct CContentKey
+{
+  UInt64 Key1;
+  UInt64 Key2;
+  unsigned Pos;
+};
+
+static int CompareContentKeys(const CContentKey *p1, const CContentKey *p2, void * /* param */)
+{
+  RINOZ_COMP(p1->Key1, p2->Key1)
+  RINOZ_COMP(p1->Key2, p2->Key2)
+  return MyCompare(p1->Pos, p2->Pos);
+}
+
+class CContentOrder
+{
+  UInt64 _gear[256];
+  CByteBuffer _buf;
+  CRecordVector<unsigned> _parents;
+
+  unsigned FindRoot(unsigned i);
+  void Union(unsigned a, unsigned b);
+  void UnionEqualKeys(CRecordVector<CContentKey> &keys);
+  HRESULT GetPrint(IArchiveUpdateCallbackFile *callback, UInt32 index, CContentPrint &p);
+public:
+  CContentOrder();
+  HRESULT Reorder(IArchiveUpdateCallbackFile *callback, UInt32 *indices, unsigned numFiles);
+};
+
+CContentOrder::CContentOrder()
+{
+  UInt64 v = 0;
+  for (unsigned i = 0; i < 256; i++)
+  {
+    v += 0x9e3779b97f4a7c15;
+    _gear[i] = Mix64(v);
+  }
+}
+
+unsigned CContentOrder::FindRoot(unsigned i)
+{
+  while (_parents[i] != i)
+  {
+    _parents[i] = _parents[_parents[i]];
+    i = _parents[i];
+  }
+  return i;
+}
+
+// the root of cluster is the file with lowest position, so it's the position of cluster
+
+void CContentOrder::Union(unsigned a, unsigned b)
+{
+  a = FindRoot(a);
+  b = FindRoot(b);
+  if (a < b)
+    _parents[b] = a;
+  else if (b < a)
+    _parents[a] = b;
+}
+
+void CContentOrder::UnionEqualKeys(CRecordVector<CContentKey> &keys)
+{
+  keys.Sort(CompareContentKeys, NULL);
+  for (unsigned i = 1; i < keys.Size(); i++)
+  {
+    const CContentKey &k0 = keys[i - 1];
+    const CContentKey &k1 = keys[i];
+    if (k0.Key1 == k1.Key1 && k0.Key2 == k1.Key2)
+      Union(k0.Pos, k1.Pos);
+  }
+}
+
+HRESULT CContentOrder::GetPrint(IArchiveUpdateCallbackFile *callback, UInt32 index, CContentPrint &p)
+{
+  p.Defined = false;
+  p.HasSamples = false;
+  CMyComPtr<ISequentialInStream> stream;
+  const HRESULT result = callback->GetStream2(index, &stream, NUpdateNotifyOp::kAnalyze);
+  if (result == E_ABORT)
+    return result;
+  // the files that can't be opened here will be reported in main pass
+  if (result != S_OK || !stream)
+    return S_OK;
+  
+  if (_buf.Size() != k_ContentBufSize)
+    _buf.Alloc(k_ContentBufSize);
+  
+  unsigned k;
+  for (k = 0; k < k_MinHash_Num; k++)
+    p.MinHash[k] = (UInt64)(Int64)-1;
+  UInt32 crc = CRC_INIT_VAL;
+  UInt64 size = 0;
+  UInt64 h = 0;
+
+  for (;;)
+  {
+    size_t cur = k_ContentBufSize;
+    if (ReadStream(stream, _buf, &cur) != S_OK)
+      return S_OK;
+    if (cur == 0)
+      break;
+    const Byte *buf = _buf;
+    crc = CrcUpdate(crc, buf, cur);
+    size += cur;
+    for (size_t i = 0; i < cur; i++)
+    {
+      h = (h << 1) + _gear[buf[i]];
+      if ((h >> (64 - k_ContentSample_Bits)) != 0)
+        continue;
+      p.HasSamples = true;
+      for (k = 0; k < k_MinHash_Num; k++)
+      {
+        const UInt64 v = Mix64(h + (UInt64)k * 0x9e3779b97f4a7c15);
+        if (p.MinHash[k] > v)
+          p.MinHash[k] = v;
+      }
+    }
+  }
+
+  p.Crc = CRC_GET_DIGEST(crc);
+  p.Size = size;
+  p.Defined = true;
+  return S_OK;
+}
+
+HRESULT CContentOrder::Reorder(IArchiveUpdateCallbackFile *callback, UInt32 *indices, unsigned numFiles)
+{
+  if (numFiles < 2)
+    return S_OK;
+  
+  CObjArray<CContentPrint> prints(numFiles);
+  unsigned i;
+  for (i = 0; i < numFiles; i++)
+  {
+    RINOK(GetPrint(callback, indices[i], prints[i]))
+  }
+
+  _parents.ClearAndSetSize(numFiles);
+  for (i = 0; i < numFiles; i++)
+    _parents[i] = i;
+
+  CRecordVector<CContentKey> keys;
+  
+  // exact duplicates
+  for (i = 0; i < numFiles; i++)
+  {
+    const CContentPrint &p = prints[i];
+    if (!p.Defined)
+      continue;
+    CContentKey key;
+    key.Key1 = p.Size;
+    key.Key2 = p.Crc;
+    key.Pos = i;
+    keys.Add(key);
+  }
+  UnionEqualKeys(keys);
+  
+  // the first file of each set of duplicates
+  CRecordVector<unsigned> dupFirst;
+  dupFirst.ClearAndSetSize(numFiles);
+  for (i = 0; i < numFiles; i++)
+    dupFirst[i] = i;
+  for (i = 1; i < keys.Size(); i++)
+  {
+    const CContentKey &k0 = keys[i - 1];
+    const CContentKey &k1 = keys[i];
+    if (k0.Key1 == k1.Key1 && k0.Key2 == k1.Key2)
+      dupFirst[k1.Pos] = dupFirst[k0.Pos];
+  }
+
+  // similar files
+  for (unsigned band = 0; band < k_MinHash_Num; band += k_MinHash_BandSize)
+  {
+    keys.Clear();
+    for (i = 0; i < numFiles; i++)
+    {
+      const CContentPrint &p = prints[i];
+      if (!p.Defined || !p.HasSamples)
+        continue;
+      UInt64 v = band;
+      for (unsigned k = 0; k < k_MinHash_BandSize; k++)
+        v = Mix64(v ^ p.MinHash[band + k]);
+      CContentKey key;
+      key.Key1 = v;
+      key.Key2 = 0;
+      key.Pos = i;
+      keys.Add(key);
+    }
+    UnionEqualKeys(keys);
+  }
+
+  keys.Clear();
+  for (i = 0; i < numFiles; i++)
+  {
+    CContentKey key;
+    key.Key1 = FindRoot(i);
+    key.Key2 = dupFirst[i];
+    key.Pos = i;
+    keys.Add(key);
+  }
+  keys.Sort(CompareContentKeys, NULL);
+
+  CRecordVector<UInt32> old;
+  old.ClearAndSetSize(numFiles);
+  for (i = 0; i < numFiles; i++)
+    old[i] = indices[i];
+  for (i = 0; i < numFiles; i++)
+    indices[i] = old[keys[i].Pos];
+  return S_OK;
+}
+
 static inline void GetMethodFull(UInt64 methodID, UInt32 numStreams, CMethodFull &m)
 {
   m.Id = methodID;
@@ -1518,6 +1777,7 @@ public:
   const CDbEx *_db;
   CMyComPtr<IArchiveUpdateCallbackFile> _opCallback;
   CMyComPtr<IArchiveExtractCallbackMessage2> _extractCallback;
+  UInt32 _crcErrorIndex; // the index of file with CRC error in archive
 
   HRESULT Init(UInt32 startIndex, const CBoolVector *extractStatuses);
   HRESULT CheckFinishedState() const { return (_currentIndex == _extractStatuses->Size()) ? S_OK: E_FAIL; }
@@ -1567,6 +1827,7 @@ HRESULT CRepackStreamBase::CloseFile()
   _currentIndex++;
   if (!_calcCrc || fi.Crc == CRC_GET_DIGEST(_crc))
     return S_OK;
+  _crcErrorIndex = arcIndex;
 
   if (_extractCallback)
   {
@@ -1834,61 +2095,857 @@ void CThreadDecoder::Execute()
       Fos,
       NULL, // compressProgress
 
-      NULL  // *inStreamMainRes
-      , dataAfterEnd_Error
+      NULL  // *inStreamMainRes
+      , dataAfterEnd_Error
+
+      Z7_7Z_DECODER_CRYPRO_VARS
+      #ifndef Z7_ST
+        , MtMode, NumThreads,
+        0 // MemUsage
+      #endif
+
+      );
+  }
+  catch(...)
+  {
+    Result = E_FAIL;
+  }
+  
+  /*
+  if (Result == S_OK)
+    Result = FosSpec->CheckFinishedState();
+  */
+  FosSpec->_stream.Release();
+}
+
+#endif
+
+#ifndef Z7_NO_CRYPTO
+
+Z7_CLASS_IMP_NOQIB_1(
+  CCryptoGetTextPassword
+  , ICryptoGetTextPassword
+)
+public:
+  UString Password;
+};
+
+Z7_COM7F_IMF(CCryptoGetTextPassword::CryptoGetTextPassword(BSTR *password))
+{
+  return StringToBstr(Password, password);
+}
+
+#endif
+
+
+static void GetFile(const CDatabase &inDb, unsigned index, CFileItem &file, CFileItem2 &file2)
+{
+  file = inDb.Files[index];
+  file2.CTimeDefined = inDb.CTime.GetItem(index, file2.CTime);
+  file2.ATimeDefined = inDb.ATime.GetItem(index, file2.ATime);
+  file2.MTimeDefined = inDb.MTime.GetItem(index, file2.MTime);
+  file2.StartPosDefined = inDb.StartPos.GetItem(index, file2.StartPos);
+  file2.AttribDefined = inDb.Attrib.GetItem(index, file2.Attrib);
+  file2.IsAnti = inDb.IsItemAnti(index);
+  // file2.IsAux = inDb.IsItemAux(index);
+}
+
+
+// it adds the kept files of old folder that was copied or repacked to (newDatabase)
+
+static void AddOldFolderFiles(
+    const CObjectVector<CUpdateItem> &updateItems,
+    const CDbEx *db,
+    unsigned folderIndex, CNum numCopyFiles,
+    const int *fileIndexToUpdateIndexMap,
+    CArchiveDatabaseOut &newDatabase)
+{
+  newDatabase.NumUnpackStreamsVector.Add(numCopyFiles);
+  
+  const CNum numUnpackStreams = db->NumUnpackStreamsVector[folderIndex];
+  CNum indexInFolder = 0;
+  for (CNum fi = db->FolderStartFileIndex[folderIndex]; indexInFolder < numUnpackStreams; fi++)
+  {
+    if (db->Files[fi].HasStream)
+    {
+      indexInFolder++;
+      const int updateIndex = fileIndexToUpdateIndexMap[fi];
+      if (updateIndex >= 0)
+      {
+        const CUpdateItem &ui = updateItems[(unsigned)updateIndex];
+        if (ui.NewData)
+          continue;
+
+        UString name;
+        CFileItem file;
+        CFileItem2 file2;
+        GetFile(*db, fi, file, file2);
+
+        if (ui.NewProps)
+        {
+          UpdateItem_To_FileItem2(ui, file2);
+          file.IsDir = ui.IsDir;
+          name = ui.Name;
+        }
+        else
+          db->GetPath(fi, name);
+
+        /*
+        file.Parent = ui.ParentFolderIndex;
+        if (ui.TreeFolderIndex >= 0)
+          treeFolderToArcIndex[ui.TreeFolderIndex] = newDatabase.Files.Size();
+        if (totalSecureDataSize != 0)
+          newDatabase.SecureIDs.Add(ui.SecureIndex);
+        */
+        newDatabase.AddFile(file, file2, name);
+      }
+    }
+  }
+}
+
+
+// it adds the files of new folder to (newDatabase) after the folder was encoded
+
+static HRESULT AddFolderFiles(
+    const CObjectVector<CUpdateItem> &updateItems,
+    const CDbEx *db,
+    const UInt32 *indices, unsigned numSubFiles,
+    const CFolderInStream *inStreamSpec,
+    CArchiveDatabaseOut &newDatabase,
+    CLocalProgress *lps,
+    IArchiveUpdateCallback *updateCallback,
+    UInt64 &complexity)
+{
+  const UInt64 curFolderUnpackSize = inStreamSpec->Get_TotalSize_for_Coder();
+
+  CNum numUnpackStreams = 0;
+  UInt64 skippedSize = 0;
+  UInt64 procSize = 0;
+  // unsigned numProcessedFiles = 0;
+
+  for (unsigned subIndex = 0; subIndex < numSubFiles; subIndex++)
+  {
+    const CUpdateItem &ui = updateItems[indices[subIndex]];
+    CFileItem file;
+    CFileItem2 file2;
+    UString name;
+    if (ui.NewProps)
+    {
+      UpdateItem_To_FileItem(ui, file, file2);
+      name = ui.Name;
+    }
+    else
+    {
+      GetFile(*db, (unsigned)ui.IndexInArchive, file, file2);
+      db->GetPath((unsigned)ui.IndexInArchive, name);
+    }
+    if (file2.IsAnti || file.IsDir)
+      return E_FAIL;
+    
+    /*
+    CFileItem &file = newDatabase.Files[
+          startFileIndexInDatabase + i + subIndex];
+    */
+    if (!inStreamSpec->Processed[subIndex])
+    {
+      // we don't add file here
+      skippedSize += ui.Size;
+      continue; // comment it for debug
+      // name += ".locked"; // for debug
+    }
+
+    // if (inStreamSpec->Need_Crc)
+    file.Crc = inStreamSpec->CRCs[subIndex];
+    file.Size = inStreamSpec->Sizes[subIndex];
+    
+    procSize += file.Size;
+    // if (file.Size >= 0) // for debug: test purposes
+    if (file.Size != 0)
+    {
+      file.CrcDefined = true; // inStreamSpec->Need_Crc;
+      file.HasStream = true;
+      numUnpackStreams++;
+    }
+    else
+    {
+      file.CrcDefined = false;
+      file.HasStream = false;
+    }
+
+    if (inStreamSpec->TimesDefined[subIndex])
+    {
+      if (inStreamSpec->Need_CTime)
+        { file2.CTimeDefined = true;  file2.CTime = inStreamSpec->CTimes[subIndex]; }
+      if (inStreamSpec->Need_ATime
+          // && !ui.ATime_WasReadByAnalysis
+          )
+        { file2.ATimeDefined = true;  file2.ATime = inStreamSpec->ATimes[subIndex]; }
+      if (inStreamSpec->Need_MTime)
+        { file2.MTimeDefined = true;  file2.MTime = inStreamSpec->MTimes[subIndex]; }
+      if (inStreamSpec->Need_Attrib)
+      {
+        file2.AttribDefined = true;
+        file2.Attrib = inStreamSpec->Attribs[subIndex];
+      }
+    }
+
+    /*
+    file.Parent = ui.ParentFolderIndex;
+    if (ui.TreeFolderIndex >= 0)
+      treeFolderToArcIndex[ui.TreeFolderIndex] = newDatabase.Files.Size();
+    if (totalSecureDataSize != 0)
+      newDatabase.SecureIDs.Add(ui.SecureIndex);
+    */
+    /*
+    if (reportArcProp)
+    {
+      RINOK(ReportItemProps(reportArcProp, ui.IndexInClient, file.Size,
+          file.CrcDefined ? &file.Crc : NULL))
+    }
+    */
+
+    // numProcessedFiles++;
+    newDatabase.AddFile(file, file2, name);
+  }
+
+  /*
+  // for debug:
+  // we can write crc to folders area, if folder contains only one file
+  if (numUnpackStreams == 1 && numSubFiles == 1)
+  {
+    const CFileItem &file = newDatabase.Files.Back();
+    if (file.CrcDefined)
+      newDatabase.FolderUnpackCRCs.SetItem(folderIndex_New, true, file.Crc);
+  }
+  */
+
+  /*
+  // it's optional check to ensure that sizes are correct
+  if (inStreamSpec->TotalSize_for_Coder != curFolderUnpackSize)
+    return E_FAIL;
+  */
+  // if (inStreamSpec->AlignLog == 0)
+  {
+    if (procSize != curFolderUnpackSize)
+      return E_FAIL;
+  }
+  // else
+  {
+    /*
+    {
+      const CFolder &old = newDatabase.Folders.Back();
+      CFolder &folder = newDatabase.Folders.AddNew();
+      {
+        const unsigned numBonds = old.Bonds.Size();
+        folder.Bonds.SetSize(numBonds + 1);
+        for (unsigned k = 0; k < numBonds; k++)
+          folder.Bonds[k] = old.Bonds[k];
+        CBond &bond = folder.Bonds[numBonds];
+        bond.PackIndex = 0;
+        bond.UnpackIndex = 0;
+      }
+      {
+        const unsigned numCoders = old.Coders.Size();
+        folder.Coders.SetSize(numCoders + 1);
+        for (unsigned k = 0; k < numCoders; k++)
+          folder.Coders[k] = old.Coders[k];
+        CCoderInfo &cod = folder.Coders[numCoders];
+        cod.Props.Alloc(1);
+        cod.Props[0] = (Byte)inStreamSpec->AlignLog;
+        cod.NumStreams = 1;
+      }
+      {
+        const unsigned numPackStreams = old.Coders.Size();
+        folder.Coders.SetSize(numPackStreams);
+        for (unsigned k = 0; k < numPackStreams; k++)
+          folder.PackStreams[k] = old.PackStreams[k];
+      }
+    }
+    newDatabase.Folders.Delete(newDatabase.Folders.Size() - 2);
+    */
+  }
+
+
+  lps->InSize += procSize;
+  // lps->InSize += curFolderUnpackSize;
+
+  // numUnpackStreams = 0 is very bad case for locked files
+  // v3.13 doesn't understand it.
+  newDatabase.NumUnpackStreamsVector.Add(numUnpackStreams);
+
+  if (skippedSize != 0 && complexity >= skippedSize)
+  {
+    complexity -= skippedSize;
+    RINOK(updateCallback->SetTotal(complexity))
+  }
+
+  return S_OK;
+}
+
+
+#ifndef Z7_ST
+
+/*
+Small folders of new files can be encoded concurrently:
+the main thread reads all files of folder to the input buffer of job
+(so all calls of IArchiveUpdateCallback are still in main thread),
+and one of worker threads encodes that buffer with single-threaded coders
+to memory buffer. The main thread reads next folder, while the jobs encode
+previous folders. The size of folder is limited by (k_FolderJob_SizeMax),
+and the number of jobs is limited by memory usage limit.
+The encoded folders are written to archive in original order.
+Old folders that must be repacked are processed same way: the main thread
+reads the pack streams, and the worker thread decodes the folder to memory
+and encodes it.
+*/
+
+static const size_t k_FolderJob_SizeMax = (size_t)1 << 26;
+static const UInt32 k_FolderJobs_NumMax = 64;
+
+Z7_CLASS_IMP_COM_2(
+  CFolderBufInStream
+  , ISequentialInStream
+  , ICompressGetSubStreamSize
+)
+  const Byte *_data;
+  size_t _size;
+  size_t _pos;
+  const CRecordVector<UInt64> *_subStreamSizes;
+public:
+  void Init(const Byte *data, size_t size, const CRecordVector<UInt64> *subStreamSizes)
+  {
+    _data = data;
+    _size = size;
+    _pos = 0;
+    _subStreamSizes = subStreamSizes;
+  }
+};
+
+Z7_COM7F_IMF(CFolderBufInStream::Read(void *data, UInt32 size, UInt32 *processedSize))
+{
+  size_t rem = _size - _pos;
+  if (rem > size)
+    rem = size;
+  if (rem != 0)
+  {
+    memcpy(data, _data + _pos, rem);
+    _pos += rem;
+  }
+  if (processedSize)
+    *processedSize = (UInt32)rem;
+  return S_OK;
+}
+
+// the sizes of files are known already, so BCJ2 encoder gets same values as for CFolderInStream
+
+Z7_COM7F_IMF(CFolderBufInStream::GetSubStreamSize(UInt64 subStream, UInt64 *value))
+{
+  *value = 0;
+  if (subStream >= _subStreamSizes->Size())
+    return S_FALSE;
+  *value = (*_subStreamSizes)[(unsigned)subStream];
+  return S_OK;
+}
+
+
+class CFolderEncoderThread Z7_final: public CVirtThread
+{
+public:
+  CEncoder *Encoder;
+  CMyComPtr2_Create<ISequentialInStream, CFolderInStream> FolderInStream;
+  CMyComPtr2_Create<ISequentialOutStream, CDynBufSeqOutStream> InBuf;
+  CMyComPtr2_Create<ISequentialInStream, CFolderBufInStream> BufInStream;
+  CMyComPtr2_Create<ISequentialOutStream, CDynBufSeqOutStream> OutBuf;
+
+  CFolder *Folder;
+  CRecordVector<UInt64> PackSizes;
+  CRecordVector<UInt64> CoderUnpackSizes;
+  const UInt64 *InSizeForReduce;
+  UInt64 ExpectedDataSize;
+  const UInt32 *Indices;
+  unsigned NumSubFiles;
+  bool WasStarted;
+  HRESULT Result;
+
+  // the job for old folder that is decoded and encoded again
+  bool IsRepack;
+  bool DataAfterEnd_Error;
+  bool UseMixerMT; // the folder with chain of coders can't be decoded by CMixerST
+  unsigned RepackFolderIndex;
+  CNum NumCopyFiles;
+  const CDbEx *Db;
+  CBoolVector ExtractStatuses;
+  CRecordVector<UInt64> RepackSizes;
+  CByteBuffer PackData;
+  CMyComPtr2_Create<IInStream, CBufInStream> PackStream;
+  CMyComPtr2_Create<ISequentialOutStream, CFolderOutStream2> RepackOutStream;
+  CDecoder *Decoder;
+  #ifndef Z7_NO_CRYPTO
+  CMyComPtr<ICryptoGetTextPassword> getTextPassword;
+  #endif
+
+  DECL_EXTERNAL_CODECS_LOC_VARS_DECL
+
+  HRESULT ReadFolder();
+  HRESULT ReadPackedFolder(IInStream *inStream);
+  HRESULT DecodeFolder();
+
+  CFolderEncoderThread(): Encoder(NULL), UseMixerMT(true), Decoder(NULL) {}
+  ~CFolderEncoderThread() Z7_DESTRUCTOR_override
+  {
+    CVirtThread::WaitThreadFinish();
+    delete Encoder;
+    delete Decoder;
+  }
+  virtual void Execute() Z7_override;
+};
+
+
+// it reads all files of folder in main thread
+
+HRESULT CFolderEncoderThread::ReadFolder()
+{
+  InBuf->Init();
+  const size_t kStep = (size_t)1 << 16;
+  for (;;)
+  {
+    Byte *buf = InBuf->GetBufPtrForWriting(kStep);
+    if (!buf)
+      return E_OUTOFMEMORY;
+    UInt32 processed = 0;
+    RINOK(FolderInStream.Interface()->Read(buf, (UInt32)kStep, &processed))
+    if (processed == 0)
+      break;
+    InBuf->UpdateSize(processed);
+  }
+  if (!FolderInStream->WasFinished())
+    return E_FAIL;
+  BufInStream->Init(InBuf->GetBuffer(), InBuf->GetSize(), &FolderInStream->Sizes);
+  return S_OK;
+}
+
+
+/* The pack streams of old folder are read in main thread,
+   because the archive stream can't be shared by threads.
+   (ExtractStatuses) and (RepackSizes) must be set before the call. */
+
+HRESULT CFolderEncoderThread::ReadPackedFolder(IInStream *inStream)
+{
+  IsRepack = true;
+  if (!Decoder)
+    Decoder = new CDecoder(UseMixerMT);
+  const size_t packSize = (size_t)Db->GetFolderFullPackSize(RepackFolderIndex);
+  if (PackData.Size() != packSize)
+    PackData.Alloc(packSize);
+  RINOK(InStream_SeekSet(inStream, Db->GetFolderStreamPos(RepackFolderIndex, 0)))
+  return ReadStream_FALSE(inStream, PackData, packSize);
+}
+
+
+HRESULT CFolderEncoderThread::DecodeFolder()
+{
+  InBuf->Init();
+  PackStream->Init(PackData, PackData.Size());
+  CFolderOutStream2 *fos = RepackOutStream.ClsPtr();
+  fos->_stream = InBuf;
+  fos->_db = Db;
+  RINOK(fos->Init(Db->FolderStartFileIndex[RepackFolderIndex], &ExtractStatuses))
+
+  #ifndef Z7_NO_CRYPTO
+  bool isEncrypted = false;
+  bool passwordIsDefined = false;
+  UString password;
+  #endif
+
+  DataAfterEnd_Error = false;
+  HRESULT res = Decoder->Decode(
+      EXTERNAL_CODECS_LOC_VARS
+      PackStream,
+      // (PackData) starts from first pack stream of folder
+      Db->ArcInfo.DataStartPosition - Db->GetFolderStreamPos(RepackFolderIndex, 0),
+      *Db, RepackFolderIndex,
+      NULL, // *unpackSize : FULL unpack
+      RepackOutStream,
+      NULL, // *compressProgress
+      NULL, // **inStreamMainRes
+      DataAfterEnd_Error
+      Z7_7Z_DECODER_CRYPRO_VARS
+      , false // mtMode
+      , 1 // numThreads
+      , 0 // memUsage
+      );
+  fos->_stream.Release();
+  if (res == S_OK)
+    res = fos->CheckFinishedState();
+  RINOK(res)
+  if (InBuf->GetSize() != ExpectedDataSize)
+    return E_FAIL;
+  BufInStream->Init(InBuf->GetBuffer(), InBuf->GetSize(), &RepackSizes);
+  return S_OK;
+}
+
+
+void CFolderEncoderThread::Execute()
+{
+  try
+  {
+    if (IsRepack)
+    {
+      Result = DecodeFolder();
+      if (Result != S_OK)
+        return;
+    }
+    OutBuf->Init();
+    PackSizes.Clear();
+    Result = Encoder->Encode1(
+        EXTERNAL_CODECS_LOC_VARS
+        BufInStream,
+        InSizeForReduce,
+        ExpectedDataSize,
+        *Folder,
+        OutBuf,
+        PackSizes,
+        NULL); // compressProgress
+  }
+  catch(...)
+  {
+    Result = E_FAIL;
+  }
+}
+
+
+static UInt32 Get_Ui4_Prop(const CMethodProps &m, PROPID id, UInt32 defaultValue)
+{
+  const int i = m.FindProp(id);
+  if (i >= 0)
+  {
+    const NWindows::NCOM::CPropVariant &val = m.Props[(unsigned)i].Value;
+    if (val.vt == VT_UI4)
+      return val.ulVal;
+  }
+  return defaultValue;
+}
+
+/* ZSTD_estimateCStreamSize() for levels 1 ... 22 in MiB (zstd 1.5).
+   We don't call zstd here, because some builds of 7z handler don't include zstd code. */
+
+static const UInt16 k_Zstd_Level_MemUsage_MiB[22] =
+  { 2, 2, 4, 5, 6, 6, 9, 9, 17, 29, 29, 53, 53, 53, 69, 69, 69, 69, 90, 194, 386, 834 };
+
+static UInt64 Get_Zstd_MemUsage(const CMethodProps &m)
+{
+  if (m.FindProp(NCoderPropID::kAdvMax) >= 0)
+    return (UInt64)(Int64)-1; // --max uses the largest window
+  UInt32 level = m.GetLevel();
+  if (m.FindProp(NCoderPropID::kAdapt) >= 0)
+    level = Get_Ui4_Prop(m, NCoderPropID::kAdaptMax, 22);
+  if (level == Z7_ZSTD_ULTIMATE_LEV)
+    return (UInt64)(Int64)-1;
+  if (level > Z7_ZSTD_FAST_LEV_INC || m.FindProp(NCoderPropID::kFast) >= 0)
+    level = 1; // fast levels use less memory than level 1
+  if (level < 1) level = 1;
+  if (level > 22) level = 22;
+  UInt64 size = (UInt64)k_Zstd_Level_MemUsage_MiB[level - 1] << 20;
+  // the tables and window that are set explicitly are added to the size for the level
+  UInt32 windowLog = Get_Ui4_Prop(m, NCoderPropID::kWindowLog, 0);
+  if (m.FindProp(NCoderPropID::kLong) >= 0)
+  {
+    const UInt32 v = Get_Ui4_Prop(m, NCoderPropID::kLong, 0);
+    windowLog = (v == 0 ? 27 : v < 10 ? 10 : v);
+    // long distance matching tables
+    size += (UInt64)1 << (windowLog > 28 ? 26 : windowLog - 2);
+  }
+  if (windowLog > 31)
+    return (UInt64)(Int64)-1;
+  if (windowLog != 0)
+    size += (UInt64)2 << windowLog;
+  const UInt32 hashLog = Get_Ui4_Prop(m, NCoderPropID::kHashLog, 0);
+  const UInt32 chainLog = Get_Ui4_Prop(m, NCoderPropID::kChainLog, 0);
+  if (hashLog != 0 && hashLog <= 30)
+    size += (UInt64)4 << hashLog;
+  if (chainLog != 0 && chainLog <= 30)
+    size += (UInt64)4 << chainLog;
+  return size;
+}
+
+/* the estimations for coders from zstdmt library with one thread:
+   BrotliEncoderEstimatePeakMemoryUsage(), LZ4F / LZ5HC / Lizard states
+   and the input and output buffers of one block (4 MiB or 1 MiB * level for brotli). */
 
-      Z7_7Z_DECODER_CRYPRO_VARS
-      #ifndef Z7_ST
-        , MtMode, NumThreads,
-        0 // MemUsage
-      #endif
+static UInt64 Get_Brotli_MemUsage(const CMethodProps &m)
+{
+  UInt32 level = m.GetLevel();
+  if (level > 11)
+    level = 11;
+  UInt32 windowLog = Get_Ui4_Prop(m, NCoderPropID::kWindowLog, 24);
+  if (m.FindProp(NCoderPropID::kLong) >= 0)
+  {
+    windowLog = Get_Ui4_Prop(m, NCoderPropID::kLong, 24);
+    if (windowLog == 0)
+      windowLog = 24;
+  }
+  if (windowLog > 30)
+    return (UInt64)(Int64)-1;
+  const UInt64 bufs = (UInt64)(level == 0 ? 1 : level) << 21;
+  if (level < 2)
+    return bufs + ((UInt64)1 << 21);
+  // the ring buffer of window, hash tables and (zopfli) nodes for levels 10 and 11
+  return bufs + ((UInt64)(level < 10 ? 6 : 18) << windowLog);
+}
 
-      );
+static UInt64 Get_Lz5_MemUsage(const CMethodProps &m)
+{
+  const UInt32 level = m.GetLevel();
+  // LZ5HC tables: level 15 uses (hashLog = 28)
+  return level >= 15 ? ((UInt64)5 << 28) : (UInt64)1 << (level >= 9 ? 27 : 25);
+}
+
+static UInt64 Get_Lizard_MemUsage(const CMethodProps &m)
+{
+  const UInt32 level = m.GetLevel();
+  const UInt32 l = level % 10;
+  // the levels (x9) use largest tables. The levels 20-29 and 40-49 use larger tables than 10-19 and 30-39
+  if (l == 9)
+    return (UInt64)192 << 20;
+  if (l >= 4 && ((level / 10) & 1) == 0)
+    return (UInt64)80 << 20;
+  return (UInt64)32 << 20;
+}
+
+
+/* it returns (UInt64)(Int64)-1, if the memory usage of some coder is unknown.
+   There is no interface to ask the coder (external codecs) about memory usage,
+   so such folders are not encoded by jobs, and the coder uses its own threads.
+   LZHAM coder is not included to this 7-Zip, and zstd --max can use 2 GiB window. */
+
+static UInt64 Get_FolderJob_MemUsage(const CCompressionMethodMode &method)
+{
+  UInt64 size = 0;
+  FOR_VECTOR (i, method.Methods)
+  {
+    const CMethodFull &m = method.Methods[i];
+    UInt64 cur;
+    if (m.Id == k_Copy || IsFilterMethod(m.Id))
+      cur = (UInt64)1 << 22; // BCJ2 encoder has the biggest buffers
+    else switch (m.Id)
+    {
+      case k_LZMA:
+      case k_LZMA2: cur = m.Get_Lzma_MemUsage(true); break;
+      case k_PPMD: cur = m.Get_Ppmd_MemSize(); break;
+      case k_BZip2: cur = (UInt64)m.Get_BZip2_BlockSize() * 10; break;
+      case k_Deflate:
+      case k_Deflate64: cur = (UInt64)1 << 24; break;
+      case k_ZSTD: cur = Get_Zstd_MemUsage(m); break;
+      case k_BROTLI: cur = Get_Brotli_MemUsage(m); break;
+      case k_LZ4: cur = (UInt64)1 << 24; break; // LZ4HC state and the buffers of block
+      case k_LZ5: cur = Get_Lz5_MemUsage(m); break;
+      case k_LIZARD: cur = Get_Lizard_MemUsage(m); break;
+      default: return (UInt64)(Int64)-1;
+    }
+    if (cur == (UInt64)(Int64)-1)
+      return cur;
+    size += cur;
   }
-  catch(...)
+  // the input buffer and the output buffer of job
+  return size + k_FolderJob_SizeMax * 2;
+}
+
+// the decoder of repack job: the largest LZMA dictionary in archive and the buffer for pack streams
+
+static UInt64 Get_RepackJob_MemUsage(const CDbEx &db)
+{
+  const CParsedMethods &pm = db.ParsedMethods;
+  UInt64 dict = pm.LzmaDic;
+  if (pm.Lzma2Prop != 0)
   {
-    Result = E_FAIL;
+    const UInt64 dict2 = pm.Lzma2Prop >= 40 ? ((UInt64)1 << 32) :
+        ((UInt64)(2 | (pm.Lzma2Prop & 1)) << (pm.Lzma2Prop / 2 + 11));
+    if (dict < dict2)
+      dict = dict2;
   }
-  
-  /*
-  if (Result == S_OK)
-    Result = FosSpec->CheckFinishedState();
-  */
-  FosSpec->_stream.Release();
+  if (dict < ((UInt64)1 << 26))
+    dict = (UInt64)1 << 26; // other coders
+  return dict + k_FolderJob_SizeMax;
 }
 
-#endif
 
-#ifndef Z7_NO_CRYPTO
+/*
+CFolderJobs keeps the ring of jobs of one group.
+The jobs are written to archive in the order of submission.
+Before any folder is written directly to archive, all pending jobs must be written.
+*/
 
-Z7_CLASS_IMP_NOQIB_1(
-  CCryptoGetTextPassword
-  , ICryptoGetTextPassword
-)
+class CFolderJobs
+{
+  CObjectVector<CFolderEncoderThread> _threads;
+  unsigned _index; // the oldest pending job
+  unsigned _numPending;
+
+  HRESULT WriteJob(CFolderEncoderThread &job);
 public:
-  UString Password;
+  CCompressionMethodMode Method;
+  unsigned NumMax;
+
+  ISequentialOutStream *OutStream;
+  const CObjectVector<CUpdateItem> *UpdateItems;
+  const CDbEx *Db;
+  const int *FileIndexToUpdateIndexMap;
+  CArchiveDatabaseOut *NewDatabase;
+  CLocalProgress *Lps;
+  IArchiveUpdateCallback *UpdateCallback;
+  IArchiveExtractCallbackMessage2 *ExtractCallback;
+  UInt64 *Complexity;
+  #ifndef Z7_NO_CRYPTO
+  ICryptoGetTextPassword *GetTextPassword;
+  #endif
+  DECL_EXTERNAL_CODECS_LOC_VARS_DECL
+
+  CFolderJobs(): _index(0), _numPending(0), NumMax(0) {}
+
+  bool IsEmpty() const { return _numPending == 0; }
+  // it creates the threads. It returns false, if there are less than 2 threads.
+  bool Create();
+  // it returns the job for next folder. It writes the oldest job, if all jobs are pending.
+  HRESULT GetFreeJob(CFolderEncoderThread *&job);
+  HRESULT Submit(CFolderEncoderThread &job);
+  HRESULT WriteAll();
 };
 
-Z7_COM7F_IMF(CCryptoGetTextPassword::CryptoGetTextPassword(BSTR *password))
+bool CFolderJobs::Create()
 {
-  return StringToBstr(Password, password);
+  if (_threads.IsEmpty())
+  {
+    for (unsigned k = 0; k < NumMax; k++)
+    {
+      CFolderEncoderThread &job = _threads.AddNew();
+      if (job.Create() != 0)
+      {
+        _threads.DeleteBack();
+        break;
+      }
+      job.Encoder = new CEncoder(Method);
+      job.UseMixerMT = Method.MultiThreadMixer;
+      job.Db = Db;
+      #ifndef Z7_NO_CRYPTO
+      job.getTextPassword = GetTextPassword;
+      #endif
+      #ifdef Z7_EXTERNAL_CODECS
+      job._externalCodecs = _externalCodecs;
+      #endif
+    }
+    if (_threads.Size() < 2)
+    {
+      NumMax = 0;
+      return false;
+    }
+    NumMax = _threads.Size();
+  }
+  return true;
 }
 
-#endif
+HRESULT CFolderJobs::GetFreeJob(CFolderEncoderThread *&job)
+{
+  if (_numPending == NumMax)
+  {
+    RINOK(WriteJob(_threads[_index]))
+    _index = (_index + 1) % NumMax;
+    _numPending--;
+  }
+  job = &_threads[(_index + _numPending) % NumMax];
+  return S_OK;
+}
 
+HRESULT CFolderJobs::Submit(CFolderEncoderThread &job)
+{
+  job.Result = E_FAIL;
+  const WRes wres = job.Start();
+  job.WasStarted = (wres == 0);
+  if (!job.WasStarted)
+    job.Execute();
+  _numPending++;
+  return S_OK;
+}
 
-static void GetFile(const CDatabase &inDb, unsigned index, CFileItem &file, CFileItem2 &file2)
+HRESULT CFolderJobs::WriteAll()
 {
-  file = inDb.Files[index];
-  file2.CTimeDefined = inDb.CTime.GetItem(index, file2.CTime);
-  file2.ATimeDefined = inDb.ATime.GetItem(index, file2.ATime);
-  file2.MTimeDefined = inDb.MTime.GetItem(index, file2.MTime);
-  file2.StartPosDefined = inDb.StartPos.GetItem(index, file2.StartPos);
-  file2.AttribDefined = inDb.Attrib.GetItem(index, file2.Attrib);
-  file2.IsAnti = inDb.IsItemAnti(index);
-  // file2.IsAux = inDb.IsItemAux(index);
+  for (; _numPending != 0; _numPending--)
+  {
+    RINOK(WriteJob(_threads[_index]))
+    _index = (_index + 1) % NumMax;
+  }
+  return S_OK;
+}
+
+// it writes the encoded folder of job to archive and adds its records to (NewDatabase)
+
+HRESULT CFolderJobs::WriteJob(CFolderEncoderThread &job)
+{
+  if (job.WasStarted)
+    job.WaitExecuteFinish();
+
+  if (job.IsRepack)
+  {
+    if (job.Result == k_My_HRESULT_CRC_ERROR)
+    {
+      if (ExtractCallback)
+      {
+        RINOK(ExtractCallback->ReportExtractResult(
+            NEventIndexType::kInArcIndex, job.RepackOutStream->_crcErrorIndex,
+            NExtract::NOperationResult::kCRCError))
+      }
+      return E_FAIL;
+    }
+    if (job.Result == S_FALSE || (job.Result == S_OK && job.DataAfterEnd_Error))
+    {
+      if (ExtractCallback)
+      {
+        RINOK(ExtractCallback->ReportExtractResult(
+            NEventIndexType::kInArcIndex, Db->FolderStartFileIndex[job.RepackFolderIndex],
+            (job.Result != S_OK ?
+              NExtract::NOperationResult::kDataError :
+              NExtract::NOperationResult::kDataAfterEnd)))
+      }
+      if (job.Result != S_OK)
+        return E_FAIL;
+    }
+  }
+
+  RINOK(job.Result)
+  if (!job.IsRepack && !job.FolderInStream->WasFinished())
+    return E_FAIL;
+  job.CoderUnpackSizes.Clear();
+  job.Encoder->Encode_Post(job.IsRepack ?
+      (UInt64)job.InBuf->GetSize() :
+      job.FolderInStream->Get_TotalSize_for_Coder(),
+      job.CoderUnpackSizes);
+  RINOK(WriteStream(OutStream, job.OutBuf->GetBuffer(), job.OutBuf->GetSize()))
+  
+  UInt64 packSize = 0;
+  FOR_VECTOR (k, job.PackSizes)
+  {
+    NewDatabase->PackSizes.Add(job.PackSizes[k]);
+    packSize += job.PackSizes[k];
+  }
+  FOR_VECTOR (k, job.CoderUnpackSizes)
+    NewDatabase->CoderUnpackSizes.Add(job.CoderUnpackSizes[k]);
+  Lps->OutSize += packSize;
+  
+  if (job.IsRepack)
+  {
+    Lps->InSize += job.ExpectedDataSize;
+    AddOldFolderFiles(*UpdateItems, Db, job.RepackFolderIndex, job.NumCopyFiles,
+        FileIndexToUpdateIndexMap, *NewDatabase);
+  }
+  else
+  {
+    RINOK(AddFolderFiles(*UpdateItems, Db, job.Indices, job.NumSubFiles,
+        job.FolderInStream.ClsPtr(), *NewDatabase, Lps, UpdateCallback, *Complexity))
+  }
+  return Lps->SetCur();
 }
 
+#endif
+
 HRESULT Update(
     DECL_EXTERNAL_CODECS_LOC_VARS
     IInStream *inStream,
@@ -2030,8 +3087,10 @@ HRESULT Update(
      #ifndef Z7_NO_CRYPTO
       const bool isEncrypted = f.IsEncrypted();
      #endif
-      const bool needCopy = (numCopyItems == numUnpackStreams);
-      const bool extractFilter = (useFilters || needCopy);
+      // in recompress mode the old folders are not copied, but encoded with new method
+      const bool fullFolder = (numCopyItems == numUnpackStreams);
+      const bool needCopy = (fullFolder && !options.Recompress);
+      const bool extractFilter = (useFilters || fullFolder);
 
       const unsigned groupIndex = Get_FilterGroup_for_Folder(filters, f, extractFilter);
       
@@ -2359,9 +3418,54 @@ HRESULT Update(
 
     CEncoder encoder(method);
 
+    const CSolidGroup &group = groups[filterMode.GroupIndex];
+    
+   #ifndef Z7_ST
+    CFolderJobs jobs;
+    if (method.NumThreads > 1 && group.Indices.Size() + group.folderRefs.Size() > 1)
+    {
+      CCompressionMethodMode &jobMethod = jobs.Method;
+      jobMethod = method;
+      FOR_VECTOR (k, jobMethod.Methods)
+      {
+        CMethodFull &m = jobMethod.Methods[k];
+        CMultiMethodProps::SetMethodThreadsTo_Replace(m, 1);
+        m.NumThreads = 1;
+      }
+      UInt64 memUsage = Get_FolderJob_MemUsage(jobMethod);
+      if (memUsage != (UInt64)(Int64)-1)
+      {
+        if (!group.folderRefs.IsEmpty())
+          memUsage += Get_RepackJob_MemUsage(*db);
+        UInt64 numJobs = method.NumThreads;
+        if (numJobs > k_FolderJobs_NumMax)
+          numJobs = k_FolderJobs_NumMax;
+        const UInt64 numJobs_Mem = method.MemoryUsageLimit / memUsage;
+        if (numJobs > numJobs_Mem)
+          numJobs = numJobs_Mem;
+        if (numJobs > 1)
+          jobs.NumMax = (unsigned)numJobs;
+      }
+      jobs.OutStream = archive.SeqStream;
+      jobs.UpdateItems = &updateItems;
+      jobs.Db = db;
+      jobs.FileIndexToUpdateIndexMap = fileIndexToUpdateIndexMap;
+      jobs.NewDatabase = &newDatabase;
+      jobs.Lps = lps.ClsPtr();
+      jobs.UpdateCallback = updateCallback;
+      jobs.ExtractCallback = extractCallback;
+      jobs.Complexity = &complexity;
+      #ifndef Z7_NO_CRYPTO
+      jobs.GetTextPassword = getTextPassword;
+      #endif
+      #ifdef Z7_EXTERNAL_CODECS
+      jobs._externalCodecs = _externalCodecs;
+      #endif
+    }
+   #endif
+
     // ---------- Repack and copy old solid blocks ----------
 
-    const CSolidGroup &group = groups[filterMode.GroupIndex];
     
     FOR_VECTOR (folderRefIndex, group.folderRefs)
     {
@@ -2371,8 +3475,12 @@ HRESULT Update(
       
       const CNum numUnpackStreams = db->NumUnpackStreamsVector[folderIndex];
 
-      if (rep.NumCopyFiles == numUnpackStreams)
+      if (rep.NumCopyFiles == numUnpackStreams && !options.Recompress)
       {
+       #ifndef Z7_ST
+        RINOK(jobs.WriteAll())
+       #endif
+
         if (opCallback)
         {
           RINOK(opCallback->ReportOperation(
@@ -2475,6 +3583,50 @@ HRESULT Update(
 
         // extractStatuses.DeleteFrom(numImportantFiles);
 
+       #ifndef Z7_ST
+        if (jobs.NumMax > 1)
+        {
+          // the last folder is encoded with all threads, if there are no other folders in progress
+          bool useJob = (!jobs.IsEmpty()
+              || folderRefIndex + 1 < group.folderRefs.Size()
+              || !group.Indices.IsEmpty());
+          if (db->GetFolderUnpackSize(folderIndex) > k_FolderJob_SizeMax
+              || db->GetFolderFullPackSize(folderIndex) > k_FolderJob_SizeMax)
+            useJob = false;
+          if (useJob && jobs.Create())
+          {
+            CFolderEncoderThread *job;
+            RINOK(jobs.GetFreeJob(job))
+            job->RepackFolderIndex = folderIndex;
+            job->NumCopyFiles = rep.NumCopyFiles;
+            job->ExtractStatuses = extractStatuses;
+            job->RepackSizes.Clear();
+            const UInt32 startIndex = db->FolderStartFileIndex[folderIndex];
+            FOR_VECTOR (k, extractStatuses)
+            {
+              const CFileItem &file = db->Files[startIndex + k];
+              job->RepackSizes.Add(extractStatuses[k] && file.HasStream ? file.Size : 0);
+              // the job doesn't call the callbacks, so we report the files here
+              if (opCallback)
+              {
+                RINOK(opCallback->ReportOperation(
+                    NEventIndexType::kInArcIndex, startIndex + k,
+                    extractStatuses[k] ?
+                        NUpdateNotifyOp::kRepack :
+                        NUpdateNotifyOp::kSkip))
+              }
+            }
+            RINOK(job->ReadPackedFolder(inStream))
+            job->Folder = &newDatabase.Folders.AddNew();
+            job->InSizeForReduce = &inSizeForReduce;
+            job->ExpectedDataSize = sizeToEncode;
+            RINOK(jobs.Submit(*job))
+            continue;
+          }
+          RINOK(jobs.WriteAll())
+        }
+       #endif
+
         unsigned startPackIndex = newDatabase.PackSizes.Size();
         UInt64 curUnpackSize;
         {
@@ -2654,46 +3806,8 @@ HRESULT Update(
         lps->InSize += curUnpackSize;
       }
       
-      newDatabase.NumUnpackStreamsVector.Add(rep.NumCopyFiles);
-      
-      CNum indexInFolder = 0;
-      for (CNum fi = db->FolderStartFileIndex[folderIndex]; indexInFolder < numUnpackStreams; fi++)
-      {
-        if (db->Files[fi].HasStream)
-        {
-          indexInFolder++;
-          const int updateIndex = fileIndexToUpdateIndexMap[fi];
-          if (updateIndex >= 0)
-          {
-            const CUpdateItem &ui = updateItems[(unsigned)updateIndex];
-            if (ui.NewData)
-              continue;
-
-            UString name;
-            CFileItem file;
-            CFileItem2 file2;
-            GetFile(*db, fi, file, file2);
-
-            if (ui.NewProps)
-            {
-              UpdateItem_To_FileItem2(ui, file2);
-              file.IsDir = ui.IsDir;
-              name = ui.Name;
-            }
-            else
-              db->GetPath(fi, name);
-
-            /*
-            file.Parent = ui.ParentFolderIndex;
-            if (ui.TreeFolderIndex >= 0)
-              treeFolderToArcIndex[ui.TreeFolderIndex] = newDatabase.Files.Size();
-            if (totalSecureDataSize != 0)
-              newDatabase.SecureIDs.Add(ui.SecureIndex);
-            */
-            newDatabase.AddFile(file, file2, name);
-          }
-        }
-      }
+      AddOldFolderFiles(updateItems, db, folderIndex, rep.NumCopyFiles,
+          fileIndexToUpdateIndexMap, newDatabase);
     }
 
 
@@ -2701,7 +3815,12 @@ HRESULT Update(
 
     const unsigned numFiles = group.Indices.Size();
     if (numFiles == 0)
+    {
+     #ifndef Z7_ST
+      RINOK(jobs.WriteAll())
+     #endif
       continue;
+    }
     CRecordVector<CRefItem> refItems;
     refItems.ClearAndSetSize(numFiles);
     // bool sortByType = (options.UseTypeSorting && isSoid); // numSolidFiles > 1
@@ -2735,7 +3854,17 @@ HRESULT Update(
       newDatabase.Files.Add(file);
       */
     }
+
+    if (options.UseContentSorting
+        && opCallback
+        && numSolidFiles > 1
+        && !options.SolidExtension)
+    {
+      CContentOrder contentOrder;
+      RINOK(contentOrder.Reorder(opCallback, indices, numFiles))
+    }
     
+
     for (i = 0; i < numFiles;)
     {
       UInt64 totalSize = 0;
@@ -2777,6 +3906,50 @@ HRESULT Update(
       }
       */
 
+     #ifndef Z7_ST
+      if (jobs.NumMax > 1)
+      {
+        // the last folder is encoded with all threads, if there are no other folders in progress
+        bool useJob = (!jobs.IsEmpty() || i + numSubFiles < numFiles);
+        UInt64 jobSize = 0;
+        for (unsigned k = 0; useJob && k < numSubFiles; k++)
+        {
+          const UInt64 size = updateItems[indices[i + k]].Size;
+          if (size > k_FolderJob_SizeMax)
+            useJob = false;
+          jobSize += size;
+        }
+        if (jobSize > k_FolderJob_SizeMax)
+          useJob = false;
+
+        if (useJob && jobs.Create())
+        {
+          CFolderEncoderThread *job;
+          RINOK(jobs.GetFreeJob(job))
+          CFolderInStream *fis = job->FolderInStream.ClsPtr();
+          fis->Need_CTime = options.Need_CTime;
+          fis->Need_ATime = options.Need_ATime;
+          fis->Need_MTime = options.Need_MTime;
+          fis->Need_Attrib = options.Need_Attrib;
+          fis->Init(updateCallback, &indices[i], numSubFiles);
+          job->IsRepack = false;
+          // the worker threads encode previous folders, while we read the files of this folder
+          RINOK(job->ReadFolder())
+
+          job->Folder = &newDatabase.Folders.AddNew();
+          job->InSizeForReduce = &inSizeForReduce;
+          job->ExpectedDataSize = jobSize;
+          job->Indices = &indices[i];
+          job->NumSubFiles = numSubFiles;
+          RINOK(jobs.Submit(*job))
+          i += numSubFiles;
+          continue;
+        }
+
+        // the folders are written in order, so we finish all pending jobs before this folder
+        RINOK(jobs.WriteAll())
+      }
+     #endif
 
       CMyComPtr2_Create<ISequentialInStream, CFolderInStream> inStreamSpec; // solidInStream;
 
@@ -2787,6 +3960,10 @@ HRESULT Update(
       inStreamSpec->Need_MTime = options.Need_MTime;
       inStreamSpec->Need_Attrib = options.Need_Attrib;
       // inStreamSpec->Need_Crc = options.Need_Crc;
+     #ifndef Z7_ST
+      // the files of solid block are opened and read by another thread
+      inStreamSpec->ReadAhead = (numSubFiles > 1 && method.NumThreads > 1);
+     #endif
 
       inStreamSpec->Init(updateCallback, &indices[i], numSubFiles);
       
@@ -2829,168 +4006,10 @@ HRESULT Update(
       // newDatabase.PackCRCsDefined.Add(false);
       // newDatabase.PackCRCs.Add(0);
 
-      CNum numUnpackStreams = 0;
-      UInt64 skippedSize = 0;
-      UInt64 procSize = 0;
-      // unsigned numProcessedFiles = 0;
-
-      for (unsigned subIndex = 0; subIndex < numSubFiles; subIndex++)
-      {
-        const CUpdateItem &ui = updateItems[indices[i + subIndex]];
-        CFileItem file;
-        CFileItem2 file2;
-        UString name;
-        if (ui.NewProps)
-        {
-          UpdateItem_To_FileItem(ui, file, file2);
-          name = ui.Name;
-        }
-        else
-        {
-          GetFile(*db, (unsigned)ui.IndexInArchive, file, file2);
-          db->GetPath((unsigned)ui.IndexInArchive, name);
-        }
-        if (file2.IsAnti || file.IsDir)
-          return E_FAIL;
-        
-        /*
-        CFileItem &file = newDatabase.Files[
-              startFileIndexInDatabase + i + subIndex];
-        */
-        if (!inStreamSpec->Processed[subIndex])
-        {
-          // we don't add file here
-          skippedSize += ui.Size;
-          continue; // comment it for debug
-          // name += ".locked"; // for debug
-        }
-
-        // if (inStreamSpec->Need_Crc)
-        file.Crc = inStreamSpec->CRCs[subIndex];
-        file.Size = inStreamSpec->Sizes[subIndex];
-        
-        procSize += file.Size;
-        // if (file.Size >= 0) // for debug: test purposes
-        if (file.Size != 0)
-        {
-          file.CrcDefined = true; // inStreamSpec->Need_Crc;
-          file.HasStream = true;
-          numUnpackStreams++;
-        }
-        else
-        {
-          file.CrcDefined = false;
-          file.HasStream = false;
-        }
-
-        if (inStreamSpec->TimesDefined[subIndex])
-        {
-          if (inStreamSpec->Need_CTime)
-            { file2.CTimeDefined = true;  file2.CTime = inStreamSpec->CTimes[subIndex]; }
-          if (inStreamSpec->Need_ATime
-              // && !ui.ATime_WasReadByAnalysis
-              )
-            { file2.ATimeDefined = true;  file2.ATime = inStreamSpec->ATimes[subIndex]; }
-          if (inStreamSpec->Need_MTime)
-            { file2.MTimeDefined = true;  file2.MTime = inStreamSpec->MTimes[subIndex]; }
-          if (inStreamSpec->Need_Attrib)
-          {
-            file2.AttribDefined = true;
-            file2.Attrib = inStreamSpec->Attribs[subIndex];
-          }
-        }
-
-        /*
-        file.Parent = ui.ParentFolderIndex;
-        if (ui.TreeFolderIndex >= 0)
-          treeFolderToArcIndex[ui.TreeFolderIndex] = newDatabase.Files.Size();
-        if (totalSecureDataSize != 0)
-          newDatabase.SecureIDs.Add(ui.SecureIndex);
-        */
-        /*
-        if (reportArcProp)
-        {
-          RINOK(ReportItemProps(reportArcProp, ui.IndexInClient, file.Size,
-              file.CrcDefined ? &file.Crc : NULL))
-        }
-        */
-
-        // numProcessedFiles++;
-        newDatabase.AddFile(file, file2, name);
-      }
-
-      /*
-      // for debug:
-      // we can write crc to folders area, if folder contains only one file
-      if (numUnpackStreams == 1 && numSubFiles == 1)
-      {
-        const CFileItem &file = newDatabase.Files.Back();
-        if (file.CrcDefined)
-          newDatabase.FolderUnpackCRCs.SetItem(folderIndex_New, true, file.Crc);
-      }
-      */
-
-      /*
-      // it's optional check to ensure that sizes are correct
-      if (inStreamSpec->TotalSize_for_Coder != curFolderUnpackSize)
-        return E_FAIL;
-      */
-      // if (inStreamSpec->AlignLog == 0)
-      {
-        if (procSize != curFolderUnpackSize)
-          return E_FAIL;
-      }
-      // else
-      {
-        /*
-        {
-          const CFolder &old = newDatabase.Folders.Back();
-          CFolder &folder = newDatabase.Folders.AddNew();
-          {
-            const unsigned numBonds = old.Bonds.Size();
-            folder.Bonds.SetSize(numBonds + 1);
-            for (unsigned k = 0; k < numBonds; k++)
-              folder.Bonds[k] = old.Bonds[k];
-            CBond &bond = folder.Bonds[numBonds];
-            bond.PackIndex = 0;
-            bond.UnpackIndex = 0;
-          }
-          {
-            const unsigned numCoders = old.Coders.Size();
-            folder.Coders.SetSize(numCoders + 1);
-            for (unsigned k = 0; k < numCoders; k++)
-              folder.Coders[k] = old.Coders[k];
-            CCoderInfo &cod = folder.Coders[numCoders];
-            cod.Props.Alloc(1);
-            cod.Props[0] = (Byte)inStreamSpec->AlignLog;
-            cod.NumStreams = 1;
-          }
-          {
-            const unsigned numPackStreams = old.Coders.Size();
-            folder.Coders.SetSize(numPackStreams);
-            for (unsigned k = 0; k < numPackStreams; k++)
-              folder.PackStreams[k] = old.PackStreams[k];
-          }
-        }
-        newDatabase.Folders.Delete(newDatabase.Folders.Size() - 2);
-        */
-      }
-
-
-      lps->InSize += procSize;
-      // lps->InSize += curFolderUnpackSize;
-
-      // numUnpackStreams = 0 is very bad case for locked files
-      // v3.13 doesn't understand it.
-      newDatabase.NumUnpackStreamsVector.Add(numUnpackStreams);
+      RINOK(AddFolderFiles(updateItems, db, &indices[i], numSubFiles,
+          inStreamSpec.ClsPtr(), newDatabase, lps.ClsPtr(), updateCallback, complexity))
       i += numSubFiles;
 
-      if (skippedSize != 0 && complexity >= skippedSize)
-      {
-        complexity -= skippedSize;
-        RINOK(updateCallback->SetTotal(complexity))
-      }
-
       /*
       if (reportArcProp)
       {
@@ -3029,6 +4048,10 @@ HRESULT Update(
       }
       */
     }
+
+   #ifndef Z7_ST
+    RINOK(jobs.WriteAll())
+   #endif
   }
 
   RINOK(lps->SetCur())
@@ -99,6 +99,8 @@ struct CUpdateOptions
   bool SolidExtension;
   
   bool UseTypeSorting;
+  bool UseContentSorting; // reorder files by content similarity in solid blocks
+  bool Recompress; // encode the kept old folders with new method instead of copying
   
   bool RemoveSfxBlock;
   bool MultiThreadMixer;
@@ -140,6 +142,8 @@ struct CUpdateOptions
       NumSolidBytes((UInt64)(Int64)(-1)),
       SolidExtension(false),
       UseTypeSorting(true),
+      UseContentSorting(false),
+      Recompress(false),
       RemoveSfxBlock(false),
       MultiThreadMixer(true),
       Need_CTime(false),
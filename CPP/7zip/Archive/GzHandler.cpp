@@ -4,6 +4,7 @@
 
 // #include  <stdio.h>
 
+#include "../../../C/7zCrc.h"
 #include "../../../C/CpuArch.h"
 
 #include "../../Common/ComTry.h"
@@ -15,7 +16,11 @@
 
 #include "../Common/ProgressUtils.h"
 #include "../Common/RegisterArc.h"
+#include "../Common/StreamObjects.h"
 #include "../Common/StreamUtils.h"
+#ifndef Z7_ST
+#include "../Common/VirtThread.h"
+#endif
 
 #include "../Compress/CopyCoder.h"
 #include "../Compress/DeflateDecoder.h"
@@ -120,6 +125,7 @@ public:
   UInt32 Time;
   UInt32 Crc;
   UInt32 Size32;
+  UInt32 BlockSize; // the size of member from BGZF "BC" subfield, 0 : no such subfield
 
   AString Name;
   AString Comment;
@@ -131,10 +137,12 @@ public:
     HostOS(0),
     Time(0),
     Crc(0),
-    Size32(0) {}
+    Size32(0),
+    BlockSize(0) {}
 
   void Clear()
   {
+    BlockSize = 0;
     Name.Empty();
     Comment.Empty();
     // Extra.Free();
@@ -251,6 +259,24 @@ static UInt32 Is_Deflate(const Byte *p, size_t size)
 static const unsigned kNameMaxLen = 1 << 12;
 static const unsigned kCommentMaxLen = 1 << 16;
 
+// BGZF (blocked gzip) members contain "BC" subfield with (member size - 1) in extra field
+static const unsigned kBgzfExtraSizeMax = 1 << 8;
+
+static UInt32 GetBgzfBlockSize(const Byte *p, unsigned size)
+{
+  while (size >= 4)
+  {
+    const unsigned len = GetUi16(p + 2);
+    if (len > size - 4)
+      break;
+    if (p[0] == 'B' && p[1] == 'C' && len == 2)
+      return (UInt32)GetUi16(p + 4) + 1;
+    p += 4 + len;
+    size -= 4 + len;
+  }
+  return 0;
+}
+
 API_FUNC_static_IsArc IsArc_Gz(const Byte *p, size_t size)
 {
   if (size < 10)
@@ -374,7 +400,14 @@ HRESULT CItem::ReadHeader(NDecoder::CCOMCoder *stream)
   {
     UInt32 xlen;
     RINOK(ReadUInt16(stream, xlen /* , crc */))
-    RINOK(SkipBytes(stream, xlen))
+    if (xlen <= kBgzfExtraSizeMax)
+    {
+      Byte extra[kBgzfExtraSizeMax];
+      RINOK(ReadBytes(stream, extra, xlen))
+      BlockSize = GetBgzfBlockSize(extra, xlen);
+    }
+    else
+      RINOK(SkipBytes(stream, xlen))
     // Extra.SetCapacity(xlen);
     // RINOK(ReadStream_FALSE(stream, Extra, xlen));
     // crc = CrcUpdate(crc, Extra, xlen);
@@ -446,8 +479,189 @@ HRESULT CItem::WriteFooter(ISequentialOutStream *stream)
   return WriteStream(stream, buf, 8);
 }
 
-Z7_CLASS_IMP_CHandler_IInArchive_3(
+/* Members of BGZF file are small independent gzip streams,
+   and the header of each member contains the size of member.
+   So we can find the boundaries of members without decoding.
+   That index of members is used for parallel decoding of members,
+   and for random access in GetStream(). */
+
+static const UInt32 kBlockUnpackSizeMax = 1 << 16;
+static const unsigned kNumBlockThreadsMax = 64;
+
+struct CBlock
+{
+  UInt64 PackPos;
+  UInt64 UnpackPos;
+  UInt32 PackSize;  // full member: header, deflate stream and footer
+  UInt32 UnpackSize;
+  UInt32 HeaderSize;
+  UInt32 Crc;
+};
+
+struct CBlockDecoder
+{
+  CMyComPtr2<ICompressCoder, NDecoder::CCOMCoder> Decoder;
+  CMyComPtr2<ISequentialInStream, CBufInStream> InStream;
+  CMyComPtr2<ISequentialOutStream, CBufPtrSeqOutStream> OutStream;
+  CByteBuffer InBuf;
+  CByteBuffer OutBuf;
+  CBlock Block;
+  HRESULT Res;
+  bool CrcError;
+
+  void Create();
+  HRESULT ReadBlock(ISequentialInStream *stream, const CBlock &block);
+  void Decode();
+};
+
+void CBlockDecoder::Create()
+{
+  if (Decoder)
+    return;
+  Decoder.Create_if_Empty();
+  // the deflate stream must be finished exactly at the size from footer
+  Decoder->Set_NeedFinishInput(true);
+  InStream.Create_if_Empty();
+  OutStream.Create_if_Empty();
+  OutBuf.Alloc(kBlockUnpackSizeMax);
+}
+
+HRESULT CBlockDecoder::ReadBlock(ISequentialInStream *stream, const CBlock &block)
+{
+  Block = block;
+  InBuf.AllocAtLeast(block.PackSize);
+  return ReadStream_FALSE(stream, InBuf, block.PackSize);
+}
+
+void CBlockDecoder::Decode()
+{
+  CrcError = false;
+  const UInt32 dataSize = Block.PackSize - Block.HeaderSize - 8;
+  InStream->Init(InBuf + Block.HeaderSize, dataSize);
+  OutStream->Init(OutBuf, Block.UnpackSize);
+  const UInt64 outSize = Block.UnpackSize;
+  Res = Decoder.Interface()->Code(InStream, OutStream, NULL, &outSize, NULL);
+  if (Res != S_OK)
+    return;
+  Decoder->AlignToByte();
+  if (!Decoder->IsFinished()
+      || Decoder->GetInputProcessedSize() != dataSize
+      || OutStream->GetPos() != Block.UnpackSize)
+    Res = S_FALSE;
+  else if (CrcCalc(OutBuf, Block.UnpackSize) != Block.Crc)
+  {
+    CrcError = true;
+    Res = S_FALSE;
+  }
+}
+
+#ifndef Z7_ST
+
+struct CBlockDecoderThread: public CVirtThread
+{
+  CBlockDecoder Decoder;
+
+  void Execute() Z7_override { Decoder.Decode(); }
+  ~CBlockDecoderThread() Z7_DESTRUCTOR_override { WaitThreadFinish(); }
+};
+
+#endif
+
+static unsigned FindBlock(const CRecordVector<CBlock> &blocks, UInt64 pos)
+{
+  unsigned left = 0, right = blocks.Size();
+  for (;;)
+  {
+    const unsigned mid = (left + right) / 2;
+    if (mid == left)
+      return left;
+    if (pos < blocks[mid].UnpackPos)
+      right = mid;
+    else
+      left = mid;
+  }
+}
+
+
+Z7_CLASS_IMP_IInStream(
+  CBlocksInStream
+)
+  UInt64 _virtPos;
+  int _curBlock; // the block in (_decoder.OutBuf)
+  CBlockDecoder _decoder;
+public:
+  CMyComPtr<IInStream> Stream;
+  CRecordVector<CBlock> Blocks;
+  UInt64 Size;
+
+  void Init()
+  {
+    _virtPos = 0;
+    _curBlock = -1;
+    _decoder.Create();
+  }
+};
+
+Z7_COM7F_IMF(CBlocksInStream::Read(void *data, UInt32 size, UInt32 *processedSize))
+{
+  COM_TRY_BEGIN
+  if (processedSize)
+    *processedSize = 0;
+  if (size == 0 || _virtPos >= Size)
+    return S_OK;
+
+  if (_curBlock >= 0)
+  {
+    const CBlock &block = Blocks[(unsigned)_curBlock];
+    if (_virtPos < block.UnpackPos || _virtPos - block.UnpackPos >= block.UnpackSize)
+      _curBlock = -1;
+  }
+
+  if (_curBlock < 0)
+  {
+    const unsigned blockIndex = FindBlock(Blocks, _virtPos);
+    const CBlock &block = Blocks[blockIndex];
+    RINOK(InStream_SeekSet(Stream, block.PackPos))
+    RINOK(_decoder.ReadBlock(Stream, block))
+    _decoder.Decode();
+    RINOK(_decoder.Res)
+    _curBlock = (int)blockIndex;
+  }
+
+  const CBlock &block = Blocks[(unsigned)_curBlock];
+  const UInt32 offset = (UInt32)(_virtPos - block.UnpackPos);
+  const UInt32 rem = block.UnpackSize - offset;
+  if (size > rem)
+    size = rem;
+  memcpy(data, _decoder.OutBuf + offset, size);
+  _virtPos += size;
+  if (processedSize)
+    *processedSize = size;
+  return S_OK;
+  COM_TRY_END
+}
+
+Z7_COM7F_IMF(CBlocksInStream::Seek(Int64 offset, UInt32 seekOrigin, UInt64 *newPosition))
+{
+  switch (seekOrigin)
+  {
+    case STREAM_SEEK_SET: break;
+    case STREAM_SEEK_CUR: offset += _virtPos; break;
+    case STREAM_SEEK_END: offset += Size; break;
+    default: return STG_E_INVALIDFUNCTION;
+  }
+  if (offset < 0)
+    return HRESULT_WIN32_ERROR_NEGATIVE_SEEK;
+  _virtPos = (UInt64)offset;
+  if (newPosition)
+    *newPosition = (UInt64)offset;
+  return S_OK;
+}
+
+
+Z7_CLASS_IMP_CHandler_IInArchive_4(
   IArchiveOpenSeq,
+  IInArchiveGetStream,
   IOutArchive,
   ISetProperties
 )
@@ -470,12 +684,26 @@ Z7_CLASS_IMP_CHandler_IInArchive_3(
   CMyComPtr<IInStream> _stream;
   CMyComPtr2<ICompressCoder, NDecoder::CCOMCoder> _decoder;
 
+  // it's empty, if the stream is not BGZF file
+  CRecordVector<CBlock> _blocks;
+  bool _blocksWereRead;
+
+  CBlockDecoder _blockDecoder;
+ #ifndef Z7_ST
+  CObjectVector<CBlockDecoderThread> _blockDecoderThreads;
+ #endif
+
   CSingleMethodProps _props;
   CHandlerTimeOptions _timeOptions;
 
+  HRESULT ReadBlocks();
+  HRESULT DecodeBlocks(ISequentialOutStream *outStream, CLocalProgress *lps,
+      UInt64 &packSize, UInt64 &numStreams, bool &crcError);
+
 public:
   CHandler():
-      _isArc(false)
+      _isArc(false),
+      _blocksWereRead(false)
       {}
   
   void CreateDecoder()
@@ -662,6 +890,9 @@ Z7_COM7F_IMF(CHandler::Close())
 
   _packSize = 0;
   _headerSize = 0;
+
+  _blocks.Clear();
+  _blocksWereRead = false;
   
   _stream.Release();
   if (_decoder)
@@ -669,6 +900,185 @@ Z7_COM7F_IMF(CHandler::Close())
   return S_OK;
 }
 
+/* ReadBlocks() reads the headers and footers of all members.
+   If some member is not BGZF member, or if there is some data after
+   last member, (_blocks) is empty, and the stream is decoded sequentially. */
+
+HRESULT CHandler::ReadBlocks()
+{
+  if (_blocksWereRead)
+    return S_OK;
+  _blocksWereRead = true;
+  _blocks.Clear();
+  if (!_stream || _item.BlockSize == 0)
+    return S_OK;
+
+  UInt64 fileSize;
+  RINOK(InStream_GetSize_SeekToEnd(_stream, fileSize))
+  
+  UInt64 pos = 0;
+  UInt64 unpackPos = 0;
+
+  while (pos != fileSize)
+  {
+    Byte buf[12 + kBgzfExtraSizeMax];
+    RINOK(InStream_SeekSet(_stream, pos))
+    size_t size = 12;
+    RINOK(ReadStream(_stream, buf, &size))
+    if (size != 12
+        || buf[0] != kSignature_0
+        || buf[1] != kSignature_1
+        || buf[2] != kSignature_2
+        || buf[3] != NFlags::kExtra)
+      break;
+    const unsigned xlen = GetUi16(buf + 10);
+    if (xlen > kBgzfExtraSizeMax)
+      break;
+    size = xlen;
+    RINOK(ReadStream(_stream, buf + 12, &size))
+    if (size != xlen)
+      break;
+    const UInt32 blockSize = GetBgzfBlockSize(buf + 12, xlen);
+    const UInt32 headerSize = 12 + xlen;
+    if (blockSize <= headerSize + 8 || blockSize > fileSize - pos)
+      break;
+    
+    RINOK(InStream_SeekSet(_stream, pos + blockSize - 8))
+    RINOK(ReadStream_FALSE(_stream, buf, 8))
+    const UInt32 unpackSize = Get32(buf + 4);
+    if (unpackSize > kBlockUnpackSizeMax)
+      break;
+    
+    CBlock b;
+    b.PackPos = pos;
+    b.UnpackPos = unpackPos;
+    b.PackSize = blockSize;
+    b.UnpackSize = unpackSize;
+    b.HeaderSize = headerSize;
+    b.Crc = Get32(buf);
+    _blocks.Add(b);
+    pos += blockSize;
+    unpackPos += unpackSize;
+  }
+
+  if (pos != fileSize)
+    _blocks.Clear();
+  return S_OK;
+}
+
+
+/* DecodeBlocks() reads the members sequentially, and it decodes
+   them in parallel: the first member of each group by this thread,
+   and other members by decoder threads. The data is written in order. */
+
+HRESULT CHandler::DecodeBlocks(ISequentialOutStream *outStream, CLocalProgress *lps,
+    UInt64 &packSize, UInt64 &numStreams, bool &crcError)
+{
+  _blockDecoder.Create();
+  
+ #ifndef Z7_ST
+  {
+    UInt32 numThreads = _props._numThreads;
+    if (numThreads > kNumBlockThreadsMax)
+      numThreads = kNumBlockThreadsMax;
+    while (_blockDecoderThreads.Size() + 1 < numThreads)
+    {
+      CBlockDecoderThread &t = _blockDecoderThreads.AddNew();
+      if (t.Create() != 0)
+      {
+        _blockDecoderThreads.DeleteBack();
+        break;
+      }
+      t.Decoder.Create();
+    }
+  }
+  const unsigned numJobsMax = _blockDecoderThreads.Size() + 1;
+ #else
+  const unsigned numJobsMax = 1;
+ #endif
+
+  RINOK(InStream_SeekToBegin(_stream))
+  
+  for (unsigned blockIndex = 0; blockIndex < _blocks.Size();)
+  {
+    lps->InSize = packSize;
+    lps->OutSize = _blocks[blockIndex].UnpackPos;
+    RINOK(lps->SetCur())
+
+    unsigned numJobs = 0;
+    for (; numJobs < numJobsMax && blockIndex + numJobs < _blocks.Size(); numJobs++)
+    {
+     #ifndef Z7_ST
+      CBlockDecoder &dec = (numJobs == 0 ? _blockDecoder : _blockDecoderThreads[numJobs - 1].Decoder);
+     #else
+      CBlockDecoder &dec = _blockDecoder;
+     #endif
+      RINOK(dec.ReadBlock(_stream, _blocks[blockIndex + numJobs]))
+    }
+
+   #ifndef Z7_ST
+    unsigned numStarted = 0;
+    for (unsigned i = 1; i < numJobs; i++)
+    {
+      if (_blockDecoderThreads[i - 1].Start() != 0)
+        break;
+      numStarted++;
+    }
+   #endif
+
+    _blockDecoder.Decode();
+
+   #ifndef Z7_ST
+    for (unsigned i = numStarted + 1; i < numJobs; i++)
+      _blockDecoderThreads[i - 1].Decoder.Decode();
+    for (unsigned i = 0; i < numStarted; i++)
+      _blockDecoderThreads[i].WaitExecuteFinish();
+   #endif
+
+    for (unsigned i = 0; i < numJobs; i++)
+    {
+     #ifndef Z7_ST
+      const CBlockDecoder &dec = (i == 0 ? _blockDecoder : _blockDecoderThreads[i - 1].Decoder);
+     #else
+      const CBlockDecoder &dec = _blockDecoder;
+     #endif
+      if (dec.Res != S_OK && !dec.CrcError)
+        return dec.Res;
+      RINOK(WriteStream(outStream, dec.OutBuf, dec.Block.UnpackSize))
+      if (dec.CrcError)
+      {
+        crcError = true;
+        return S_FALSE;
+      }
+      packSize += dec.Block.PackSize;
+      numStreams++;
+    }
+    blockIndex += numJobs;
+  }
+  
+  return S_OK;
+}
+
+
+Z7_COM7F_IMF(CHandler::GetStream(UInt32 /* index */, ISequentialInStream **stream))
+{
+  COM_TRY_BEGIN
+  *stream = NULL;
+  RINOK(ReadBlocks())
+  if (_blocks.IsEmpty())
+    return S_FALSE;
+  CBlocksInStream *streamSpec = new CBlocksInStream;
+  CMyComPtr<IInStream> streamTemp = streamSpec;
+  streamSpec->Stream = _stream;
+  streamSpec->Blocks = _blocks;
+  const CBlock &last = _blocks.Back();
+  streamSpec->Size = last.UnpackPos + last.UnpackSize;
+  streamSpec->Init();
+  *stream = streamTemp.Detach();
+  return S_OK;
+  COM_TRY_END
+}
+
 Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
     Int32 testMode, IArchiveExtractCallback *extractCallback))
 {
@@ -696,6 +1106,15 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
 
   CreateDecoder();
 
+  bool blocksMode = false;
+ #ifndef Z7_ST
+  if (_props._numThreads > 1 && _stream)
+  {
+    RINOK(ReadBlocks())
+    blocksMode = !_blocks.IsEmpty();
+  }
+ #endif
+
   CMyComPtr2_Create<ISequentialOutStream, COutStreamWithCRC> outStream;
   outStream->SetStream(realOutStream);
   outStream->Init();
@@ -729,6 +1148,14 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
 
   HRESULT result = S_OK;
 
+  if (blocksMode)
+  {
+    firstItem = false;
+    result = DecodeBlocks(outStream, lps.ClsPtr(), packSize, numStreams, crcError);
+    unpackedSize = outStream->GetSize();
+  }
+  else
+  {
   try {
   
   for (;;)
@@ -824,6 +1251,7 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
   }
 
   } catch(const CInBufferException &e) { return e.ErrorCode; }
+  }
 
   if (!firstItem)
   {
@@ -978,7 +1406,14 @@ static HRESULT UpdateArchive(
 
   CMyComPtr2_Create<ICompressCoder, NEncoder::CCOMCoder> deflateEncoder;
 
-  RINOK(props.SetCoderProps(deflateEncoder.ClsPtr(), NULL))
+  {
+    CMethodProps props2 = props;
+   #ifndef Z7_ST
+    // deflate encoder splits the stream to chunks that are compressed in parallel
+    CMultiMethodProps::SetMethodThreadsTo_IfNotFinded(props2, props._numThreads);
+   #endif
+    RINOK(props2.SetCoderProps(deflateEncoder.ClsPtr(), NULL))
+  }
   RINOK(deflateEncoder.Interface()->Code(crcStream, outStream, NULL, NULL, lps))
 
   item.Crc = crcStream->GetCRC();
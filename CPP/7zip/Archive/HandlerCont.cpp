@@ -106,12 +106,12 @@ Z7_COM7F_IMF(CHandlerCont::GetStream(UInt32 index, ISequentialInStream **stream)
 
 
 
-CHandlerImg::CHandlerImg()
+CHandlerImgBase::CHandlerImgBase()
 {
   Clear_HandlerImg_Vars();
 }
 
-Z7_COM7F_IMF(CHandlerImg::Seek(Int64 offset, UInt32 seekOrigin, UInt64 *newPosition))
+Z7_COM7F_IMF(CHandlerImgBase::Seek(Int64 offset, UInt32 seekOrigin, UInt64 *newPosition))
 {
   switch (seekOrigin)
   {
@@ -159,12 +159,12 @@ static const char *GetImgExt(ISequentialInStream *stream)
   return NULL;
 }
 
-void CHandlerImg::CloseAtError()
+void CHandlerImgBase::CloseAtError()
 {
   Stream.Release();
 }
 
-void CHandlerImg::Clear_HandlerImg_Vars()
+void CHandlerImgBase::Clear_HandlerImg_Vars()
 {
   _imgExt = NULL;
   _size = 0;
@@ -173,7 +173,7 @@ void CHandlerImg::Clear_HandlerImg_Vars()
   Reset_PosInArc();
 }
 
-Z7_COM7F_IMF(CHandlerImg::Open(IInStream *stream,
+Z7_COM7F_IMF(CHandlerImgBase::Open(IInStream *stream,
     const UInt64 * /* maxCheckStartPosition */,
     IArchiveOpenCallback * openCallback))
 {
@@ -211,7 +211,7 @@ Z7_COM7F_IMF(CHandlerImg::Open(IInStream *stream,
   COM_TRY_END
 }
 
-Z7_COM7F_IMF(CHandlerImg::GetNumberOfItems(UInt32 *numItems))
+Z7_COM7F_IMF(CHandlerImgBase::GetNumberOfItems(UInt32 *numItems))
 {
   *numItems = 1;
   return S_OK;
@@ -223,10 +223,10 @@ Z7_CLASS_IMP_NOQIB_1(
   , ICompressProgressInfo
 )
 public:
-  CHandlerImg &Handler;
+  CHandlerImgBase &Handler;
   CMyComPtr<ICompressProgressInfo> _ratioProgress;
 
-  CHandlerImgProgress(CHandlerImg &handler) : Handler(handler) {}
+  CHandlerImgProgress(CHandlerImgBase &handler) : Handler(handler) {}
 };
 
 
@@ -239,7 +239,7 @@ Z7_COM7F_IMF(CHandlerImgProgress::SetRatioInfo(const UInt64 *inSize, const UInt6
 }
   
 
-Z7_COM7F_IMF(CHandlerImg::Extract(const UInt32 *indices, UInt32 numItems,
+Z7_COM7F_IMF(CHandlerImgBase::Extract(const UInt32 *indices, UInt32 numItems,
     Int32 testMode, IArchiveExtractCallback *extractCallback))
 {
   COM_TRY_BEGIN
@@ -62,18 +62,16 @@ protected:
   x(GetArchivePropertyInfo(UInt32 index, BSTR *name, PROPID *propID, VARTYPE *varType)) \
 
 
-class CHandlerImg:
+/* CHandlerImgBase doesn't implement IUnknown.
+   The handler that supports additional interfaces (ISetProperties)
+   is derived from CHandlerImgBase, and it implements IUnknown itself. */
+
+class CHandlerImgBase:
   public IInArchive,
   public IInArchiveGetStream,
   public IInStream,
   public CMyUnknownImp
 {
-  Z7_COM_UNKNOWN_IMP_4(
-      IInArchive,
-      IInArchiveGetStream,
-      ISequentialInStream,
-      IInStream)
-
   Z7_COM7F_IMP(Open(IInStream *stream, const UInt64 *maxCheckStartPosition, IArchiveOpenCallback *openCallback))
   Z7_COM7F_IMP(GetNumberOfItems(UInt32 *numItems))
   Z7_COM7F_IMP(Extract(const UInt32 *indices, UInt32 numItems, Int32 testMode, IArchiveExtractCallback *extractCallback))
@@ -121,9 +119,19 @@ public:
     return false;
   }
 
-  CHandlerImg();
+  CHandlerImgBase();
   // destructor must be virtual for this class
-  virtual ~CHandlerImg() {}
+  virtual ~CHandlerImgBase() {}
+};
+
+
+class CHandlerImg: public CHandlerImgBase
+{
+  Z7_COM_UNKNOWN_IMP_4(
+      IInArchive,
+      IInArchiveGetStream,
+      ISequentialInStream,
+      IInStream)
 };
 
 
@@ -5,6 +5,7 @@
 // #include <stdio.h>
 
 #include "../../../C/CpuArch.h"
+#include "../../../C/zstd/zstd.h"
 
 #include "../../Common/ComTry.h"
 #include "../../Common/IntToString.h"
@@ -12,12 +13,20 @@
 
 #include "../../Windows/PropVariant.h"
 #include "../../Windows/PropVariantUtils.h"
+#include "../../Windows/System.h"
 
+#include "../Common/MethodProps.h"
 #include "../Common/RegisterArc.h"
 #include "../Common/StreamObjects.h"
 #include "../Common/StreamUtils.h"
+#ifndef Z7_ST
+#include "../Common/VirtThread.h"
+#endif
 
 #include "../Compress/DeflateDecoder.h"
+#include "../Compress/ZstdDecoder.h"
+
+#include "Common/HandlerOut.h"
 
 #include "HandlerCont.h"
 
@@ -38,11 +47,137 @@ VA to PA maps:
   low bits       : _clusterBits : offset inside cluster.
 */
 
-Z7_class_CHandler_final: public CHandlerImg
+static const UInt32 k_CompressionType_Zstd = 1;
+
+// it decodes one compressed cluster from (InBuf) to (Dest).
+// (InBuf) points to the data in (CHandler::_cacheCompressed).
+
+class CClusterDecoder
+{
+  CMyComPtr2<ISequentialInStream, CBufInStream> _bufInStream;
+  CMyComPtr2<ISequentialOutStream, CBufPtrSeqOutStream> _bufOutStream;
+  CMyComPtr2<ICompressCoder, NCompress::NDeflate::NDecoder::CCOMCoder> _deflateDecoder;
+  ZSTD_DCtx *_zstdCtx;
+
+  HRESULT DecodeDeflate();
+  HRESULT DecodeZstd();
+
+  Z7_CLASS_NO_COPY(CClusterDecoder)
+public:
+  const Byte *InBuf;
+  size_t InSize;
+  Byte *Dest;
+  size_t ClusterSize;
+  bool Zstd;
+  HRESULT Res;
+
+  CClusterDecoder(): _zstdCtx(NULL), InBuf(NULL) {}
+  ~CClusterDecoder() { ZSTD_freeDCtx(_zstdCtx); }
+  void Decode() { Res = Zstd ? DecodeZstd() : DecodeDeflate(); }
+};
+
+HRESULT CClusterDecoder::DecodeDeflate()
+{
+  _bufInStream.Create_if_Empty();
+  _bufOutStream.Create_if_Empty();
+  if (!_deflateDecoder)
+  {
+    _deflateDecoder.Create_if_Empty();
+    _deflateDecoder->Set_NeedFinishInput(true);
+  }
+  _bufInStream->Init(InBuf, InSize);
+  _bufOutStream->Init(Dest, ClusterSize);
+  // Do we need to use smaller block than clusterSize for last cluster?
+  const UInt64 blockSize64 = ClusterSize;
+  HRESULT res = _deflateDecoder.Interface()->Code(_bufInStream, _bufOutStream, NULL, &blockSize64, NULL);
+  if (res == S_OK)
+    if (!_deflateDecoder->IsFinished()
+        || _bufOutStream->GetPos() != ClusterSize)
+      res = S_FALSE;
+  return res;
+}
+
+/* zstd cluster is zstd stream followed by padding up to the end of sector.
+   The stream must fill the cluster. The data after the stream is ignored (as in qemu). */
+
+HRESULT CClusterDecoder::DecodeZstd()
 {
+  if (!_zstdCtx)
+  {
+    _zstdCtx = ZSTD_createDCtx_advanced(NCompress::NZSTD::g_ZstdAlloc);
+    if (!_zstdCtx)
+      return E_OUTOFMEMORY;
+  }
+  else
+    ZSTD_DCtx_reset(_zstdCtx, ZSTD_reset_session_only);
+
+  ZSTD_inBuffer in;
+  in.src = InBuf;
+  in.size = InSize;
+  in.pos = 0;
+  ZSTD_outBuffer out;
+  out.dst = Dest;
+  out.size = ClusterSize;
+  out.pos = 0;
+
+  for (;;)
+  {
+    const size_t inPos = in.pos;
+    const size_t outPos = out.pos;
+    const size_t zres = ZSTD_decompressStream(_zstdCtx, &out, &in);
+    if (ZSTD_isError(zres))
+      return S_FALSE;
+    if (zres == 0)
+      break; // end of frame
+    if (in.pos == inPos && out.pos == outPos)
+      return S_FALSE;
+  }
+  if (out.pos != ClusterSize)
+    return S_FALSE;
+  return S_OK;
+}
+
+#ifndef Z7_ST
+
+struct CClusterDecoderThread: public CVirtThread
+{
+  CClusterDecoder Decoder;
+
+  void Execute() Z7_override { Decoder.Decode(); }
+  ~CClusterDecoderThread() Z7_DESTRUCTOR_override { WaitThreadFinish(); }
+};
+
+#endif
+
+struct CCacheCluster
+{
+  CByteBuffer Data;
+  UInt64 Cluster;
+  UInt64 LastUse; // 0 : the entry is empty
+
+  CCacheCluster(): LastUse(0) {}
+};
+
+static const UInt64 k_CacheSize_Default = (UInt64)1 << 25;
+// the cache is searched linearly, so we limit the number of clusters in cache
+static const unsigned k_NumCacheClusters_Max = 1 << 12;
+static const UInt32 k_NumThreads_Max = 64;
+
+Z7_class_CHandler_final:
+  public CHandlerImgBase,
+  public ISetProperties
+{
+  Z7_COM_UNKNOWN_IMP_5(
+      IInArchive,
+      IInArchiveGetStream,
+      ISequentialInStream,
+      IInStream,
+      ISetProperties)
+
   Z7_IFACE_COM7_IMP(IInArchive_Img)
   Z7_IFACE_COM7_IMP(IInArchiveGetStream)
   Z7_IFACE_COM7_IMP(ISequentialInStream)
+  Z7_IFACE_COM7_IMP(ISetProperties)
 
   unsigned _clusterBits;
   unsigned _numMidBits;
@@ -50,13 +185,26 @@ Z7_class_CHandler_final: public CHandlerImg
 
   CObjArray2<UInt32> _dir;
   CAlignedBuffer _table;
-  CByteBuffer _cache;
   CByteBuffer _cacheCompressed;
-  UInt64 _cacheCluster;
 
   UInt64 _comprPos;
   size_t _comprSize;
 
+  /* decoded clusters are kept in LRU cache.
+     If there are several threads, the next compressed clusters
+     from L2 table are decoded in parallel with requested cluster. */
+  CObjectVector<CCacheCluster> _cache;
+  UInt64 _cacheUseCounter;
+  unsigned _cacheLastIndex;
+  UInt64 _cacheSizeMax;
+  UInt32 _numThreads;
+  UInt32 _numProcessors;
+
+  CClusterDecoder _decoder;
+ #ifndef Z7_ST
+  CObjectVector<CClusterDecoderThread> _decoderThreads;
+ #endif
+
   bool _needCompression;
   bool _isArc;
   bool _unsupported;
@@ -64,10 +212,6 @@ Z7_class_CHandler_final: public CHandlerImg
 
   UInt64 _phySize;
 
-  CMyComPtr2<ISequentialInStream, CBufInStream> _bufInStream;
-  CMyComPtr2<ISequentialOutStream, CBufPtrSeqOutStream> _bufOutStream;
-  CMyComPtr2<ICompressCoder, NCompress::NDeflate::NDecoder::CCOMCoder> _deflateDecoder;
-
   UInt32 _version;
   UInt32 _cryptMethod;
   UInt64 _incompatFlags;
@@ -84,12 +228,275 @@ Z7_class_CHandler_final: public CHandlerImg
     return Seek2(0);
   }
 
+  UInt64 GetClusterRecord(UInt64 cluster) const;
+  int FindCacheCluster(UInt64 cluster);
+  unsigned AllocCacheCluster();
+  HRESULT ReadCompressedData(UInt64 v, bool keepPrev, const Byte *&data, size_t &size);
+  HRESULT DecodeClusters(UInt64 cluster);
+  void InitProps();
+
   HRESULT Open2(IInStream *stream, IArchiveOpenCallback *openCallback) Z7_override;
+public:
+  CHandler():
+      _cacheUseCounter(0),
+      _cacheLastIndex(0)
+  {
+    InitProps();
+  }
 };
 
 
 static const UInt32 kEmptyDirItem = (UInt32)0 - 1;
 
+UInt64 CHandler::GetClusterRecord(UInt64 cluster) const
+{
+  const UInt64 high = cluster >> _numMidBits;
+  if (high < _dir.Size())
+  {
+    const UInt32 tabl = _dir[(size_t)high];
+    if (tabl != kEmptyDirItem)
+    {
+      const size_t midBits = (size_t)cluster & (((size_t)1 << _numMidBits) - 1);
+      const Byte *p = _table + ((((size_t)tabl << _numMidBits) + midBits) << 3);
+      return Get64(p);
+    }
+  }
+  return 0;
+}
+
+
+int CHandler::FindCacheCluster(UInt64 cluster)
+{
+  // sequential reading usually requests the last used cluster or the next decoded cluster
+  for (unsigned i = _cacheLastIndex; i < _cache.Size() && i <= _cacheLastIndex + 1; i++)
+  {
+    const CCacheCluster &cc = _cache[i];
+    if (cc.LastUse != 0 && cc.Cluster == cluster)
+      return (int)i;
+  }
+  FOR_VECTOR (i, _cache)
+  {
+    const CCacheCluster &cc = _cache[i];
+    if (cc.LastUse != 0 && cc.Cluster == cluster)
+      return (int)i;
+  }
+  return -1;
+}
+
+
+unsigned CHandler::AllocCacheCluster()
+{
+  // the caller marks the returned entry as used, so the next call returns another entry
+  unsigned numMax = k_NumCacheClusters_Max;
+  {
+    const UInt64 num = _cacheSizeMax >> _clusterBits;
+    if (numMax > num)
+      numMax = (unsigned)num;
+  }
+  if (numMax < _numThreads + 1)
+    numMax = _numThreads + 1;
+  if (_cache.Size() < numMax)
+  {
+    CCacheCluster &cc = _cache.AddNew();
+    cc.Data.Alloc((size_t)1 << _clusterBits);
+    return _cache.Size() - 1;
+  }
+  unsigned best = 0;
+  FOR_VECTOR (i, _cache)
+    if (_cache[i].LastUse < _cache[best].LastUse)
+      best = i;
+  return best;
+}
+
+
+/* if (keepPrev == true), the data of previous clusters in (_cacheCompressed)
+   is not moved, because it's not decoded yet. Then it returns S_FALSE,
+   if the data of cluster doesn't fit to (_cacheCompressed) after that data. */
+
+HRESULT CHandler::ReadCompressedData(UInt64 v, bool keepPrev, const Byte *&data, size_t &size)
+{
+  /*
+  the example of table record for 12-bit clusters (4KB uncompressed):
+    2 bits : isCompressed status
+    (4 == _clusterBits - 8) bits : (num_sectors - 1)
+        packSize = num_sectors * 512;
+        it uses one additional bit over unpacked cluster_bits.
+    (49 == 61 - _clusterBits) bits : offset of 512-byte sector
+    9 bits : offset in 512-byte sector
+  */
+  const unsigned numOffsetBits = 62 - (_clusterBits - 8);
+  const UInt64 offset = v & (((UInt64)1 << 62) - 1);
+  const size_t dataSize = ((size_t)(offset >> numOffsetBits) + 1) << 9;
+  const UInt64 sectorOffset = offset & (((UInt64)1 << numOffsetBits) - (1 << 9));
+  const UInt64 offset2inCache = sectorOffset - _comprPos;
+  size_t offsetInCache = 0;
+  
+  // _comprPos is aligned for 512-bytes
+  // we try to use previous _cacheCompressed that contains compressed data
+  // that was read for previous unpacking
+
+  if (keepPrev)
+  {
+    if (sectorOffset < _comprPos
+        || dataSize > _cacheCompressed.Size()
+        || offset2inCache > _cacheCompressed.Size() - dataSize)
+      return S_FALSE;
+    offsetInCache = (size_t)offset2inCache;
+  }
+  else if (sectorOffset >= _comprPos && offset2inCache < _comprSize)
+  {
+    if (offset2inCache)
+    {
+      _comprSize -= (size_t)offset2inCache;
+      memmove(_cacheCompressed, _cacheCompressed + (size_t)offset2inCache, _comprSize);
+      _comprPos = sectorOffset;
+    }
+  }
+  else
+  {
+    _comprPos = sectorOffset;
+    _comprSize = 0;
+  }
+  
+  const size_t end = offsetInCache + dataSize;
+  if (end > _comprSize)
+  {
+    const UInt64 readPos = _comprPos + _comprSize;
+    if (readPos != _posInArc)
+    {
+      // printf("\nDeflate-Seek %12I64x %12I64x\n", readPos, readPos - _posInArc);
+      RINOK(Seek2(readPos))
+    }
+    if (_cacheCompressed.Size() < end)
+      return E_FAIL;
+    const size_t dataSize3 = end - _comprSize;
+    size_t dataSize2 = dataSize3;
+    // printf("\n\n=======\nReadStream = %6d _comprPos = %6d \n", (UInt32)dataSize2, (UInt32)_comprPos);
+    const HRESULT hres = ReadStream(Stream, _cacheCompressed + _comprSize, &dataSize2);
+    _posInArc += dataSize2;
+    RINOK(hres)
+    if (dataSize2 != dataSize3)
+      return E_FAIL;
+    _comprSize += dataSize2;
+  }
+  
+  const size_t kSectorMask = (1 << 9) - 1;
+  const size_t offsetInSector = (size_t)offset & kSectorMask;
+  data = _cacheCompressed + offsetInCache + offsetInSector;
+  size = dataSize - offsetInSector;
+  return S_OK;
+}
+
+
+/*
+DecodeClusters() reads the compressed data of (cluster) and of next compressed
+clusters sequentially to (_cacheCompressed), and then it decodes these clusters
+in parallel from that buffer to cache.
+Only the error of (cluster) is returned. If some next cluster can't be
+decoded, it's not added to cache, and the error will be returned, if that
+cluster is requested later.
+*/
+
+HRESULT CHandler::DecodeClusters(UInt64 cluster)
+{
+  const size_t clusterSize = (size_t)1 << _clusterBits;
+  const UInt64 numClusters = (_size + clusterSize - 1) >> _clusterBits;
+
+ #ifndef Z7_ST
+  while (_decoderThreads.Size() + 1 < _numThreads)
+  {
+    CClusterDecoderThread &t = _decoderThreads.AddNew();
+    if (t.Create() != 0)
+    {
+      _decoderThreads.DeleteBack();
+      break;
+    }
+  }
+ #endif
+
+  unsigned cacheIndexes[k_NumThreads_Max];
+  unsigned numJobs = 0;
+
+  for (UInt64 c = cluster; c < numClusters; c++)
+  {
+   #ifndef Z7_ST
+    if (numJobs > _decoderThreads.Size())
+      break;
+    CClusterDecoder &dec = (numJobs == 0 ? _decoder : _decoderThreads[numJobs - 1].Decoder);
+   #else
+    if (numJobs != 0)
+      break;
+    CClusterDecoder &dec = _decoder;
+   #endif
+
+    const UInt64 v = GetClusterRecord(c);
+    // read-ahead stops at the first cluster that is not compressed or is in cache already
+    if (numJobs != 0 && ((v & _compressedFlag) == 0 || FindCacheCluster(c) >= 0))
+      break;
+    
+    const Byte *data;
+    size_t size;
+    // read-ahead stops also, if the compressed data doesn't fit to buffer
+    const HRESULT res = ReadCompressedData(v, numJobs != 0, data, size);
+    if (res != S_OK)
+    {
+      if (numJobs == 0)
+        return res;
+      break;
+    }
+    dec.InBuf = data;
+    dec.InSize = size;
+    dec.ClusterSize = clusterSize;
+    dec.Zstd = (_compressionType == k_CompressionType_Zstd);
+    
+    const unsigned cacheIndex = AllocCacheCluster();
+    CCacheCluster &cc = _cache[cacheIndex];
+    cc.Cluster = c;
+    // it protects the entry from AllocCacheCluster() calls for next clusters
+    cc.LastUse = ++_cacheUseCounter;
+    dec.Dest = cc.Data;
+    cacheIndexes[numJobs++] = cacheIndex;
+  }
+
+  // the job 0 is decoded by this thread, and other jobs by decoder threads
+ #ifndef Z7_ST
+  unsigned numStarted = 0;
+  for (unsigned i = 1; i < numJobs; i++)
+  {
+    if (_decoderThreads[i - 1].Start() != 0)
+      break;
+    numStarted++;
+  }
+ #endif
+
+  _decoder.Decode();
+
+ #ifndef Z7_ST
+  for (unsigned i = numStarted + 1; i < numJobs; i++)
+    _decoderThreads[i - 1].Decoder.Decode();
+  for (unsigned i = 0; i < numStarted; i++)
+    _decoderThreads[i].WaitExecuteFinish();
+ #endif
+
+  HRESULT res = S_OK;
+  for (unsigned i = 0; i < numJobs; i++)
+  {
+   #ifndef Z7_ST
+    const CClusterDecoder &dec = (i == 0 ? _decoder : _decoderThreads[i - 1].Decoder);
+   #else
+    const CClusterDecoder &dec = _decoder;
+   #endif
+    if (dec.Res != S_OK)
+    {
+      _cache[cacheIndexes[i]].LastUse = 0;
+      if (i == 0)
+        res = dec.Res;
+    }
+  }
+  return res;
+}
+
+
 Z7_COM7F_IMF(CHandler::Read(void *data, UInt32 size, UInt32 *processedSize))
 {
   if (processedSize)
@@ -105,145 +512,53 @@ Z7_COM7F_IMF(CHandler::Read(void *data, UInt32 size, UInt32 *processedSize))
       return S_OK;
   }
  
-  for (;;)
+  const UInt64 cluster = _virtPos >> _clusterBits;
+  const size_t clusterSize = (size_t)1 << _clusterBits;
+  const size_t lowBits = (size_t)_virtPos & (clusterSize - 1);
   {
-    const UInt64 cluster = _virtPos >> _clusterBits;
-    const size_t clusterSize = (size_t)1 << _clusterBits;
-    const size_t lowBits = (size_t)_virtPos & (clusterSize - 1);
-    {
-      const size_t rem = clusterSize - lowBits;
-      if (size > rem)
-        size = (UInt32)rem;
-    }
-    if (cluster == _cacheCluster)
+    const size_t rem = clusterSize - lowBits;
+    if (size > rem)
+      size = (UInt32)rem;
+  }
+  
+  UInt64 v = GetClusterRecord(cluster);
+  
+  if (v & _compressedFlag)
+  {
+    if (_version <= 1)
+      return E_FAIL;
+    int cacheIndex = FindCacheCluster(cluster);
+    if (cacheIndex < 0)
     {
-      memcpy(data, _cache + lowBits, size);
-      break;
+      RINOK(DecodeClusters(cluster))
+      cacheIndex = FindCacheCluster(cluster);
+      if (cacheIndex < 0)
+        return E_FAIL;
     }
-   
-    const UInt64 high = cluster >> _numMidBits;
- 
-    if (high < _dir.Size())
+    _cacheLastIndex = (unsigned)cacheIndex;
+    CCacheCluster &cc = _cache[(unsigned)cacheIndex];
+    cc.LastUse = ++_cacheUseCounter;
+    memcpy(data, cc.Data + lowBits, size);
+  }
+  // version_3 supports zero clusters
+  else if (v && ((UInt32)v & 511) != 1)
+  {
+    v &= _compressedFlag - 1;
+    v += lowBits;
+    if (v != _posInArc)
     {
-      const UInt32 tabl = _dir[(size_t)high];
-      if (tabl != kEmptyDirItem)
-      {
-        const size_t midBits = (size_t)cluster & (((size_t)1 << _numMidBits) - 1);
-        const Byte *p = _table + ((((size_t)tabl << _numMidBits) + midBits) << 3);
-        UInt64 v = Get64(p);
-        
-        if (v)
-        {
-          if (v & _compressedFlag)
-          {
-            if (_version <= 1)
-              return E_FAIL;
-            /*
-            the example of table record for 12-bit clusters (4KB uncompressed):
-              2 bits : isCompressed status
-              (4 == _clusterBits - 8) bits : (num_sectors - 1)
-                  packSize = num_sectors * 512;
-                  it uses one additional bit over unpacked cluster_bits.
-              (49 == 61 - _clusterBits) bits : offset of 512-byte sector
-              9 bits : offset in 512-byte sector
-            */
-            const unsigned numOffsetBits = 62 - (_clusterBits - 8);
-            const UInt64 offset = v & (((UInt64)1 << 62) - 1);
-            const size_t dataSize = ((size_t)(offset >> numOffsetBits) + 1) << 9;
-            UInt64 sectorOffset = offset & (((UInt64)1 << numOffsetBits) - (1 << 9));
-            const UInt64 offset2inCache = sectorOffset - _comprPos;
-            
-            // _comprPos is aligned for 512-bytes
-            // we try to use previous _cacheCompressed that contains compressed data
-            // that was read for previous unpacking
-
-            if (sectorOffset >= _comprPos && offset2inCache < _comprSize)
-            {
-              if (offset2inCache)
-              {
-                _comprSize -= (size_t)offset2inCache;
-                memmove(_cacheCompressed, _cacheCompressed + (size_t)offset2inCache, _comprSize);
-                _comprPos = sectorOffset;
-              }
-              sectorOffset += _comprSize;
-            }
-            else
-            {
-              _comprPos = sectorOffset;
-              _comprSize = 0;
-            }
-            
-            if (dataSize > _comprSize)
-            {
-              if (sectorOffset != _posInArc)
-              {
-                // printf("\nDeflate-Seek %12I64x %12I64x\n", sectorOffset, sectorOffset - _posInArc);
-                RINOK(Seek2(sectorOffset))
-              }
-              if (_cacheCompressed.Size() < dataSize)
-                return E_FAIL;
-              const size_t dataSize3 = dataSize - _comprSize;
-              size_t dataSize2 = dataSize3;
-              // printf("\n\n=======\nReadStream = %6d _comprPos = %6d \n", (UInt32)dataSize2, (UInt32)_comprPos);
-              const HRESULT hres = ReadStream(Stream, _cacheCompressed + _comprSize, &dataSize2);
-              _posInArc += dataSize2;
-              RINOK(hres)
-              if (dataSize2 != dataSize3)
-                return E_FAIL;
-              _comprSize += dataSize2;
-            }
-            
-            const size_t kSectorMask = (1 << 9) - 1;
-            const size_t offsetInSector = (size_t)offset & kSectorMask;
-            _bufInStream->Init(_cacheCompressed + offsetInSector, dataSize - offsetInSector);
-            _cacheCluster = (UInt64)(Int64)-1;
-            if (_cache.Size() < clusterSize)
-              return E_FAIL;
-            _bufOutStream->Init(_cache, clusterSize);
-            // Do we need to use smaller block than clusterSize for last cluster?
-            const UInt64 blockSize64 = clusterSize;
-            HRESULT res = _deflateDecoder.Interface()->Code(_bufInStream, _bufOutStream, NULL, &blockSize64, NULL);
-            /*
-            if (_bufOutStreamSpec->GetPos() != clusterSize)
-              memset(_cache + _bufOutStreamSpec->GetPos(), 0, clusterSize - _bufOutStreamSpec->GetPos());
-            */
-            if (res == S_OK)
-              if (!_deflateDecoder->IsFinished()
-                  || _bufOutStream->GetPos() != clusterSize)
-                res = S_FALSE;
-            RINOK(res)
-            _cacheCluster = cluster;
-            continue;
-            /*
-            memcpy(data, _cache + lowBits, size);
-            break;
-            */
-          }
-
-          // version_3 supports zero clusters
-          if (((UInt32)v & 511) != 1)
-          {
-            v &= _compressedFlag - 1;
-            v += lowBits;
-            if (v != _posInArc)
-            {
-              // printf("\n%12I64x\n", v - _posInArc);
-              RINOK(Seek2(v))
-            }
-            const HRESULT res = Stream->Read(data, size, &size);
-            _posInArc += size;
-            _virtPos += size;
-            if (processedSize)
-              *processedSize = size;
-            return res;
-          }
-        }
-      }
+      // printf("\n%12I64x\n", v - _posInArc);
+      RINOK(Seek2(v))
     }
-    
-    memset(data, 0, size);
-    break;
+    const HRESULT res = Stream->Read(data, size, &size);
+    _posInArc += size;
+    _virtPos += size;
+    if (processedSize)
+      *processedSize = size;
+    return res;
   }
+  else
+    memset(data, 0, size);
 
   _virtPos += size;
   if (processedSize)
@@ -252,6 +567,55 @@ Z7_COM7F_IMF(CHandler::Read(void *data, UInt32 size, UInt32 *processedSize))
 }
 
 
+void CHandler::InitProps()
+{
+  _cacheSizeMax = k_CacheSize_Default;
+ #ifndef Z7_ST
+  _numProcessors = NSystem::GetNumberOfProcessors();
+ #else
+  _numProcessors = 1;
+ #endif
+  _numThreads = _numProcessors;
+}
+
+Z7_COM7F_IMF(CHandler::SetProperties(const wchar_t * const *names, const PROPVARIANT *values, UInt32 numProps))
+{
+  InitProps();
+
+  for (UInt32 i = 0; i < numProps; i++)
+  {
+    UString name = names[i];
+    name.MakeLower_Ascii();
+    const PROPVARIANT &prop = values[i];
+
+    if (name.IsPrefixedBy_Ascii_NoCase("mt"))
+    {
+     #ifndef Z7_ST
+      RINOK(ParseMtProp(name.Ptr(2), prop, _numProcessors, _numThreads))
+     #endif
+    }
+    else if (name.IsPrefixedBy_Ascii_NoCase("cache"))
+    {
+      // the size of cache for decoded clusters: -mcache=64m
+      UInt64 v;
+      if (!ParseSizeString(name.Ptr(5), prop, 0, v))
+        return E_INVALIDARG;
+      _cacheSizeMax = v;
+    }
+    else if (name.IsPrefixedBy_Ascii_NoCase("memuse"))
+    {
+    }
+    else
+      return E_INVALIDARG;
+  }
+  if (_numThreads == 0)
+    _numThreads = 1;
+  if (_numThreads > k_NumThreads_Max)
+    _numThreads = k_NumThreads_Max;
+  return S_OK;
+}
+
+
 static const Byte kProps[] =
 {
   kpidSize,
@@ -311,7 +675,7 @@ Z7_COM7F_IMF(CHandler::GetArchiveProperty(PROPID propID, PROPVARIANT *value))
 
       if (_compressionType)
       {
-        if (_compressionType == 1)
+        if (_compressionType == k_CompressionType_Zstd)
           s += "ZSTD";
         else
         {
@@ -640,7 +1004,7 @@ HRESULT CHandler::Open2(IInStream *stream, IArchiveOpenCallback *openCallback)
     _unsupported = true;
   if (_needCompression && _version <= 1) // that case was not implemented
     _unsupported = true;
-  if (_compressionType)
+  if (_compressionType > k_CompressionType_Zstd)
     _unsupported = true;
 
   Stream = stream;
@@ -656,7 +1020,8 @@ Z7_COM7F_IMF(CHandler::Close())
   // _cacheCompressed.Free();
   _phySize = 0;
 
-  _cacheCluster = (UInt64)(Int64)-1;
+  _cache.Clear();
+  _cacheLastIndex = 0;
   _comprPos = 0;
   _comprSize = 0;
 
@@ -682,15 +1047,15 @@ Z7_COM7F_IMF(CHandler::GetStream(UInt32 /* index */, ISequentialInStream **strea
     return S_FALSE;
   if (_needCompression)
   {
-    if (_version <= 1 || _compressionType)
+    if (_version <= 1 || _compressionType > k_CompressionType_Zstd)
       return S_FALSE;
-    _bufInStream.Create_if_Empty();
-    _bufOutStream.Create_if_Empty();
-    _deflateDecoder.Create_if_Empty();
-    _deflateDecoder->Set_NeedFinishInput(true);
     const size_t clusterSize = (size_t)1 << _clusterBits;
-    _cache.AllocAtLeast(clusterSize);
-    _cacheCompressed.AllocAtLeast(clusterSize * 2);
+    size_t bufSize = clusterSize * 2;
+   #ifndef Z7_ST
+    // the compressed data of clusters that are decoded in parallel
+    bufSize += clusterSize * (_numThreads - 1);
+   #endif
+    _cacheCompressed.AllocAtLeast(bufSize);
   }
   CMyComPtr<ISequentialInStream> streamTemp = this;
   RINOK(InitAndSeek())
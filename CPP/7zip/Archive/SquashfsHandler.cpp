@@ -15,20 +15,27 @@
 #include "../../Common/UTFConvert.h"
 
 #include "../../Windows/PropVariantUtils.h"
+#include "../../Windows/System.h"
 #include "../../Windows/TimeUtils.h"
 
 #include "../Common/CWrappers.h"
 #include "../Common/LimitedStreams.h"
+#include "../Common/MethodProps.h"
 #include "../Common/ProgressUtils.h"
 #include "../Common/RegisterArc.h"
 #include "../Common/StreamObjects.h"
 #include "../Common/StreamUtils.h"
+#ifndef Z7_ST
+#include "../Common/VirtThread.h"
+#endif
 
 #include "../Compress/CopyCoder.h"
 #include "../Compress/ZlibDecoder.h"
 // #include "../Compress/LzmaDecoder.h"
 #include "../Compress/ZstdDecoder.h"
 
+#include "Common/HandlerOut.h"
+
 namespace NArchive {
 namespace NSquashfs {
 
@@ -838,8 +845,66 @@ struct CFrag
 };
 
 
-Z7_CLASS_IMP_CHandler_IInArchive_1(
-  IInArchiveGetStream
+// it decodes one data block from (InBuf) to (Dest)
+
+class CBlockDecoder
+{
+  CMyComPtr2<ICompressCoder, NCompress::NZlib::CDecoder> _zlibDecoder;
+  CMyComPtr2<ICompressCoder, NCompress::NZSTD::CDecoder> _zstdDecoder;
+  CMyComPtr2_Create<IInStream, CBufInStream> _inStream;
+  CMyComPtr2_Create<ISequentialOutStream, CBufPtrSeqOutStream> _outStream;
+  CXzUnpacker _xz;
+
+  Z7_CLASS_NO_COPY(CBlockDecoder)
+public:
+  CByteBuffer InBuf;
+  UInt32 PackSize;
+  UInt32 Method;
+  bool NoPropsLZMA;
+  UInt32 BlockSize;
+  Byte *Dest;
+
+  UInt32 UnpackSize;
+  HRESULT Res;
+
+  CBlockDecoder() { XzUnpacker_Construct(&_xz, &g_Alloc); }
+  ~CBlockDecoder() { XzUnpacker_Free(&_xz); }
+  void Decode();
+};
+
+#ifndef Z7_ST
+
+struct CBlockDecoderThread: public CVirtThread
+{
+  CBlockDecoder Decoder;
+
+  void Execute() Z7_override { Decoder.Decode(); }
+  ~CBlockDecoderThread() Z7_DESTRUCTOR_override { WaitThreadFinish(); }
+};
+
+#endif
+
+// decoded data block in cache. Blocks are identified by position in archive.
+
+struct CCacheBlock
+{
+  CByteBuffer Data;
+  UInt64 Offset;
+  UInt32 PackSize;
+  UInt32 UnpackSize;
+  UInt64 LastUse; // 0 : the block is empty
+  bool Compressed;
+
+  CCacheBlock(): LastUse(0) {}
+};
+
+static const UInt64 k_CacheSize_Default = (UInt64)1 << 25;
+static const UInt32 k_NumThreads_Max = 64;
+
+
+Z7_CLASS_IMP_CHandler_IInArchive_2(
+  IInArchiveGetStream,
+  ISetProperties
 )
   bool _noPropsLZMA;
   bool _needCheckLzma;
@@ -865,10 +930,20 @@ Z7_CLASS_IMP_CHandler_IInArchive_1(
   CRecordVector<bool> _blockCompressed;
   CRecordVector<UInt64> _blockOffsets;
   
-  CByteBuffer _cachedBlock;
-  UInt64 _cachedBlockStartPos;
-  UInt32 _cachedPackBlockSize;
-  UInt32 _cachedUnpackBlockSize;
+  /* decoded data blocks and fragment blocks are kept in LRU cache.
+     If there are several threads, the next data blocks of file
+     are decoded in parallel with requested block. */
+  CObjectVector<CCacheBlock> _cache;
+  UInt64 _cacheUseCounter;
+  UInt64 _cacheSizeMax;
+  UInt64 _memUsageMax; // (UInt64)(Int64)-1, if "memuse" was not set
+  UInt32 _numThreads;
+  UInt32 _numProcessors;
+
+  CBlockDecoder _blockDecoder;
+ #ifndef Z7_ST
+  CObjectVector<CBlockDecoderThread> _decoderThreads;
+ #endif
 
   CMyComPtr2_Create<ISequentialInStream, CLimitedSequentialInStream> _limitedInStream;
   CMyComPtr2_Create<ISequentialOutStream, CBufPtrSeqOutStream> _outStream;
@@ -884,12 +959,13 @@ Z7_CLASS_IMP_CHandler_IInArchive_1(
 
   CByteBuffer _inputBuffer;
 
-  void ClearCache()
-  {
-    _cachedBlockStartPos = 0;
-    _cachedPackBlockSize = 0;
-    _cachedUnpackBlockSize = 0;
-  }
+  int FindCacheBlock(UInt64 offset, UInt32 packSize, bool compressed) const;
+  unsigned GetNumDecodeBlocks() const;
+  unsigned AllocCacheBlock();
+  UInt32 GetBlockMethod(Byte firstByte);
+  bool GetDataBlockInfo(UInt64 blockIndex, UInt64 &offset, UInt32 &packSize, bool &compressed) const;
+  HRESULT DecodeBlocks(const CRecordVector<UInt64> &blockIndexes, UInt64 fragOffset, UInt32 fragPackSize, bool fragCompressed);
+  void InitProps();
 
   HRESULT Seek2(UInt64 offset)
   {
@@ -920,9 +996,67 @@ public:
 };
 
 
-CHandler::CHandler()
+CHandler::CHandler():
+    _cacheUseCounter(0)
 {
   XzUnpacker_Construct(&_xz, &g_Alloc);
+  InitProps();
+}
+
+void CHandler::InitProps()
+{
+  _cacheSizeMax = k_CacheSize_Default;
+  _memUsageMax = (UInt64)(Int64)-1;
+ #ifndef Z7_ST
+  _numProcessors = NWindows::NSystem::GetNumberOfProcessors();
+ #else
+  _numProcessors = 1;
+ #endif
+  _numThreads = _numProcessors;
+}
+
+Z7_COM7F_IMF(CHandler::SetProperties(const wchar_t * const *names, const PROPVARIANT *values, UInt32 numProps))
+{
+  InitProps();
+
+  for (UInt32 i = 0; i < numProps; i++)
+  {
+    UString name = names[i];
+    name.MakeLower_Ascii();
+    const PROPVARIANT &prop = values[i];
+
+    if (name.IsPrefixedBy_Ascii_NoCase("mt"))
+    {
+     #ifndef Z7_ST
+      RINOK(ParseMtProp(name.Ptr(2), prop, _numProcessors, _numThreads))
+     #endif
+    }
+    else if (name.IsPrefixedBy_Ascii_NoCase("cache"))
+    {
+      // the size of cache for decoded blocks: -mcache=64m
+      UInt64 v;
+      if (!ParseSizeString(name.Ptr(5), prop, 0, v))
+        return E_INVALIDARG;
+      _cacheSizeMax = v;
+    }
+    else if (name.IsPrefixedBy_Ascii_NoCase("memuse"))
+    {
+      // the limit for the cache and the input buffers of read-ahead: -mmemuse=16m
+      size_t ramSize = (size_t)sizeof(size_t) << 28;
+      NWindows::NSystem::GetRamSize(ramSize);
+      UInt64 v;
+      if (!ParseSizeString(name.Ptr(6), prop, ramSize, v))
+        return E_INVALIDARG;
+      _memUsageMax = v;
+    }
+    else
+      return E_INVALIDARG;
+  }
+  if (_numThreads == 0)
+    _numThreads = 1;
+  if (_numThreads > k_NumThreads_Max)
+    _numThreads = k_NumThreads_Max;
+  return S_OK;
 }
 
 static const Byte kProps[] =
@@ -1129,34 +1263,142 @@ static HRESULT Lz4Decode(Byte *dest, SizeT *destLen, const Byte *src, SizeT *src
   return S_OK;
 }
 
-HRESULT CHandler::Decompress(ISequentialOutStream *outStream, Byte *outBuf, bool *outBufWasWritten, UInt32 *outBufWasWrittenSize, UInt32 inSize, UInt32 outSizeMax)
+// it decodes the block of memory-only methods: LZO, LZ4, LZMA and XZ
+
+static HRESULT DecodeBuf(CXzUnpacker &xz, UInt32 method, bool noPropsLZMA, UInt32 blockSize,
+    Byte *dest, SizeT &destLen, const Byte *src, UInt32 inSize)
 {
-  if (outBuf)
+  const SizeT outSizeMax = destLen;
+  SizeT srcLen = inSize;
+
+  if (method == kMethod_LZO)
   {
-    *outBufWasWritten = false;
-    *outBufWasWrittenSize = 0;
+    RINOK(LzoDecode(dest, &destLen, src, &srcLen))
   }
-  UInt32 method = _h.Method;
-  if (_h.SeveralMethods)
+  else if (method == kMethod_LZ4)
   {
-    Byte b;
-    RINOK(ReadStream_FALSE(_stream, &b, 1))
-    RINOK(_stream->Seek(-1, STREAM_SEEK_CUR, NULL))
-    method = (b == 0x5D ? kMethod_LZMA : kMethod_ZLIB);
+    RINOK(Lz4Decode(dest, &destLen, src, &srcLen))
+  }
+  else if (method == kMethod_LZMA)
+  {
+    Byte props[5];
+
+    if (noPropsLZMA)
+    {
+      props[0] = 0x5D;
+      SetUi32(&props[1], blockSize)
+    }
+    else
+    {
+      const UInt32 kPropsSize = LZMA_PROPS_SIZE + 8;
+      if (inSize < kPropsSize)
+        return S_FALSE;
+      memcpy(props, src, LZMA_PROPS_SIZE);
+      const UInt64 outSize = GetUi64(src + LZMA_PROPS_SIZE);
+      if (outSize > outSizeMax)
+        return S_FALSE;
+      destLen = (SizeT)outSize;
+      src += kPropsSize;
+      inSize -= kPropsSize;
+      srcLen = inSize;
+    }
+
+    ELzmaStatus status;
+    const SRes res = LzmaDecode(dest, &destLen,
+        src, &srcLen,
+        props, LZMA_PROPS_SIZE,
+        LZMA_FINISH_END,
+        &status, &g_Alloc);
+    if (res != 0)
+      return SResToHRESULT(res);
+    if (status != LZMA_STATUS_FINISHED_WITH_MARK
+        && status != LZMA_STATUS_MAYBE_FINISHED_WITHOUT_MARK)
+      return S_FALSE;
+  }
+  else
+  {
+    ECoderStatus status;
+    const SRes res = XzUnpacker_CodeFull(&xz,
+        dest, &destLen,
+        src, &srcLen,
+        CODER_FINISH_END, &status);
+    if (res != 0)
+      return SResToHRESULT(res);
+    if (status != CODER_STATUS_NEEDS_MORE_INPUT || !XzUnpacker_IsStreamWasFinished(&xz))
+      return S_FALSE;
+  }
+
+  if (inSize != srcLen)
+    return S_FALSE;
+  return S_OK;
+}
+
+
+void CBlockDecoder::Decode()
+{
+  UnpackSize = 0;
+  Res = S_OK;
+  if (Method == kMethod_ZLIB || Method == kMethod_ZSTD)
+  {
+    _inStream->Init(InBuf, PackSize);
+    _outStream->Init(Dest, BlockSize);
+    UInt64 inProcessed;
+    if (Method == kMethod_ZLIB)
+    {
+      _zlibDecoder.Create_if_Empty();
+      Res = _zlibDecoder.Interface()->Code(_inStream, _outStream, NULL, NULL, NULL);
+      inProcessed = _zlibDecoder->GetInputProcessedSize();
+    }
+    else
+    {
+      _zstdDecoder.Create_if_Empty();
+      Res = _zstdDecoder.Interface()->Code(_inStream, _outStream, NULL, NULL, NULL);
+      inProcessed = _zstdDecoder->GetInputProcessedSize();
+    }
+    if (Res == S_OK && inProcessed != PackSize)
+      Res = S_FALSE;
+    UnpackSize = (UInt32)_outStream->GetPos();
+    return;
   }
+  SizeT destLen = BlockSize;
+  Res = DecodeBuf(_xz, Method, NoPropsLZMA, BlockSize, Dest, destLen, InBuf, PackSize);
+  UnpackSize = (UInt32)destLen;
+}
 
+
+UInt32 CHandler::GetBlockMethod(Byte firstByte)
+{
+  UInt32 method = _h.Method;
+  if (_h.SeveralMethods)
+    method = (firstByte == 0x5D ? kMethod_LZMA : kMethod_ZLIB);
   if (method == kMethod_ZLIB && _needCheckLzma)
   {
-    Byte b;
-    RINOK(ReadStream_FALSE(_stream, &b, 1))
-    RINOK(_stream->Seek(-1, STREAM_SEEK_CUR, NULL))
-    if (b == 0)
+    if (firstByte == 0)
     {
       _noPropsLZMA = true;
       method = _h.Method = kMethod_LZMA;
     }
     _needCheckLzma = false;
   }
+  return method;
+}
+
+
+HRESULT CHandler::Decompress(ISequentialOutStream *outStream, Byte *outBuf, bool *outBufWasWritten, UInt32 *outBufWasWrittenSize, UInt32 inSize, UInt32 outSizeMax)
+{
+  if (outBuf)
+  {
+    *outBufWasWritten = false;
+    *outBufWasWrittenSize = 0;
+  }
+  UInt32 method = _h.Method;
+  if (_h.SeveralMethods || (method == kMethod_ZLIB && _needCheckLzma))
+  {
+    Byte b;
+    RINOK(ReadStream_FALSE(_stream, &b, 1))
+    RINOK(_stream->Seek(-1, STREAM_SEEK_CUR, NULL))
+    method = GetBlockMethod(b);
+  }
   
   if (method == kMethod_ZLIB)
   {
@@ -1220,68 +1462,8 @@ HRESULT CHandler::Decompress(ISequentialOutStream *outStream, Byte *outBuf, bool
         return E_OUTOFMEMORY;
     }
     
-    SizeT destLen = outSizeMax, srcLen = inSize;
-
-    if (method == kMethod_LZO)
-    {
-      RINOK(LzoDecode(dest, &destLen, _inputBuffer, &srcLen))
-    }
-    else if (method == kMethod_LZ4)
-    {
-      RINOK(Lz4Decode(dest, &destLen, _inputBuffer, &srcLen));
-    }
-    else if (method == kMethod_LZMA)
-    {
-      Byte props[5];
-      const Byte *src = _inputBuffer;
-
-      if (_noPropsLZMA)
-      {
-        props[0] = 0x5D;
-        SetUi32(&props[1], _h.BlockSize)
-      }
-      else
-      {
-        const UInt32 kPropsSize = LZMA_PROPS_SIZE + 8;
-        if (inSize < kPropsSize)
-          return S_FALSE;
-        memcpy(props, src, LZMA_PROPS_SIZE);
-        UInt64 outSize = GetUi64(src + LZMA_PROPS_SIZE);
-        if (outSize > outSizeMax)
-          return S_FALSE;
-        destLen = (SizeT)outSize;
-        src += kPropsSize;
-        inSize -= kPropsSize;
-        srcLen = inSize;
-      }
-
-      ELzmaStatus status;
-      SRes res = LzmaDecode(dest, &destLen,
-          src, &srcLen,
-          props, LZMA_PROPS_SIZE,
-          LZMA_FINISH_END,
-          &status, &g_Alloc);
-      if (res != 0)
-        return SResToHRESULT(res);
-      if (status != LZMA_STATUS_FINISHED_WITH_MARK
-          && status != LZMA_STATUS_MAYBE_FINISHED_WITHOUT_MARK)
-        return S_FALSE;
-    }
-    else
-    {
-      ECoderStatus status;
-      const SRes res = XzUnpacker_CodeFull(&_xz,
-          dest, &destLen,
-          _inputBuffer, &srcLen,
-          CODER_FINISH_END, &status);
-      if (res != 0)
-        return SResToHRESULT(res);
-      if (status != CODER_STATUS_NEEDS_MORE_INPUT || !XzUnpacker_IsStreamWasFinished(&_xz))
-        return S_FALSE;
-    }
-    
-    if (inSize != srcLen)
-      return S_FALSE;
+    SizeT destLen = outSizeMax;
+    RINOK(DecodeBuf(_xz, method, _noPropsLZMA, _h.BlockSize, dest, destLen, _inputBuffer, inSize))
     if (outBuf)
     {
       *outBufWasWritten = true;
@@ -1816,8 +1998,7 @@ Z7_COM7F_IMF(CHandler::Close())
   _uids.Free();
   _gids.Free();
 
-  _cachedBlock.Free();
-  ClearCache();
+  _cache.Clear();
 
   return S_OK;
 }
@@ -2105,6 +2286,214 @@ HRESULT CSquashfsInStream::ReadBlock(UInt64 blockIndex, Byte *dest, size_t block
   return Handler->ReadBlock(blockIndex, dest, blockSize);
 }
 
+bool CHandler::GetDataBlockInfo(UInt64 blockIndex, UInt64 &offset, UInt32 &packSize, bool &compressed) const
+{
+  if (blockIndex >= _blockCompressed.Size())
+    return false;
+  compressed = _blockCompressed[(unsigned)blockIndex];
+  offset = _blockOffsets[(unsigned)blockIndex];
+  packSize = (UInt32)(_blockOffsets[(unsigned)blockIndex + 1] - offset);
+  offset += _nodes[_nodeIndex].StartBlock;
+  return true;
+}
+
+int CHandler::FindCacheBlock(UInt64 offset, UInt32 packSize, bool compressed) const
+{
+  FOR_VECTOR (i, _cache)
+  {
+    const CCacheBlock &cb = _cache[i];
+    if (cb.LastUse != 0
+        && cb.Offset == offset
+        && cb.PackSize == packSize
+        && cb.Compressed == compressed)
+      return (int)i;
+  }
+  return -1;
+}
+
+/* the number of blocks that are decoded together: the requested block and read-ahead blocks.
+   Each of them needs the cache block and the input buffer,
+   and the cache must keep another block, so "memuse" can't be smaller than 3 blocks. */
+
+unsigned CHandler::GetNumDecodeBlocks() const
+{
+  UInt64 num = _numThreads;
+  const UInt64 numMax = _memUsageMax / ((UInt64)_h.BlockSize * 2);
+  if (num > numMax)
+    num = numMax;
+  if (num == 0)
+    num = 1;
+  return (unsigned)num;
+}
+
+unsigned CHandler::AllocCacheBlock()
+{
+  // the caller marks the returned block as used, so the next call returns another block
+  const unsigned numDecodeBlocks = GetNumDecodeBlocks();
+  UInt64 cacheSizeMax = _cacheSizeMax;
+  {
+    const UInt64 inBufsSize = (UInt64)numDecodeBlocks << _h.BlockSizeLog;
+    const UInt64 cacheSizeMax2 = _memUsageMax > inBufsSize ? _memUsageMax - inBufsSize : 0;
+    if (cacheSizeMax > cacheSizeMax2)
+      cacheSizeMax = cacheSizeMax2;
+  }
+  unsigned numBlocksMax = (unsigned)MyMin(cacheSizeMax >> _h.BlockSizeLog, (UInt64)1 << 16);
+  const unsigned numBlocksMin = numDecodeBlocks + 1;
+  if (numBlocksMax < numBlocksMin)
+    numBlocksMax = numBlocksMin;
+  if (_cache.Size() < numBlocksMax)
+  {
+    CCacheBlock &cb = _cache.AddNew();
+    cb.Data.Alloc(_h.BlockSize);
+    return _cache.Size() - 1;
+  }
+  unsigned best = 0;
+  FOR_VECTOR (i, _cache)
+    if (_cache[i].LastUse < _cache[best].LastUse)
+      best = i;
+  return best;
+}
+
+/*
+DecodeBlocks() reads the packed data of blocks sequentially,
+then it decodes the blocks in parallel, and it puts the decoded blocks to cache.
+The first block is the requested block: (blockIndexes[0]) or fragment block.
+Only the error of the first block is returned. If some next block can't be
+decoded, it's not added to cache, and the error will be returned, if that
+block is requested later.
+*/
+
+HRESULT CHandler::DecodeBlocks(const CRecordVector<UInt64> &blockIndexes,
+    UInt64 fragOffset, UInt32 fragPackSize, bool fragCompressed)
+{
+  const unsigned numBlocks = blockIndexes.IsEmpty() ? 1 : blockIndexes.Size();
+
+ #ifndef Z7_ST
+  while (_decoderThreads.Size() + 1 < numBlocks)
+  {
+    CBlockDecoderThread &t = _decoderThreads.AddNew();
+    if (t.Create() != 0)
+    {
+      _decoderThreads.DeleteBack();
+      break;
+    }
+  }
+ #endif
+
+  unsigned cacheIndexes[k_NumThreads_Max];
+  unsigned numJobs = 0;
+  bool firstIsJob = false;
+  HRESULT res = S_OK;
+
+  for (unsigned i = 0; i < numBlocks; i++)
+  {
+    UInt64 offset = fragOffset;
+    UInt32 packSize = fragPackSize;
+    bool compressed = fragCompressed;
+    if (!blockIndexes.IsEmpty())
+      GetDataBlockInfo(blockIndexes[i], offset, packSize, compressed);
+    
+   #ifndef Z7_ST
+    if (numJobs > _decoderThreads.Size())
+      break;
+    CBlockDecoder &dec = (numJobs == 0 ? _blockDecoder : _decoderThreads[numJobs - 1].Decoder);
+   #else
+    if (numJobs != 0)
+      break;
+    CBlockDecoder &dec = _blockDecoder;
+   #endif
+
+    const unsigned cacheIndex = AllocCacheBlock();
+    CCacheBlock &cb = _cache[cacheIndex];
+    cb.LastUse = 0;
+    cb.Offset = offset;
+    cb.PackSize = packSize;
+    cb.Compressed = compressed;
+    // it protects the block from AllocCacheBlock() calls for next blocks
+    cb.LastUse = ++_cacheUseCounter;
+
+    res = Seek2(offset);
+    if (res == S_OK)
+    {
+      if (!compressed)
+      {
+        if (packSize > _h.BlockSize)
+          res = S_FALSE;
+        else
+          res = ReadStream_FALSE(_stream, cb.Data, packSize);
+        cb.UnpackSize = packSize;
+      }
+      else
+      {
+        if (dec.InBuf.Size() < packSize)
+          dec.InBuf.Alloc(packSize);
+        res = ReadStream_FALSE(_stream, dec.InBuf, packSize);
+        if (res == S_OK)
+        {
+          dec.PackSize = packSize;
+          dec.Method = GetBlockMethod(dec.InBuf[0]);
+          dec.NoPropsLZMA = _noPropsLZMA;
+          dec.BlockSize = _h.BlockSize;
+          dec.Dest = cb.Data;
+          dec.Res = S_OK;
+          if (i == 0)
+            firstIsJob = true;
+          cacheIndexes[numJobs++] = cacheIndex;
+        }
+      }
+    }
+    if (res != S_OK)
+    {
+      cb.LastUse = 0;
+      if (i == 0)
+        return res;
+      break;
+    }
+  }
+
+  if (numJobs == 0)
+    return S_OK;
+
+  // the job 0 is decoded by this thread, and other jobs by decoder threads
+ #ifndef Z7_ST
+  unsigned numStarted = 0;
+  for (unsigned i = 1; i < numJobs; i++)
+  {
+    if (_decoderThreads[i - 1].Start() != 0)
+      break;
+    numStarted++;
+  }
+ #endif
+
+  _blockDecoder.Decode();
+
+ #ifndef Z7_ST
+  for (unsigned i = numStarted + 1; i < numJobs; i++)
+    _decoderThreads[i - 1].Decoder.Decode();
+  for (unsigned i = 0; i < numStarted; i++)
+    _decoderThreads[i].WaitExecuteFinish();
+ #endif
+
+  res = S_OK;
+  for (unsigned i = 0; i < numJobs; i++)
+  {
+   #ifndef Z7_ST
+    const CBlockDecoder &dec = (i == 0 ? _blockDecoder : _decoderThreads[i - 1].Decoder);
+   #else
+    const CBlockDecoder &dec = _blockDecoder;
+   #endif
+    CCacheBlock &cb = _cache[cacheIndexes[i]];
+    cb.UnpackSize = dec.UnpackSize;
+    if (dec.Res != S_OK)
+    {
+      cb.LastUse = 0;
+      if (i == 0 && firstIsJob)
+        res = dec.Res;
+    }
+  }
+  return res;
+}
+
 HRESULT CHandler::ReadBlock(UInt64 blockIndex, Byte *dest, size_t blockSize)
 {
   const CNode &node = _nodes[_nodeIndex];
@@ -2112,14 +2501,8 @@ HRESULT CHandler::ReadBlock(UInt64 blockIndex, Byte *dest, size_t blockSize)
   UInt32 packBlockSize;
   UInt32 offsetInBlock = 0;
   bool compressed;
-  if (blockIndex < _blockCompressed.Size())
-  {
-    compressed = _blockCompressed[(unsigned)blockIndex];
-    blockOffset = _blockOffsets[(unsigned)blockIndex];
-    packBlockSize = (UInt32)(_blockOffsets[(unsigned)blockIndex + 1] - blockOffset);
-    blockOffset += node.StartBlock;
-  }
-  else
+  const bool isDataBlock = GetDataBlockInfo(blockIndex, blockOffset, packBlockSize, compressed);
+  if (!isDataBlock)
   {
     if (!node.ThereAreFrags())
       return S_FALSE;
@@ -2137,39 +2520,40 @@ HRESULT CHandler::ReadBlock(UInt64 blockIndex, Byte *dest, size_t blockSize)
     return S_OK;
   }
 
-  if (blockOffset != _cachedBlockStartPos ||
-      packBlockSize != _cachedPackBlockSize)
+  int cacheIndex = FindCacheBlock(blockOffset, packBlockSize, compressed);
+  if (cacheIndex < 0)
   {
-    ClearCache();
-    RINOK(Seek2(blockOffset))
-    _limitedInStream->Init(packBlockSize);
-    
-    if (compressed)
-    {
-      _outStream->Init((Byte *)_cachedBlock, _h.BlockSize);
-      bool outBufWasWritten;
-      UInt32 outBufWasWrittenSize;
-      HRESULT res = Decompress(_outStream, _cachedBlock, &outBufWasWritten, &outBufWasWrittenSize, packBlockSize, _h.BlockSize);
-      RINOK(res)
-      if (outBufWasWritten)
-        _cachedUnpackBlockSize = outBufWasWrittenSize;
-      else
-        _cachedUnpackBlockSize = (UInt32)_outStream->GetPos();
-    }
-    else
+    CRecordVector<UInt64> blockIndexes;
+    if (isDataBlock)
     {
-      if (packBlockSize > _h.BlockSize)
-        return S_FALSE;
-      RINOK(ReadStream_FALSE(_limitedInStream, _cachedBlock, packBlockSize))
-      _cachedUnpackBlockSize = packBlockSize;
+      // read-ahead: the next data blocks of file are decoded together with this block
+      blockIndexes.Add(blockIndex);
+      const unsigned numDecodeBlocks = GetNumDecodeBlocks();
+      for (UInt64 next = blockIndex + 1; blockIndexes.Size() < numDecodeBlocks; next++)
+      {
+        UInt64 offset;
+        UInt32 packSize;
+        bool compressed2;
+        if (!GetDataBlockInfo(next, offset, packSize, compressed2)
+            || packSize == 0
+            || !compressed2
+            || FindCacheBlock(offset, packSize, compressed2) >= 0)
+          break;
+        blockIndexes.Add(next);
+      }
     }
-    _cachedBlockStartPos = blockOffset;
-    _cachedPackBlockSize = packBlockSize;
+    RINOK(DecodeBlocks(blockIndexes, blockOffset, packBlockSize, compressed))
+    cacheIndex = FindCacheBlock(blockOffset, packBlockSize, compressed);
+    if (cacheIndex < 0)
+      return E_FAIL;
   }
-  if (offsetInBlock + blockSize > _cachedUnpackBlockSize)
+
+  CCacheBlock &cb = _cache[(unsigned)cacheIndex];
+  cb.LastUse = ++_cacheUseCounter;
+  if (offsetInBlock + blockSize > cb.UnpackSize)
     return S_FALSE;
   if (blockSize != 0)
-    memcpy(dest, _cachedBlock + offsetInBlock, blockSize);
+    memcpy(dest, cb.Data + offsetInBlock, blockSize);
   return S_OK;
 }
 
@@ -2305,13 +2689,6 @@ Z7_COM7F_IMF(CHandler::GetStream(UInt32 index, ISequentialInStream **stream))
 
   _nodeIndex = item.Node;
 
-  size_t cacheSize = _h.BlockSize;
-  if (_cachedBlock.Size() != cacheSize)
-  {
-    ClearCache();
-    _cachedBlock.Alloc(cacheSize);
-  }
-
   CSquashfsInStream *streamSpec = new CSquashfsInStream;
   CMyComPtr<IInStream> streamTemp = streamSpec;
   streamSpec->Handler = this;
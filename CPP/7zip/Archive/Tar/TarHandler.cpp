@@ -18,6 +18,7 @@
 #include "../Common/ItemNameUtils.h"
 
 #include "TarHandler.h"
+#include "TarZstd.h"
 
 using namespace NWindows;
 
@@ -59,6 +60,7 @@ static const Byte kProps[] =
 
 static const Byte kArcProps[] =
 {
+  kpidMethod,
   kpidHeadersSize,
   kpidCodePage,
   kpidCharacts,
@@ -75,7 +77,13 @@ Z7_COM7F_IMF(CHandler::GetArchiveProperty(PROPID propID, PROPVARIANT *value))
   NCOM::CPropVariant prop;
   switch (propID)
   {
-    case kpidPhySize:     if (_arc._phySize_Defined) prop = _arc._phySize; break;
+    case kpidPhySize:
+      if (_isZstd)
+        prop = _zstdPhySize;
+      else if (_arc._phySize_Defined)
+        prop = _arc._phySize;
+      break;
+    case kpidMethod: if (_isZstd) prop = "zstd"; break;
     case kpidHeadersSize: if (_arc._phySize_Defined) prop = _arc._headersSize; break;
     case kpidErrorFlags:
     {
@@ -323,8 +331,27 @@ Z7_COM7F_IMF(CHandler::Open(IInStream *stream, const UInt64 *, IArchiveOpenCallb
   // for (int i = 0; i < 10; i++) // for debug
   {
     Close();
-    RINOK(Open2(stream, openArchiveCallback))
-    _stream = stream;
+    CMyComPtr<IInStream> stream2 = stream;
+    Byte sig[4];
+    size_t processed = sizeof(sig);
+    RINOK(ReadStream(stream, sig, &processed))
+    if (processed == sizeof(sig) && IsZstdSignature(sig))
+    {
+      CZstdSeekInStream *zstdStreamSpec = new CZstdSeekInStream;
+      CMyComPtr<IInStream> zstdStream = zstdStreamSpec;
+      const HRESULT res = zstdStreamSpec->Open(stream);
+      if (res == S_OK)
+      {
+        stream2 = zstdStream;
+        _zstdPhySize = zstdStreamSpec->PhySize;
+        _isZstd = true;
+      }
+      else if (res != S_FALSE)
+        return res;
+    }
+    RINOK(InStream_SeekToBegin(stream))
+    RINOK(Open2(stream2, openArchiveCallback))
+    _stream = stream2;
   }
   return S_OK;
   COM_TRY_END
@@ -341,6 +368,7 @@ Z7_COM7F_IMF(CHandler::OpenSeq(ISequentialInStream *stream))
 Z7_COM7F_IMF(CHandler::Close())
 {
   _isArc = false;
+  _isZstd = false;
 
   _arc.Clear();
 
@@ -364,6 +392,7 @@ CHandler::CHandler()
   // copyCoder = new NCompress::CCopyCoder();
   // copyCoder = copyCoder;
   _openCodePage = CP_UTF8;
+  _isZstd = false;
   Init();
 }
 
@@ -829,7 +858,12 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
           RINOK(InStream_SeekSet(_stream, item->Get_DataPos()))
         }
         inStream->Init(item->Get_PackSize_Aligned());
-        RINOK(copyCoder.Interface()->Code(inStream2, outStreamSpec, NULL, NULL, lps))
+        const HRESULT res = copyCoder.Interface()->Code(inStream2, outStreamSpec, NULL, NULL, lps);
+        // the stream of tar.zst returns S_FALSE for data error in frame
+        if (res == S_FALSE)
+          opRes = NExtract::NOperationResult::kDataError;
+        else
+          RINOK(res)
       }
       if (outStreamSpec->GetRem() != 0)
         opRes = NExtract::NOperationResult::kDataError;
@@ -1004,6 +1038,9 @@ void CHandler::Init()
   // TimeOptions.Clear();
   _handlerTimeOptions.Init();
   // _handlerTimeOptions.Write_MTime.Val = true; // it's default already
+  _zstdLevel = -1;
+  _zstdFrameSize = k_ZstdFrameSize_Def;
+  _methodProps = CCommonMethodProps();
 }
 
 
@@ -1033,11 +1070,29 @@ Z7_COM7F_IMF(CHandler::SetProperties(const wchar_t * const *names, const PROPVAR
       _forceCodePage = true;
       _curCodePage = _specifiedCodePage = cp;
     }
-    else if (name.IsPrefixedBy_Ascii_NoCase("mt"))
+    else if (name.IsPrefixedBy_Ascii_NoCase("mt")
+        || name.IsPrefixedBy_Ascii_NoCase("memuse"))
     {
+      HRESULT hres;
+      _methodProps.SetCommonProperty(name, prop, hres);
+      RINOK(hres)
     }
-    else if (name.IsPrefixedBy_Ascii_NoCase("memuse"))
+    else if (name.IsEqualTo("zstd"))
     {
+      UInt32 level = 3;
+      RINOK(ParsePropToUInt32(L"", prop, level))
+      if (level > (UInt32)ZSTD_maxCLevel())
+        return E_INVALIDARG;
+      _zstdLevel = (Int32)level;
+    }
+    else if (name.IsPrefixedBy_Ascii_NoCase("zsf"))
+    {
+      UInt64 v;
+      if (!ParseSizeString(name.Ptr(3), prop, 0, v)
+          || v < k_ZstdFrameSize_Min
+          || v > k_ZstdFrameSize_Max)
+        return E_INVALIDARG;
+      _zstdFrameSize = (UInt32)v;
     }
     else if (name.IsEqualTo("m"))
     {
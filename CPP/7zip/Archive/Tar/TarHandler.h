@@ -36,6 +36,12 @@ private:
   CHandlerTimeOptions _handlerTimeOptions;
   CEncodingCharacts _encodingCharacts;
 
+  bool _isZstd; // tar.zst with seek table, (_stream) is decoded stream
+  UInt64 _zstdPhySize;
+  Int32 _zstdLevel; // -1 : default, 0 : tar without zstd
+  UInt32 _zstdFrameSize;
+  CCommonMethodProps _methodProps; // "mt" and "memuse" for zstd encoder
+
   UInt32 _curIndex;
   bool _latestIsRead;
   CItemEx _latestItem;
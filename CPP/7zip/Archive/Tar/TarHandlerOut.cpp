@@ -14,6 +14,7 @@
 
 #include "TarHandler.h"
 #include "TarUpdate.h"
+#include "TarZstd.h"
 
 using namespace NWindows;
 
@@ -323,8 +324,25 @@ Z7_COM7F_IMF(CHandler::UpdateItems(ISequentialOutStream *outStream, UInt32 numIt
         // k_PaxTimeMode_RemoveZero_Always; // original pax code
   }
 
-  return UpdateArchive(_stream, outStream, _items, updateItems,
-      options, callback);
+  const Int32 zstdLevel = (_zstdLevel >= 0 ? _zstdLevel : (_isZstd ? 3 : 0));
+  if (zstdLevel == 0)
+    return UpdateArchive(_stream, outStream, _items, updateItems,
+        options, callback);
+
+  // tar.zst with seek table
+  CMyComPtr2_Create<ISequentialOutStream, CZstdFramesOutStream> zstdStream;
+ #ifndef Z7_ST
+  const UInt32 numThreads = _methodProps._numThreads;
+ #else
+  const UInt32 numThreads = 1;
+ #endif
+  // (_memUsage_Compress) is "memuse" or the default limit from RAM size
+  RINOK(zstdStream->Init(outStream, zstdLevel, _zstdFrameSize, numThreads,
+      _methodProps._memUsage_Compress))
+  options.ZstdStream = zstdStream.ClsPtr();
+  RINOK(UpdateArchive(_stream, zstdStream, _items, updateItems,
+      options, callback))
+  return zstdStream->Finish();
   
   COM_TRY_END
 }
@@ -14,6 +14,7 @@
 
 #include "TarOut.h"
 #include "TarUpdate.h"
+#include "TarZstd.h"
 
 namespace NArchive {
 namespace NTar {
@@ -422,6 +423,8 @@ HRESULT UpdateArchive(IInStream *inStream, ISequentialOutStream *outStream,
         if (outSeekStream && setRestriction)
           RINOK(setRestriction->SetRestriction(outArchive.Pos, (UInt64)(Int64)-1))
 
+        if (options.ZstdStream)
+          RINOK(options.ZstdStream->StartMember(item.PackSize))
         RINOK(outArchive.WriteHeader(item))
         if (fileInStream)
         {
@@ -505,6 +508,9 @@ HRESULT UpdateArchive(IInStream *inStream, ISequentialOutStream *outStream,
 
       const CItemEx &existItem = inputItems[(unsigned)ui.IndexInArc];
       UInt64 size, pos;
+
+      if (options.ZstdStream)
+        RINOK(options.ZstdStream->StartMember(existItem.PackSize))
       
       if (ui.NewProps)
       {
@@ -43,6 +43,8 @@ struct CUpdateItem
 };
 
 
+class CZstdFramesOutStream;
+
 struct CUpdateOptions
 {
   UINT CodePage;
@@ -52,6 +54,10 @@ struct CUpdateOptions
   CBoolPair Write_ATime;
   CBoolPair Write_CTime;
   CTimeOptions TimeOptions;
+  // if it's set, it must be (outStream) of UpdateArchive()
+  CZstdFramesOutStream *ZstdStream;
+
+  CUpdateOptions(): ZstdStream(NULL) {}
 };
 
 
@@ -0,0 +1,411 @@
+// TarZstd.cpp
+
+#include "StdAfx.h"
+
+#include "../../../../C/CpuArch.h"
+
+#include "../../../Common/ComTry.h"
+
+#include "../../Common/StreamUtils.h"
+
+#include "../../Compress/ZstdDecoder.h"
+
+#include "TarZstd.h"
+
+#define Get32(p) GetUi32(p)
+
+namespace NArchive {
+namespace NTar {
+
+static const UInt32 kZstdMagic = 0xFD2FB528;
+static const UInt32 kSeekTable_SkippableMagic = 0x184D2A5E;
+static const UInt32 kSeekTable_Magic = 0x8F92EAB1;
+
+static const unsigned kSkippableHeaderSize = 8;
+static const unsigned kFooterSize = 9;
+static const unsigned kEntrySize = 8;
+static const unsigned kEntrySize_Checksum = 12;
+
+static const Byte kDescriptor_Checksum = 0x80;
+static const Byte kDescriptor_Reserved = 0x7C;
+
+// we decode full frame to buffer. So we don't support big frames of other writers.
+static const UInt32 kFrameUnpackSizeMax = (UInt32)1 << (sizeof(size_t) > 4 ? 30 : 28);
+static const UInt32 kNumFramesMax = (UInt32)1 << 26;
+
+#ifndef Z7_ST
+static const unsigned kNumThreadsMax = 64;
+#endif
+
+static unsigned FindFrame(const CRecordVector<CZstdFrame> &frames, UInt64 pos)
+{
+  unsigned left = 0, right = frames.Size();
+  for (;;)
+  {
+    const unsigned mid = (left + right) / 2;
+    if (mid == left)
+      return left;
+    if (pos < frames[mid].UnpackPos)
+      right = mid;
+    else
+      left = mid;
+  }
+}
+
+
+CZstdSeekInStream::~CZstdSeekInStream()
+{
+  ZSTD_freeDCtx(_ctx);
+}
+
+HRESULT CZstdSeekInStream::ReadTable(UInt64 arcSize)
+{
+  if (arcSize < 4 + kSkippableHeaderSize + kFooterSize)
+    return S_FALSE;
+  Byte buf[kSkippableHeaderSize + kFooterSize];
+  RINOK(InStream_SeekSet(Stream, 0))
+  RINOK(ReadStream_FALSE(Stream, buf, 4))
+  if (Get32(buf) != kZstdMagic)
+    return S_FALSE;
+
+  RINOK(InStream_SeekSet(Stream, arcSize - kFooterSize))
+  RINOK(ReadStream_FALSE(Stream, buf, kFooterSize))
+  if (Get32(buf + 5) != kSeekTable_Magic)
+    return S_FALSE;
+  const UInt32 numFrames = Get32(buf);
+  const Byte descriptor = buf[4];
+  if ((descriptor & kDescriptor_Reserved) != 0
+      || numFrames == 0
+      || numFrames > kNumFramesMax)
+    return S_FALSE;
+  const unsigned entrySize = (descriptor & kDescriptor_Checksum) ? kEntrySize_Checksum : kEntrySize;
+  const UInt32 tableSize = numFrames * entrySize + kFooterSize;
+  if (arcSize - 4 < kSkippableHeaderSize + (UInt64)tableSize)
+    return S_FALSE;
+  const UInt64 tablePos = arcSize - kSkippableHeaderSize - tableSize;
+
+  RINOK(InStream_SeekSet(Stream, tablePos))
+  RINOK(ReadStream_FALSE(Stream, buf, kSkippableHeaderSize))
+  if (Get32(buf) != kSeekTable_SkippableMagic
+      || Get32(buf + 4) != tableSize)
+    return S_FALSE;
+
+  CByteBuffer table(numFrames * entrySize);
+  RINOK(ReadStream_FALSE(Stream, table, table.Size()))
+
+  Frames.ClearAndReserve(numFrames);
+  UInt64 packPos = 0;
+  UInt64 unpackPos = 0;
+  for (UInt32 i = 0; i < numFrames; i++)
+  {
+    const Byte *p = table + (size_t)i * entrySize;
+    CZstdFrame f;
+    f.PackPos = packPos;
+    f.UnpackPos = unpackPos;
+    f.PackSize = Get32(p);
+    f.UnpackSize = Get32(p + 4);
+    if (f.PackSize == 0 || f.UnpackSize > kFrameUnpackSizeMax)
+      return S_FALSE;
+    packPos += f.PackSize;
+    unpackPos += f.UnpackSize;
+    Frames.AddInReserved(f);
+  }
+  if (packPos != tablePos)
+    return S_FALSE;
+  Size = unpackPos;
+  PhySize = arcSize;
+  return S_OK;
+}
+
+HRESULT CZstdSeekInStream::Open(IInStream *stream)
+{
+  Stream = stream;
+  Frames.Clear();
+  _virtPos = 0;
+  _curFrame = -1;
+  UInt64 arcSize;
+  RINOK(InStream_GetSize_SeekToEnd(stream, arcSize))
+  const HRESULT res = ReadTable(arcSize);
+  if (res != S_OK)
+  {
+    Frames.Clear();
+    Stream.Release();
+    return res;
+  }
+  return S_OK;
+}
+
+Z7_COM7F_IMF(CZstdSeekInStream::Read(void *data, UInt32 size, UInt32 *processedSize))
+{
+  COM_TRY_BEGIN
+  if (processedSize)
+    *processedSize = 0;
+  if (size == 0 || _virtPos >= Size)
+    return S_OK;
+
+  if (_curFrame >= 0)
+  {
+    const CZstdFrame &f = Frames[(unsigned)_curFrame];
+    if (_virtPos < f.UnpackPos || _virtPos - f.UnpackPos >= f.UnpackSize)
+      _curFrame = -1;
+  }
+
+  if (_curFrame < 0)
+  {
+    const unsigned frameIndex = FindFrame(Frames, _virtPos);
+    const CZstdFrame &f = Frames[frameIndex];
+    _inBuf.AllocAtLeast(f.PackSize);
+    _outBuf.AllocAtLeast(f.UnpackSize);
+    RINOK(InStream_SeekSet(Stream, f.PackPos))
+    RINOK(ReadStream_FALSE(Stream, _inBuf, f.PackSize))
+    if (!_ctx)
+    {
+      _ctx = ZSTD_createDCtx_advanced(NCompress::NZSTD::g_ZstdAlloc);
+      if (!_ctx)
+        return E_OUTOFMEMORY;
+    }
+    const size_t zres = ZSTD_decompressDCtx(_ctx, _outBuf, f.UnpackSize, _inBuf, f.PackSize);
+    if (ZSTD_isError(zres))
+      return ZSTD_getErrorCode(zres) == ZSTD_error_memory_allocation ? E_OUTOFMEMORY : S_FALSE;
+    if (zres != f.UnpackSize)
+      return S_FALSE;
+    _curFrame = (int)frameIndex;
+  }
+
+  const CZstdFrame &f = Frames[(unsigned)_curFrame];
+  const UInt32 offset = (UInt32)(_virtPos - f.UnpackPos);
+  const UInt32 rem = f.UnpackSize - offset;
+  if (size > rem)
+    size = rem;
+  memcpy(data, _outBuf + offset, size);
+  _virtPos += size;
+  if (processedSize)
+    *processedSize = size;
+  return S_OK;
+  COM_TRY_END
+}
+
+Z7_COM7F_IMF(CZstdSeekInStream::Seek(Int64 offset, UInt32 seekOrigin, UInt64 *newPosition))
+{
+  switch (seekOrigin)
+  {
+    case STREAM_SEEK_SET: break;
+    case STREAM_SEEK_CUR: offset += _virtPos; break;
+    case STREAM_SEEK_END: offset += Size; break;
+    default: return STG_E_INVALIDFUNCTION;
+  }
+  if (offset < 0)
+    return HRESULT_WIN32_ERROR_NEGATIVE_SEEK;
+  _virtPos = (UInt64)offset;
+  if (newPosition)
+    *newPosition = (UInt64)offset;
+  return S_OK;
+}
+
+
+#ifndef Z7_EXTRACT_ONLY
+
+CZstdFrameEncoder::~CZstdFrameEncoder()
+{
+  ZSTD_freeCCtx(Ctx);
+}
+
+HRESULT CZstdFrameEncoder::Alloc(size_t frameSize)
+{
+  if (!Ctx)
+  {
+    Ctx = ZSTD_createCCtx_advanced(NCompress::NZSTD::g_ZstdAlloc);
+    if (!Ctx)
+      return E_OUTOFMEMORY;
+  }
+  if (ZSTD_isError(ZSTD_CCtx_setParameter(Ctx, ZSTD_c_compressionLevel, Level))
+      || ZSTD_isError(ZSTD_CCtx_setParameter(Ctx, ZSTD_c_checksumFlag, 1)))
+    return E_INVALIDARG;
+  InBuf.AllocAtLeast(frameSize);
+  OutBuf.AllocAtLeast(ZSTD_compressBound(frameSize));
+  InSize = 0;
+  return S_OK;
+}
+
+void CZstdFrameEncoder::Encode()
+{
+  const size_t zres = ZSTD_compress2(Ctx, OutBuf, OutBuf.Size(), InBuf, InSize);
+  if (ZSTD_isError(zres))
+  {
+    Res = (ZSTD_getErrorCode(zres) == ZSTD_error_memory_allocation) ? E_OUTOFMEMORY : E_FAIL;
+    return;
+  }
+  OutSize = zres;
+  Res = S_OK;
+}
+
+
+HRESULT CZstdFramesOutStream::Init(ISequentialOutStream *stream, int level, UInt32 frameSize,
+    UInt32 numThreads, UInt64 memUsage)
+{
+  _stream = stream;
+  _frameIsOpen = false;
+  _frameSize = frameSize;
+  _table.Clear();
+ #ifndef Z7_ST
+  _first = 0;
+  _numJobs = 0;
+  if (numThreads > kNumThreadsMax)
+    numThreads = kNumThreadsMax;
+  if (numThreads > 1)
+  {
+    // the ring contains (numThreads + 1) jobs: one job is filled by caller
+    const UInt64 jobMemUsage = (UInt64)frameSize
+        + ZSTD_compressBound(frameSize)
+        + ZSTD_estimateCCtxSize(level);
+    const UInt64 numJobs64 = memUsage / jobMemUsage;
+    if (numJobs64 < 3)
+      numThreads = 1;
+    else if (numThreads >= numJobs64)
+      numThreads = (UInt32)numJobs64 - 1;
+  }
+  if (numThreads > 1)
+  {
+    while (_threads.Size() < numThreads + 1)
+    {
+      CZstdFrameEncoderThread &t = _threads.AddNew();
+      t.Encoder.Level = level;
+      if (t.Encoder.Alloc(frameSize) != S_OK || t.Create() != 0)
+      {
+        _threads.DeleteBack();
+        break;
+      }
+    }
+    if (_threads.Size() >= 2)
+      return S_OK;
+    _threads.Clear();
+  }
+ #else
+  UNUSED_VAR(numThreads)
+  UNUSED_VAR(memUsage)
+ #endif
+  _encoder.Level = level;
+  return _encoder.Alloc(frameSize);
+}
+
+HRESULT CZstdFramesOutStream::WriteFrame(const CZstdFrameEncoder &job)
+{
+  RINOK(job.Res)
+  RINOK(WriteStream(_stream, job.OutBuf, job.OutSize))
+  _table.Add((UInt32)job.OutSize);
+  _table.Add((UInt32)job.InSize);
+  return S_OK;
+}
+
+#ifndef Z7_ST
+
+HRESULT CZstdFramesOutStream::WriteOldestJob()
+{
+  CZstdFrameEncoderThread &t = _threads[_first];
+  if (t.IsStarted)
+  {
+    t.WaitExecuteFinish();
+    t.IsStarted = false;
+  }
+  if (++_first == _threads.Size())
+    _first = 0;
+  _numJobs--;
+  return WriteFrame(t.Encoder);
+}
+
+#endif
+
+HRESULT CZstdFramesOutStream::CloseFrame()
+{
+  _frameIsOpen = false;
+ #ifndef Z7_ST
+  if (!_threads.IsEmpty())
+  {
+    unsigned i = _first + _numJobs - 1;
+    if (i >= _threads.Size())
+      i -= _threads.Size();
+    CZstdFrameEncoderThread &t = _threads[i];
+    if (t.Start() == 0)
+      t.IsStarted = true;
+    else
+      t.Encoder.Encode();
+    return S_OK;
+  }
+ #endif
+  _encoder.Encode();
+  return WriteFrame(_encoder);
+}
+
+HRESULT CZstdFramesOutStream::StartMember(UInt64 size)
+{
+  if (size >= _frameSize && _frameIsOpen)
+    return CloseFrame();
+  return S_OK;
+}
+
+Z7_COM7F_IMF(CZstdFramesOutStream::Write(const void *data, UInt32 size, UInt32 *processedSize))
+{
+  if (processedSize)
+    *processedSize = 0;
+  while (size != 0)
+  {
+    CZstdFrameEncoder *job = &_encoder;
+   #ifndef Z7_ST
+    if (!_threads.IsEmpty())
+    {
+      if (!_frameIsOpen && _numJobs == _threads.Size())
+        RINOK(WriteOldestJob())
+      unsigned i = _first + _numJobs - (_frameIsOpen ? 1 : 0);
+      if (i >= _threads.Size())
+        i -= _threads.Size();
+      job = &_threads[i].Encoder;
+      if (!_frameIsOpen)
+        _numJobs++;
+    }
+   #endif
+    if (!_frameIsOpen)
+    {
+      job->InSize = 0;
+      _frameIsOpen = true;
+    }
+    UInt32 cur = (UInt32)(_frameSize - job->InSize);
+    if (cur > size)
+      cur = size;
+    memcpy(job->InBuf + job->InSize, data, cur);
+    job->InSize += cur;
+    data = (const void *)((const Byte *)data + cur);
+    size -= cur;
+    if (processedSize)
+      *processedSize += cur;
+    if (job->InSize == _frameSize)
+      RINOK(CloseFrame())
+  }
+  return S_OK;
+}
+
+HRESULT CZstdFramesOutStream::Finish()
+{
+  if (_frameIsOpen)
+    RINOK(CloseFrame())
+ #ifndef Z7_ST
+  while (_numJobs != 0)
+    RINOK(WriteOldestJob())
+ #endif
+  const UInt32 numFrames = _table.Size() / 2;
+  const UInt32 tableSize = numFrames * kEntrySize + kFooterSize;
+  CByteBuffer buf(kSkippableHeaderSize + tableSize);
+  Byte *p = buf;
+  SetUi32(p, kSeekTable_SkippableMagic)
+  SetUi32(p + 4, tableSize)
+  p += kSkippableHeaderSize;
+  for (unsigned i = 0; i < _table.Size(); i++, p += 4)
+    SetUi32(p, _table[i])
+  SetUi32(p, numFrames)
+  p[4] = 0; // descriptor: no checksums
+  SetUi32(p + 5, kSeekTable_Magic)
+  return WriteStream(_stream, buf, buf.Size());
+}
+
+#endif
+
+}}
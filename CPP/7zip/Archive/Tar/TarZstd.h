@@ -0,0 +1,154 @@
+// TarZstd.h
+
+#ifndef ZIP7_INC_TAR_ZSTD_H
+#define ZIP7_INC_TAR_ZSTD_H
+
+#include "../../../../C/zstd/zstd.h"
+
+#include "../../../Common/MyBuffer.h"
+#include "../../../Common/MyCom.h"
+#include "../../../Common/MyVector.h"
+
+#ifndef Z7_ST
+#include "../../Common/VirtThread.h"
+#endif
+
+#include "../../IStream.h"
+
+/*
+tar.zst in zstd "seekable format":
+  the tar stream is split to independent zstd frames,
+  and the last frame is skippable frame with the table of sizes of all frames:
+    UInt32 SkippableMagic (0x184D2A5E)
+    UInt32 FrameSize
+    { UInt32 PackSize; UInt32 UnpackSize; [UInt32 Checksum] } [NumFrames]
+    UInt32 NumFrames
+    Byte   Descriptor (bit 7 : Checksum field is present)
+    UInt32 SeekableMagic (0x8F92EAB1)
+  Any zstd decoder can decode such file as usual zstd stream.
+
+Our writer starts new frame before header of tar member, if the size of member
+is not smaller than frame size. So the data of big member is in own frames.
+Also the frame is finished, if it reaches the frame size.
+The tar headers give the names, and the table gives the positions of frames.
+So the reader needs to decode only the frames that contain the headers
+and the data of requested members.
+*/
+
+namespace NArchive {
+namespace NTar {
+
+const UInt32 k_ZstdFrameSize_Def = 1 << 22;
+const UInt32 k_ZstdFrameSize_Min = 1 << 12;
+const UInt32 k_ZstdFrameSize_Max = 1 << 28;
+
+struct CZstdFrame
+{
+  UInt64 PackPos;
+  UInt64 UnpackPos;
+  UInt32 PackSize;
+  UInt32 UnpackSize;
+};
+
+
+Z7_CLASS_IMP_IInStream(
+  CZstdSeekInStream
+)
+  UInt64 _virtPos;
+  int _curFrame; // the frame in (_outBuf)
+  ZSTD_DCtx *_ctx;
+  CByteBuffer _inBuf;
+  CByteBuffer _outBuf;
+
+  HRESULT ReadTable(UInt64 arcSize);
+public:
+  CMyComPtr<IInStream> Stream;
+  CRecordVector<CZstdFrame> Frames;
+  UInt64 Size;
+  UInt64 PhySize;
+
+  CZstdSeekInStream(): _virtPos(0), _curFrame(-1), _ctx(NULL), Size(0), PhySize(0) {}
+  ~CZstdSeekInStream();
+  // returns S_FALSE, if (stream) is not zstd stream with seek table
+  HRESULT Open(IInStream *stream);
+};
+
+inline bool IsZstdSignature(const Byte *p)
+{
+  return p[0] == 0x28 && p[1] == 0xB5 && p[2] == 0x2F && p[3] == 0xFD;
+}
+
+
+#ifndef Z7_EXTRACT_ONLY
+
+struct CZstdFrameEncoder
+{
+  ZSTD_CCtx *Ctx;
+  CByteBuffer InBuf;
+  CByteBuffer OutBuf;
+  size_t InSize;
+  size_t OutSize;
+  int Level;
+  HRESULT Res;
+
+  Z7_CLASS_NO_COPY(CZstdFrameEncoder)
+public:
+  CZstdFrameEncoder(): Ctx(NULL), InSize(0), OutSize(0), Level(3), Res(S_OK) {}
+  ~CZstdFrameEncoder();
+  HRESULT Alloc(size_t frameSize);
+  void Encode();
+};
+
+#ifndef Z7_ST
+
+struct CZstdFrameEncoderThread: public CVirtThread
+{
+  CZstdFrameEncoder Encoder;
+  bool IsStarted;
+
+  CZstdFrameEncoderThread(): IsStarted(false) {}
+  void Execute() Z7_override { Encoder.Encode(); }
+  ~CZstdFrameEncoderThread() Z7_DESTRUCTOR_override { WaitThreadFinish(); }
+};
+
+#endif
+
+/* The caller calls StartMember() before header of each tar member,
+   and Finish() after end of tar stream.
+   In multi-threaded mode the frames are in ring of jobs:
+   the filled frame is compressed by its thread, while the caller
+   fills next frames. The frames are written in order, when the ring is full. */
+
+Z7_CLASS_IMP_NOQIB_1(
+  CZstdFramesOutStream
+  , ISequentialOutStream
+)
+  CMyComPtr<ISequentialOutStream> _stream;
+  CZstdFrameEncoder _encoder; // it's used, if there are no threads
+ #ifndef Z7_ST
+  CObjectVector<CZstdFrameEncoderThread> _threads;
+  unsigned _first;   // the oldest job that was not written
+  unsigned _numJobs; // the number of jobs in ring, including open frame
+ #endif
+  bool _frameIsOpen; // the last job can get more data
+  UInt32 _frameSize;
+  CRecordVector<UInt32> _table; // (PackSize, UnpackSize) pairs
+
+  HRESULT WriteFrame(const CZstdFrameEncoder &job);
+  HRESULT CloseFrame();
+ #ifndef Z7_ST
+  HRESULT WriteOldestJob();
+ #endif
+public:
+  // (memUsage) is limit for all jobs
+  HRESULT Init(ISequentialOutStream *stream, int level, UInt32 frameSize,
+      UInt32 numThreads, UInt64 memUsage);
+  HRESULT StartMember(UInt64 size);
+  HRESULT Finish();
+};
+
+#endif
+
+}}
+
+#endif
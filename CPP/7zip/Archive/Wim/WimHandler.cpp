@@ -1061,6 +1061,11 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
   int prevSuccessStreamIndex = -1;
 
   CUnpacker unpacker;
+ #ifndef Z7_ST
+  unpacker.NumThreads = _methodProps._numThreads;
+ #endif
+  if (_methodProps._memUsage_WasSet)
+    unpacker.MemUsage = _methodProps._memUsage_Decompress;
 
   CMyComPtr2_Create<ICompressProgressInfo, CLocalProgress> lps;
   lps->Init(extractCallback, false);
@@ -1205,11 +1210,12 @@ Z7_COM7F_IMF(CHandler::SetProperties(const wchar_t * const *names, const PROPVAR
       RINOK(ParsePropToUInt32(L"", prop, image))
       _defaultImageNumber = (int)image;
     }
-    else if (name.IsPrefixedBy_Ascii_NoCase("mt"))
-    {
-    }
-    else if (name.IsPrefixedBy_Ascii_NoCase("memuse"))
+    else if (name.IsPrefixedBy_Ascii_NoCase("mt")
+        || name.IsPrefixedBy_Ascii_NoCase("memuse"))
     {
+      HRESULT hres;
+      _methodProps.SetCommonProperty(name, prop, hres);
+      RINOK(hres)
     }
     else if (name.IsPrefixedBy_Ascii_NoCase("crc"))
     {
@@ -47,6 +47,8 @@ Z7_CLASS_IMP_CHandler_IInArchive_5(
   bool _keepMode_ShowImageNumber;
   bool _disable_Sha1Check;
 
+  CCommonMethodProps _methodProps; // "mt" and "memuse" for extraction
+
   UInt64 _phySize;
   Int32 _firstVolumeIndex;
 
@@ -59,6 +61,7 @@ Z7_CLASS_IMP_CHandler_IInArchive_5(
     _set_showImageNumber = false;
     _defaultImageNumber = -1;
     _timeOptions.Init();
+    _methodProps = CCommonMethodProps();
   }
 
   bool IsUpdateSupported() const
@@ -50,108 +50,315 @@ static bool inline GetLog_val_min_dest(const UInt32 val, unsigned i, unsigned &d
 }
 
 
-HRESULT CUnpacker::UnpackChunk(
-    ISequentialInStream *inStream,
-    unsigned method, unsigned chunkSizeBits,
-    size_t inSize, size_t outSize,
-    ISequentialOutStream *outStream)
+static const unsigned kAdditionalInputSize = 32;
+
+/* each decoder job uses the buffer for packed chunk,
+   and each cache entry uses the buffer for unpacked chunk.
+   There are (numJobs + 1) cache entries at least. */
+static const UInt64 k_Mt_MemUsage_Max = (UInt64)1 << (sizeof(size_t) > 4 ? 30 : 28);
+static const size_t k_CacheSize_Default = (size_t)1 << 25;
+// the cache is searched linearly, so we limit the number of chunks in cache
+static const unsigned k_NumCacheChunks_Max = 1 << 8;
+
+
+// ReadChunk() is called by main thread.
+// It reads packed chunk to (PackBuf) or stored chunk to (Dest).
+
+HRESULT CChunkDecoder::ReadChunk(ISequentialInStream *inStream, UInt64 &totalPacked)
 {
-  if (inSize == outSize)
+  const size_t chunkSize = (size_t)1 << ChunkSizeBits;
+
+  Res = S_FALSE;
+  UnpackedSize = 0;
+  NeedDecode = false;
+  
+  if (InSize == OutSize)
   {
+    UnpackedSize = OutSize;
+    Res = ReadStream(inStream, Dest, &UnpackedSize);
+    totalPacked += UnpackedSize;
   }
-  else if (method == NMethod::kXPRESS)
+  else if (InSize < chunkSize)
   {
+    if (Method == NMethod::kLZX)
+    {
+      lzxDecoder.Create_if_Empty();
+      lzxDecoder->Set_WimMode(true);
+    }
+    else if (Method == NMethod::kLZMS)
+      lzmsDecoder.Create_if_Empty();
+
+    PackBuf.EnsureCapacity(chunkSize + kAdditionalInputSize);
+    if (!PackBuf.Data)
+      return E_OUTOFMEMORY;
+    
+    RINOK(ReadStream_FALSE(inStream, PackBuf.Data, InSize))
+    memset(PackBuf.Data + InSize, 0xff, kAdditionalInputSize);
+
+    totalPacked += InSize;
+    NeedDecode = true;
   }
-  else if (method == NMethod::kLZX)
+  return S_OK;
+}
+
+
+void CChunkDecoder::Decode()
+{
+  if (NeedDecode)
   {
-    lzxDecoder.Create_if_Empty();
-    lzxDecoder->Set_WimMode(true);
+    if (Method == NMethod::kXPRESS)
+    {
+      Res = NCompress::NXpress::Decode_WithExceedWrite(PackBuf.Data, InSize, Dest, OutSize);
+      if (Res == S_OK)
+        UnpackedSize = OutSize;
+    }
+    else if (Method == NMethod::kLZX)
+    {
+      if (lzxDecoder->Set_ExternalWindow_DictBits(Dest, ChunkSizeBits) != S_OK)
+      {
+        Res = E_NOTIMPL;
+        return;
+      }
+      lzxDecoder->Set_KeepHistoryForNext(false);
+      lzxDecoder->Set_KeepHistory(false);
+      Res = lzxDecoder->Code_WithExceedReadWrite(PackBuf.Data, InSize, (UInt32)OutSize);
+      UnpackedSize = lzxDecoder->GetUnpackSize();
+      if (Res == S_OK && !lzxDecoder->WasBlockFinished())
+        Res = S_FALSE;
+    }
+    else
+    {
+      Res = lzmsDecoder->Code(PackBuf.Data, InSize, Dest, OutSize);
+      UnpackedSize = lzmsDecoder->GetUnpackSize();
+    }
   }
-  else if (method == NMethod::kLZMS)
+  
+  if (UnpackedSize != OutSize)
   {
-    lzmsDecoder.Create_if_Empty();
+    if (Res == S_OK)
+      Res = S_FALSE;
+    
+    if (UnpackedSize > OutSize)
+      Res = S_FALSE;
+    else
+      memset(Dest + UnpackedSize, 0, OutSize - UnpackedSize);
   }
-  else
-    return E_NOTIMPL;
+}
 
-  const size_t chunkSize = (size_t)1 << chunkSizeBits;
 
+int CUnpacker::FindCacheChunk(IInStream *inStream, UInt64 packPos) const
+{
+  FOR_VECTOR (i, _cache)
   {
-    const unsigned
-        kAdditionalOutputBufSize = MyMax(NCompress::NLzx::
-        kAdditionalOutputBufSize,        NCompress::NXpress::
-        kAdditionalOutputBufSize);
-    unpackBuf.EnsureCapacity(chunkSize + kAdditionalOutputBufSize);
-    if (!unpackBuf.Data)
-      return E_OUTOFMEMORY;
+    const CCacheChunk &cc = _cache[i];
+    if (cc.LastUse != 0 && cc.PackPos == packPos && cc.Stream == inStream)
+      return (int)i;
   }
-  
-  HRESULT res = S_FALSE;
-  size_t unpackedSize = 0;
-  
-  if (inSize == outSize)
+  return -1;
+}
+
+
+unsigned CUnpacker::AllocCacheChunk()
+{
+  // the caller marks the returned entry as used, so the next call returns another entry
+  if (_cache.Size() < _numCacheChunksMax)
   {
-    unpackedSize = outSize;
-    res = ReadStream(inStream, unpackBuf.Data, &unpackedSize);
-    TotalPacked += unpackedSize;
+    _cache.AddNew();
+    return _cache.Size() - 1;
   }
-  else if (inSize < chunkSize)
+  unsigned best = 0;
+  FOR_VECTOR (i, _cache)
+    if (_cache[i].LastUse < _cache[best].LastUse)
+      best = i;
+  return best;
+}
+
+
+// it creates the decoder threads and sets the cache limit for chunks of (chunkSizeBits)
+
+unsigned CUnpacker::GetNumJobsMax(unsigned chunkSizeBits)
+{
+  UInt64 memUsage = MemUsage;
+  if (memUsage > k_Mt_MemUsage_Max)
+    memUsage = k_Mt_MemUsage_Max;
+  const UInt64 numBufsMax = memUsage >> chunkSizeBits;
+
+  UInt32 numJobs = NumThreads;
+  if (numJobs > k_Unpacker_NumThreads_Max)
+    numJobs = k_Unpacker_NumThreads_Max;
   {
-    const unsigned kAdditionalInputSize = 32;
-    packBuf.EnsureCapacity(chunkSize + kAdditionalInputSize);
-    if (!packBuf.Data)
-      return E_OUTOFMEMORY;
-    
-    RINOK(ReadStream_FALSE(inStream, packBuf.Data, inSize))
-    memset(packBuf.Data + inSize, 0xff, kAdditionalInputSize);
+    // (numJobs) packed buffers and (numJobs + 1) cache entries
+    const UInt64 numMax = numBufsMax < 3 ? 1 : (numBufsMax - 1) / 2;
+    if (numJobs > numMax)
+      numJobs = (UInt32)numMax;
+  }
+  if (numJobs == 0)
+    numJobs = 1;
 
-    TotalPacked += inSize;
-    
-    if (method == NMethod::kXPRESS)
+ #ifndef Z7_ST
+  while (_decoderThreads.Size() + 1 < numJobs)
+  {
+    CChunkDecoderThread &t = _decoderThreads.AddNew();
+    if (t.Create() != 0)
     {
-      res = NCompress::NXpress::Decode_WithExceedWrite(packBuf.Data, inSize, unpackBuf.Data, outSize);
-      if (res == S_OK)
-        unpackedSize = outSize;
+      _decoderThreads.DeleteBack();
+      break;
     }
-    else if (method == NMethod::kLZX)
+  }
+  if (numJobs > _decoderThreads.Size() + 1)
+    numJobs = _decoderThreads.Size() + 1;
+ #else
+  numJobs = 1;
+ #endif
+
+  unsigned numCache = k_NumCacheChunks_Max;
+  {
+    const size_t num = k_CacheSize_Default >> chunkSizeBits;
+    if (numCache > num)
+      numCache = (unsigned)num;
+    if (numBufsMax > numJobs && numCache > numBufsMax - numJobs)
+      numCache = (unsigned)(numBufsMax - numJobs);
+  }
+  // the requested chunk must stay in cache, while other jobs use another entries
+  if (numCache < numJobs + 1)
+    numCache = numJobs + 1;
+  _numCacheChunksMax = numCache;
+  // the entries with big buffers of previous calls are not kept over the limit
+  if (_cache.Size() > numCache)
+    _cache.DeleteFrom(numCache);
+  
+  return numJobs;
+}
+
+
+/*
+DecodeChunks() reads the packed data of (chunks[0]) and of next chunks sequentially,
+and then it decodes these chunks in parallel to cache.
+The read-ahead stops at first chunk that is in cache already.
+Only the error of (chunks[0]) is returned. If some next chunk can't be
+decoded, it's not added to cache, and the error will be returned, if that
+chunk is requested later. Data errors (S_FALSE) are stored in cache entries.
+*/
+
+HRESULT CUnpacker::DecodeChunks(
+    IInStream *inStream,
+    unsigned method, unsigned chunkSizeBits,
+    const CChunkInfo *chunks, unsigned numChunks)
+{
+  if (method != NMethod::kXPRESS &&
+      method != NMethod::kLZX &&
+      method != NMethod::kLZMS)
+    return E_NOTIMPL;
+
+  const unsigned numJobsMax = GetNumJobsMax(chunkSizeBits);
+  if (numChunks > numJobsMax)
+    numChunks = numJobsMax;
+
+  const size_t chunkSize = (size_t)1 << chunkSizeBits;
+  const unsigned
+      kAdditionalOutputBufSize = MyMax(NCompress::NLzx::
+      kAdditionalOutputBufSize,        NCompress::NXpress::
+      kAdditionalOutputBufSize);
+
+  unsigned cacheIndexes[k_Unpacker_NumThreads_Max];
+  unsigned numJobs = 0;
+
+  for (; numJobs < numChunks; numJobs++)
+  {
+    const CChunkInfo &ci = chunks[numJobs];
+    if (numJobs != 0 && FindCacheChunk(inStream, ci.PackPos) >= 0)
+      break;
+   #ifndef Z7_ST
+    CChunkDecoder &dec = (numJobs == 0 ? _decoder : _decoderThreads[numJobs - 1].Decoder);
+   #else
+    CChunkDecoder &dec = _decoder;
+   #endif
+
+    const unsigned cacheIndex = AllocCacheChunk();
+    CCacheChunk &cc = _cache[cacheIndex];
+    cc.LastUse = 0;
+    cc.Buf.EnsureCapacity(chunkSize + kAdditionalOutputBufSize);
+    if (!cc.Buf.Data)
     {
-      res = lzxDecoder->Set_ExternalWindow_DictBits(unpackBuf.Data, chunkSizeBits);
-      if (res != S_OK)
-        return E_NOTIMPL;
-      lzxDecoder->Set_KeepHistoryForNext(false);
-      lzxDecoder->Set_KeepHistory(false);
-      res = lzxDecoder->Code_WithExceedReadWrite(packBuf.Data, inSize, (UInt32)outSize);
-      unpackedSize = lzxDecoder->GetUnpackSize();
-      if (res == S_OK && !lzxDecoder->WasBlockFinished())
-        res = S_FALSE;
+      if (numJobs == 0)
+        return E_OUTOFMEMORY;
+      break;
     }
-    else
+
+    dec.Method = method;
+    dec.ChunkSizeBits = chunkSizeBits;
+    dec.InSize = ci.PackSize;
+    dec.OutSize = ci.UnpackSize;
+    dec.Dest = cc.Buf.Data;
+
+    HRESULT res = InStream_SeekSet(inStream, ci.PackPos);
+    if (res == S_OK)
+      res = dec.ReadChunk(inStream, TotalPacked);
+    if (res != S_OK)
     {
-      res = lzmsDecoder->Code(packBuf.Data, inSize, unpackBuf.Data, outSize);
-      unpackedSize = lzmsDecoder->GetUnpackSize();
+      if (numJobs == 0)
+        return res;
+      break;
     }
+
+    cc.Stream = inStream;
+    cc.PackPos = ci.PackPos;
+    // it protects the entry from AllocCacheChunk() calls for next chunks
+    cc.LastUse = ++_cacheUseCounter;
+    cacheIndexes[numJobs] = cacheIndex;
   }
-  
-  if (unpackedSize != outSize)
+
+  // the job 0 is decoded by this thread, and other jobs by decoder threads
+ #ifndef Z7_ST
+  unsigned numStarted = 0;
+  for (unsigned i = 1; i < numJobs; i++)
   {
-    if (res == S_OK)
-      res = S_FALSE;
-    
-    if (unpackedSize > outSize)
-      res = S_FALSE;
-    else
-      memset(unpackBuf.Data + unpackedSize, 0, outSize - unpackedSize);
+    if (_decoderThreads[i - 1].Start() != 0)
+      break;
+    numStarted++;
   }
-  
-  if (outStream)
+ #endif
+
+  _decoder.Decode();
+
+ #ifndef Z7_ST
+  for (unsigned i = numStarted + 1; i < numJobs; i++)
+    _decoderThreads[i - 1].Decoder.Decode();
+  for (unsigned i = 0; i < numStarted; i++)
+    _decoderThreads[i].WaitExecuteFinish();
+ #endif
+
+  HRESULT res = S_OK;
+  for (unsigned i = 0; i < numJobs; i++)
   {
-    RINOK(WriteStream(outStream, unpackBuf.Data, outSize))
+   #ifndef Z7_ST
+    const CChunkDecoder &dec = (i == 0 ? _decoder : _decoderThreads[i - 1].Decoder);
+   #else
+    const CChunkDecoder &dec = _decoder;
+   #endif
+    CCacheChunk &cc = _cache[cacheIndexes[i]];
+    cc.Res = dec.Res;
+    if (dec.Res != S_OK && dec.Res != S_FALSE)
+    {
+      cc.LastUse = 0;
+      if (i == 0)
+        res = dec.Res;
+    }
   }
-  
   return res;
 }
 
 
+static UInt64 GetChunkEnd(const Byte *sizes, size_t index, size_t numChunks,
+    unsigned entrySizeShifts, UInt64 packDataSize)
+{
+  if (index + 1 >= numChunks)
+    return packDataSize;
+  const Byte *p = sizes + (index << entrySizeShifts);
+  return (entrySizeShifts == 2) ? Get32(p): Get64(p);
+}
+
+
 HRESULT CUnpacker::Unpack2(
     IInStream *inStream,
     const CResource &resource,
@@ -181,6 +388,8 @@ HRESULT CUnpacker::Unpack2(
     return res;
   }
   
+  CChunkInfo chunks[k_Unpacker_NumThreads_Max];
+
   if (resource.IsSolid())
   {
     if (!db || resource.SolidIndex < 0)
@@ -192,6 +401,9 @@ HRESULT CUnpacker::Unpack2(
     
     const unsigned chunkSizeBits = ss.ChunkSizeBits;
     const size_t chunkSize = (size_t)1 << chunkSizeBits;
+    const size_t numChunks = (size_t)((ss.UnpackSize + chunkSize - 1) >> chunkSizeBits);
+    const CResource &rs = db->DataStreams[ss.StreamIndex].Resource;
+    const UInt64 packBase = rs.Offset + ss.HeadersSize;
     
     size_t chunkIndex = 0;
     UInt64 rem = ss.UnpackSize;
@@ -215,47 +427,44 @@ HRESULT CUnpacker::Unpack2(
     UInt64 packProcessed = 0;
     UInt64 outProcessed = 0;
     
-    if (_solidIndex == resource.SolidIndex && _unpackedChunkIndex == chunkIndex)
-    {
-      size_t cur = chunkSize - offsetInChunk;
-      if (cur > rem)
-        cur = (size_t)rem;
-      RINOK(WriteStream(outStream, unpackBuf.Data + offsetInChunk, cur))
-      outProcessed += cur;
-      rem -= cur;
-      offsetInChunk = 0;
-      chunkIndex++;
-    }
-    
     for (;;)
     {
       if (rem == 0)
         return S_OK;
     
-      const UInt64 offset = ss.Chunks[chunkIndex];
       const UInt64 packSize = ss.GetChunkPackSize(chunkIndex);
-      const CResource &rs = db->DataStreams[ss.StreamIndex].Resource;
-      RINOK(InStream_SeekSet(inStream, rs.Offset + ss.HeadersSize + offset))
-      
-      size_t cur = chunkSize;
-      const UInt64 unpackRem = ss.UnpackSize - ((UInt64)chunkIndex << chunkSizeBits);
-      if (cur > unpackRem)
-        cur = (size_t)unpackRem;
-      
-      _solidIndex = -1;
-      _unpackedChunkIndex = 0;
+      int cacheIndex = FindCacheChunk(inStream, packBase + ss.Chunks[chunkIndex]);
       
-      const HRESULT res = UnpackChunk(inStream, (unsigned)ss.Method, chunkSizeBits, (size_t)packSize, cur, NULL);
-      
-      if (res != S_OK)
+      if (cacheIndex < 0)
       {
+        // the next chunks of solid stream are decoded ahead, because next files can use them
+        unsigned num = 0;
+        for (size_t c = chunkIndex; c < numChunks && num < k_Unpacker_NumThreads_Max; c++)
+        {
+          CChunkInfo &ci = chunks[num++];
+          ci.PackPos = packBase + ss.Chunks[c];
+          ci.PackSize = (size_t)ss.GetChunkPackSize(c);
+          ci.UnpackSize = chunkSize;
+          const UInt64 unpackRem = ss.UnpackSize - ((UInt64)c << chunkSizeBits);
+          if (ci.UnpackSize > unpackRem)
+            ci.UnpackSize = (size_t)unpackRem;
+        }
+        
+        const HRESULT res = DecodeChunks(inStream, (unsigned)ss.Method, chunkSizeBits, chunks, num);
         // We ignore data errors in solid stream. SHA will show what files are bad.
-        if (res != S_FALSE)
-          return res;
+        RINOK(res)
+        cacheIndex = FindCacheChunk(inStream, packBase + ss.Chunks[chunkIndex]);
+        if (cacheIndex < 0)
+          return E_FAIL;
       }
       
-      _solidIndex = resource.SolidIndex;
-      _unpackedChunkIndex = chunkIndex;
+      CCacheChunk &cc = _cache[(unsigned)cacheIndex];
+      cc.LastUse = ++_cacheUseCounter;
+
+      size_t cur = chunkSize;
+      const UInt64 unpackRem = ss.UnpackSize - ((UInt64)chunkIndex << chunkSizeBits);
+      if (cur > unpackRem)
+        cur = (size_t)unpackRem;
 
       if (cur < offsetInChunk)
         return E_FAIL;
@@ -265,7 +474,7 @@ HRESULT CUnpacker::Unpack2(
       if (cur > rem)
         cur = (size_t)rem;
       
-      RINOK(WriteStream(outStream, unpackBuf.Data + offsetInChunk, cur))
+      RINOK(WriteStream(outStream, cc.Buf.Data + offsetInChunk, cur))
       
       if (progress)
       {
@@ -316,32 +525,21 @@ HRESULT CUnpacker::Unpack2(
     numChunks = (size_t)numChunks64;
   }
 
-  _solidIndex = -1;
-  _unpackedChunkIndex = 0;
-
   UInt64 outProcessed = 0;
   UInt64 offset = 0;
   
   for (size_t i = 0; i < numChunks; i++)
   {
-    UInt64 nextOffset = packDataSize;
-    
-    if (i + 1 < numChunks)
-    {
-      const Byte *p = (const Byte *)sizesBuf + (i << entrySizeShifts);
-      nextOffset = (entrySizeShifts == 2) ? Get32(p): Get64(p);
-    }
+    const UInt64 nextOffset = GetChunkEnd(sizesBuf, i, numChunks, entrySizeShifts, packDataSize);
     
     if (nextOffset < offset)
       return S_FALSE;
 
-    UInt64 inSize64 = nextOffset - offset;
-    size_t inSize = (size_t)inSize64;
+    const UInt64 inSize64 = nextOffset - offset;
+    const size_t inSize = (size_t)inSize64;
     if (inSize != inSize64)
       return S_FALSE;
 
-    RINOK(InStream_SeekSet(inStream, baseOffset + offset))
-
     if (progress)
     {
       RINOK(progress->SetRatioInfo(&offset, &outProcessed))
@@ -352,7 +550,44 @@ HRESULT CUnpacker::Unpack2(
     if (outSize > rem)
       outSize = (size_t)rem;
 
-    RINOK(UnpackChunk(inStream, header.GetMethod(), chunkSizeBits, inSize, outSize, outStream))
+    int cacheIndex = FindCacheChunk(inStream, baseOffset + offset);
+    
+    if (cacheIndex < 0)
+    {
+      // the next chunks of this resource are decoded ahead
+      chunks[0].PackPos = baseOffset + offset;
+      chunks[0].PackSize = inSize;
+      chunks[0].UnpackSize = outSize;
+      unsigned num = 1;
+      {
+        UInt64 offs = nextOffset;
+        UInt64 outPos = outProcessed + outSize;
+        for (size_t c = i + 1; c < numChunks && num < k_Unpacker_NumThreads_Max; c++)
+        {
+          const UInt64 next = GetChunkEnd(sizesBuf, c, numChunks, entrySizeShifts, packDataSize);
+          if (next < offs || (size_t)(next - offs) != next - offs)
+            break;
+          CChunkInfo &ci = chunks[num++];
+          ci.PackPos = baseOffset + offs;
+          ci.PackSize = (size_t)(next - offs);
+          ci.UnpackSize = (size_t)1 << chunkSizeBits;
+          if (ci.UnpackSize > unpackSize - outPos)
+            ci.UnpackSize = (size_t)(unpackSize - outPos);
+          outPos += ci.UnpackSize;
+          offs = next;
+        }
+      }
+      RINOK(DecodeChunks(inStream, header.GetMethod(), chunkSizeBits, chunks, num))
+      cacheIndex = FindCacheChunk(inStream, baseOffset + offset);
+      if (cacheIndex < 0)
+        return E_FAIL;
+    }
+
+    CCacheChunk &cc = _cache[(unsigned)cacheIndex];
+    cc.LastUse = ++_cacheUseCounter;
+
+    RINOK(WriteStream(outStream, cc.Buf.Data, outSize))
+    RINOK(cc.Res)
 
     outProcessed += outSize;
     offset = nextOffset;
@@ -15,6 +15,10 @@
 #include "../../Compress/LzmsDecoder.h"
 #include "../../Compress/LzxDecoder.h"
 
+#ifndef Z7_ST
+#include "../../Common/VirtThread.h"
+#endif
+
 #include "../IArchive.h"
 
 namespace NArchive {
@@ -596,26 +600,89 @@ struct CMidBuf
 };
 
 
-class CUnpacker
+// CChunkDecoder decodes one chunk from (PackBuf) to (Dest)
+
+struct CChunkDecoder
 {
-  CMyComPtr2<ICompressCoder, NCompress::CCopyCoder> copyCoder;
   CMyUniquePtr<NCompress::NLzx::CDecoder> lzxDecoder;
   CMyUniquePtr<NCompress::NLzms::CDecoder> lzmsDecoder;
+  CMidBuf PackBuf;
 
-  CByteBuffer sizesBuf;
+  unsigned Method;
+  unsigned ChunkSizeBits;
+  size_t InSize;
+  size_t OutSize;
+  size_t UnpackedSize;
+  Byte *Dest;
+  bool NeedDecode;
+  HRESULT Res;
+
+  CChunkDecoder(): lzmsDecoder(NULL) {}
+
+  HRESULT ReadChunk(ISequentialInStream *inStream, UInt64 &totalPacked);
+  void Decode();
+};
+
+#ifndef Z7_ST
+
+struct CChunkDecoderThread: public CVirtThread
+{
+  CChunkDecoder Decoder;
+
+  void Execute() Z7_override { Decoder.Decode(); }
+  ~CChunkDecoderThread() Z7_DESTRUCTOR_override { WaitThreadFinish(); }
+};
 
-  CMidBuf packBuf;
-  CMidBuf unpackBuf;
+#endif
+
+struct CCacheChunk
+{
+  CMidBuf Buf;
+  IInStream *Stream;
+  UInt64 PackPos;
+  HRESULT Res;    // S_OK or S_FALSE (data error)
+  UInt64 LastUse; // 0 : the entry is empty
+
+  CCacheChunk(): LastUse(0) {}
+};
+
+struct CChunkInfo
+{
+  UInt64 PackPos;
+  size_t PackSize;
+  size_t UnpackSize;
+};
 
-  // solid resource
-  int _solidIndex;
-  size_t _unpackedChunkIndex;
+const unsigned k_Unpacker_NumThreads_Max = 64;
 
-  HRESULT UnpackChunk(
-      ISequentialInStream *inStream,
+class CUnpacker
+{
+  CMyComPtr2<ICompressCoder, NCompress::CCopyCoder> copyCoder;
+
+  CByteBuffer sizesBuf;
+
+  /* decoded chunks are kept in LRU cache, keyed by stream and position of packed chunk.
+     So the chunks of solid stream and the streams that are extracted
+     several times are not decoded again.
+     If there are several threads, the next chunks of resource
+     (or of solid stream) are decoded in parallel with requested chunk. */
+  CObjectVector<CCacheChunk> _cache;
+  UInt64 _cacheUseCounter;
+  unsigned _numCacheChunksMax;
+
+  CChunkDecoder _decoder;
+ #ifndef Z7_ST
+  CObjectVector<CChunkDecoderThread> _decoderThreads;
+ #endif
+
+  int FindCacheChunk(IInStream *inStream, UInt64 packPos) const;
+  unsigned AllocCacheChunk();
+  unsigned GetNumJobsMax(unsigned chunkSizeBits);
+
+  HRESULT DecodeChunks(
+      IInStream *inStream,
       unsigned method, unsigned chunkSizeBits,
-      size_t inSize, size_t outSize,
-      ISequentialOutStream *outStream);
+      const CChunkInfo *chunks, unsigned numChunks);
 
   HRESULT Unpack2(
       IInStream *inStream,
@@ -627,12 +694,15 @@ class CUnpacker
 
 public:
   UInt64 TotalPacked;
+  UInt32 NumThreads;
+  UInt64 MemUsage; // limit for chunk buffers of decoders and cache
 
   CUnpacker():
-      lzmsDecoder(NULL),
-      _solidIndex(-1),
-      _unpackedChunkIndex(0),
-      TotalPacked(0)
+      _cacheUseCounter(0),
+      _numCacheChunksMax(1),
+      TotalPacked(0),
+      NumThreads(1),
+      MemUsage((UInt64)(Int64)-1)
       {}
 
   HRESULT Unpack(
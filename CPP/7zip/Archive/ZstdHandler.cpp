@@ -8,7 +8,11 @@
 
 #include "../Common/ProgressUtils.h"
 #include "../Common/RegisterArc.h"
+#include "../Common/StreamObjects.h"
 #include "../Common/StreamUtils.h"
+#ifndef Z7_ST
+#include "../Common/VirtThread.h"
+#endif
 
 #include "../Compress/ZstdDecoder.h"
 #include "../Compress/ZstdEncoder.h"
@@ -17,12 +21,15 @@
 #include "Common/DummyOutStream.h"
 #include "Common/HandlerOut.h"
 
+#include "Tar/TarZstd.h"
+
 using namespace NWindows;
 
 namespace NArchive {
 namespace NZSTD {
 
-Z7_CLASS_IMP_CHandler_IInArchive_3(
+Z7_CLASS_IMP_CHandler_IInArchive_4(
+  IInArchiveGetStream,
   IArchiveOpenSeq,
   IOutArchive,
   ISetProperties
@@ -36,11 +43,16 @@ Z7_CLASS_IMP_CHandler_IInArchive_3(
 
   bool _packSize_Defined;
   bool _unpackSize_Defined;
+  bool _seekTable; // the frames can be decoded by CZstdSeekInStream
 
   UInt64 _packSize;
   UInt64 _unpackSize;
+  UInt32 _numFrames;
 
   CSingleMethodProps _props;
+  UInt32 _segmentSize; // 0 : single frame
+public:
+  CHandler(): _segmentSize(0) {}
 };
 
 static const Byte kProps[] =
@@ -58,8 +70,16 @@ static const Byte kArcProps[] =
 IMP_IInArchive_Props
 IMP_IInArchive_ArcProps
 
-Z7_COM7F_IMF(CHandler::GetArchiveProperty(PROPID /*propID*/, PROPVARIANT * /*value*/))
+Z7_COM7F_IMF(CHandler::GetArchiveProperty(PROPID propID, PROPVARIANT *value))
 {
+  NCOM::CPropVariant prop;
+  switch (propID)
+  {
+    case kpidNumBlocks: if (_seekTable) prop = _numFrames; break;
+    // the item (tar) is opened as archive with random access to frames
+    case kpidMainSubfile: if (_seekTable) prop = (UInt32)0; break;
+  }
+  prop.Detach(value);
   return S_OK;
 }
 
@@ -127,8 +147,41 @@ Z7_COM7F_IMF(CHandler::Open(IInStream *stream, const UInt64 *, IArchiveOpenCallb
     _isArc = true;
     _stream = stream;
     _seqStream = stream;
-    RINOK(_stream->Seek(0, STREAM_SEEK_SET, NULL));
   }
+  {
+    // the stream in seekable format (tar.zst written by tar handler) has the table of frames
+    CMyComPtr2_Create<IInStream, NTar::CZstdSeekInStream> seekStream;
+    const HRESULT res = seekStream->Open(stream);
+    if (res == S_OK)
+    {
+      _seekTable = true;
+      _numFrames = seekStream->Frames.Size();
+      _packSize = seekStream->PhySize;
+      _unpackSize = seekStream->Size;
+      _packSize_Defined = true;
+      _unpackSize_Defined = true;
+    }
+    else if (res != S_FALSE)
+      return res;
+  }
+  RINOK(_stream->Seek(0, STREAM_SEEK_SET, NULL));
+  return S_OK;
+  COM_TRY_END
+}
+
+
+Z7_COM7F_IMF(CHandler::GetStream(UInt32 index, ISequentialInStream **stream))
+{
+  COM_TRY_BEGIN
+  *stream = NULL;
+  if (index != 0)
+    return E_INVALIDARG;
+  if (!_seekTable || !_stream)
+    return S_FALSE;
+  CMyComPtr2<ISequentialInStream, NTar::CZstdSeekInStream> seekStream;
+  seekStream.Create_if_Empty();
+  RINOK(seekStream->Open(_stream))
+  *stream = seekStream.Detach();
   return S_OK;
   COM_TRY_END
 }
@@ -150,8 +203,10 @@ Z7_COM7F_IMF(CHandler::Close())
 
   _packSize_Defined = false;
   _unpackSize_Defined = false;
+  _seekTable = false;
 
   _packSize = 0;
+  _numFrames = 0;
 
   _seqStream.Release();
   _stream.Release();
@@ -184,6 +239,14 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
 
   {
 
+  if (_stream)
+  {
+    // the archive is read sequentially
+    Z7_DECL_CMyComPtr_QI_FROM(IStreamAdvise, advise, _stream)
+    if (advise)
+      advise->Advise(0, (UInt64)(Int64)-1, NStreamAdvise::kSequential);
+  }
+
   NCompress::NZSTD::CDecoder *decoderSpec = new NCompress::NZSTD::CDecoder;
   CMyComPtr<ICompressCoder> decoder = decoderSpec;
   decoderSpec->SetInStream(_seqStream);
@@ -258,10 +321,195 @@ Z7_COM7F_IMF(CHandler::Extract(const UInt32 *indices, UInt32 numItems,
   COM_TRY_END
 }
 
+/* segment mode (-mzsf=size):
+   the input is split to segments that are compressed as independent frames
+   by the pool of threads, while the main thread reads next segments
+   and writes the finished frames in the original order.
+   Each frame is preceded by skippable frame with the size of frame, as in zstdmt:
+     UInt32 0x184D2A50; UInt32 4; UInt32 PackSize;
+   So the decoder can find all frames without decoding. */
+
+static const UInt32 kSegmentSize_Def = (UInt32)1 << 25;
+static const UInt32 kSegmentSize_Min = (UInt32)1 << 16;
+static const UInt32 kSegmentSize_Max = (UInt32)1 << 30;
+#ifndef Z7_ST
+static const unsigned kNumSegmentThreadsMax = 64;
+#endif
+
+static const UInt32 kSkippableMagic_Zstdmt = 0x184D2A50;
+static const unsigned kSkippableHeaderSize_Zstdmt = 12;
+
+struct CSegmentEncoder
+{
+  CMyComPtr2<ICompressCoder, NCompress::NZSTD::CEncoder> Encoder;
+  CMyComPtr2<ISequentialInStream, CBufInStream> InStream;
+  CMyComPtr2<ISequentialOutStream, CDynBufSeqOutStream> OutStream;
+  CByteBuffer InBuf;
+  size_t InSize;
+  HRESULT Res;
+
+  HRESULT Create(const CSingleMethodProps &props, UInt32 segmentSize);
+  void Encode();
+};
+
+HRESULT CSegmentEncoder::Create(const CSingleMethodProps &props, UInt32 segmentSize)
+{
+  Encoder.Create_if_Empty();
+  Encoder->dictIDFlag = 1;
+  Encoder->checksumFlag = 1;
+  const UInt64 reduceSize = segmentSize;
+  RINOK(props.SetCoderProps(Encoder.ClsPtr(), &reduceSize))
+  // the threads of pool are used instead of zstd workers
+  ICompressSetCoderMt *setCoderMt = Encoder.ClsPtr();
+  RINOK(setCoderMt->SetNumberOfThreads(1))
+  InStream.Create_if_Empty();
+  OutStream.Create_if_Empty();
+  InBuf.Alloc(segmentSize);
+  InSize = 0;
+  return S_OK;
+}
+
+void CSegmentEncoder::Encode()
+{
+  InStream->Init(InBuf, InSize);
+  OutStream->Init();
+  Encoder->unpackSize = InSize;
+  Res = Encoder.Interface()->Code(InStream, OutStream, NULL, NULL, NULL);
+}
+
+#ifndef Z7_ST
+
+struct CSegmentJob: public CVirtThread
+{
+  CSegmentEncoder Encoder;
+  bool IsStarted;
+
+  void Execute() Z7_override { Encoder.Encode(); }
+  ~CSegmentJob() Z7_DESTRUCTOR_override { WaitThreadFinish(); }
+};
+
+#else
+
+struct CSegmentJob
+{
+  CSegmentEncoder Encoder;
+};
+
+#endif
+
+static HRESULT EncodeSegments(
+    ISequentialInStream *inStream,
+    ISequentialOutStream *outStream,
+    const CSingleMethodProps &props,
+    UInt32 segmentSize,
+    ICompressProgressInfo *progress)
+{
+  CObjectVector<CSegmentJob> jobs;
+ #ifndef Z7_ST
+  {
+    UInt32 numThreads = props._numThreads;
+    if (numThreads > kNumSegmentThreadsMax)
+      numThreads = kNumSegmentThreadsMax;
+    if (numThreads > 1)
+    {
+      /* each job keeps input segment, output frame and zstd stream context.
+         (_memUsage_Compress) is "memuse" or the default limit from RAM size. */
+      int level = props.GetLevel();
+      if (level > ZSTD_maxCLevel())
+        level = ZSTD_maxCLevel();
+      const UInt64 jobMemUsage = (UInt64)segmentSize
+          + ZSTD_compressBound(segmentSize)
+          + ZSTD_estimateCStreamSize(level);
+      const UInt64 numThreads64 = props._memUsage_Compress / jobMemUsage;
+      if (numThreads > numThreads64)
+        numThreads = numThreads64 == 0 ? 1 : (UInt32)numThreads64;
+    }
+    do
+    {
+      CSegmentJob &job = jobs.AddNew();
+      const HRESULT res = job.Encoder.Create(props, segmentSize);
+      if (res != S_OK || job.Create() != 0)
+      {
+        jobs.DeleteBack();
+        if (jobs.IsEmpty())
+          return res != S_OK ? res : E_FAIL;
+        break;
+      }
+    }
+    while (jobs.Size() < numThreads);
+  }
+ #else
+  RINOK(jobs.AddNew().Encoder.Create(props, segmentSize))
+ #endif
+
+  const unsigned numJobs = jobs.Size();
+  unsigned first = 0; // the oldest job that was not written
+  unsigned numPending = 0;
+  bool finished = false;
+  UInt64 numSegments = 0;
+  UInt64 inSize = 0;
+  UInt64 outSize = 0;
+
+  for (;;)
+  {
+    if (numPending == numJobs || (finished && numPending != 0))
+    {
+      CSegmentJob &job = jobs[first];
+     #ifndef Z7_ST
+      if (job.IsStarted)
+        job.WaitExecuteFinish();
+     #endif
+      CSegmentEncoder &enc = job.Encoder;
+      RINOK(enc.Res)
+      const size_t packSize = enc.OutStream->GetSize();
+      if (packSize > (UInt32)0xFFFFFFFF)
+        return E_FAIL;
+      Byte header[kSkippableHeaderSize_Zstdmt];
+      SetUi32(header, kSkippableMagic_Zstdmt)
+      SetUi32(header + 4, 4)
+      SetUi32(header + 8, (UInt32)packSize)
+      RINOK(WriteStream(outStream, header, kSkippableHeaderSize_Zstdmt))
+      RINOK(WriteStream(outStream, enc.OutStream->GetBuffer(), packSize))
+      inSize += enc.InSize;
+      outSize += kSkippableHeaderSize_Zstdmt + packSize;
+      if (progress)
+        RINOK(progress->SetRatioInfo(&inSize, &outSize))
+      if (++first == numJobs)
+        first = 0;
+      numPending--;
+      continue;
+    }
+    if (finished)
+      return S_OK;
+
+    unsigned index = first + numPending;
+    if (index >= numJobs)
+      index -= numJobs;
+    CSegmentJob &job = jobs[index];
+    CSegmentEncoder &enc = job.Encoder;
+    size_t size = segmentSize;
+    RINOK(ReadStream(inStream, enc.InBuf, &size))
+    if (size != segmentSize)
+      finished = true;
+    // empty input is stored as one empty frame
+    if (size == 0 && numSegments != 0)
+      continue;
+    numSegments++;
+    enc.InSize = size;
+   #ifndef Z7_ST
+    job.IsStarted = (job.Start() == 0);
+    if (!job.IsStarted)
+   #endif
+      enc.Encode();
+    numPending++;
+  }
+}
+
 static HRESULT UpdateArchive(
     UInt64 unpackSize,
     ISequentialOutStream *outStream,
-    const CProps &props,
+    const CSingleMethodProps &props,
+    UInt32 segmentSize,
     IArchiveUpdateCallback *updateCallback)
 {
   RINOK(updateCallback->SetTotal(unpackSize));
@@ -270,6 +518,11 @@ static HRESULT UpdateArchive(
   CLocalProgress *localProgressSpec = new CLocalProgress;
   CMyComPtr<ICompressProgressInfo> localProgress = localProgressSpec;
   localProgressSpec->Init(updateCallback, true);
+  if (segmentSize != 0)
+  {
+    RINOK(EncodeSegments(fileInStream, outStream, props, segmentSize, localProgress))
+    return updateCallback->SetOperationResult(NArchive::NUpdate::NOperationResult::kOK);
+  }
   NCompress::NZSTD::CEncoder *encoderSpec = new NCompress::NZSTD::CEncoder;
   // by zstd archive type store dictID and checksum (similar to zstd client)
   encoderSpec->dictIDFlag = 1;
@@ -322,7 +575,7 @@ Z7_COM7F_IMF(CHandler::UpdateItems(ISequentialOutStream *outStream, UInt32 numIt
         return E_INVALIDARG;
       size = prop.uhVal.QuadPart;
     }
-    return UpdateArchive(size, outStream, _props, updateCallback);
+    return UpdateArchive(size, outStream, _props, _segmentSize, updateCallback);
   }
 
   if (indexInArchive != 0)
@@ -351,7 +604,31 @@ Z7_COM7F_IMF(CHandler::UpdateItems(ISequentialOutStream *outStream, UInt32 numIt
 
 Z7_COM7F_IMF(CHandler::SetProperties(const wchar_t * const *names, const PROPVARIANT *values, UInt32 numProps))
 {
-  return _props.SetProperties(names, values, numProps);
+  // "zsf" is parsed here, other properties are parsed by CSingleMethodProps
+  CRecordVector<const wchar_t *> names2;
+  CRecordVector<PROPVARIANT> values2;
+  _segmentSize = 0;
+  for (UInt32 i = 0; i < numProps; i++)
+  {
+    const UString name = names[i];
+    const PROPVARIANT &prop = values[i];
+    if (!name.IsPrefixedBy_Ascii_NoCase("zsf"))
+    {
+      names2.Add(names[i]);
+      values2.Add(prop);
+      continue;
+    }
+    UInt64 v = kSegmentSize_Def;
+    if (name.Len() != 3 || prop.vt != VT_EMPTY)
+    {
+      if (!ParseSizeString(name.Ptr(3), prop, 0, v))
+        return E_INVALIDARG;
+    }
+    if (v != 0 && (v < kSegmentSize_Min || v > kSegmentSize_Max))
+      return E_INVALIDARG;
+    _segmentSize = (UInt32)v;
+  }
+  return _props.SetProperties(names2.ConstData(), values2.ConstData(), names2.Size());
 }
 
 static const Byte k_Signature[] = "0xFD2FB522..28";
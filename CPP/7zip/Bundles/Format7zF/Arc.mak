@@ -168,6 +168,7 @@ TAR_OBJS = \
   $O\TarIn.obj \
   $O\TarOut.obj \
   $O\TarUpdate.obj \
+  $O\TarZstd.obj \
   $O\TarRegister.obj \
 
 UDF_OBJS = \
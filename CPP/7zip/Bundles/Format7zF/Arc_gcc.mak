@@ -211,6 +211,7 @@ TAR_OBJS = \
   $O/TarIn.o \
   $O/TarOut.o \
   $O/TarUpdate.o \
+  $O/TarZstd.o \
   $O/TarRegister.o \
 
 UDF_OBJS = \
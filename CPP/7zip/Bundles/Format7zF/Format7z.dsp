@@ -2808,6 +2808,14 @@ SOURCE=..\..\Archive\Tar\TarUpdate.cpp
 
 SOURCE=..\..\Archive\Tar\TarUpdate.h
 # End Source File
+# Begin Source File
+
+SOURCE=..\..\Archive\Tar\TarZstd.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\Archive\Tar\TarZstd.h
+# End Source File
 # End Group
 # Begin Group "Zip"
 
@@ -72,6 +72,9 @@ CInFileStream::CInFileStream():
   Buf(NULL),
   BufSize(0),
  #endif
+ #ifdef Z7_FILE_STREAMS_USE_MAP
+  _viewPos(0),
+ #endif
  #ifndef _WIN32
   _uid(0),
   _gid(0),
@@ -206,6 +209,20 @@ Z7_COM7F_IMF(CInFileStream::Read(void *data, UInt32 size, UInt32 *processedSize)
 
   #else // Z7_FILE_STREAMS_USE_WIN_FILE
   
+ #ifdef Z7_FILE_STREAMS_USE_MAP
+  if (_view.IsMapped())
+  {
+    const Byte *p;
+    UInt32 cur;
+    ReadBuf(&p, size, &cur);
+    if (cur != 0)
+      memcpy(data, p, cur);
+    if (processedSize)
+      *processedSize = cur;
+    return S_OK;
+  }
+ #endif
+
   if (processedSize)
     *processedSize = 0;
   const ssize_t res = File.read_part(data, (size_t)size);
@@ -400,6 +417,25 @@ Z7_COM7F_IMF(CInFileStream::Seek(Int64 offset, UInt32 seekOrigin, UInt64 *newPos
   
   #else
   
+ #ifdef Z7_FILE_STREAMS_USE_MAP
+  if (_view.IsMapped())
+  {
+    switch (seekOrigin)
+    {
+      case STREAM_SEEK_SET: break;
+      case STREAM_SEEK_CUR: offset += (Int64)_viewPos; break;
+      case STREAM_SEEK_END: offset += (Int64)_view.Size(); break;
+      default: return STG_E_INVALIDFUNCTION;
+    }
+    if (offset < 0)
+      return HRESULT_WIN32_ERROR_NEGATIVE_SEEK;
+    _viewPos = (UInt64)offset;
+    if (newPosition)
+      *newPosition = (UInt64)offset;
+    return S_OK;
+  }
+ #endif
+
   const off_t res = File.seek((off_t)offset, (int)seekOrigin);
   if (res == -1)
   {
@@ -417,9 +453,63 @@ Z7_COM7F_IMF(CInFileStream::Seek(Int64 offset, UInt32 seekOrigin, UInt64 *newPos
 
 Z7_COM7F_IMF(CInFileStream::GetSize(UInt64 *size))
 {
+ #ifdef Z7_FILE_STREAMS_USE_MAP
+  if (_view.IsMapped())
+  {
+    *size = _view.Size();
+    return S_OK;
+  }
+ #endif
   return ConvertBoolToHRESULT(File.GetLength(*size));
 }
 
+#ifdef Z7_FILE_STREAMS_USE_MAP
+
+bool CInFileStream::MapFile()
+{
+  struct stat st;
+  if (File.my_fstat(&st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    return false;
+  const UInt64 size = (UInt64)st.st_size;
+  // we don't want to use big part of address space in 32-bit systems
+  if (sizeof(size_t) < 8 && size > ((UInt64)1 << 28))
+    return false;
+  const off_t pos = File.seekToCur();
+  if (pos == -1)
+    return false;
+  if (!_view.Map(File.GetHandle(), (size_t)size))
+    return false;
+  _viewPos = (UInt64)pos;
+  return true;
+}
+
+Z7_COM7F_IMF(CInFileStream::ReadBuf(const Byte **data, UInt32 size, UInt32 *processedSize))
+{
+  *data = NULL;
+  *processedSize = 0;
+  if (!_view.IsMapped())
+    return E_NOTIMPL;
+  if (_viewPos >= _view.Size())
+    return S_OK;
+  const UInt64 rem = _view.Size() - _viewPos;
+  if (size > rem)
+    size = (UInt32)rem;
+  *data = _view.Data() + (size_t)_viewPos;
+  *processedSize = size;
+  _viewPos += size;
+  return S_OK;
+}
+
+Z7_COM7F_IMF(CInFileStream::Advise(UInt64 pos, UInt64 size, UInt32 advice))
+{
+  _view.Advise(pos, size,
+      (advice & NStreamAdvise::kSequential) != 0,
+      (advice & NStreamAdvise::kWillNeed) != 0);
+  return S_OK;
+}
+
+#endif
+
 #ifdef Z7_FILE_STREAMS_USE_WIN_FILE
 
 Z7_COM7F_IMF(CInFileStream::GetProps(UInt64 *size, FILETIME *cTime, FILETIME *aTime, FILETIME *mTime, UInt32 *attrib))
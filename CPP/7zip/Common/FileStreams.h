@@ -5,12 +5,18 @@
 
 #ifdef _WIN32
 #define Z7_FILE_STREAMS_USE_WIN_FILE
+#else
+// CInFileStream can read regular files via memory mapping
+#define Z7_FILE_STREAMS_USE_MAP
 #endif
 
 #include "../../Common/MyCom.h"
 #include "../../Common/MyString.h"
 
 #include "../../Windows/FileIO.h"
+#ifdef Z7_FILE_STREAMS_USE_MAP
+#include "../../Windows/FileMapping.h"
+#endif
 
 #include "../IStream.h"
 
@@ -44,8 +50,23 @@ Z7_class_final(CInFileStream) :
   public IStreamGetProps,
   public IStreamGetProps2,
   public IStreamGetProp,
+ #ifdef Z7_FILE_STREAMS_USE_MAP
+  public ISequentialInStreamBuf,
+  public IStreamAdvise,
+ #endif
   public CMyUnknownImp
 {
+ #ifdef Z7_FILE_STREAMS_USE_MAP
+  Z7_COM_UNKNOWN_IMP_8(
+      IInStream,
+      ISequentialInStream,
+      IStreamGetSize,
+      IStreamGetProps,
+      IStreamGetProps2,
+      IStreamGetProp,
+      ISequentialInStreamBuf,
+      IStreamAdvise)
+ #else
   Z7_COM_UNKNOWN_IMP_6(
       IInStream,
       ISequentialInStream,
@@ -53,6 +74,7 @@ Z7_class_final(CInFileStream) :
       IStreamGetProps,
       IStreamGetProps2,
       IStreamGetProp)
+ #endif
 
   Z7_IFACE_COM7_IMP(ISequentialInStream)
   Z7_IFACE_COM7_IMP(IInStream)
@@ -63,9 +85,18 @@ private:
 public:
   Z7_IFACE_COM7_IMP(IStreamGetProps2)
   Z7_IFACE_COM7_IMP(IStreamGetProp)
+ #ifdef Z7_FILE_STREAMS_USE_MAP
+  Z7_IFACE_COM7_IMP(ISequentialInStreamBuf)
+  Z7_IFACE_COM7_IMP(IStreamAdvise)
+ #endif
 
 private:
   NWindows::NFile::NIO::CInFile File;
+ #ifdef Z7_FILE_STREAMS_USE_MAP
+  // if (_view) is mapped, the file position is not used
+  NWindows::CFileView _view;
+  UInt64 _viewPos;
+ #endif
 public:
 
   #ifdef Z7_FILE_STREAMS_USE_WIN_FILE
@@ -119,6 +150,13 @@ public:
     _info_WasLoaded = false;
     return File.Open(fileName);
   }
+
+ #ifdef Z7_FILE_STREAMS_USE_MAP
+  /* it maps the opened regular file to memory for Read() and ReadBuf().
+     It returns false, if mapping is not possible, and the stream
+     continues to use read() calls. */
+  bool MapFile();
+ #endif
   
   bool OpenShared(CFSTR fileName, bool shareForWrite)
   {
@@ -27,6 +27,26 @@ Z7_COM7F_IMF(CLimitedSequentialInStream::Read(void *data, UInt32 size, UInt32 *p
   return result;
 }
 
+Z7_COM7F_IMF(CLimitedSequentialInStream::ReadBuf(const Byte **data, UInt32 size, UInt32 *processedSize))
+{
+  *data = NULL;
+  *processedSize = 0;
+  if (!_streamBuf)
+    return E_NOTIMPL;
+  {
+    const UInt64 rem = _size - _pos;
+    if (size > rem)
+      size = (UInt32)rem;
+  }
+  if (size == 0)
+    return S_OK;
+  const HRESULT res = _streamBuf->ReadBuf(data, size, processedSize);
+  _pos += *processedSize;
+  if (res == S_OK && *processedSize == 0)
+    _wasFinished = true;
+  return res;
+}
+
 Z7_COM7F_IMF(CLimitedInStream::Read(void *data, UInt32 size, UInt32 *processedSize))
 {
   if (processedSize)
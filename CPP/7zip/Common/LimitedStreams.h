@@ -10,17 +10,25 @@
 
 #include "StreamUtils.h"
 
-Z7_CLASS_IMP_COM_1(
+Z7_CLASS_IMP_COM_2(
   CLimitedSequentialInStream
   , ISequentialInStream
+  , ISequentialInStreamBuf
 )
   CMyComPtr<ISequentialInStream> _stream;
+  CMyComPtr<ISequentialInStreamBuf> _streamBuf;
   UInt64 _size;
   UInt64 _pos;
   bool _wasFinished;
 public:
-  void SetStream(ISequentialInStream *stream) { _stream = stream; }
-  void ReleaseStream() { _stream.Release(); }
+  void SetStream(ISequentialInStream *stream)
+  {
+    _stream = stream;
+    _streamBuf.Release();
+    if (stream)
+      stream->QueryInterface(IID_ISequentialInStreamBuf, (void **)&_streamBuf);
+  }
+  void ReleaseStream() { _stream.Release(); _streamBuf.Release(); }
   void Init(UInt64 streamSize)
   {
     _size = streamSize;
@@ -479,7 +479,10 @@ static const CNameToPropID g_NameToPropID[] =
   { VT_UI4, "ldmslen" },
   { VT_UI4, "ldmblog" },
   { VT_UI4, "ldmhevery" },
-  { VT_BOOL, "max" }
+  { VT_BOOL, "max" },
+  { VT_BOOL, "adapt" },
+  { VT_UI4, "adaptmin" },
+  { VT_UI4, "adaptmax" }
 };
 
 #if defined(static_assert) || (defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)) || (_MSC_VER >= 1900)
@@ -9,6 +9,13 @@
 
 #include "../Common/CWrappers.h"
 
+#ifndef Z7_ST
+#include "../../Common/MyBuffer2.h"
+#include "../Common/StreamObjects.h"
+#include "../Common/StreamUtils.h"
+#include "../Common/VirtThread.h"
+#endif
+
 #include "DeflateEncoder.h"
 
 #undef NO_INLINE
@@ -40,6 +47,38 @@ static const UInt32 kMatchArrayLimit = kMatchArraySize - kMatchMaxLen * 4 * size
 static const UInt32 kBlockUncompressedSizeThreshold = kMaxUncompressedBlockSize -
     kMatchMaxLen - kNumOpts;
 
+#ifndef Z7_ST
+
+/* In multi-threaded mode the input is split to chunks that are encoded independently.
+   Each chunk is encoded with the end of previous chunk as dictionary,
+   and each chunk except last one ends with empty stored block.
+   So the output is one standard deflate stream. */
+static const unsigned k_Mt_ChunkSizeLog = 20;
+static const UInt32 k_Mt_NumThreadsMax = 64;
+
+struct CChunkEncoder: public CVirtThread
+{
+  CCoder *Coder;
+  CMidBuffer Buf; // history (maximal size) + chunk data
+  UInt32 HistorySize;
+  size_t ChunkSize;
+  bool FinalChunk;
+  bool WasStarted;
+  HRESULT Result;
+  CMyComPtr2_Create<ISequentialInStream, CBufInStream> InStream;
+  CMyComPtr2_Create<ISequentialOutStream, CDynBufSeqOutStream> OutStream;
+
+  void Execute() Z7_override;
+  CChunkEncoder(): Coder(NULL) {}
+  ~CChunkEncoder() Z7_DESTRUCTOR_override
+  {
+    WaitThreadFinish();
+    delete Coder;
+  }
+};
+
+#endif
+
 // static const unsigned kMaxCodeBitLength = 11;
 static const unsigned kMaxLevelBitLength = 7;
 
@@ -113,6 +152,7 @@ void CEncProps::Normalize()
 
 void CCoder::SetProps(const CEncProps *props2)
 {
+  _props = *props2;
   CEncProps props = *props2;
   props.Normalize();
 
@@ -149,6 +189,9 @@ CCoder::CCoder(bool deflate64Mode):
   m_Created(false),
   m_Deflate64Mode(deflate64Mode),
   m_Tables(NULL)
+ #ifndef Z7_ST
+  , _numThreads(1)
+ #endif
 {
   m_MatchMaxLen = deflate64Mode ? kMatchMaxLen64 : kMatchMaxLen32;
   m_NumLenCombinations = deflate64Mode ? kNumLenSymbols64 : kNumLenSymbols32;
@@ -220,6 +263,7 @@ HRESULT CCoder::Create()
 HRESULT CCoder::BaseSetEncoderProperties2(const PROPID *propIDs, const PROPVARIANT *coderProps, UInt32 numProps)
 {
   CEncProps props;
+  UInt32 numThreads = 1;
   for (UInt32 i = 0; i < numProps; i++)
   {
     const PROPVARIANT &prop = coderProps[i];
@@ -236,11 +280,16 @@ HRESULT CCoder::BaseSetEncoderProperties2(const PROPID *propIDs, const PROPVARIA
       case NCoderPropID::kMatchFinderCycles: props.mc = v; break;
       case NCoderPropID::kAlgorithm: props.algo = (int)v; break;
       case NCoderPropID::kLevel: props.Level = (int)v; break;
-      case NCoderPropID::kNumThreads: break;
+      case NCoderPropID::kNumThreads: numThreads = v; break;
       default: return E_INVALIDARG;
     }
   }
   SetProps(&props);
+ #ifndef Z7_ST
+  _numThreads = numThreads;
+ #else
+  UNUSED_VAR(numThreads)
+ #endif
   return S_OK;
 }
   
@@ -966,8 +1015,8 @@ void CCoder::CodeBlock(unsigned tableIndex, bool finalBlock)
 }
 
 
-HRESULT CCoder::CodeReal(ISequentialInStream *inStream, ISequentialOutStream *outStream,
-    const UInt64 * /* inSize */ , const UInt64 * /* outSize */ , ICompressProgressInfo *progress)
+HRESULT CCoder::Encode(ISequentialInStream *inStream, ISequentialOutStream *outStream,
+    ICompressProgressInfo *progress, UInt32 historySize, bool finalStream)
 {
   m_CheckStatic = (m_NumPasses != 1 || m_NumDivPasses != 1);
   m_IsMultiPass = (m_CheckStatic || (m_NumPasses != 1 || m_NumDivPasses != 1));
@@ -987,6 +1036,13 @@ HRESULT CCoder::CodeReal(ISequentialInStream *inStream, ISequentialOutStream *ou
   UInt64 nowPos = 0;
 
   MatchFinder_Init(&_lzInWindow);
+  if (historySize != 0)
+  {
+    if (_btMode)
+      Bt3Zip_MatchFinder_Skip(&_lzInWindow, historySize);
+    else
+      Hc3Zip_MatchFinder_Skip(&_lzInWindow, historySize);
+  }
   m_OutStream.SetStream(outStream);
   m_OutStream.Init();
 
@@ -1002,7 +1058,7 @@ HRESULT CCoder::CodeReal(ISequentialInStream *inStream, ISequentialOutStream *ou
     t.BlockSizeRes = kBlockUncompressedSizeThreshold;
     m_SecondPass = false;
     GetBlockPrice(1, m_NumDivPasses);
-    CodeBlock(1, Inline_MatchFinder_GetNumAvailableBytes(&_lzInWindow) == 0);
+    CodeBlock(1, finalStream && Inline_MatchFinder_GetNumAvailableBytes(&_lzInWindow) == 0);
     nowPos += m_Tables[1].BlockSizeRes;
     if (progress != NULL)
     {
@@ -1017,9 +1073,139 @@ HRESULT CCoder::CodeReal(ISequentialInStream *inStream, ISequentialOutStream *ou
 
   if (_lzInWindow.result != SZ_OK)
     return SResToHRESULT(_lzInWindow.result);
+  if (!finalStream)
+  {
+    // sync flush: the next chunk starts at byte boundary
+    WriteStoreBlock(0, 0, false);
+  }
   return m_OutStream.Flush();
 }
 
+
+HRESULT CCoder::CodeReal(ISequentialInStream *inStream, ISequentialOutStream *outStream,
+    const UInt64 * /* inSize */ , const UInt64 * /* outSize */ , ICompressProgressInfo *progress)
+{
+ #ifndef Z7_ST
+  if (_numThreads > 1)
+    return CodeMt(inStream, outStream, progress);
+ #endif
+  return Encode(inStream, outStream, progress, 0, true);
+}
+
+
+#ifndef Z7_ST
+
+void CChunkEncoder::Execute()
+{
+  const UInt32 historySizeMax = Coder->m_Deflate64Mode ? kHistorySize64 : kHistorySize32;
+  InStream->Init(Buf + historySizeMax - HistorySize, HistorySize + ChunkSize);
+  OutStream->Init();
+  try { Result = Coder->Encode(InStream, OutStream, NULL, HistorySize, FinalChunk); }
+  catch(const COutBufferException &e) { Result = e.ErrorCode; }
+  catch(...) { Result = E_FAIL; }
+}
+
+
+HRESULT CCoder::CodeMt(ISequentialInStream *inStream, ISequentialOutStream *outStream, ICompressProgressInfo *progress)
+{
+  const size_t kChunkSize = (size_t)1 << k_Mt_ChunkSizeLog;
+  const UInt32 historySizeMax = m_Deflate64Mode ? kHistorySize64 : kHistorySize32;
+  const unsigned numMax = (unsigned)(_numThreads < k_Mt_NumThreadsMax ? _numThreads : k_Mt_NumThreadsMax);
+
+  // the ring of jobs can be smaller than in previous call
+  if (_chunkEncoders.Size() > numMax)
+    _chunkEncoders.DeleteFrom(numMax);
+
+  UInt64 inProcessed = 0;
+  UInt64 outProcessed = 0;
+  unsigned index = 0;
+  unsigned numPending = 0;
+  bool finished = false;
+  const CChunkEncoder *prev = NULL;
+  HRESULT res = S_OK;
+
+  for (;;)
+  {
+    if (numPending != 0 && (numPending == numMax || finished || res != S_OK))
+    {
+      // the chunks are written in order
+      CChunkEncoder &job = _chunkEncoders[index];
+      if (job.WasStarted)
+        job.WaitExecuteFinish();
+      if (++index == numMax)
+        index = 0;
+      numPending--;
+      if (res != S_OK)
+        continue;
+      res = job.Result;
+      if (res != S_OK)
+        continue;
+      const size_t size = job.OutStream->GetSize();
+      res = WriteStream(outStream, job.OutStream->GetBuffer(), size);
+      if (res != S_OK)
+        continue;
+      inProcessed += job.ChunkSize;
+      outProcessed += size;
+      if (progress)
+        res = progress->SetRatioInfo(&inProcessed, &outProcessed);
+      continue;
+    }
+    if (finished || res != S_OK)
+      return res;
+
+    const unsigned k = (index + numPending) % numMax;
+    if (k == _chunkEncoders.Size())
+    {
+      CChunkEncoder &job = _chunkEncoders.AddNew();
+      job.Coder = new CCoder(m_Deflate64Mode);
+    }
+    CChunkEncoder &job = _chunkEncoders[k];
+    job.Coder->SetProps(&_props);
+    if (!job.Buf.IsAllocated())
+    {
+      job.Buf.Alloc(historySizeMax + kChunkSize);
+      if (!job.Buf.IsAllocated())
+      {
+        res = E_OUTOFMEMORY;
+        continue;
+      }
+    }
+
+    size_t size = kChunkSize;
+    res = ReadStream(inStream, job.Buf + historySizeMax, &size);
+    if (res != S_OK)
+      continue;
+    finished = (size != kChunkSize);
+
+    // all chunks except last one are full, so the previous chunk contains full history
+    job.HistorySize = 0;
+    if (prev)
+    {
+      job.HistorySize = historySizeMax;
+      memcpy(job.Buf, prev->Buf + prev->ChunkSize, historySizeMax);
+    }
+    job.ChunkSize = size;
+    job.FinalChunk = finished;
+    job.Result = S_OK;
+    prev = &job;
+
+    // the data that fits to one chunk is encoded without threads
+    job.WasStarted = false;
+    if (!finished || numPending != 0)
+    {
+      if (!job.Thread.IsCreated())
+        job.Create();
+      if (job.Thread.IsCreated())
+        job.WasStarted = (job.Start() == 0);
+    }
+    if (!job.WasStarted)
+      job.Execute();
+    numPending++;
+  }
+}
+
+#endif
+
 HRESULT CCoder::BaseCode(ISequentialInStream *inStream, ISequentialOutStream *outStream,
     const UInt64 *inSize, const UInt64 *outSize, ICompressProgressInfo *progress)
 {
@@ -6,6 +6,9 @@
 #include "../../../C/LzFind.h"
 
 #include "../../Common/MyCom.h"
+#ifndef Z7_ST
+#include "../../Common/MyVector.h"
+#endif
 
 #include "../ICoder.h"
 
@@ -36,6 +39,10 @@ const UInt32 kNumOpts = kNumOptsBase + kMatchMaxLen;
 
 class CCoder;
 
+#ifndef Z7_ST
+struct CChunkEncoder;
+#endif
+
 struct CTables: public CLevels
 {
   bool UseSubBlocks;
@@ -129,6 +136,15 @@ public:
 
   UInt32 m_MatchFinderCycles;
 
+  CEncProps _props;
+
+ #ifndef Z7_ST
+  UInt32 _numThreads;
+  CObjectVector<CChunkEncoder> _chunkEncoders;
+
+  HRESULT CodeMt(ISequentialInStream *inStream, ISequentialOutStream *outStream, ICompressProgressInfo *progress);
+ #endif
+
   void GetMatches();
   void MovePos(UInt32 num);
   UInt32 Backward(UInt32 &backRes, UInt32 cur);
@@ -163,6 +179,12 @@ public:
 
   void SetProps(const CEncProps *props2);
 public:
+  /* (historySize) bytes at the start of (inStream) are used only as dictionary.
+     If (!finalStream), the stream is terminated with empty stored block instead of final block,
+     so the output can be followed by the output of the next chunk. */
+  HRESULT Encode(ISequentialInStream *inStream, ISequentialOutStream *outStream,
+      ICompressProgressInfo *progress, UInt32 historySize, bool finalStream);
+
   CCoder(bool deflate64Mode = false);
   ~CCoder();
 
@@ -33,7 +33,8 @@ CDecoder::CDecoder():
     _inBufSize(0),
     _inBufSizeNew(1 << 20),
     _lzmaStatus(LZMA_STATUS_NOT_SPECIFIED),
-    _inBuf(NULL)
+    _inBuf(NULL),
+    _inData(NULL)
 {
   _inProcessed = 0;
   _inPos = _inLim = 0;
@@ -116,6 +117,28 @@ Z7_COM7F_IMF(CDecoder::GetInStreamProcessedSize(UInt64 *value))
 }
 
 
+HRESULT CDecoder::ReadInput(ISequentialInStream *inStream)
+{
+  _inPos = _inLim = 0;
+  {
+    // if the stream is mapped to memory, we decode from that memory without copying
+    Z7_DECL_CMyComPtr_QI_FROM(ISequentialInStreamBuf, bufStream, inStream)
+    if (bufStream)
+    {
+      const Byte *data;
+      const HRESULT res = bufStream->ReadBuf(&data, _inBufSize, &_inLim);
+      if (res != E_NOTIMPL)
+      {
+        _inData = data ? data : _inBuf;
+        return res;
+      }
+    }
+  }
+  _inData = _inBuf;
+  return inStream->Read(_inBuf, _inBufSize, &_inLim);
+}
+
+
 HRESULT CDecoder::CodeSpec(ISequentialInStream *inStream, ISequentialOutStream *outStream, ICompressProgressInfo *progress)
 {
   if (!_inBuf || !_propsWereSet)
@@ -128,10 +151,7 @@ HRESULT CDecoder::CodeSpec(ISequentialInStream *inStream, ISequentialOutStream *
   for (;;)
   {
     if (_inPos == _inLim && readRes == S_OK)
-    {
-      _inPos = _inLim = 0;
-      readRes = inStream->Read(_inBuf, _inBufSize, &_inLim);
-    }
+      readRes = ReadInput(inStream);
 
     const SizeT dicPos = _state.dicPos;
     SizeT size;
@@ -157,7 +177,7 @@ HRESULT CDecoder::CodeSpec(ISequentialInStream *inStream, ISequentialOutStream *
     SizeT inProcessed = _inLim - _inPos;
     ELzmaStatus status;
 
-    const SRes res = LzmaDec_DecodeToDic(&_state, dicPos + size, _inBuf + _inPos, &inProcessed, finishMode, &status);
+    const SRes res = LzmaDec_DecodeToDic(&_state, dicPos + size, _inData + _inPos, &inProcessed, finishMode, &status);
 
     _lzmaStatus = status;
     _inPos += (UInt32)inProcessed;
@@ -259,17 +279,14 @@ Z7_COM7F_IMF(CDecoder::Read(void *data, UInt32 size, UInt32 *processedSize))
   for (;;)
   {
     if (_inPos == _inLim && readRes == S_OK)
-    {
-      _inPos = _inLim = 0;
-      readRes = _inStream->Read(_inBuf, _inBufSize, &_inLim);
-    }
+      readRes = ReadInput(_inStream);
 
     SizeT inProcessed = _inLim - _inPos;
     SizeT outProcessed = size;
     ELzmaStatus status;
     
     const SRes res = LzmaDec_DecodeToBuf(&_state, (Byte *)data, &outProcessed,
-        _inBuf + _inPos, &inProcessed, finishMode, &status);
+        _inData + _inPos, &inProcessed, finishMode, &status);
     
     _lzmaStatus = status;
     _inPos += (UInt32)inProcessed;
@@ -325,7 +342,7 @@ HRESULT CDecoder::ReadFromInputStream(void *data, UInt32 size, UInt32 *processed
     {
       _inPos = _inLim = 0;
       if (readRes == S_OK)
-        readRes = _inStream->Read(_inBuf, _inBufSize, &_inLim);
+        readRes = ReadInput(_inStream);
       if (_inLim == 0)
         break;
     }
@@ -333,7 +350,7 @@ HRESULT CDecoder::ReadFromInputStream(void *data, UInt32 size, UInt32 *processed
     UInt32 cur = _inLim - _inPos;
     if (cur > size)
       cur = size;
-    memcpy(data, _inBuf + _inPos, cur);
+    memcpy(data, _inData + _inPos, cur);
     _inPos += cur;
     _inProcessed += cur;
     size -= cur;
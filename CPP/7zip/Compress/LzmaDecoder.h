@@ -72,6 +72,7 @@ private:
   UInt32 _inPos;
   UInt32 _inLim;
   Byte *_inBuf;
+  const Byte *_inData; // (_inBuf) or the data of ISequentialInStreamBuf stream
  
   UInt64 _outSize;
   UInt64 _inProcessed;
@@ -82,6 +83,7 @@ private:
   CLzmaDec _state;
 
   HRESULT CreateInputBuffer();
+  HRESULT ReadInput(ISequentialInStream *inStream);
   HRESULT CodeSpec(ISequentialInStream *inStream, ISequentialOutStream *outStream, ICompressProgressInfo *progress);
   void SetOutStreamSizeResume(const UInt64 *outSize);
 
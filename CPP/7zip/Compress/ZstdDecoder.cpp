@@ -3,9 +3,60 @@
 #include "StdAfx.h"
 #include "ZstdDecoder.h"
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
 namespace NCompress {
 namespace NZSTD {
 
+/* blocks of this size and larger are allocated with BigAlloc().
+   BigAlloc() and MyAlloc() blocks are not interchangeable, so the
+   block header keeps the kind of allocation for ZstdFree(). */
+static const size_t kZstdBigAllocMin = (size_t)1 << 21;
+static const size_t kZstdAllocHeader = 64;
+
+static void *ZstdAlloc(void *, size_t size)
+{
+  if (size > (size_t)0 - kZstdAllocHeader)
+    return NULL;
+  const bool isBig = (size >= kZstdBigAllocMin);
+  Byte *p = (Byte *)(isBig ?
+      BigAlloc(size + kZstdAllocHeader) :
+      MyAlloc(size + kZstdAllocHeader));
+  if (!p)
+    return NULL;
+  *(size_t *)(void *)p = (isBig ? 1 : 0);
+  p += kZstdAllocHeader;
+ #if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if (isBig)
+  {
+    /* BigAlloc() has no large pages on linux: ask for transparent huge pages instead.
+       Physical pages are placed on first touch, so the tables of zstd workers
+       are local to the NUMA node of the thread that fills them. */
+    const size_t pageSize = 4096;
+    const size_t start = ((size_t)p + pageSize - 1) & ~(pageSize - 1);
+    const size_t end = ((size_t)p + size) & ~(pageSize - 1);
+    if (end > start)
+      madvise((void *)start, end - start, MADV_HUGEPAGE);
+  }
+ #endif
+  return p;
+}
+
+static void ZstdFree(void *, void *address)
+{
+  if (!address)
+    return;
+  Byte *p = (Byte *)address - kZstdAllocHeader;
+  if (*(const size_t *)(const void *)p)
+    BigFree(p);
+  else
+    MyFree(p);
+}
+
+const ZSTD_customMem g_ZstdAlloc = { ZstdAlloc, ZstdFree, NULL };
+
 CDecoder::CDecoder():
   _ctx(NULL),
   _srcBuf(NULL),
@@ -59,16 +110,44 @@ Z7_COM7F_IMF(CDecoder::SetOutStreamSize(const UInt64 * outSize))
   return S_OK;
 }
 
+HRESULT CDecoder::ReadInput(ISequentialInStream *inStream, ZSTD_inBuffer &zIn)
+{
+  zIn.pos = 0;
+  {
+    // if the stream is mapped to memory, we decode from that memory without copying
+    Z7_DECL_CMyComPtr_QI_FROM(ISequentialInStreamBuf, bufStream, inStream)
+    if (bufStream)
+    {
+      const Byte *data;
+      UInt32 size;
+      const HRESULT res = bufStream->ReadBuf(&data, (UInt32)_srcBufSize, &size);
+      if (res != E_NOTIMPL)
+      {
+        zIn.src = data ? data : _srcBuf;
+        zIn.size = size;
+        _processedIn += size;
+        return res;
+      }
+    }
+  }
+  size_t srcBufLen = _srcBufSize;
+  const HRESULT res = ReadStream(inStream, _srcBuf, &srcBufLen);
+  zIn.src = _srcBuf;
+  zIn.size = srcBufLen;
+  _processedIn += srcBufLen;
+  return res;
+}
+
 HRESULT CDecoder::CodeSpec(ISequentialInStream * inStream,
   ISequentialOutStream * outStream, ICompressProgressInfo * progress)
 {
-  size_t srcBufLen, result;
+  size_t result;
   ZSTD_inBuffer zIn;
   ZSTD_outBuffer zOut;
 
   /* 1) create context */
   if (!_ctx) {
-    _ctx = ZSTD_createDCtx();
+    _ctx = ZSTD_createDCtx_advanced(g_ZstdAlloc);
     if (!_ctx)
       return E_OUTOFMEMORY;
 
@@ -90,15 +169,9 @@ HRESULT CDecoder::CodeSpec(ISequentialInStream * inStream,
   }
 
   zOut.dst = _dstBuf;
-  srcBufLen = _srcBufSize;
 
   /* read first input block */
-  RINOK(ReadStream(inStream, _srcBuf, &srcBufLen))
-  _processedIn += srcBufLen;
-
-  zIn.src = _srcBuf;
-  zIn.size = srcBufLen;
-  zIn.pos = 0;
+  RINOK(ReadInput(inStream, zIn))
 
   /* Main decompression Loop */
   for (;;) {
@@ -155,16 +228,11 @@ HRESULT CDecoder::CodeSpec(ISequentialInStream * inStream,
     } /* for() decompress */
 
     /* read next input */
-    srcBufLen = _srcBufSize;
-    RINOK(ReadStream(inStream, _srcBuf, &srcBufLen))
-    _processedIn += srcBufLen;
+    RINOK(ReadInput(inStream, zIn))
 
     /* finished */
-    if (srcBufLen == 0)
+    if (zIn.size == 0)
       return S_OK;
-
-    zIn.size = srcBufLen;
-    zIn.pos = 0;
   }
 }
 
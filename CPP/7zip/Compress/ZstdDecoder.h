@@ -31,6 +31,10 @@
 namespace NCompress {
 namespace NZSTD {
 
+/* allocator for zstd contexts: big workspaces (hash/chain tables, windows)
+   go through BigAlloc() to get large pages, small ones through MyAlloc() */
+extern const ZSTD_customMem g_ZstdAlloc;
+
 struct DProps
 {
   DProps() { clear (); }
@@ -62,6 +66,7 @@ public:
   UInt64 _processedIn;
   UInt64 _processedOut;
 
+  HRESULT ReadInput(ISequentialInStream *inStream, ZSTD_inBuffer &zIn);
   HRESULT CodeSpec(ISequentialInStream *inStream, ISequentialOutStream *outStream, ICompressProgressInfo *progress);
   HRESULT CodeResume(ISequentialOutStream * outStream, const UInt64 * outSize, ICompressProgressInfo * progress);
   HRESULT SetOutStreamSizeResume(const UInt64 *outSize);
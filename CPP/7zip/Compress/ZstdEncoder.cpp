@@ -4,10 +4,38 @@
 #include "ZstdEncoder.h"
 #include "ZstdDecoder.h"
 
+#ifndef _WIN32
+#include <time.h>
+#endif
+
 #ifndef Z7_EXTRACT_ONLY
 namespace NCompress {
 namespace NZSTD {
 
+/* amount of input between two decisions of the adaptive mode */
+static const UInt32 kAdaptWindow = (UInt32)1 << 24;
+
+/* it returns nanoseconds in all branches, because
+   the adaptive mode sums the intervals from different calls */
+static UInt64 GetTimeCount()
+{
+#ifdef _WIN32
+  LARGE_INTEGER value, freq;
+  if (::QueryPerformanceCounter(&value) && ::QueryPerformanceFrequency(&freq) && freq.QuadPart > 0)
+  {
+    const UInt64 v = (UInt64)value.QuadPart;
+    const UInt64 f = (UInt64)freq.QuadPart;
+    return v / f * 1000000000 + v % f * 1000000000 / f;
+  }
+  return (UInt64)GetTickCount() * 1000000;
+#else
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    return (UInt64)ts.tv_sec * 1000000000 + (UInt64)ts.tv_nsec;
+  return (UInt64)time(NULL) * 1000000000;
+#endif
+}
+
 CEncoder::CEncoder():
   _ctx(NULL),
   _srcBuf(NULL),
@@ -32,6 +60,14 @@ CEncoder::CEncoder():
   _LdmMinMatch(-1),
   _LdmBucketSizeLog(-1),
   _LdmHashRateLog(-1),
+  _Adapt(false),
+  _AdaptMin(1),
+  _AdaptMax(ZSTD_maxCLevel()),
+  _AdaptLevel(ZSTD_CLEVEL_DEFAULT),
+  _adaptCpuTime(0),
+  _adaptIoTime(0),
+  _adaptNextCheck(0),
+  _adaptNewFrame(false),
   dictIDFlag(-1),
   checksumFlag(-1),
   unpackSize(0)
@@ -218,6 +254,27 @@ Z7_COM7F_IMF(CEncoder::SetCoderProperties(const PROPID * propIDs, const PROPVARI
         _LdmHashRateLog = v;
         break;
       }
+    case NCoderPropID::kAdapt:
+      {
+        _Adapt = (prop.boolVal != VARIANT_FALSE);
+        break;
+      }
+    case NCoderPropID::kAdaptMin:
+      {
+        if (v < 1) v = 1;
+        if ((Int32)v > ZSTD_maxCLevel()) v = ZSTD_maxCLevel();
+        _AdaptMin = v;
+        _Adapt = true;
+        break;
+      }
+    case NCoderPropID::kAdaptMax:
+      {
+        if (v < 1) v = 1;
+        if ((Int32)v > ZSTD_maxCLevel()) v = ZSTD_maxCLevel();
+        _AdaptMax = v;
+        _Adapt = true;
+        break;
+      }
     default:
       {
         break;
@@ -260,7 +317,7 @@ Z7_COM7F_IMF(CEncoder::Code(ISequentialInStream *inStream,
   _processedOut = 0;
 
   if (!_ctx) {
-    _ctx = ZSTD_createCCtx();
+    _ctx = ZSTD_createCCtx_advanced(g_ZstdAlloc);
     if (!_ctx)
       return E_OUTOFMEMORY;
 
@@ -289,15 +346,29 @@ Z7_COM7F_IMF(CEncoder::Code(ISequentialInStream *inStream,
       _LdmMinMatch = 16; /* heuristic */
       _LdmBucketSizeLog = ZSTD_LDM_BUCKETSIZELOG_MAX;
       _Level = ZSTD_maxCLevel();
+      _Adapt = false;
     }
   #endif
 
+    /* adaptive mode starts with the configured level, kept within the bounds */
+    if (_Adapt) {
+      if (_AdaptMin > _AdaptMax)
+        _AdaptMin = _AdaptMax;
+      if (_Level < _AdaptMin) _Level = _AdaptMin;
+      if (_Level > _AdaptMax) _Level = _AdaptMax;
+      _AdaptLevel = _Level;
+    }
+
     /* setup level */
     err = ZSTD_CCtx_setParameter(_ctx, ZSTD_c_compressionLevel, (UInt32)_Level);
     if (ZSTD_isError(err)) return E_INVALIDARG;
 
-    /* setup thread count */
+    /* setup thread count,
+       zstd compiled without ZSTD_MULTITHREAD supports only single thread mode (0 workers) */
     err = ZSTD_CCtx_setParameter(_ctx, ZSTD_c_nbWorkers, _numThreads);
+    if (ZSTD_isError(err) && _numThreads == 1
+        && ZSTD_getErrorCode(err) == ZSTD_error_parameter_unsupported)
+      err = 0;
     if (ZSTD_isError(err)) return E_INVALIDARG;
 
     /* set the content size flag */
@@ -313,11 +384,6 @@ Z7_COM7F_IMF(CEncoder::Code(ISequentialInStream *inStream,
       if (ZSTD_isError(err)) return E_INVALIDARG;
     }
 
-    if (unpackSize && unpackSize != (UInt64)(Int64)-1) { // size is known
-      err = ZSTD_CCtx_setParameter(_ctx, ZSTD_c_srcSizeHint, (int)(unpackSize <= INT_MAX ? unpackSize : INT_MAX));
-      if (ZSTD_isError(err)) return E_INVALIDARG;
-    }
-
     /* enable ldm for large windowlog values */
     if (_WindowLog > 27 && _Long == 0)
       _Long = 1;
@@ -394,6 +460,30 @@ Z7_COM7F_IMF(CEncoder::Code(ISequentialInStream *inStream,
     //err = ZSTD_CCtx_setParameter(_ctx, ZSTD_c_enableDedicatedDictSearch, 1);
     //if (ZSTD_isError(err)) return E_INVALIDARG;
   }
+  else {
+    /* the context is reused for the next item (zip / 7z folders):
+       drop the state of an unfinished frame, but keep the parameters and tables */
+    err = ZSTD_CCtx_reset(_ctx, ZSTD_reset_session_only);
+    if (ZSTD_isError(err)) return E_FAIL;
+
+    if (_Adapt) {
+      /* a new frame starts with the level reached by the previous one */
+      err = ZSTD_CCtx_setParameter(_ctx, ZSTD_c_compressionLevel, _AdaptLevel);
+      if (ZSTD_isError(err)) return E_INVALIDARG;
+    }
+  }
+
+  /* the size hint is set for each item, 0 resets the hint of the previous one */
+  err = ZSTD_CCtx_setParameter(_ctx, ZSTD_c_srcSizeHint,
+      (unpackSize && unpackSize != (UInt64)(Int64)-1) ? (int)(unpackSize <= INT_MAX ? unpackSize : INT_MAX) : 0);
+  if (ZSTD_isError(err)) return E_INVALIDARG;
+  unpackSize = 0;
+
+  _adaptCpuTime = 0;
+  _adaptIoTime = 0;
+  _adaptNextCheck = kAdaptWindow;
+  _adaptNewFrame = false;
+  UInt64 t = _Adapt ? GetTimeCount() : 0;
 
   for (;;) {
 
@@ -423,7 +513,20 @@ Z7_COM7F_IMF(CEncoder::Code(ISequentialInStream *inStream,
         inBuff.pos = 0;
       }
 
+      if (_Adapt) {
+        const UInt64 t2 = GetTimeCount();
+        _adaptIoTime += t2 - t;
+        t = t2;
+      }
+
       err = ZSTD_compressStream2(_ctx, &outBuff, &inBuff, ZSTD_todo);
+
+      if (_Adapt) {
+        const UInt64 t2 = GetTimeCount();
+        _adaptCpuTime += t2 - t;
+        t = t2;
+      }
+
       if (ZSTD_isError(err)) {
         switch (ZSTD_getErrorCode(err)) {
           /* @Igor: would be nice, if we have an API to store the errmsg */
@@ -450,6 +553,9 @@ Z7_COM7F_IMF(CEncoder::Code(ISequentialInStream *inStream,
       if (progress)
         RINOK(progress->SetRatioInfo(&_processedIn, &_processedOut))
 
+      if (_Adapt && _processedIn >= _adaptNextCheck)
+        AdaptLevel();
+
       /* done */
       if (ZSTD_todo == ZSTD_e_end && err == 0)
         return S_OK;
@@ -458,9 +564,76 @@ Z7_COM7F_IMF(CEncoder::Code(ISequentialInStream *inStream,
       if (inBuff.pos == inBuff.size)
         break;
     }
+
+    if (_adaptNewFrame) {
+      /* zstd without workers changes the level only at the start of frame */
+      _adaptNewFrame = false;
+      for (;;) {
+        outBuff.dst = _dstBuf;
+        outBuff.size = _dstBufSize;
+        outBuff.pos = 0;
+        inBuff.src = 0;
+        inBuff.size = 0;
+        inBuff.pos = 0;
+        err = ZSTD_compressStream2(_ctx, &outBuff, &inBuff, ZSTD_e_end);
+        if (ZSTD_isError(err))
+          return E_FAIL;
+        if (outBuff.pos) {
+          RINOK(WriteStream(outStream, _dstBuf, outBuff.pos))
+          _processedOut += outBuff.pos;
+        }
+        if (err == 0)
+          break;
+      }
+      err = ZSTD_CCtx_setParameter(_ctx, ZSTD_c_compressionLevel, _AdaptLevel);
+      if (ZSTD_isError(err)) return E_INVALIDARG;
+      t = GetTimeCount();
+    }
   }
 }
 
+/*
+  Adaptive mode: the time spent in reading and writing the streams is
+  compared with the time zstd needs for compression (in mt mode that is the
+  time waiting for the workers). When the compressor is the bottleneck, the
+  level is decreased. When the cpu waits for the input or the output stream,
+  the level is increased, so the idle time is used for a better ratio.
+  In mt mode zstd applies the new level to the next job of the frame.
+  Without workers (zstd is compiled without ZSTD_MULTITHREAD) zstd uses
+  the level only from the start of frame, so Code() finishes the current
+  frame, and the new level is used for the next frame of the stream.
+*/
+void CEncoder::AdaptLevel()
+{
+  Int32 level = _AdaptLevel;
+
+  if (_adaptCpuTime > _adaptIoTime * 2) {
+    if (level > _AdaptMin)
+      level--;
+  } else if (_adaptIoTime > _adaptCpuTime * 2) {
+    if (level < _AdaptMax)
+      level++;
+  }
+
+  _adaptCpuTime = 0;
+  _adaptIoTime = 0;
+  _adaptNextCheck = _processedIn + kAdaptWindow;
+
+  if (level == _AdaptLevel)
+    return;
+
+  int numWorkers = 0;
+  ZSTD_CCtx_getParameter(_ctx, ZSTD_c_nbWorkers, &numWorkers);
+  if (numWorkers == 0) {
+    _AdaptLevel = level;
+    _adaptNewFrame = true;
+    return;
+  }
+
+  if (!ZSTD_isError(ZSTD_CCtx_setParameter(_ctx, ZSTD_c_compressionLevel, level)))
+    _AdaptLevel = level;
+}
+
 Z7_COM7F_IMF(CEncoder::SetNumberOfThreads(UInt32 numThreads))
 {
   const UInt32 kNumThreadsMax = ZSTD_THREAD_MAX;
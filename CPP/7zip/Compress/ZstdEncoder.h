@@ -69,6 +69,18 @@ public:
   Int32 _LdmBucketSizeLog;
   Int32 _LdmHashRateLog;
 
+  /* adaptive level, like --adapt in zstd cli program */
+  bool  _Adapt;
+  Int32 _AdaptMin;
+  Int32 _AdaptMax;
+  Int32 _AdaptLevel;
+  UInt64 _adaptCpuTime;
+  UInt64 _adaptIoTime;
+  UInt64 _adaptNextCheck;
+  bool _adaptNewFrame; // zstd without workers: the frame is finished to use new level
+
+  void AdaptLevel();
+
   int dictIDFlag;
   int checksumFlag;
   UInt64 unpackSize;
@@ -155,6 +155,9 @@ namespace NCoderPropID
     kLdmBucketSizeLog,  // VT_UI4 The minimum ldmblog is 0 and the maximum is 8 (default: 3).
     kLdmHashRateLog,    // VT_UI4 The default value is wlog - ldmhlog.
     kAdvMax,            // VT_BOOL 1=ZSTD --max (advanced max compression)
+    kAdapt,             // VT_BOOL 1=ZSTD --adapt (adjust level to the I/O throughput)
+    kAdaptMin,          // VT_UI4 The lowest level used by adapt mode (default: 1)
+    kAdaptMax,          // VT_UI4 The highest level used by adapt mode (default: ZSTD_maxCLevel)
     k_NUM_DEFINED
   };
 }
@@ -141,6 +141,37 @@ Z7_IFACE_CONSTR_STREAM(IStreamGetProps2, 0x09)
 Z7_IFACE_CONSTR_STREAM(IStreamGetProp, 0x0a)
 
 
+/*
+ISequentialInStreamBuf::ReadBuf()
+  It works like ISequentialInStream::Read(), but it doesn't copy the data.
+  It returns pointer (*data) to (*processedSize) bytes of stream data
+  and moves the stream position. The data is available while the stream
+  object is alive, so the caller can use it as input buffer directly.
+  If the stream can't return the data without copying now
+  (for example, the file was not mapped to memory), it returns E_NOTIMPL,
+  and the caller must use ISequentialInStream::Read().
+
+IStreamAdvise::Advise()
+  The caller tells how it's going to read the region [pos, pos + size)
+  of stream. It's a hint only. The callee can ignore it and return S_OK.
+    advice : combination of NStreamAdvise flags
+*/
+
+namespace NStreamAdvise
+{
+  const UInt32 kSequential = 1 << 0;
+  const UInt32 kWillNeed   = 1 << 1;
+}
+
+#define Z7_IFACEM_ISequentialInStreamBuf(x) \
+  x(ReadBuf(const Byte **data, UInt32 size, UInt32 *processedSize))
+Z7_IFACE_CONSTR_STREAM(ISequentialInStreamBuf, 0x0b)
+
+#define Z7_IFACEM_IStreamAdvise(x) \
+  x(Advise(UInt64 pos, UInt64 size, UInt32 advice))
+Z7_IFACE_CONSTR_STREAM(IStreamAdvise, 0x0c)
+
+
 /*
 IStreamSetRestriction::SetRestriction(UInt64 begin, UInt64 end)
   
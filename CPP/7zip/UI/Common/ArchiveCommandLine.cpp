@@ -166,6 +166,8 @@ enum Enum
   // kHashGenFile,
   kHashDir,
   kExtractMemLimit,
+  kMapArcFile,
+  kAsyncWrite,
  
   kStdIn,
   kStdOut,
@@ -317,6 +319,8 @@ static const CSwitchForm kSwitchForms[] =
   // { "scrf", SWFRM_STRING_SINGL(1) },
   { "shd", SWFRM_STRING_SINGL(1) },
   { "smemx", SWFRM_STRING },
+  { "smm", SWFRM_SIMPLE },
+  { "swa", SWFRM_SIMPLE },
   
   { "si", SWFRM_STRING },
   { "so", SWFRM_SIMPLE },
@@ -1312,6 +1316,35 @@ static bool ParseSizeString(const wchar_t *s, UInt64 &res)
   return true;
 }
 
+// it returns the number of threads from -mmt switch, or 0, if -mmt is not specified
+
+static UInt32 Get_NumThreads_from_Props(const CObjectVector<CProperty> &props)
+{
+  UInt32 res = 0;
+  FOR_VECTOR (i, props)
+  {
+    const CProperty &prop = props[i];
+    if (!prop.Name.IsPrefixedBy_Ascii_NoCase("mt"))
+      continue;
+    {
+      // "mtf" and other properties of handlers also start with "mt"
+      const wchar_t *s = prop.Name.Ptr(2);
+      while (*s >= '0' && *s <= '9')
+        s++;
+      if (*s != 0)
+        continue;
+    }
+    NCOM::CPropVariant v;
+    if (!prop.Value.IsEmpty())
+      v = prop.Value;
+    UInt32 numThreads;
+    if (ParseMtProp(prop.Name.Ptr(2), v, NSystem::GetNumberOfProcessors(), numThreads) != S_OK)
+      throw CArcCmdLineException("Unsupported -m switch:", prop.Name);
+    res = (numThreads == 0 ? 1 : numThreads);
+  }
+  return res;
+}
+
 void CArcCmdLineParser::Parse2(CArcCmdLineOptions &options)
 {
   const UStringVector &nonSwitchStrings = parser.NonSwitchStrings;
@@ -1352,6 +1385,9 @@ void CArcCmdLineParser::Parse2(CArcCmdLineOptions &options)
     if (!ParseSizeString(s, options.ExtractOptions.NtOptions.MemLimit))
       throw CArcCmdLineException("Unsupported -smemx:", s);
   }
+
+  options.ExtractOptions.MapArcFile = parser[NKey::kMapArcFile].ThereIs;
+  options.ExtractOptions.NtOptions.AsyncWrite = parser[NKey::kAsyncWrite].ThereIs;
   
   if (parser[NKey::kElimDup].ThereIs)
   {
@@ -1663,6 +1699,7 @@ void CArcCmdLineParser::Parse2(CArcCmdLineOptions &options)
     SetAddCommandOptions(options.Command.CommandType, parser, updateOptions);
     
     updateOptions.MethodMode.Properties = options.Properties;
+    updateOptions.NumThreads = Get_NumThreads_from_Props(options.Properties);
 
     if (parser[NKey::kPreserveATime].ThereIs)
       updateOptions.PreserveATime = true;
@@ -1748,6 +1785,8 @@ void CArcCmdLineParser::Parse2(CArcCmdLineOptions &options)
     hashOptions.StdInMode = options.StdInMode;
     hashOptions.AltStreamsMode = options.AltStreams.Val;
     hashOptions.SymLinks = options.SymLinks;
+
+    hashOptions.NumThreads = Get_NumThreads_from_Props(options.Properties);
   }
   else if (options.Command.CommandType == NCommandType::kInfo)
   {
@@ -303,6 +303,9 @@ CArchiveExtractCallback::CArchiveExtractCallback():
     _arc(NULL),
     _multiArchives(false)
 {
+  #ifdef Z7_ASYNC_FILE_WRITER
+  _asyncOutStreamSpec = NULL;
+  #endif
   #ifdef Z7_USE_SECURITY_CODE
   _saclEnabled = InitLocalPrivileges();
   #endif
@@ -327,6 +330,10 @@ void CArchiveExtractCallback::Init(
     UInt64 packSize)
 {
   ClearExtractedDirsInfo();
+  #ifdef Z7_ASYNC_FILE_WRITER
+  _asyncOutStreamSpec = NULL;
+  _asyncOutStream.Release();
+  #endif
   _outFileStream.Release();
   _bufPtrSeqOutStream.Release();
   
@@ -1191,6 +1198,13 @@ HRESULT CArchiveExtractCallback::CheckExistFile(FString &fullProcessedPath, bool
   {
     if (_overwriteMode == NExtract::NOverwriteMode::kSkip)
       return S_OK;
+
+   #ifdef Z7_ASYNC_FILE_WRITER
+    /* it can be the file of this archive that is not closed still by the writer thread.
+       The writer thread sets the times and the attributes by path,
+       so we wait before we delete or rename that file. */
+    RINOK(_asyncWriter.WaitClosed())
+   #endif
     
     if (_overwriteMode == NExtract::NOverwriteMode::kAsk)
     {
@@ -1502,6 +1516,12 @@ HRESULT CArchiveExtractCallback::GetExtractStream(CMyComPtr<ISequentialOutStream
   }
   else // not reparse
   {
+   #ifdef Z7_ASYNC_FILE_WRITER
+    // split items need seeking, so they are written here.
+    // The writer thread calls fallocate() instead of SetLength().
+    const bool useAsync = (_ntOptions.AsyncWrite && !_isSplit && _asyncWriter.Create() == S_OK);
+    if (!useAsync)
+   #endif
     if (_ntOptions.PreAllocateOutFile && !_isSplit && _curSize_Defined && _curSize > (1 << 12))
     {
       // UInt64 ticks = GetCpuTicks();
@@ -1555,6 +1575,20 @@ HRESULT CArchiveExtractCallback::GetExtractStream(CMyComPtr<ISequentialOutStream
       RINOK(outFileStream_Loc->Seek((Int64)_position, STREAM_SEEK_SET, NULL))
     }
     outStreamLoc = outFileStream_Loc;
+   #ifdef Z7_ASYNC_FILE_WRITER
+    if (useAsync)
+    {
+      // small files are written by one write() call, so they don't need fallocate()
+      // the writer thread releases the reserved space past the end of file at closing
+      UInt64 preAllocSize = 0;
+      if (_curSize_Defined && _curSize > (1 << 16))
+        preAllocSize = _curSize;
+      _asyncOutStreamSpec = new CAsyncOutFileStream;
+      _asyncOutStream = _asyncOutStreamSpec;
+      _asyncOutStreamSpec->Init(&_asyncWriter, _outFileStreamSpec, fullProcessedPath, preAllocSize);
+      outStreamLoc = _asyncOutStream;
+    }
+   #endif
   } // if not reparse
 
   _outFileStream = outFileStream_Loc;
@@ -1598,6 +1632,10 @@ Z7_COM7F_IMF(CArchiveExtractCallback::GetStream(UInt32 index, ISequentialOutStre
   _hashStreamWasUsed = false;
   #endif
 
+  #ifdef Z7_ASYNC_FILE_WRITER
+  _asyncOutStreamSpec = NULL;
+  _asyncOutStream.Release();
+  #endif
   _outFileStream.Release();
   _bufPtrSeqOutStream.Release();
 
@@ -1932,6 +1970,22 @@ Z7_COM7F_IMF(CArchiveExtractCallback::PrepareOperation(Int32 askExtractMode))
 
 
 
+#ifdef Z7_ASYNC_FILE_WRITER
+
+HRESULT CArchiveExtractCallback::Async_ReportMessages()
+{
+  CObjectVector<CAsyncFileMessage> messages;
+  _asyncWriter.GetMessages(messages);
+  FOR_VECTOR (i, messages)
+  {
+    const CAsyncFileMessage &m = messages[i];
+    RINOK(SendMessageError_with_Error(m.ErrorCode, m.Message, m.Path))
+  }
+  return S_OK;
+}
+
+#endif
+
 HRESULT CArchiveExtractCallback::CloseFile()
 {
   if (!_outFileStream)
@@ -1939,6 +1993,45 @@ HRESULT CArchiveExtractCallback::CloseFile()
   
   HRESULT hres = S_OK;
   
+ #ifdef Z7_ASYNC_FILE_WRITER
+  if (_asyncOutStreamSpec)
+  {
+    /* The writer thread closes the file after all its writes,
+       and then it sets the owner and the attributes instead of SetAttrib().
+       So the writes of this file can overlap the decoding of next files.
+       The errors are reported for one of next items or in CloseArc(). */
+    _curSize = _asyncOutStreamSpec->WrittenSize;
+    _curSize_Defined = true;
+
+    CFiTimesCAM t;
+    GetFiTimesCAM(_fi, t, *_arc);
+    if (t.IsSomeTimeDefined())
+      _outFileStreamSpec->SetTime(
+          t.CTime_Defined ? &t.CTime : NULL,
+          t.ATime_Defined ? &t.ATime : NULL,
+          t.MTime_Defined ? &t.MTime : NULL);
+
+    if (_needSetAttrib && !_itemFailure)
+    {
+      _needSetAttrib = false;
+      if (_fi.Owner.Id_Defined &&
+          _fi.Group.Id_Defined)
+        _asyncOutStreamSpec->SetOwner(_fi.Owner.Id, _fi.Group.Id);
+      if (_fi.Attrib_Defined)
+        _asyncOutStreamSpec->SetAttrib(_fi.Attrib);
+    }
+
+    hres = _asyncOutStreamSpec->Close();
+    _asyncOutStreamSpec = NULL;
+    _asyncOutStream.Release();
+    _outFileStream.Release();
+    const HRESULT hres2 = Async_ReportMessages();
+    if (hres == S_OK)
+      hres = hres2;
+    return hres;
+  }
+ #endif
+
   const UInt64 processedSize = _outFileStreamSpec->ProcessedSize;
   if (_fileLength_WasSet && _fileLength_that_WasSet > processedSize)
   {
@@ -3062,6 +3155,17 @@ HRESULT CArchiveExtractCallback::CloseArc()
 {
   // we call CloseReparseAndFile() here because we can have non-closed file in some cases?
   HRESULT res = CloseReparseAndFile();
+#ifdef Z7_ASYNC_FILE_WRITER
+  {
+    // links and folder times are set after all files are written
+    HRESULT res2 = _asyncWriter.Flush();
+    const HRESULT res3 = Async_ReportMessages();
+    if (res2 == S_OK)
+      res2 = res3;
+    if (res == S_OK)
+      res = res2;
+  }
+#endif
 #ifdef SUPPORT_LINKS
   {
     const HRESULT res2 = SetPostLinks();
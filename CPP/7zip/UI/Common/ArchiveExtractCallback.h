@@ -15,6 +15,7 @@
 
 #include "../../Archive/IArchive.h"
 
+#include "AsyncFileWriter.h"
 #include "ExtractMode.h"
 #include "IFileExtractCallback.h"
 #include "OpenArchive.h"
@@ -60,6 +61,8 @@ struct CExtractNtOptions
   bool ExtractOwner;
 
   bool PreAllocateOutFile;
+  // writes the files in separate thread (-swa switch, if Z7_ASYNC_FILE_WRITER)
+  bool AsyncWrite;
 
   // used for hash arcs only, when we open external files
   bool PreserveATime;
@@ -73,6 +76,7 @@ struct CExtractNtOptions
       ReplaceColonForAltStream(false),
       WriteToAltStreamIfColon(false),
       ExtractOwner(false),
+      AsyncWrite(false),
       PreserveATime(false),
       OpenShareForWrite(false),
       SymLinks_DangerousLevel(5),
@@ -435,6 +439,13 @@ private:
 #endif
 // #endif
 
+#ifdef Z7_ASYNC_FILE_WRITER
+  // (_asyncWriter) must be destroyed after the streams that use it
+  CAsyncFileWriter _asyncWriter;
+  CAsyncOutFileStream *_asyncOutStreamSpec;
+  CMyComPtr<ISequentialOutStream> _asyncOutStream;
+#endif
+
   COutFileStream *_outFileStreamSpec;
   CMyComPtr<ISequentialOutStream> _outFileStream;
 
@@ -604,6 +615,9 @@ private:
   HRESULT GetItem(UInt32 index);
 
   HRESULT CloseFile();
+#ifdef Z7_ASYNC_FILE_WRITER
+  HRESULT Async_ReportMessages();
+#endif
   HRESULT CloseReparseAndFile();
   HRESULT SetDirsTimes();
   HRESULT SetSecurityInfo(UInt32 indexInArc, const FString &path) const;
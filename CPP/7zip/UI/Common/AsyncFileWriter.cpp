@@ -0,0 +1,310 @@
+// AsyncFileWriter.cpp
+
+#include "StdAfx.h"
+
+#include "../../../Windows/FileDir.h"
+
+#include "AsyncFileWriter.h"
+
+#ifdef Z7_ASYNC_FILE_WRITER
+
+using namespace NWindows;
+using namespace NFile;
+
+static const unsigned k_AsyncWriter_NumSlots = 32;
+static const size_t k_AsyncWriter_SlotSize = (size_t)1 << 18;
+
+static THREAD_FUNC_DECL AsyncWriterThread(void *p)
+{
+  ((CAsyncFileWriter *)p)->ThreadFunc();
+  return THREAD_FUNC_RET_ZERO;
+}
+
+HRESULT CAsyncFileWriter::Create()
+{
+  if (_thread.IsCreated())
+    return S_OK;
+  _buf.Alloc(k_AsyncWriter_NumSlots * k_AsyncWriter_SlotSize);
+  if (!_buf.IsAllocated())
+    return E_OUTOFMEMORY;
+  _slots.ClearAndSetSize(k_AsyncWriter_NumSlots);
+  for (unsigned i = 0; i < k_AsyncWriter_NumSlots; i++)
+  {
+    CSlot &slot = _slots[i];
+    slot.Buf = _buf + i * k_AsyncWriter_SlotSize;
+    slot.File = NULL;
+    slot.Close = false;
+  }
+  _prodPos = 0;
+  _consPos = 0;
+  _cur = NULL;
+  _error = S_OK;
+  WRes wres = _freeSem.Create(k_AsyncWriter_NumSlots, k_AsyncWriter_NumSlots);
+  if (wres == 0)
+    wres = _filledSem.Create(0, k_AsyncWriter_NumSlots);
+  if (wres == 0)
+    wres = _thread.Create(AsyncWriterThread, this);
+  return HRESULT_FROM_WIN32(wres);
+}
+
+void CAsyncFileWriter::Stop()
+{
+  if (!_thread.IsCreated())
+    return;
+  if (GetSlot(NULL) == S_OK)
+  {
+    _cur->Exit = true;
+    SubmitSlot();
+    _thread.Wait_Close();
+    FreeClosedFiles();
+  }
+  // else: the semaphore is broken, and the thread can't be stopped
+}
+
+// it's called, when the writer thread doesn't use the slots
+
+void CAsyncFileWriter::FreeClosedFiles()
+{
+  FOR_VECTOR (i, _slots)
+  {
+    CSlot &slot = _slots[i];
+    if (slot.Close)
+    {
+      slot.Close = false;
+      delete slot.File;
+      slot.File = NULL;
+    }
+  }
+}
+
+void CAsyncFileWriter::GetMessages(CObjectVector<CAsyncFileMessage> &messages)
+{
+  NSynchronization::CCriticalSectionLock lock(_cs);
+  messages = _messages;
+  _messages.Clear();
+}
+
+// a slot is reused for the next write to the same file, until it's full
+
+HRESULT CAsyncFileWriter::GetSlot(CAsyncOutFile *file)
+{
+  if (_cur)
+  {
+    if (_cur->File == file && _cur->Size != k_AsyncWriter_SlotSize)
+      return S_OK;
+    SubmitSlot();
+  }
+  const WRes wres = _freeSem.Lock();
+  if (wres != 0)
+    return HRESULT_FROM_WIN32(wres);
+  _cur = &_slots[_prodPos];
+  if (++_prodPos == k_AsyncWriter_NumSlots)
+    _prodPos = 0;
+  if (_cur->Close)
+  {
+    // the writer thread has closed that file already
+    _cur->Close = false;
+    delete _cur->File;
+  }
+  _cur->File = file;
+  _cur->Size = 0;
+  _cur->Exit = false;
+  return S_OK;
+}
+
+void CAsyncFileWriter::SubmitSlot()
+{
+  _cur = NULL;
+  _filledSem.Release();
+}
+
+HRESULT CAsyncFileWriter::Write(CAsyncOutFile *file, const void *data, size_t size)
+{
+  {
+    NSynchronization::CCriticalSectionLock lock(_cs);
+    RINOK(_error)
+  }
+  while (size != 0)
+  {
+    RINOK(GetSlot(file))
+    size_t cur = k_AsyncWriter_SlotSize - _cur->Size;
+    if (cur > size)
+      cur = size;
+    memcpy(_cur->Buf + _cur->Size, data, cur);
+    _cur->Size += cur;
+    data = (const void *)((const Byte *)data + cur);
+    size -= cur;
+  }
+  return S_OK;
+}
+
+HRESULT CAsyncFileWriter::Close(CAsyncOutFile *file)
+{
+  // the close slot is not reused for the writes of the next file
+  const HRESULT res = GetSlot(NULL);
+  if (res != S_OK)
+  {
+    delete file;
+    return res;
+  }
+  _cur->File = file;
+  _cur->Close = true;
+  SubmitSlot();
+  return S_OK;
+}
+
+HRESULT CAsyncFileWriter::WaitSlots()
+{
+  if (_cur)
+    SubmitSlot();
+  // all slots are free only after the writer thread has processed all of them
+  for (unsigned i = 0; i < k_AsyncWriter_NumSlots; i++)
+  {
+    const WRes wres = _freeSem.Lock();
+    if (wres != 0)
+      return HRESULT_FROM_WIN32(wres);
+  }
+  FreeClosedFiles();
+  _freeSem.Release(k_AsyncWriter_NumSlots);
+  return S_OK;
+}
+
+HRESULT CAsyncFileWriter::Flush()
+{
+  if (!_thread.IsCreated())
+    return S_OK;
+  RINOK(WaitSlots())
+  NSynchronization::CCriticalSectionLock lock(_cs);
+  // the error is returned once, so the writer can be used for the next archive
+  const HRESULT res = _error;
+  _error = S_OK;
+  return res;
+}
+
+void CAsyncFileWriter::AddMessage(const CAsyncOutFile *f, const char *message, HRESULT errorCode, bool isError)
+{
+  NSynchronization::CCriticalSectionLock lock(_cs);
+  if (isError && _error == S_OK)
+    _error = errorCode;
+  CAsyncFileMessage &m = _messages.AddNew();
+  m.Path = f->Path;
+  m.Message = message;
+  m.ErrorCode = errorCode;
+}
+
+// it does same operations as CArchiveExtractCallback::CloseFile() and SetAttrib() in synchronous mode
+
+void CAsyncFileWriter::CloseFile(CAsyncOutFile *f)
+{
+  COutFileStream *stream = f->Stream;
+  const UInt64 size = stream->ProcessedSize;
+  // it releases the reserved space past the end of file
+  if (f->PreAllocSize > size)
+    if (!stream->File.SetLength(size))
+      AddMessage(f, "Cannot set length for output file", GetLastError_noZero_HRESULT(), true);
+  const HRESULT res = stream->Close();
+  if (res != S_OK)
+  {
+    AddMessage(f, "Cannot close output file", res, true);
+    return;
+  }
+  if (f->Owner_Defined)
+    if (NDir::my_chown(f->Path, f->OwnerId, f->GroupId) != 0)
+      AddMessage(f, "Cannot set owner", GetLastError_noZero_HRESULT(), false);
+  if (f->Attrib_Defined)
+    if (!NDir::SetFileAttrib_PosixHighDetect(f->Path, f->Attrib))
+      AddMessage(f, "Cannot set file attribute", GetLastError_noZero_HRESULT(), false);
+}
+
+void CAsyncFileWriter::ProcessSlot(CSlot &slot)
+{
+  CAsyncOutFile *f = slot.File;
+  if (slot.Close)
+  {
+    CloseFile(f);
+    return;
+  }
+  if (f->Failed || slot.Size == 0)
+    return;
+
+  if (f->PreAllocSize != 0 && f->Stream->ProcessedSize == 0)
+  {
+    // it's a hint only, so we ignore the errors (for example, EOPNOTSUPP)
+    f->Stream->File.PreAllocate(f->PreAllocSize);
+  }
+
+  ISequentialOutStream *stream = f->Stream;
+  const HRESULT res = stream->Write(slot.Buf, (UInt32)slot.Size, NULL);
+  if (res != S_OK)
+  {
+    f->Failed = true;
+    AddMessage(f, "Cannot write output file", res, true);
+  }
+}
+
+void CAsyncFileWriter::ThreadFunc()
+{
+  for (;;)
+  {
+    if (_filledSem.Lock() != 0)
+      return;
+    CSlot &slot = _slots[_consPos];
+    if (++_consPos == k_AsyncWriter_NumSlots)
+      _consPos = 0;
+    const bool isExit = slot.Exit;
+    if (!isExit)
+      ProcessSlot(slot);
+    _freeSem.Release();
+    if (isExit)
+      return;
+  }
+}
+
+
+CAsyncOutFileStream::~CAsyncOutFileStream()
+{
+  if (!_file)
+    return;
+  // the stream was released without Close() (after some error).
+  // The caller closes the file, so we wait for all writes of the file.
+  _writer->WaitClosed();
+  delete _file;
+}
+
+void CAsyncOutFileStream::Init(CAsyncFileWriter *writer, COutFileStream *stream,
+    const FString &path, UInt64 preAllocSize)
+{
+  _writer = writer;
+  _file = new CAsyncOutFile;
+  _file->StreamRef = stream;
+  _file->Stream = stream;
+  _file->Path = path;
+  _file->PreAllocSize = preAllocSize;
+  WrittenSize = 0;
+}
+
+HRESULT CAsyncOutFileStream::Close()
+{
+  CAsyncOutFile *file = _file;
+  if (!file)
+    return S_OK;
+  _file = NULL;
+  return _writer->Close(file);
+}
+
+Z7_COM7F_IMF(CAsyncOutFileStream::Write(const void *data, UInt32 size, UInt32 *processedSize))
+{
+  if (processedSize)
+    *processedSize = 0;
+  if (size == 0)
+    return S_OK;
+  if (!_file)
+    return E_FAIL;
+  RINOK(_writer->Write(_file, data, size))
+  WrittenSize += size;
+  if (processedSize)
+    *processedSize = size;
+  return S_OK;
+}
+
+#endif
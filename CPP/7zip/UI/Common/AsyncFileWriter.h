@@ -0,0 +1,146 @@
+// AsyncFileWriter.h
+
+#ifndef ZIP7_INC_ASYNC_FILE_WRITER_H
+#define ZIP7_INC_ASYNC_FILE_WRITER_H
+
+#if !defined(_WIN32) && !defined(Z7_ST) && !defined(Z7_SFX)
+#define Z7_ASYNC_FILE_WRITER
+#endif
+
+#ifdef Z7_ASYNC_FILE_WRITER
+
+#include "../../../Common/MyBuffer2.h"
+#include "../../../Common/MyCom.h"
+#include "../../../Common/MyString.h"
+
+#include "../../../Windows/Synchronization.h"
+#include "../../../Windows/Thread.h"
+
+#include "../../Common/FileStreams.h"
+
+/*
+CAsyncFileWriter moves the preallocation, the writes and the closing of files
+of extraction to one writer thread. The decoding thread copies the data to one of
+a fixed number of slots and continues. If all slots are in use, it waits.
+
+The caller creates files as in synchronous mode. CAsyncOutFileStream::Close()
+queues the closing of the file in the next slot, so the number of files that
+are still open is limited by the number of slots. The writer thread closes the file
+after all its writes, sets the times stored by COutFileStream::SetTime(), and
+then it sets the owner and the attributes. The errors of these operations are
+reported later by GetMessages(), and the first error is returned by Flush().
+Also the first error is returned by the next Write() call from the decoding thread.
+*/
+
+struct CAsyncOutFile
+{
+  CMyComPtr<IOutStream> StreamRef;
+  COutFileStream *Stream;
+  FString Path;
+  UInt64 PreAllocSize; // 0 : no preallocation
+  bool Failed;
+
+  // the values that are set by the writer thread after closing
+  bool Owner_Defined;
+  bool Attrib_Defined;
+  UInt32 OwnerId;
+  UInt32 GroupId;
+  UInt32 Attrib;
+
+  CAsyncOutFile(): Stream(NULL), PreAllocSize(0), Failed(false),
+      Owner_Defined(false), Attrib_Defined(false) {}
+};
+
+struct CAsyncFileMessage
+{
+  FString Path;
+  const char *Message;
+  HRESULT ErrorCode;
+};
+
+class CAsyncFileWriter
+{
+  struct CSlot
+  {
+    CAsyncOutFile *File;
+    Byte *Buf;
+    size_t Size;
+    bool Exit;
+    bool Close; // the slot owns (File), that is deleted, when the slot is reused
+  };
+
+  CRecordVector<CSlot> _slots;
+  CMidBuffer _buf;
+  unsigned _prodPos;
+  unsigned _consPos;
+  CSlot *_cur;
+
+  NWindows::CThread _thread;
+  NWindows::NSynchronization::CSemaphore _freeSem;
+  NWindows::NSynchronization::CSemaphore _filledSem;
+
+  NWindows::NSynchronization::CCriticalSection _cs;
+  HRESULT _error;
+  CObjectVector<CAsyncFileMessage> _messages;
+
+  HRESULT GetSlot(CAsyncOutFile *file);
+  void SubmitSlot();
+  HRESULT WaitSlots();
+  void FreeClosedFiles();
+  void AddMessage(const CAsyncOutFile *f, const char *message, HRESULT errorCode, bool isError);
+  void ProcessSlot(CSlot &slot);
+  void CloseFile(CAsyncOutFile *f);
+public:
+  CAsyncFileWriter(): _prodPos(0), _consPos(0), _cur(NULL), _error(S_OK) {}
+  ~CAsyncFileWriter() { Stop(); }
+
+  bool IsCreated() { return _thread.IsCreated(); }
+  HRESULT Create();
+  void Stop();
+
+  HRESULT Write(CAsyncOutFile *file, const void *data, size_t size);
+  // the writer thread closes the file and deletes (file)
+  HRESULT Close(CAsyncOutFile *file);
+  // waits for all submitted writes and closings, and clears the error state
+  HRESULT Flush();
+  // waits for all submitted closings, but it keeps the error state for Flush()
+  HRESULT WaitClosed() { return _thread.IsCreated() ? WaitSlots() : S_OK; }
+  // moves the messages of write errors to (messages)
+  void GetMessages(CObjectVector<CAsyncFileMessage> &messages);
+
+  void ThreadFunc();
+};
+
+
+Z7_CLASS_IMP_NOQIB_1(
+  CAsyncOutFileStream
+  , ISequentialOutStream
+)
+  CAsyncFileWriter *_writer;
+  CAsyncOutFile *_file;
+public:
+  UInt64 WrittenSize;
+
+  CAsyncOutFileStream(): _writer(NULL), _file(NULL), WrittenSize(0) {}
+  ~CAsyncOutFileStream();
+  void Init(CAsyncFileWriter *writer, COutFileStream *stream,
+      const FString &path, UInt64 preAllocSize);
+  void SetOwner(UInt32 ownerId, UInt32 groupId)
+  {
+    _file->OwnerId = ownerId;
+    _file->GroupId = groupId;
+    _file->Owner_Defined = true;
+  }
+  void SetAttrib(UInt32 attrib)
+  {
+    _file->Attrib = attrib;
+    _file->Attrib_Defined = true;
+  }
+  // the writer thread closes the file after all its writes.
+  // The caller must call COutFileStream::SetTime() before Close().
+  HRESULT Close();
+};
+
+#endif
+
+#endif
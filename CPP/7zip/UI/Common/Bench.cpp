@@ -2729,6 +2729,28 @@ static const CBenchMethod g_Bench[] =
   // { 10, 22, 1655,    0, 1830, "PPMDZip:x5" },
   { 10, 22, 1655,    0, 1830, "PPMD:x5" },
 
+  // ZS codecs: these entries are also used as levels for "b -mm=method"
+  { 20, 22,   18,    0,    5, "ZSTD:x1" },
+  { 20, 22,   42,    0,    6, "ZSTD:x5" },
+  { 10, 22,   82,    0,    6, "ZSTD:x9" },
+  {  5, 22,  313,    0,    6, "ZSTD:x15" },
+
+  { 10, 22,   22,    0,   16, "BROTLI:x1" },
+  { 10, 22,  125,    0,   16, "BROTLI:x5" },
+  {  5, 22, 1466,    0,   16, "BROTLI:x9" },
+
+  { 10, 22,   10,    0,    4, "LZ4:x1" },
+  {  5, 22,   68,    0,    4, "LZ4:x9" },
+
+  { 10, 22,   10,    0,    4, "LZ5:x1" },
+  {  5, 22,  211,    0,    7, "LZ5:x9" },
+
+  { 10, 22,   13,    0,    4, "LIZARD:x10" },
+  {  5, 22,   21,    0,    4, "LIZARD:x30" },
+
+  { 10, 22,  473,  145,   20, "FLZMA2:x1" },
+  { 10, 22,  843,  145,   20, "FLZMA2:x5" },
+
   // {  2,  0,  -16,    0,  -16, "Swap2" },
   {  2,  0,  -16,    0,  -16, "Swap4" },
 
@@ -3744,6 +3766,51 @@ static void Print_Pow(IBenchPrintCallback &f, unsigned pow)
   PrintLeft(f, s, kFieldSize_SmallName); // 4
 }
 
+/* the methods of ZS codecs are controlled by the level, and not by the dictionary size */
+static const char * const k_LevelBench_Methods[] =
+{
+    "ZSTD"
+  , "BROTLI"
+  , "LZ4"
+  , "LZ5"
+  , "LIZARD"
+  , "FLZMA2"
+};
+
+static bool IsLevelBenchMethod(const AString &methodName)
+{
+  for (unsigned i = 0; i < Z7_ARRAY_SIZE(k_LevelBench_Methods); i++)
+    if (AreSameMethodNames(k_LevelBench_Methods[i], methodName))
+      return true;
+  return false;
+}
+
+// returns level of g_Bench entry, if the entry is "method:x{level}"
+static bool GetLevelBenchMethod(const char *benchName, const AString &methodName, UInt32 &level)
+{
+  AString benchMethod (benchName);
+  const int propPos = benchMethod.Find(':');
+  if (propPos < 0 || benchMethod[(unsigned)propPos + 1] != 'x')
+    return false;
+  const char *end;
+  level = ConvertStringToUInt32(benchMethod.Ptr((unsigned)propPos + 2), &end);
+  if (*end != 0)
+    return false;
+  benchMethod.DeleteFrom((unsigned)propPos);
+  return AreSameMethodNames(benchMethod, methodName);
+}
+
+static const unsigned kFieldSize_Ratio = 5;
+
+static void Print_Ratio(IBenchPrintCallback &f, const CBenchInfo &info)
+{
+  f.Print(kSep);
+  UInt64 ratio = 0;
+  if (info.UnpackSize != 0)
+    ratio = info.PackSize * 100 / info.UnpackSize;
+  PrintNumber(f, ratio, kFieldSize_Ratio);
+}
+
 static void Bench_BW_Print_Usage_Speed(IBenchPrintCallback &f,
     UInt64 usage, UInt64 speed)
 {
@@ -4624,6 +4691,8 @@ HRESULT Bench(
   else if (methodName.Find('*') >= 0)
     totalBenchMode = true;
 
+  const bool levelBenchMode = !totalBenchMode && IsLevelBenchMethod(methodName);
+
   // ---------- Threads loop ----------
   for (unsigned threadsPassIndex = 0; threadsPassIndex < 3; threadsPassIndex++)
   {
@@ -4729,7 +4798,7 @@ HRESULT Bench(
     PrintRight(f, "Decompressing", fileldSize);
   }
   f.NewLine();
-  PrintLeft(f, totalBenchMode ? "Method" : "Dict", callback.NameFieldSize);
+  PrintLeft(f, totalBenchMode ? "Method" : levelBenchMode ? "Lev" : "Dict", callback.NameFieldSize);
 
   int j;
 
@@ -4749,6 +4818,11 @@ HRESULT Bench(
     if (j == 0)
       f.Print(kSep);
   }
+  if (levelBenchMode)
+  {
+    f.Print(kSep);
+    PrintRight(f, "Ratio", kFieldSize_Ratio + 1);
+  }
   
   f.NewLine();
   PrintSpaces(f, callback.NameFieldSize);
@@ -4769,6 +4843,11 @@ HRESULT Bench(
     if (j == 0)
       f.Print(kSep);
   }
+  if (levelBenchMode)
+  {
+    f.Print(kSep);
+    PrintRight(f, "%", kFieldSize_Ratio + 1);
+  }
   
   f.NewLine();
   f.NewLine();
@@ -4938,6 +5017,95 @@ HRESULT Bench(
   if (startDicLog < kBenchMinDicLogSize)
     startDicLog = kBenchMinDicLogSize;
 
+  if (levelBenchMode)
+  {
+    /* the rows are the levels of the method from g_Bench, each with its own complexity.
+       If the level is specified, we use the complexity of the nearest level
+       (of the lower level, if two levels are at the same distance). */
+    const bool levelDefined = (method.FindProp(NCoderPropID::kLevel) >= 0);
+    CUIntVector rows;
+    {
+      int best = -1;
+      UInt32 bestLevel = 0;
+      UInt32 bestDist = 0;
+      for (unsigned k = 0; k < Z7_ARRAY_SIZE(g_Bench); k++)
+      {
+        UInt32 benchLevel;
+        if (!GetLevelBenchMethod(g_Bench[k].Name, methodName, benchLevel))
+          continue;
+        if (!levelDefined)
+        {
+          rows.Add(k);
+          continue;
+        }
+        const UInt32 dist = benchLevel <= level ? level - benchLevel : benchLevel - level;
+        if (best < 0 || dist < bestDist || (dist == bestDist && benchLevel < bestLevel))
+        {
+          best = (int)k;
+          bestLevel = benchLevel;
+          bestDist = dist;
+        }
+      }
+      if (best >= 0)
+        rows.Add((unsigned)best);
+    }
+
+    for (unsigned i = 0; i < numIterations; i++)
+    FOR_VECTOR (k, rows)
+    {
+      const CBenchMethod &h = g_Bench[rows[k]];
+      UInt32 rowLevel = level;
+      COneMethodInfo method2 = method;
+      if (!levelDefined)
+      {
+        GetLevelBenchMethod(h.Name, methodName, rowLevel);
+        NCOM::CPropVariant propVariant = (UInt32)rowLevel;
+        RINOK(method2.ParseMethodFromPROPVARIANT((UString)"x", propVariant))
+      }
+      {
+        char s[16];
+        s[0] = 'x';
+        ConvertUInt32ToString(rowLevel, s + 1);
+        const unsigned pos = MyStringLen(s);
+        s[pos] = ':';
+        s[pos + 1] = 0;
+        PrintLeft(f, s, callback.NameFieldSize);
+      }
+
+      callback.BenchProps.EncComplex = h.EncComplex;
+      callback.BenchProps.DecComplexCompr = h.DecComplexCompr;
+      callback.BenchProps.DecComplexUnc = h.DecComplexUnc;
+      callback.BenchProps.LzmaRatingMode = false;
+      callback.DictSize = dict;
+
+      size_t uncompressedDataSize;
+      if (use_fileData)
+        uncompressedDataSize = fileDataBuffer.Size();
+      else
+      {
+        uncompressedDataSize = (size_t)dict;
+        if (uncompressedDataSize != dict)
+          return E_OUTOFMEMORY;
+        uncompressedDataSize += kAdditionalSize;
+      }
+
+      const HRESULT res = MethodBench(
+          EXTERNAL_CODECS_LOC_VARS
+          complexInCommands,
+        #ifndef Z7_ST
+          true, numThreads,
+          &affinityMode,
+        #endif
+          method2,
+          uncompressedDataSize, (const Byte *)fileDataBuffer,
+          kOldLzmaDictBits, printCallback, &callback, &callback.BenchProps);
+      if (res == S_OK)
+        Print_Ratio(f, callback.BenchInfo_Results[0]);
+      f.NewLine();
+      RINOK(res)
+    }
+  }
+  else
   for (unsigned i = 0; i < numIterations; i++)
   {
     unsigned pow = (dict < GetDictSizeFromLog(startDicLog)) ? kBenchMinDicLogSize : (unsigned)startDicLog;
@@ -5000,6 +5168,11 @@ HRESULT Bench(
     f.Print(kSep);
     PrintChars(f, '-', fileldSize);
   }
+  if (levelBenchMode)
+  {
+    f.Print(kSep);
+    PrintChars(f, '-', kFieldSize_Ratio + 1);
+  }
 
   f.NewLine();
   
@@ -17,6 +17,11 @@
 
 #include "../../Archive/IArchive.h"
 
+#if !defined(_WIN32) && !defined(Z7_ST) && !defined(Z7_SFX)
+#define Z7_DIR_PREFETCH
+class CDirPrefetcher;
+#endif
+
 struct CDirItemsStat
 {
   UInt64 NumDirs;
@@ -306,6 +311,11 @@ class CDirItems
 
   HRESULT EnumerateDir(int phyParent, int logParent, const FString &phyPrefix);
 
+ #ifdef Z7_DIR_PREFETCH
+  CDirPrefetcher *_prefetcher;
+  CBoolVector _prefetchIsLink; // for the items of last EnumerateOneDir() call
+ #endif
+
 public:
   CObjectVector<CDirItem> Items;
 
@@ -351,6 +361,24 @@ public:
 
  #endif
 
+ #ifdef Z7_DIR_PREFETCH
+  // the number of threads that list the subdirectories ahead of the scan.
+  // (NumScanThreads <= 1) : the directories are listed only by the scan itself.
+  UInt32 NumScanThreads;
+  bool Prefetch_IsActive() const { return _prefetcher != NULL; }
+  /* it queues the subdirectories of (phyPrefix) that the scan will enter.
+     (files) is the result of last EnumerateOneDir() call for (phyPrefix).
+     The links to directories are not queued. */
+  void Prefetch_Subdirs(const FString &phyPrefix,
+      const CObjectVector<NWindows::NFile::NFind::CFileInfo> &files,
+      const CBoolVector &needEnter);
+  // the scan has left the directory (phyPrefix), so the listings inside it are not needed
+  void Prefetch_Release(const FString &phyPrefix);
+  // it stops the threads and frees the listings that were not used
+  void Prefetch_Stop();
+  ~CDirItems() { Prefetch_Stop(); }
+ #endif
+
   IDirItemsCallback *Callback;
 
   CDirItems();
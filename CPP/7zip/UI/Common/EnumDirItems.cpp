@@ -25,6 +25,11 @@
 #include "EnumDirItems.h"
 #include "SortUtils.h"
 
+#ifdef Z7_DIR_PREFETCH
+#include "../../../Windows/Synchronization.h"
+#include "../../../Windows/Thread.h"
+#endif
+
 using namespace NWindows;
 using namespace NFile;
 using namespace NName;
@@ -177,6 +182,11 @@ void CDirItems::DeleteLastPrefix()
 
 bool InitLocalPrivileges();
 
+#ifdef Z7_DIR_PREFETCH
+// the threads mostly wait for the file system, so it doesn't depend on the number of CPUs
+static const UInt32 k_DirPrefetch_NumThreads_Def = 4;
+#endif
+
 CDirItems::CDirItems():
     SymLinks(false),
     ScanAltStreams(false)
@@ -188,9 +198,15 @@ CDirItems::CDirItems():
    #endif
    #ifndef _WIN32
     , StoreOwnerName(false)
+   #endif
+   #ifdef Z7_DIR_PREFETCH
+    , NumScanThreads(k_DirPrefetch_NumThreads_Def)
    #endif
     , Callback(NULL)
 {
+  #ifdef Z7_DIR_PREFETCH
+  _prefetcher = NULL;
+  #endif
   #ifdef Z7_USE_SECURITY_CODE
   _saclEnabled = InitLocalPrivileges();
   #endif
@@ -255,9 +271,438 @@ HRESULT CDirItems::AddSecurityItem(const FString &path, int &secureIndex)
 
 #endif // Z7_USE_SECURITY_CODE
 
+#ifdef Z7_DIR_PREFETCH
+
+/*
+CDirPrefetcher lists directories before the scan reaches them.
+The scan (EnumerateDir() / EnumerateDirItems()) is still single-threaded,
+and it walks the tree in the same order as before, so (CDirItems) gets the
+same items and the same errors in the same order. Only the readdir() and
+fstatat() calls are moved to the threads.
+
+When the scan has the listing of some directory, it queues the subdirectories
+that it will enter: the censor rules are checked by the scan before queueing,
+and the links to directories are not queued. So the threads don't list the
+excluded directories, and they don't follow the links.
+The queued subdirectories of one directory are kept in one frame in the order
+of the scan. The frames of the directories on the current path of the scan
+are in stack, so the scan finds the listing for next subdirectory in the top frame.
+The queue for threads is a stack too, and the first subdirectory is on top of it.
+So the threads work near the current position of the scan.
+The number of listings that are ready but not used yet is limited by _spaceSem.
+The scan waits for a directory that is being listed by a thread,
+and it lists a queued directory itself, if no thread has taken it yet.
+*/
+
+static const UInt32 k_DirPrefetch_NumThreads_Max = 32;
+static const UInt32 k_DirPrefetch_NumListingsMax = 1 << 10;
+static const UInt32 k_DirPrefetch_NumQueuedMax = (UInt32)1 << 30;
+
+struct CDirListError
+{
+  FString Path;
+  DWORD ErrorCode;
+};
+
+struct CDirListing
+{
+  FString Path;
+  CObjectVector<NFind::CFileInfo> Files;
+  CBoolVector IsLink; // for (Files)
+  CObjectVector<CDirListError> Errors;
+  int State;
+  bool Cancelled;
+
+  CDirListing(): State(0), Cancelled(false) {}
+};
+
+// it's same as posix code of CDirItems::EnumerateOneDir(), but it saves the errors.
+// The prefetch threads call it without (callbackItems).
+
+static HRESULT ListDir(CDirListing &listing, bool followLink, CDirItems *callbackItems)
+{
+  const FString &phyPrefix = listing.Path;
+  NFind::CEnumerator enumerator;
+  enumerator.SetDirPrefix(phyPrefix);
+
+  CObjectVector<NFind::CDirEntry> entries;
+  for (;;)
+  {
+    bool found;
+    NFind::CDirEntry de;
+    if (!enumerator.Next(de, found))
+    {
+      CDirListError &e = listing.Errors.AddNew();
+      e.ErrorCode = ::GetLastError();
+      e.Path = phyPrefix;
+      return S_OK;
+    }
+    if (!found)
+      break;
+    entries.Add(de);
+  }
+
+  FOR_VECTOR (i, entries)
+  {
+    const NFind::CDirEntry &de = entries[i];
+    NFind::CFileInfo fi;
+    if (!enumerator.Fill_FileInfo(de, fi, followLink))
+    {
+      CDirListError &e = listing.Errors.AddNew();
+      e.ErrorCode = ::GetLastError();
+      e.Path = phyPrefix + de.Name;
+      continue;
+    }
+    listing.Files.Add(fi);
+   #if !defined(_AIX) && !defined(__sun)
+    // (fi) is the target of link in (followLink) mode, so we check the type of entry
+    listing.IsLink.Add(de.Type == DT_LNK || de.Type == DT_UNKNOWN);
+   #else
+    listing.IsLink.Add(true);
+   #endif
+    if (callbackItems && callbackItems->Callback
+        && (i & kScanProgressStepMask) == kScanProgressStepMask)
+    {
+      RINOK(callbackItems->ScanProgress(phyPrefix))
+    }
+  }
+  return S_OK;
+}
+
+// the queued subdirectories of one directory in the order of the scan
+
+struct CDirPrefetchFrame
+{
+  FString Path;
+  CRecordVector<CDirListing *> Subdirs;
+  unsigned Next; // the first subdirectory that was not requested by the scan
+
+  CDirPrefetchFrame(): Next(0) {}
+};
+
+class CDirPrefetcher
+{
+  enum
+  {
+    k_State_Queued,
+    k_State_Listing,
+    k_State_Done
+  };
+
+  CObjectVector<NWindows::CThread> _threads;
+  NWindows::NSynchronization::CCriticalSection _cs;
+  NWindows::NSynchronization::CSemaphore _queueSem;
+  NWindows::NSynchronization::CSemaphore _spaceSem;
+  NWindows::NSynchronization::CAutoResetEvent _doneEvent;
+
+  // only the scan thread changes (_frames).
+  // The listings before (Next) in frame are owned by the scan or they are cancelled.
+  CObjectVector<CDirPrefetchFrame> _frames;
+  // the queued listings, the last one is listed first.
+  // The cancelled listing is deleted by the thread that takes it.
+  CRecordVector<CDirListing *> _queue;
+  bool _followLink;
+  bool _exit;
+
+  unsigned Drop(CDirListing *listing);
+public:
+  CDirPrefetcher(bool followLink): _followLink(followLink), _exit(false) {}
+  ~CDirPrefetcher() { Stop(); }
+
+  bool Create(UInt32 numThreads);
+  void Stop();
+  // it returns NULL, if the directory is not queued. The caller deletes returned listing.
+  CDirListing *Get(const FString &path);
+  void Queue_Subdirs(const FString &path,
+      const CObjectVector<NFind::CFileInfo> &files,
+      const CBoolVector &isLink,
+      const CBoolVector &needEnter);
+  void Release(const FString &path);
+  void ThreadFunc();
+};
+
+static THREAD_FUNC_DECL DirPrefetchThread(void *p)
+{
+  ((CDirPrefetcher *)p)->ThreadFunc();
+  return THREAD_FUNC_RET_ZERO;
+}
+
+bool CDirPrefetcher::Create(UInt32 numThreads)
+{
+  if (_doneEvent.Create() != 0
+      || _queueSem.Create(0, k_DirPrefetch_NumQueuedMax) != 0
+      || _spaceSem.Create(k_DirPrefetch_NumListingsMax, k_DirPrefetch_NumListingsMax) != 0)
+    return false;
+  for (UInt32 i = 0; i < numThreads; i++)
+  {
+    NWindows::CThread &t = _threads.AddNew();
+    if (t.Create(DirPrefetchThread, this) != 0)
+    {
+      _threads.DeleteBack();
+      break;
+    }
+  }
+  return !_threads.IsEmpty();
+}
+
+void CDirPrefetcher::Stop()
+{
+  if (!_threads.IsEmpty())
+  {
+    {
+      NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+      _exit = true;
+    }
+    _queueSem.Release(_threads.Size());
+    _spaceSem.Release(_threads.Size());
+    FOR_VECTOR (i, _threads)
+      _threads[i].Wait_Close();
+    _threads.Clear();
+  }
+  FOR_VECTOR (i, _queue)
+    if (_queue[i]->Cancelled)
+      delete _queue[i];
+  _queue.Clear();
+  FOR_VECTOR (i, _frames)
+  {
+    const CDirPrefetchFrame &frame = _frames[i];
+    for (unsigned k = frame.Next; k < frame.Subdirs.Size(); k++)
+      delete frame.Subdirs[k];
+  }
+  _frames.Clear();
+}
+
+// it must be called in critical section.
+// it returns the number of slots that must be released in _spaceSem.
+
+unsigned CDirPrefetcher::Drop(CDirListing *listing)
+{
+  if (listing->State == k_State_Done)
+  {
+    delete listing;
+    return 1;
+  }
+  listing->Cancelled = true;
+  return 0;
+}
+
+void CDirPrefetcher::Queue_Subdirs(const FString &path,
+    const CObjectVector<NFind::CFileInfo> &files,
+    const CBoolVector &isLink,
+    const CBoolVector &needEnter)
+{
+  CDirPrefetchFrame *frame = NULL;
+  FOR_VECTOR (i, files)
+  {
+    if (!needEnter[i] || isLink[i])
+      continue;
+    if (!frame)
+    {
+      frame = &_frames.AddNew();
+      frame->Path = path;
+    }
+    CDirListing *sub = new CDirListing;
+    sub->Path = path;
+    sub->Path += files[i].Name;
+    sub->Path.Add_PathSepar();
+    frame->Subdirs.Add(sub);
+  }
+  if (!frame)
+    return;
+  {
+    NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+    for (unsigned i = frame->Subdirs.Size(); i != 0;)
+      _queue.Add(frame->Subdirs[--i]);
+  }
+  _queueSem.Release(frame->Subdirs.Size());
+}
+
+CDirListing *CDirPrefetcher::Get(const FString &path)
+{
+  if (_frames.IsEmpty())
+    return NULL;
+  CDirPrefetchFrame &frame = _frames.Back();
+  unsigned index = frame.Next;
+  for (; index < frame.Subdirs.Size(); index++)
+    if (frame.Subdirs[index]->Path == path)
+      break;
+  if (index == frame.Subdirs.Size())
+    return NULL;
+  CDirListing *listing = frame.Subdirs[index];
+  {
+    NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+    // the scan doesn't enter the skipped subdirectories
+    unsigned numFreed = 0;
+    for (unsigned i = frame.Next; i < index; i++)
+      numFreed += Drop(frame.Subdirs[i]);
+    frame.Next = index + 1;
+    if (numFreed != 0)
+      _spaceSem.Release(numFreed);
+  }
+  for (;;)
+  {
+    {
+      NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+      if (listing->State == k_State_Done)
+      {
+        _spaceSem.Release();
+        return listing;
+      }
+      if (listing->State == k_State_Queued)
+      {
+        // no thread has taken it yet, so we list it in the caller's thread
+        listing->Cancelled = true;
+        return NULL;
+      }
+    }
+    if (_doneEvent.Lock() != 0)
+    {
+      NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+      if (Drop(listing) != 0)
+        _spaceSem.Release();
+      return NULL;
+    }
+  }
+}
+
+void CDirPrefetcher::Release(const FString &path)
+{
+  if (_frames.IsEmpty() || _frames.Back().Path != path)
+    return;
+  const CDirPrefetchFrame &frame = _frames.Back();
+  unsigned numFreed = 0;
+  {
+    NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+    for (unsigned i = frame.Next; i < frame.Subdirs.Size(); i++)
+      numFreed += Drop(frame.Subdirs[i]);
+  }
+  _frames.DeleteBack();
+  if (numFreed != 0)
+    _spaceSem.Release(numFreed);
+}
+
+void CDirPrefetcher::ThreadFunc()
+{
+  for (;;)
+  {
+    if (_spaceSem.Lock() != 0)
+      return;
+    if (_queueSem.Lock() != 0)
+      return;
+    CDirListing *listing;
+    {
+      NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+      if (_exit)
+        return;
+      listing = _queue.Back();
+      _queue.DeleteBack();
+      if (!listing->Cancelled)
+        listing->State = k_State_Listing;
+    }
+    if (listing->Cancelled)
+    {
+      delete listing;
+      _spaceSem.Release();
+      continue;
+    }
+
+    ListDir(*listing, _followLink, NULL);
+
+    {
+      NWindows::NSynchronization::CCriticalSectionLock lock(_cs);
+      if (listing->Cancelled)
+      {
+        delete listing;
+        _spaceSem.Release();
+        continue;
+      }
+      listing->State = k_State_Done;
+    }
+    _doneEvent.Set();
+  }
+}
+
+
+void CDirItems::Prefetch_Subdirs(const FString &phyPrefix,
+    const CObjectVector<NFind::CFileInfo> &files,
+    const CBoolVector &needEnter)
+{
+  if (_prefetcher && files.Size() == _prefetchIsLink.Size())
+    _prefetcher->Queue_Subdirs(phyPrefix, files, _prefetchIsLink, needEnter);
+}
+
+void CDirItems::Prefetch_Release(const FString &phyPrefix)
+{
+  if (_prefetcher)
+    _prefetcher->Release(phyPrefix);
+}
+
+void CDirItems::Prefetch_Stop()
+{
+  if (_prefetcher)
+  {
+    delete _prefetcher;
+    _prefetcher = NULL;
+  }
+}
+
+#endif // Z7_DIR_PREFETCH
+
 
 HRESULT CDirItems::EnumerateOneDir(const FString &phyPrefix, CObjectVector<NFind::CFileInfo> &files)
 {
+ #ifdef Z7_DIR_PREFETCH
+  if (!_prefetcher && NumScanThreads > 1)
+  {
+    _prefetcher = new CDirPrefetcher(!SymLinks);
+    UInt32 numThreads = NumScanThreads;
+    if (numThreads > k_DirPrefetch_NumThreads_Max)
+      numThreads = k_DirPrefetch_NumThreads_Max;
+    if (!_prefetcher->Create(numThreads))
+    {
+      Prefetch_Stop();
+      NumScanThreads = 1;
+    }
+  }
+  if (_prefetcher)
+  {
+    HRESULT res = S_OK;
+    CDirListing *listing = _prefetcher->Get(phyPrefix);
+    // ListDir() reports the progress of the directory that is listed here
+    const bool wasPrefetched = (listing != NULL);
+    if (!listing)
+    {
+      listing = new CDirListing;
+      listing->Path = phyPrefix;
+      res = ListDir(*listing, !SymLinks, this);
+    }
+    if (res == S_OK)
+    FOR_VECTOR (i, listing->Errors)
+    {
+      const CDirListError &e = listing->Errors[i];
+      res = AddError(e.Path, e.ErrorCode);
+      if (res != S_OK)
+        break;
+    }
+    if (res == S_OK)
+    {
+      FOR_VECTOR (i, listing->Files)
+      {
+        files.Add(listing->Files[i]);
+        if (wasPrefetched && Callback && (i & kScanProgressStepMask) == kScanProgressStepMask)
+        {
+          res = ScanProgress(phyPrefix);
+          if (res != S_OK)
+            break;
+        }
+      }
+      _prefetchIsLink = listing->IsLink;
+    }
+    delete listing;
+    return res;
+  }
+ #endif
+
   NFind::CEnumerator enumerator;
   // printf("\n  enumerator.SetDirPrefix(phyPrefix) \n");
 
@@ -335,6 +780,16 @@ HRESULT CDirItems::EnumerateDir(int phyParent, int logParent, const FString &phy
   CObjectVector<NFind::CFileInfo> files;
   RINOK(EnumerateOneDir(phyPrefix, files))
 
+ #ifdef Z7_DIR_PREFETCH
+  if (Prefetch_IsActive())
+  {
+    CBoolVector needEnter;
+    FOR_VECTOR (i, files)
+      needEnter.Add(files[i].IsDir());
+    Prefetch_Subdirs(phyPrefix, files, needEnter);
+  }
+ #endif
+
   FOR_VECTOR (i, files)
   {
     #ifdef _WIN32
@@ -380,6 +835,9 @@ HRESULT CDirItems::EnumerateDir(int phyParent, int logParent, const FString &phy
       RINOK(EnumerateDir((int)parent, (int)parent, phyPrefix + name2))
     }
   }
+ #ifdef Z7_DIR_PREFETCH
+  Prefetch_Release(phyPrefix);
+ #endif
   return S_OK;
 }
 
@@ -465,6 +923,9 @@ HRESULT CDirItems::EnumerateItems2(
     }
   }
   
+ #ifdef Z7_DIR_PREFETCH
+  Prefetch_Stop();
+ #endif
   ReserveDown();
   return S_OK;
 }
@@ -783,6 +1244,30 @@ static bool IsVirtualFsFolder(const FString &prefix, const UString &name)
 
 
 
+#ifdef Z7_DIR_PREFETCH
+
+// it's same check as in EnumerateForItem() for directories that the scan enters
+
+static bool NeedEnterDir(
+    const NFind::CFileInfo &fi,
+    const NWildcard::CCensorNode &curNode,
+    const UStringVector &addParts,
+    bool enterToSubFolders)
+{
+  if (!fi.IsDir() || fi.IsPosixLink())
+    return false;
+  const UString name = fs2us(fi.Name);
+  UStringVector newParts = addParts;
+  newParts.Add(name);
+  if (curNode.CheckPathToRoot(false, newParts, false))
+    return false;
+  if (addParts.IsEmpty() && curNode.FindSubNode(name) >= 0)
+    return true;
+  return enterToSubFolders || curNode.CheckPathToRoot(true, newParts, false);
+}
+
+#endif
+
 static HRESULT EnumerateDirItems(
     const NWildcard::CCensorNode &curNode,
     const int phyParent, const int logParent, const FString &phyPrefix,
@@ -1103,6 +1588,15 @@ static HRESULT EnumerateDirItems(
   {
     // files.Clear();
     RINOK(dirItems.EnumerateOneDir(phyPrefix, files))
+   #ifdef Z7_DIR_PREFETCH
+    if (dirItems.Prefetch_IsActive())
+    {
+      CBoolVector needEnter;
+      FOR_VECTOR (i, files)
+        needEnter.Add(NeedEnterDir(files[i], curNode, addParts, enterToSubFolders));
+      dirItems.Prefetch_Subdirs(phyPrefix, files, needEnter);
+    }
+   #endif
   /*
   FOR_VECTOR (i, files)
   {
@@ -1155,6 +1649,9 @@ static HRESULT EnumerateDirItems(
     }
   }
 
+ #ifdef Z7_DIR_PREFETCH
+  dirItems.Prefetch_Release(phyPrefix);
+ #endif
   return S_OK;
 }
 
@@ -1186,6 +1683,9 @@ HRESULT EnumerateItems(
         false // enterToSubFolders
         ))
   }
+ #ifdef Z7_DIR_PREFETCH
+  dirItems.Prefetch_Stop();
+ #endif
   dirItems.ReserveDown();
 
  #if defined(_WIN32) && !defined(UNDER_CE)
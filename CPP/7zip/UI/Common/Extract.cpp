@@ -416,6 +416,7 @@ HRESULT Extract(
     op.types = &types2;
     op.excludedFormats = &excludedFormats;
     op.stdInMode = options.StdInMode;
+    op.mapFile = options.MapArcFile;
     op.stream = NULL;
     op.filePath = arcPath;
 
@@ -23,6 +23,7 @@ struct CExtractOptionsBase
 
   bool PathMode_Force;
   bool OverwriteMode_Force;
+  bool MapArcFile;
   NExtract::NPathMode::EEnum PathMode;
   NExtract::NOverwriteMode::EEnum OverwriteMode;
   NExtract::NZoneIdMode::EEnum ZoneMode;
@@ -37,6 +38,7 @@ struct CExtractOptionsBase
       ExcludeFileItems(false),
       PathMode_Force(false),
       OverwriteMode_Force(false),
+      MapArcFile(false),
       PathMode(NExtract::NPathMode::kFullPaths),
       OverwriteMode(NExtract::NOverwriteMode::kAsk),
       ZoneMode(NExtract::NZoneIdMode::kNone)
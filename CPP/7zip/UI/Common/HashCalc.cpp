@@ -9,10 +9,18 @@
 #include "../../../Common/IntToString.h"
 #include "../../../Common/StringToInt.h"
 
+#ifndef Z7_ST
+#include "../../../Common/MyBuffer2.h"
+#include "../../../Windows/System.h"
+#endif
+
 #include "../../Common/FileStreams.h"
 #include "../../Common/ProgressUtils.h"
 #include "../../Common/StreamObjects.h"
 #include "../../Common/StreamUtils.h"
+#ifndef Z7_ST
+#include "../../Common/VirtThread.h"
+#endif
 
 #include "../../Archive/Common/ItemNameUtils.h"
 #include "../../Archive/IArchive.h"
@@ -99,12 +107,16 @@ HRESULT CHashBundle::SetMethods(DECL_EXTERNAL_CODECS_LOC_VARS const UStringVecto
     RINOK(CreateHasher(EXTERNAL_CODECS_LOC_VARS ids[i], name, hasher))
     if (!hasher)
       throw "Can't create hasher";
-    const COneMethodInfo &m = methods[i];
+    COneMethodInfo &m = methods[i];
     {
       CMyComPtr<ICompressSetCoderProperties> scp;
       hasher.QueryInterface(IID_ICompressSetCoderProperties, &scp);
       if (scp)
+      {
+        if (NumThreads != 0 && m.Get_NumThreads() < 0)
+          m.AddProp_NumThreads(NumThreads);
         RINOK(m.SetCoderProps(scp, NULL))
+      }
     }
     const UInt32 digestSize = hasher->GetDigestSize();
     if (digestSize > k_HashCalc_DigestSize_Max)
@@ -187,6 +199,11 @@ void CHasherState::AddDigest(unsigned groupIndex, const Byte *data)
 }
 
 void CHashBundle::Final(bool isDir, bool isAltStream, const UString &path)
+{
+  Final(isDir, isAltStream, path, NULL);
+}
+
+void CHashBundle::Final(bool isDir, bool isAltStream, const UString &path, const Byte *digests)
 {
   if (isDir)
     NumDirs++;
@@ -211,7 +228,10 @@ void CHashBundle::Final(bool isDir, bool isAltStream, const UString &path)
     CHasherState &h = Hashers[i];
     if (!isDir)
     {
-      h.Hasher->Final(h.Digests[0]); // k_HashCalc_Index_Current
+      if (digests)
+        memcpy(h.Digests[0], digests + (size_t)i * k_HashCalc_DigestSize_Max, h.DigestSize);
+      else
+        h.Hasher->Final(h.Digests[0]); // k_HashCalc_Index_Current
       if (!isAltStream)
         h.AddDigest(k_HashCalc_Index_DataSum, h.Digests[0]);
     }
@@ -466,6 +486,395 @@ static void WriteLine(CDynLimBuf &hashFileString,
   WriteLine(hashFileString, options, path, isDir, methodName, hashesString);
 }
 
+#ifndef Z7_ST
+
+/*
+  Multi-threaded HashCalc():
+  worker threads take the items in order. Each worker opens its file, reads it
+  with large buffers and hashes it with its own set of hashers. If a file is
+  bigger than one buffer, each hash method runs in its own lane thread on the
+  same buffer, while the worker reads the next buffer.
+  The main thread takes the results in the order of items and calls the
+  callback as in the single-threaded code, so the output doesn't change.
+  Workers can be ahead of the main thread by (_window) items only.
+*/
+
+static const UInt32 k_HashMt_ReadSize = (UInt32)1 << 20;
+static const UInt32 k_HashMt_NumThreadsMax = 64;
+static const unsigned k_HashMt_WindowPerThread = 16;
+
+struct CHashMtFile
+{
+  bool Finished;
+  bool OpenError;
+  bool PhySize_Defined;
+  DWORD SystemError;
+  HRESULT Result;
+  UInt64 PhySize;
+  UInt64 FileSize;
+  CByteBuffer Digests; // k_HashCalc_DigestSize_Max bytes per hasher
+};
+
+class CHashMtLane Z7_final: public CVirtThread
+{
+public:
+  IHasher *Hasher;
+  const Byte *Data;
+  UInt32 Size;
+
+  ~CHashMtLane() Z7_DESTRUCTOR_override
+  {
+    CVirtThread::WaitThreadFinish();
+  }
+private:
+  virtual void Execute() Z7_override
+  {
+    Hasher->Update(Data, Size);
+  }
+};
+
+class CHashMtPipe;
+
+class CHashMtThread Z7_final: public CVirtThread
+{
+  CMidBuffer _bufs[2];
+  CObjectVector<CHashMtLane> _lanes;
+  unsigned _numLanesStarted;
+  bool _lanesFailed;
+
+  bool StartLanes(const Byte *data, UInt32 size);
+  void WaitLanes();
+public:
+  CHashMtPipe *Parent;
+  CHashBundle Hb;
+  unsigned NumLanesMax; // hashers that can run in lane threads, other hashers run in this thread
+
+  CHashMtThread(): _numLanesStarted(0), _lanesFailed(false), NumLanesMax(0) {}
+  ~CHashMtThread() Z7_DESTRUCTOR_override
+  {
+    CVirtThread::WaitThreadFinish();
+  }
+
+  bool AllocBufs()
+  {
+    _bufs[0].Alloc(k_HashMt_ReadSize);
+    _bufs[1].Alloc(k_HashMt_ReadSize);
+    return _bufs[0].IsAllocated() && _bufs[1].IsAllocated();
+  }
+  HRESULT HashStream(ISequentialInStream *stream, CHashMtFile &file);
+private:
+  virtual void Execute() Z7_override;
+};
+
+class CHashMtPipe
+{
+  unsigned _nextItem; // next item for workers
+  unsigned _mainItem; // next item for the main thread
+  unsigned _window;
+  bool _stop;
+  UInt64 _completed;
+  NSynchronization::CCriticalSection _cs;
+  NSynchronization::CManualResetEvent _canReadEvent;
+  NSynchronization::CManualResetEvent _changedEvent;
+  CObjectVector<CHashMtThread> _threads;
+  CObjectVector<CHashMtFile> _files;
+
+  HRESULT HashItem(CHashMtThread &thread, unsigned index, CHashMtFile &f);
+public:
+  const CDirItems *DirItems;
+  bool PreserveATime;
+  bool OpenShareForWrite;
+
+  CHashMtPipe():
+      _nextItem(0),
+      _mainItem(0),
+      _window(0),
+      _stop(false),
+      _completed(0),
+      DirItems(NULL),
+      PreserveATime(false),
+      OpenShareForWrite(false)
+      {}
+  ~CHashMtPipe() { StopThreads(); }
+
+  HRESULT StartThreads(DECL_EXTERNAL_CODECS_LOC_VARS
+      const UStringVector &methods, UInt32 numHasherThreads,
+      UInt32 numThreads, unsigned numHashers, unsigned numLanes);
+  void StopThreads();
+  void HashItems(CHashMtThread &thread);
+  // it's called once per read buffer, so the lock is cheap here
+  bool IsStopped()
+  {
+    NSynchronization::CCriticalSectionLock lock(_cs);
+    return _stop;
+  }
+  void AddCompleted(UInt64 size)
+  {
+    NSynchronization::CCriticalSectionLock lock(_cs);
+    _completed += size;
+    _changedEvent.Set();
+  }
+  UInt64 GetCompleted()
+  {
+    NSynchronization::CCriticalSectionLock lock(_cs);
+    return _completed;
+  }
+  HRESULT WaitFile(IHashCallbackUI *callback, CHashMtFile *&file);
+  void ReleaseFile();
+};
+
+void CHashMtThread::Execute()
+{
+  Parent->HashItems(*this);
+}
+
+bool CHashMtThread::StartLanes(const Byte *data, UInt32 size)
+{
+  if (_lanesFailed || NumLanesMax == 0)
+    return false;
+  const unsigned numHashers = Hb.Hashers.Size();
+  unsigned numLanes = numHashers;
+  if (numLanes > NumLanesMax)
+    numLanes = NumLanesMax;
+  while (_lanes.Size() < numLanes)
+  {
+    CHashMtLane &lane = _lanes.AddNew();
+    if (lane.Create() != 0)
+    {
+      _lanes.DeleteBack();
+      _lanesFailed = true;
+      return false;
+    }
+  }
+  unsigned i;
+  for (i = 0; i < numLanes; i++)
+  {
+    CHashMtLane &lane = _lanes[i];
+    lane.Hasher = Hb.Hashers[i].Hasher;
+    lane.Data = data;
+    lane.Size = size;
+    if (lane.Start() != 0)
+      break;
+  }
+  _numLanesStarted = i;
+  for (; i < numHashers; i++)
+    Hb.Hashers[i].Hasher->Update(data, size);
+  return true;
+}
+
+void CHashMtThread::WaitLanes()
+{
+  for (unsigned i = 0; i < _numLanesStarted; i++)
+    _lanes[i].WaitExecuteFinish();
+  _numLanesStarted = 0;
+}
+
+HRESULT CHashMtThread::HashStream(ISequentialInStream *stream, CHashMtFile &f)
+{
+  Hb.InitForNewFile();
+  HRESULT res;
+  unsigned bufIndex = 0;
+  for (;;)
+  {
+    const Byte *data = _bufs[bufIndex];
+    size_t size = k_HashMt_ReadSize;
+    res = ReadStream(stream, _bufs[bufIndex], &size);
+    // the lanes still can work with another buffer
+    WaitLanes();
+    if (res != S_OK || size == 0)
+      break;
+    f.FileSize += size;
+    Parent->AddCompleted(size);
+    // small file is hashed here without lanes
+    if ((f.FileSize == size && size != k_HashMt_ReadSize)
+        || !StartLanes(data, (UInt32)size))
+      Hb.Update(data, (UInt32)size);
+    if (size != k_HashMt_ReadSize)
+      break;
+    if (Parent->IsStopped())
+    {
+      res = E_ABORT;
+      break;
+    }
+    bufIndex ^= 1;
+  }
+  WaitLanes();
+  if (res == S_OK)
+    FOR_VECTOR (i, Hb.Hashers)
+      Hb.Hashers[i].Hasher->Final(f.Digests + (size_t)i * k_HashCalc_DigestSize_Max);
+  return res;
+}
+
+HRESULT CHashMtPipe::StartThreads(DECL_EXTERNAL_CODECS_LOC_VARS
+    const UStringVector &methods, UInt32 numHasherThreads,
+    UInt32 numThreads, unsigned numHashers, unsigned numLanes)
+{
+  _window = (unsigned)numThreads * k_HashMt_WindowPerThread;
+  unsigned i;
+  for (i = 0; i < _window; i++)
+  {
+    CHashMtFile &f = _files.AddNew();
+    f.Finished = false;
+    f.Digests.Alloc((size_t)numHashers * k_HashCalc_DigestSize_Max);
+  }
+  {
+    WRes wres = _canReadEvent.CreateIfNotCreated_Reset();
+    if (wres == 0)
+      wres = _changedEvent.CreateIfNotCreated_Reset();
+    if (wres != 0)
+      return HRESULT_FROM_WIN32(wres);
+  }
+  HRESULT res = S_OK;
+  for (i = 0; i < numThreads; i++)
+  {
+    CHashMtThread &t = _threads.AddNew();
+    t.Parent = this;
+    t.Hb.NumThreads = numHasherThreads;
+    t.NumLanesMax = numLanes;
+    res = t.Hb.SetMethods(EXTERNAL_CODECS_LOC_VARS methods);
+    if (res == S_OK && !t.AllocBufs())
+      res = E_OUTOFMEMORY;
+    if (res == S_OK)
+    {
+      WRes wres = t.Create();
+      if (wres == 0)
+        wres = t.Start();
+      if (wres != 0)
+        res = HRESULT_FROM_WIN32(wres);
+    }
+    if (res != S_OK)
+    {
+      // the thread was not started
+      _threads.DeleteBack();
+      break;
+    }
+  }
+  // the items are taken dynamically, so any number of started workers is enough
+  if (_threads.IsEmpty())
+    return res == S_OK ? E_FAIL : res;
+  return S_OK;
+}
+
+void CHashMtPipe::StopThreads()
+{
+  if (_threads.IsEmpty())
+    return;
+  {
+    NSynchronization::CCriticalSectionLock lock(_cs);
+    _stop = true;
+    _canReadEvent.Set();
+  }
+  FOR_VECTOR (i, _threads)
+    _threads[i].WaitExecuteFinish();
+  _threads.Clear();
+}
+
+HRESULT CHashMtPipe::HashItem(CHashMtThread &thread, unsigned index, CHashMtFile &f)
+{
+  const CDirItem &di = DirItems->Items[index];
+  #ifndef UNDER_CE
+  if (di.ReparseData.Size() != 0)
+  {
+    CMyComPtr2_Create<ISequentialInStream, CBufInStream> inStream;
+    inStream->Init(di.ReparseData, di.ReparseData.Size());
+    return thread.HashStream(inStream, f);
+  }
+  #endif
+  if (di.IsDir())
+    return S_OK;
+  CMyComPtr2_Create<IInStream, CInFileStream> inStream;
+  inStream->Set_PreserveATime(PreserveATime);
+  if (!inStream->OpenShared(DirItems->GetPhyPath(index), OpenShareForWrite))
+  {
+    f.OpenError = true;
+    f.SystemError = ::GetLastError();
+    return S_OK;
+  }
+  if (inStream->GetSize(&f.PhySize) == S_OK)
+    f.PhySize_Defined = true;
+  return thread.HashStream(inStream, f);
+}
+
+void CHashMtPipe::HashItems(CHashMtThread &thread)
+{
+  const unsigned numItems = DirItems->Items.Size();
+  for (;;)
+  {
+    unsigned index;
+    _cs.Enter();
+    for (;;)
+    {
+      if (_stop || _nextItem == numItems)
+      {
+        _cs.Leave();
+        return;
+      }
+      if (_nextItem - _mainItem < _window)
+        break;
+      _canReadEvent.Reset();
+      _cs.Leave();
+      _canReadEvent.Lock();
+      _cs.Enter();
+    }
+    index = _nextItem++;
+    _cs.Leave();
+
+    CHashMtFile &f = _files[index % _window];
+    f.OpenError = false;
+    f.PhySize_Defined = false;
+    f.SystemError = 0;
+    f.PhySize = 0;
+    f.FileSize = 0;
+    try
+    {
+      f.Result = HashItem(thread, index, f);
+    }
+    catch(...)
+    {
+      f.Result = E_OUTOFMEMORY;
+    }
+
+    {
+      NSynchronization::CCriticalSectionLock lock(_cs);
+      f.Finished = true;
+      _changedEvent.Set();
+    }
+  }
+}
+
+HRESULT CHashMtPipe::WaitFile(IHashCallbackUI *callback, CHashMtFile *&file)
+{
+  CHashMtFile &f = _files[_mainItem % _window];
+  for (;;)
+  {
+    UInt64 completed;
+    {
+      NSynchronization::CCriticalSectionLock lock(_cs);
+      if (f.Finished)
+      {
+        file = &f;
+        return S_OK;
+      }
+      completed = _completed;
+      _changedEvent.Reset();
+    }
+    RINOK(callback->SetCompleted(&completed))
+    const WRes wres = _changedEvent.Lock();
+    if (wres != 0)
+      return HRESULT_FROM_WIN32(wres);
+  }
+}
+
+void CHashMtPipe::ReleaseFile()
+{
+  NSynchronization::CCriticalSectionLock lock(_cs);
+  _files[_mainItem % _window].Finished = false;
+  _mainItem++;
+  _canReadEvent.Set();
+}
+
+#endif
+
 
 HRESULT HashCalc(
     DECL_EXTERNAL_CODECS_LOC_VARS
@@ -495,6 +904,12 @@ HRESULT HashCalc(
 
     dirItems.ShareForWrite = options.OpenShareForWrite;
 
+   #ifdef Z7_DIR_PREFETCH
+    // -mmt limits the number of threads that list the directories
+    if (options.NumThreads != 0 && options.NumThreads < dirItems.NumScanThreads)
+      dirItems.NumScanThreads = options.NumThreads;
+   #endif
+
     HRESULT res = EnumerateItems(censor,
         options.PathMode,
         UString(),
@@ -511,6 +926,7 @@ HRESULT HashCalc(
 
   unsigned i;
   CHashBundle hb;
+  hb.NumThreads = options.NumThreads;
   RINOK(hb.SetMethods(EXTERNAL_CODECS_LOC_VARS options.Methods))
   // hb.Init();
 
@@ -536,6 +952,87 @@ HRESULT HashCalc(
 
   RINOK(callback->BeforeFirstFile(hb))
 
+ #ifndef Z7_ST
+  CHashMtPipe pipe;
+  bool useMt = false;
+  if (!options.StdInMode && !dirItems.Items.IsEmpty())
+  {
+    UInt32 numThreads = options.NumThreads;
+    if (numThreads == 0)
+      numThreads = NSystem::GetNumberOfProcessors();
+    if (numThreads > 1)
+    {
+      UInt32 numWorkers = numThreads;
+      if (numWorkers > k_HashMt_NumThreadsMax)
+        numWorkers = k_HashMt_NumThreadsMax;
+      if (numWorkers > dirItems.Items.Size())
+        numWorkers = dirItems.Items.Size();
+      /* the threads of all workers (with their lanes) must not exceed numThreads.
+         If there are fewer lanes than hashers, the worker thread also hashes. */
+      const UInt32 numWorkerThreads = numThreads / numWorkers;
+      const unsigned numHashers = hb.Hashers.Size();
+      unsigned numLanes = 0;
+      if (numHashers > 1 && numWorkerThreads > 1)
+        numLanes = numWorkerThreads >= numHashers ? numHashers : (unsigned)numWorkerThreads - 1;
+      pipe.DirItems = &dirItems;
+      pipe.PreserveATime = options.PreserveATime;
+      pipe.OpenShareForWrite = options.OpenShareForWrite;
+      // without lanes the worker can give its threads to the hasher (BLAKE3)
+      useMt = (pipe.StartThreads(EXTERNAL_CODECS_LOC_VARS
+          options.Methods, numLanes == 0 ? numWorkerThreads : 1,
+          numWorkers, numHashers, numLanes) == S_OK);
+    }
+  }
+
+  if (useMt)
+  {
+    for (i = 0; i < dirItems.Items.Size(); i++)
+    {
+      CHashMtFile *f;
+      RINOK(pipe.WaitFile(callback, f))
+      RINOK(f->Result)
+      
+      const CDirItem &di = dirItems.Items[i];
+      bool isDir = false;
+      bool isAltStream = false;
+     #ifdef _WIN32
+      isAltStream = di.IsAltStream;
+     #endif
+     #ifndef UNDER_CE
+      if (di.ReparseData.Size() == 0)
+     #endif
+        isDir = di.IsDir();
+
+      if (f->OpenError)
+      {
+        const HRESULT res = callback->OpenFileError(dirItems.GetPhyPath(i), f->SystemError);
+        hb.NumErrors++;
+        if (res != S_FALSE)
+          return res;
+        pipe.ReleaseFile();
+        continue;
+      }
+      if (f->PhySize_Defined && f->PhySize > di.Size)
+      {
+        totalSize += f->PhySize - di.Size;
+        RINOK(callback->SetTotal(totalSize))
+      }
+
+      const UString path = dirItems.GetLogPath(i);
+      RINOK(callback->GetStream(path, isDir))
+      hb.InitForNewFile();
+      hb.SetSize(f->FileSize);
+      hb.Final(isDir, isAltStream, path, f->Digests);
+      RINOK(callback->SetOperationResult(f->FileSize, hb, !isDir))
+      pipe.ReleaseFile();
+      completeValue = pipe.GetCompleted();
+      RINOK(callback->SetCompleted(&completeValue))
+    }
+    pipe.StopThreads();
+    return callback->AfterLastFile(hb);
+  }
+ #endif
+
   /*
   CDynLimBuf hashFileString((size_t)1 << 31);
   const bool needGenerate = !options.HashFilePath.IsEmpty();
@@ -94,18 +94,24 @@ struct CHashBundle Z7_final: public IHashCalc
   UString MainName;
   UString FirstFileName;
 
+  UInt32 NumThreads; // for hashers that support it, if not set in method, 0 - default
+
   HRESULT SetMethods(DECL_EXTERNAL_CODECS_LOC_VARS const UStringVector &methods);
   
   // void Init() {}
   CHashBundle()
   {
     NumDirs = NumFiles = NumAltStreams = FilesSize = AltStreamsSize = NumErrors = 0;
+    NumThreads = 0;
   }
 
   void InitForNewFile() Z7_override;
   void Update(const void *data, UInt32 size) Z7_override;
   void SetSize(UInt64 size) Z7_override;
   void Final(bool isDir, bool isAltStream, const UString &path) Z7_override;
+  // (digests) : current digests calculated by another hasher set (k_HashCalc_DigestSize_Max bytes per hasher),
+  //             or NULL to get them from the hashers
+  void Final(bool isDir, bool isAltStream, const UString &path, const Byte *digests);
 };
 
 Z7_PURE_INTERFACES_BEGIN
@@ -196,6 +202,7 @@ struct CHashOptions
   bool StdInMode;
   bool AltStreamsMode;
   CBoolPair SymLinks;
+  UInt32 NumThreads; // from -mmt, 0 - not specified
 
   NWildcard::ECensorPathMode PathMode;
 
@@ -204,6 +211,7 @@ struct CHashOptions
       OpenShareForWrite(false),
       StdInMode(false),
       AltStreamsMode(false),
+      NumThreads(0),
       PathMode(NWildcard::k_RelatPath) {}
 };
 
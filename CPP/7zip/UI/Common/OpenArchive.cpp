@@ -3102,6 +3102,13 @@ HRESULT CArc::OpenStreamOrFile(COpenOptions &op)
     Path = filePath;
     if (!fileStreamSpec->Open(us2fs(Path)))
       return GetLastError_noZero_HRESULT();
+    #ifdef Z7_FILE_STREAMS_USE_MAP
+    /* the mapped file gives SIGBUS, if the file is truncated by another
+       process or if there is read error. So we map it only by request.
+       If mapping fails, the stream uses read() calls */
+    if (op.mapFile)
+      fileStreamSpec->MapFile();
+    #endif
     op.stream = fileStream;
     #ifdef Z7_SFX
     IgnoreSplit = true;
@@ -129,6 +129,7 @@ struct COpenOptions
   // bool openOnlySpecifiedByExtension,
 
   bool stdInMode;
+  bool mapFile; // map archive file to memory (-smm switch)
   UString filePath;
 
   COpenOptions():
@@ -139,7 +140,8 @@ struct COpenOptions
       seqStream(NULL),
       callback(NULL),
       callbackSpec(NULL),
-      stdInMode(false)
+      stdInMode(false),
+      mapFile(false)
     {}
 
 };
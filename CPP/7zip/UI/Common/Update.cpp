@@ -1394,6 +1394,12 @@ HRESULT UpdateArchive(
       dirItems.StoreOwnerName = options.StoreOwnerName.Val;
      #endif
 
+     #ifdef Z7_DIR_PREFETCH
+      // -mmt limits the number of threads that list the directories
+      if (options.NumThreads != 0 && options.NumThreads < dirItems.NumScanThreads)
+        dirItems.NumScanThreads = options.NumThreads;
+     #endif
+
       const HRESULT res = EnumerateItems(censor,
           options.PathMode,
           UString(), // options.AddPathPrefix,
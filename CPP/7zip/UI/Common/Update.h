@@ -104,6 +104,8 @@ struct CUpdateOptions
   CBoolPair StoreOwnerId;
   CBoolPair StoreOwnerName;
 
+  UInt32 NumThreads; // from -mmt, 0 - not specified
+
   EArcNameMode ArcNameMode;
   NWildcard::ECensorPathMode PathMode;
 
@@ -142,6 +144,7 @@ struct CUpdateOptions
     SetArcMTime(false),
     RenameMode(false),
 
+    NumThreads(0),
     ArcNameMode(k_ArcNameMode_Smart),
     PathMode(NWildcard::k_RelatPath)
     
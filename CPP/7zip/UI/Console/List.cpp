@@ -1178,6 +1178,7 @@ HRESULT ListArchives(
     options.types = &types;
     options.excludedFormats = &excludedFormats;
     options.stdInMode = stdInMode;
+    options.mapFile = listOptions.MapArcFile;
     options.stream = NULL;
     options.filePath = arcPath;
 
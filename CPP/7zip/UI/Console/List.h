@@ -12,11 +12,13 @@ struct CListOptions
   bool ExcludeDirItems;
   bool ExcludeFileItems;
   bool DisablePercents;
+  bool MapArcFile;
 
   CListOptions():
     ExcludeDirItems(false),
     ExcludeFileItems(false),
-    DisablePercents(false)
+    DisablePercents(false),
+    MapArcFile(false)
     {}
 };
 
@@ -184,6 +184,7 @@ static const char * const kHelpString =
     "  -si[{name}] : read data from stdin\n"
     "  -slp : set Large Pages mode\n"
     "  -slt : show technical information for l (List) command\n"
+    "  -smm : map archive file to memory for reading\n"
     "  -snh : store hard links as links\n"
     "  -snl : store symbolic links as links\n"
     "  -sni : store NT security information\n"
@@ -199,6 +200,7 @@ static const char * const kHelpString =
     "  -stl : set archive timestamp from the most recently modified file\n"
     "  -stm{HexMask} : set CPU thread affinity mask (hexadecimal number)\n"
     "  -stx{Type} : exclude archive type\n"
+    "  -swa : write extracted files in separate thread\n"
     "  -t{Type} : Set type of archive\n"
     "  -u[-][p#][q#][r#][x#][y#][z#][!newArchiveName] : Update options\n"
     "  -v{Size}[b|k|m|g] : Create volumes\n"
@@ -1508,6 +1510,7 @@ int Main2(
       lo.ExcludeDirItems = options.Censor.ExcludeDirItems;
       lo.ExcludeFileItems = options.Censor.ExcludeFileItems;
       lo.DisablePercents = options.DisablePercents;
+      lo.MapArcFile = options.ExtractOptions.MapArcFile;
 
       hresultMain = ListArchives(
           lo,
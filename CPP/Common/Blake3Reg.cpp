@@ -8,32 +8,253 @@ EXTERN_C_BEGIN
 #include "../../C/hashes/blake3.h"
 EXTERN_C_END
 
+#include "../Common/MyBuffer2.h"
 #include "../Common/MyCom.h"
 #include "../7zip/Common/RegisterCodec.h"
 
+#ifndef Z7_ST
+#include "../Common/MyVector.h"
+#include "../7zip/Common/VirtThread.h"
+#endif
+
+#ifndef Z7_ST
+
+// each job hashes one subtree of 1 MiB (1024 chunks)
+static const unsigned k_Blake3_SubtreeLog = 20;
+static const UInt32 k_Blake3_NumThreadsMax = 64;
+
+struct CBlake3Thread: public CVirtThread
+{
+  const blake3_hasher *Ctx;
+  const Byte *Data;
+  UInt64 ChunkCounter;
+  Byte CvPair[2 * BLAKE3_OUT_LEN];
+
+  void Execute() Z7_override
+  {
+    blake3_hasher_subtree_cvs(Ctx, Data, (size_t)1 << k_Blake3_SubtreeLog, ChunkCounter, CvPair);
+  }
+  ~CBlake3Thread() Z7_DESTRUCTOR_override { WaitThreadFinish(); }
+};
+
+#endif
+
 // BLAKE3
-Z7_CLASS_IMP_COM_1(
+Z7_CLASS_IMP_COM_2(
   CBLAKE3Hasher
   , IHasher
+  , ICompressSetCoderProperties
 )
   blake3_hasher _ctx;
+  unsigned _simdDegree; // 0 - detected SIMD degree, 1 - portable code
+
+  void InitCtx()
+  {
+    blake3_hasher_init(&_ctx);
+    blake3_hasher_set_simd_degree(&_ctx, _simdDegree);
+  }
+
+ #ifndef Z7_ST
+  UInt32 _numThreads;
+  size_t _bufPos;
+  CMidBuffer _buf;
+  CObjectVector<CBlake3Thread> _threads;
+
+  bool Alloc_Mt();
+  void Hash_Mt(const Byte *data);
+  void Flush_Mt();
+ #endif
 
 public:
-  CBLAKE3Hasher() { blake3_hasher_init(&_ctx); }
+  CBLAKE3Hasher():
+      _simdDegree(0)
+   #ifndef Z7_ST
+    , _numThreads(1)
+    , _bufPos(0)
+   #endif
+    { InitCtx(); }
 };
 
+#ifndef Z7_ST
+
+/* Input is collected into blocks of (_numThreads) subtrees. A full block is
+   hashed by the worker threads and the main thread together, and the subtree
+   chaining values are pushed into (_ctx) in order, so the digest is the same
+   as for single-threaded hashing. The tail goes through blake3_hasher_update()
+   in Final(). Small inputs never fill a block and don't start any thread. */
+
+bool CBLAKE3Hasher::Alloc_Mt()
+{
+  // threads are created before any data is buffered, so (_numThreads) can be reduced here
+  while (_threads.Size() + 1 < _numThreads)
+  {
+    CBlake3Thread &t = _threads.AddNew();
+    if (t.Create() != 0)
+    {
+      _threads.DeleteBack();
+      _numThreads = _threads.Size() + 1;
+      break;
+    }
+  }
+  if (_numThreads <= 1)
+    return false;
+  const size_t blockSize = (size_t)_numThreads << k_Blake3_SubtreeLog;
+  if (_buf.Size() != blockSize)
+  {
+    _buf.Alloc(blockSize);
+    if (!_buf.IsAllocated())
+      return false;
+  }
+  return true;
+}
+
+void CBLAKE3Hasher::Hash_Mt(const Byte *data)
+{
+  const size_t subtreeSize = (size_t)1 << k_Blake3_SubtreeLog;
+  const UInt64 subtreeChunks = subtreeSize / BLAKE3_CHUNK_LEN;
+  const UInt64 counter = _ctx.chunk.chunk_counter;
+  Byte cvPair[2 * BLAKE3_OUT_LEN];
+  unsigned i;
+
+  // jobs whose thread can't be started are hashed here after job 0
+  unsigned numStarted = 0;
+  for (i = 0; i + 1 < _numThreads; i++)
+  {
+    CBlake3Thread &t = _threads[i];
+    t.Ctx = &_ctx;
+    t.Data = data + ((size_t)(i + 1) << k_Blake3_SubtreeLog);
+    t.ChunkCounter = counter + subtreeChunks * (i + 1);
+    if (t.Start() != 0)
+      break;
+    numStarted++;
+  }
+
+  blake3_hasher_subtree_cvs(&_ctx, data, subtreeSize, counter, cvPair);
+
+  for (i = numStarted + 1; i < _numThreads; i++)
+  {
+    CBlake3Thread &t = _threads[i - 1];
+    t.Ctx = &_ctx;
+    t.Data = data + ((size_t)i << k_Blake3_SubtreeLog);
+    t.ChunkCounter = counter + subtreeChunks * i;
+    t.Execute();
+  }
+  for (i = 0; i < numStarted; i++)
+    _threads[i].WaitExecuteFinish();
+
+  blake3_hasher_push_subtree_cvs(&_ctx, cvPair, subtreeSize);
+  for (i = 1; i < _numThreads; i++)
+    blake3_hasher_push_subtree_cvs(&_ctx, _threads[i - 1].CvPair, subtreeSize);
+}
+
+void CBLAKE3Hasher::Flush_Mt()
+{
+  if (_bufPos != 0)
+  {
+    blake3_hasher_update(&_ctx, _buf, _bufPos);
+    _bufPos = 0;
+  }
+}
+
+#endif
+
 Z7_COM7F_IMF2(void, CBLAKE3Hasher::Init())
 {
-  blake3_hasher_init(&_ctx);
+  InitCtx();
+ #ifndef Z7_ST
+  _bufPos = 0;
+ #endif
 }
 
 Z7_COM7F_IMF2(void, CBLAKE3Hasher::Update(const void *data, UInt32 size))
 {
+ #ifndef Z7_ST
+  if (_numThreads > 1)
+  {
+    if (!Alloc_Mt())
+    {
+      // no memory or no threads: continue single-threaded
+      Flush_Mt();
+      _numThreads = 1;
+      _buf.Free();
+    }
+    else
+    {
+      const size_t blockSize = _buf.Size();
+      const Byte *p = (const Byte *)data;
+      while (size != 0)
+      {
+        if (_bufPos == 0 && size >= blockSize)
+        {
+          Hash_Mt(p);
+          p += blockSize;
+          size -= (UInt32)blockSize;
+          continue;
+        }
+        size_t cur = blockSize - _bufPos;
+        if (cur > size)
+          cur = size;
+        memcpy(_buf + _bufPos, p, cur);
+        _bufPos += cur;
+        p += cur;
+        size -= (UInt32)cur;
+        if (_bufPos == blockSize)
+        {
+          Hash_Mt(_buf);
+          _bufPos = 0;
+        }
+      }
+      return;
+    }
+  }
+ #endif
   blake3_hasher_update(&_ctx, data, size);
 }
 
 Z7_COM7F_IMF2(void, CBLAKE3Hasher::Final(Byte *digest))
 {
+ #ifndef Z7_ST
+  Flush_Mt();
+ #endif
   blake3_hasher_finalize(&_ctx, digest, BLAKE3_OUT_LEN);
 }
+
+Z7_COM7F_IMF(CBLAKE3Hasher::SetCoderProperties(const PROPID *propIDs, const PROPVARIANT *coderProps, UInt32 numProps))
+{
+  unsigned algo = 0;
+  for (UInt32 i = 0; i < numProps; i++)
+  {
+    if (propIDs[i] == NCoderPropID::kDefaultProp)
+    {
+      // 0 - auto, 1 - portable code, 2 - SIMD code
+      const PROPVARIANT &prop = coderProps[i];
+      if (prop.vt != VT_UI4)
+        return E_INVALIDARG;
+      if (prop.ulVal > 2)
+        return E_NOTIMPL;
+      algo = (unsigned)prop.ulVal;
+    }
+    else if (propIDs[i] == NCoderPropID::kNumThreads)
+    {
+      const PROPVARIANT &prop = coderProps[i];
+      if (prop.vt != VT_UI4)
+        return E_INVALIDARG;
+     #ifndef Z7_ST
+      UInt32 v = prop.ulVal;
+      if (v == 0)
+        v = 1;
+      if (v > k_Blake3_NumThreadsMax)
+        v = k_Blake3_NumThreadsMax;
+      // the properties are set before hashing, so nothing is buffered yet
+      _numThreads = v;
+     #endif
+    }
+  }
+  if (algo == 2 && blake3_simd_degree() == 1)
+    return E_NOTIMPL;
+  _simdDegree = (algo == 1 ? 1 : 0);
+  blake3_hasher_set_simd_degree(&_ctx, _simdDegree);
+  return S_OK;
+}
+
 REGISTER_HASHER(CBLAKE3Hasher, 0x204, "BLAKE3", BLAKE3_OUT_LEN)
@@ -6,6 +6,11 @@
 
 #define XXH_STATIC_LINKING_ONLY
 #include "../../C/hashes/xxhash.h"
+#ifdef MY_CPU_X86_OR_AMD64
+// XXH3_*_update() go through the runtime SSE2 / AVX2 / AVX-512 dispatcher
+// (arm64 builds use NEON code from xxhash.h directly)
+#include "../../C/hashes/xxh_x86dispatch.h"
+#endif
 
 #include "../Common/MyCom.h"
 #include "../7zip/Common/RegisterCodec.h"
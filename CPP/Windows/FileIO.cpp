@@ -903,6 +903,24 @@ bool COutFile::SetLength(UInt64 length) throw()
   return (iret == 0);
 }
 
+bool COutFile::PreAllocate(UInt64 length) throw()
+{
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+  const off_t len2 = (off_t)length;
+  if ((Int64)length != len2)
+  {
+    SetLastError(EFBIG);
+    return false;
+  }
+  // FALLOC_FL_KEEP_SIZE: the file size is not changed, so the reserved space past
+  // the written data is not visible. ftruncate() to the file size releases it.
+  return fallocate(_handle, FALLOC_FL_KEEP_SIZE, 0, len2) == 0;
+#else
+  UNUSED_VAR(length)
+  return true;
+#endif
+}
+
 bool COutFile::Close()
 {
   const bool res = CFileBase::Close();
@@ -380,6 +380,7 @@ public:
   off_t seekToCur() const throw();
   // bool SeekToBegin() throw();
   int my_fstat(struct stat *st) const  { return fstat(_handle, st); }
+  int GetHandle() const { return _handle; }
   /*
   int my_ioctl_BLKGETSIZE64(unsigned long long *val);
   int GetDeviceSize_InBytes(UInt64 &size);
@@ -453,6 +454,8 @@ public:
   {
     return SetLength(length);
   }
+  // reserves disk space without changing the file size (Linux only)
+  bool PreAllocate(UInt64 length) throw();
   bool SetTime(const CFiTime *cTime, const CFiTime *aTime, const CFiTime *mTime) throw();
   bool SetMTime(const CFiTime *mTime) throw();
 };
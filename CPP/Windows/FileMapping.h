@@ -5,10 +5,17 @@
 
 #include "../Common/MyTypes.h"
 
+#ifdef _WIN32
 #include "Handle.h"
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 namespace NWindows {
 
+#ifdef _WIN32
+
 class CFileMapping: public CHandle
 {
 public:
@@ -61,6 +68,79 @@ public:
   ~CFileUnmapper() { ::UnmapViewOfFile(_data); }
 };
 
+#else // _WIN32
+
+/*
+CFileView is read-only shared mapping of whole file in posix.
+If the file is truncated by another process while it's mapped,
+the access to unavailable pages raises SIGBUS.
+*/
+
+class CFileView
+{
+  Byte *_data;
+  size_t _size;
+
+  Z7_CLASS_NO_COPY(CFileView)
+public:
+  CFileView(): _data(NULL), _size(0) {}
+  ~CFileView() { Unmap(); }
+
+  bool IsMapped() const { return _data != NULL; }
+  const Byte *Data() const { return _data; }
+  size_t Size() const { return _size; }
+
+  bool Map(int fd, size_t size)
+  {
+    Unmap();
+    if (size == 0)
+      return false;
+    void *p = ::mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+      return false;
+    _data = (Byte *)p;
+    _size = size;
+    return true;
+  }
+
+  void Unmap()
+  {
+    if (_data)
+    {
+      ::munmap(_data, _size);
+      _data = NULL;
+      _size = 0;
+    }
+  }
+
+  // it's a hint only, so the errors are ignored
+  void Advise(UInt64 pos, UInt64 size, bool sequential, bool willNeed) const
+  {
+    if (!_data || pos >= _size)
+      return;
+    if (size > _size - pos)
+      size = _size - pos;
+    // madvise() requires page aligned address
+    const size_t pageSize = (size_t)::sysconf(_SC_PAGESIZE);
+    const size_t offset = (size_t)pos & ~(pageSize - 1);
+    const size_t len = (size_t)size + ((size_t)pos - offset);
+   #ifdef MADV_SEQUENTIAL
+    if (sequential)
+      ::madvise(_data + offset, len, MADV_SEQUENTIAL);
+   #else
+    UNUSED_VAR(sequential)
+   #endif
+   #ifdef MADV_WILLNEED
+    if (willNeed)
+      ::madvise(_data + offset, len, MADV_WILLNEED);
+   #else
+    UNUSED_VAR(willNeed)
+   #endif
+  }
+};
+
+#endif // _WIN32
+
 }
 
 #endif
@@ -642,3 +642,7 @@ EMSCRIPTEN_KEEPALIVE int wasm7z_extract_end(void) {
 EMSCRIPTEN_KEEPALIVE int wasm7z_has_encrypted_content(void) {
   return g_hasEncryptedContent;
 }
+
+EMSCRIPTEN_KEEPALIVE void wasm7z_set_threads(uint32_t numThreads) {
+  SzAr_SetNumThreads(numThreads);
+}
@@ -23,6 +23,20 @@ fi
 
 echo "Using Emscripten compiler command: ${EMCC_CMD[*]}"
 
+# WASM7Z_THREADS=1: pthreads build with multi-threaded LZMA2 decoding in 7zDec.c
+# and a Fast-LZMA2 compression thread pool
+MT_ARGS=(-DFL2_SINGLETHREAD)
+if [ "${WASM7Z_THREADS:-0}" != "0" ]; then
+  MT_ARGS=(
+    -pthread
+    -DZ7_LZMA2_DEC_MT
+    -s PTHREAD_POOL_SIZE="${WASM7Z_THREADS_POOL:-4}"
+    "${ROOT_DIR}/C/Lzma2DecMt.c"
+    "${ROOT_DIR}/C/MtDec.c"
+    "${ROOT_DIR}/C/Threads.c"
+  )
+fi
+
 "${EMCC_CMD[@]}" \
   -O3 \
   -I"${ROOT_DIR}/C/zstd" \
@@ -75,7 +89,20 @@ echo "Using Emscripten compiler command: ${EMCC_CMD[*]}"
   "${ROOT_DIR}/C/Bra86.c" \
   "${ROOT_DIR}/C/Bcj2.c" \
   "${ROOT_DIR}/C/Delta.c" \
-  -s EXPORTED_FUNCTIONS="['_zstd_wasm_compress','_zstd_wasm_compress_bound','_zstd_wasm_decompress','_zstd_wasm_get_frame_content_size','_zstd_wasm_is_error','_zstd_wasm_get_error_name','_wasm7z_open','_wasm7z_open_with_password','_wasm7z_close','_wasm7z_file_count','_wasm7z_fetch_name','_wasm7z_name_buffer','_wasm7z_name_length','_wasm7z_is_directory','_wasm7z_file_size','_wasm7z_extract','_wasm7z_extract_begin','_wasm7z_extract_read','_wasm7z_extract_end','_wasm7z_has_encrypted_content','_malloc','_free']" \
+  "${ROOT_DIR}/wasm/fl2_wasm.c" \
+  "${ROOT_DIR}/C/fast-lzma2/dict_buffer.c" \
+  "${ROOT_DIR}/C/fast-lzma2/fl2_common.c" \
+  "${ROOT_DIR}/C/fast-lzma2/fl2_compress.c" \
+  "${ROOT_DIR}/C/fast-lzma2/fl2_pool.c" \
+  "${ROOT_DIR}/C/fast-lzma2/fl2_threading.c" \
+  "${ROOT_DIR}/C/fast-lzma2/lzma2_enc.c" \
+  "${ROOT_DIR}/C/fast-lzma2/radix_bitpack.c" \
+  "${ROOT_DIR}/C/fast-lzma2/radix_mf.c" \
+  "${ROOT_DIR}/C/fast-lzma2/radix_struct.c" \
+  "${ROOT_DIR}/C/fast-lzma2/range_enc.c" \
+  "${ROOT_DIR}/C/fast-lzma2/util.c" \
+  ${MT_ARGS[@]+"${MT_ARGS[@]}"} \
+  -s EXPORTED_FUNCTIONS="['_zstd_wasm_compress','_zstd_wasm_compress_bound','_zstd_wasm_decompress','_zstd_wasm_get_frame_content_size','_zstd_wasm_is_error','_zstd_wasm_get_error_name','_fl2_wasm_cstream_create','_fl2_wasm_cstream_free','_fl2_wasm_cstream_thread_count','_fl2_wasm_cstream_init','_fl2_wasm_cstream_dict_prop','_fl2_wasm_cstream_compress','_fl2_wasm_cstream_end','_fl2_wasm_compress_bound','_fl2_wasm_max_level','_fl2_wasm_is_error','_fl2_wasm_get_error_name','_wasm7z_open','_wasm7z_open_with_password','_wasm7z_close','_wasm7z_file_count','_wasm7z_fetch_name','_wasm7z_name_buffer','_wasm7z_name_length','_wasm7z_is_directory','_wasm7z_file_size','_wasm7z_extract','_wasm7z_extract_begin','_wasm7z_extract_read','_wasm7z_extract_end','_wasm7z_has_encrypted_content','_wasm7z_set_threads','_malloc','_free']" \
   -s EXPORTED_RUNTIME_METHODS="['cwrap','getValue','setValue']" \
   -s ALLOW_MEMORY_GROWTH=1 \
   -s MODULARIZE=1 \
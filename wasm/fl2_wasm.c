@@ -0,0 +1,298 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../C/7zCrc.h"
+#include "../C/fast-lzma2/fast-lzma2.h"
+#include "../C/fast-lzma2/fl2_errors.h"
+
+#if defined(__EMSCRIPTEN__)
+#include <emscripten/emscripten.h>
+#define FL2_WASM_EXPORT EMSCRIPTEN_KEEPALIVE
+#else
+#define FL2_WASM_EXPORT
+#endif
+
+/* Output formats for fl2_wasm_cstream_init(). */
+#define FL2_WASM_FORMAT_LZMA2 0 /* raw LZMA2 chunks; property byte from fl2_wasm_cstream_dict_prop() */
+#define FL2_WASM_FORMAT_XZ 1    /* .xz stream with one LZMA2 block and CRC32 check */
+
+#define FL2_WASM_STAGE_HEADER 0
+#define FL2_WASM_STAGE_DATA 1
+#define FL2_WASM_STAGE_TRAILER 2
+#define FL2_WASM_STAGE_DONE 3
+
+#define XZ_HEADER_SIZE 12
+#define XZ_BLOCK_HEADER_SIZE 12
+#define XZ_CHECK_CRC32 1
+
+#define FL2_WASM_ERROR(name) ((size_t)-FL2_error_##name)
+
+typedef struct {
+  FL2_CStream *cs;
+  int format;
+  int stage;
+  uint64_t unpack_size;
+  uint64_t pack_size;
+  uint32_t crc;
+  uint8_t pend[64];
+  size_t pend_pos;
+  size_t pend_size;
+} Fl2WasmCStream;
+
+static int g_crc_ready = 0;
+
+static void SetUi32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+static size_t WriteVarInt(uint8_t *p, uint64_t v) {
+  size_t i = 0;
+  while (v >= 0x80) {
+    p[i++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  p[i++] = (uint8_t)v;
+  return i;
+}
+
+static uint32_t XzCrc(const uint8_t *p, size_t size) {
+  return CRC_GET_DIGEST(CrcUpdate(CRC_INIT_VAL, p, size));
+}
+
+/* Stream header and the header of the only block. */
+static void XzWriteHeaders(Fl2WasmCStream *s) {
+  static const uint8_t kMagic[6] = { 0xFD, '7', 'z', 'X', 'Z', 0 };
+  uint8_t *p = s->pend;
+  memcpy(p, kMagic, 6);
+  p[6] = 0;
+  p[7] = XZ_CHECK_CRC32;
+  SetUi32(p + 8, XzCrc(p + 6, 2));
+  p += XZ_HEADER_SIZE;
+  p[0] = XZ_BLOCK_HEADER_SIZE / 4 - 1;
+  p[1] = 0; /* one filter, no sizes in the header */
+  p[2] = 0x21; /* LZMA2 */
+  p[3] = 1;
+  p[4] = FL2_getCCtxDictProp(s->cs);
+  memset(p + 5, 0, 3);
+  SetUi32(p + 8, XzCrc(p, XZ_BLOCK_HEADER_SIZE - 4));
+  s->pend_pos = 0;
+  s->pend_size = XZ_HEADER_SIZE + XZ_BLOCK_HEADER_SIZE;
+}
+
+/* Block padding, check, index and stream footer. */
+static void XzWriteTrailer(Fl2WasmCStream *s) {
+  uint8_t *p = s->pend;
+  uint8_t *index;
+  size_t pos = 0;
+  size_t indexSize;
+  const uint64_t unpadded = XZ_BLOCK_HEADER_SIZE + s->pack_size + 4;
+
+  while (((s->pack_size + pos) & 3) != 0)
+    p[pos++] = 0;
+  SetUi32(p + pos, CRC_GET_DIGEST(s->crc));
+  pos += 4;
+
+  index = p + pos;
+  indexSize = 0;
+  index[indexSize++] = 0;
+  index[indexSize++] = 1;
+  indexSize += WriteVarInt(index + indexSize, unpadded);
+  indexSize += WriteVarInt(index + indexSize, s->unpack_size);
+  while ((indexSize & 3) != 0)
+    index[indexSize++] = 0;
+  SetUi32(index + indexSize, XzCrc(index, indexSize));
+  indexSize += 4;
+  pos += indexSize;
+
+  SetUi32(p + pos + 4, (uint32_t)(indexSize / 4 - 1));
+  p[pos + 8] = 0;
+  p[pos + 9] = XZ_CHECK_CRC32;
+  SetUi32(p + pos, XzCrc(p + pos + 4, 6));
+  p[pos + 10] = 'Y';
+  p[pos + 11] = 'Z';
+  pos += 12;
+
+  s->pend_pos = 0;
+  s->pend_size = pos;
+}
+
+static void FlushPending(Fl2WasmCStream *s, FL2_outBuffer *out) {
+  size_t cur = s->pend_size - s->pend_pos;
+  if (cur > out->size - out->pos)
+    cur = out->size - out->pos;
+  memcpy((uint8_t *)out->dst + out->pos, s->pend + s->pend_pos, cur);
+  out->pos += cur;
+  s->pend_pos += cur;
+  if (s->pend_pos == s->pend_size && s->stage == FL2_WASM_STAGE_HEADER)
+    s->stage = FL2_WASM_STAGE_DATA;
+}
+
+/* nb_threads == 0 uses all cores. Builds without pthreads always use one thread. */
+FL2_WASM_EXPORT Fl2WasmCStream *fl2_wasm_cstream_create(unsigned nb_threads) {
+  Fl2WasmCStream *s;
+  if (!g_crc_ready) {
+    CrcGenerateTable();
+    g_crc_ready = 1;
+  }
+  s = (Fl2WasmCStream *)calloc(1, sizeof(Fl2WasmCStream));
+  if (!s)
+    return NULL;
+  s->cs = FL2_createCStreamMt(nb_threads, 0);
+  if (!s->cs) {
+    free(s);
+    return NULL;
+  }
+  s->stage = FL2_WASM_STAGE_DONE;
+  return s;
+}
+
+FL2_WASM_EXPORT void fl2_wasm_cstream_free(Fl2WasmCStream *s) {
+  if (!s)
+    return;
+  FL2_freeCStream(s->cs);
+  free(s);
+}
+
+FL2_WASM_EXPORT unsigned fl2_wasm_cstream_thread_count(const Fl2WasmCStream *s) {
+  return FL2_getCCtxThreadCount(s->cs);
+}
+
+/* Starts a new stream. The object can be reused for consecutive streams. */
+FL2_WASM_EXPORT size_t fl2_wasm_cstream_init(Fl2WasmCStream *s, int level, int format) {
+  size_t res;
+  if (format != FL2_WASM_FORMAT_LZMA2 && format != FL2_WASM_FORMAT_XZ)
+    return FL2_WASM_ERROR(parameter_unsupported);
+  res = FL2_CStream_setParameter(s->cs, FL2_p_compressionLevel, (size_t)level);
+  if (FL2_isError(res))
+    return res;
+  FL2_CStream_setParameter(s->cs, FL2_p_omitProperties, 1);
+  FL2_CStream_setParameter(s->cs, FL2_p_doXXHash, 0);
+  res = FL2_initCStream(s->cs, 0);
+  if (FL2_isError(res))
+    return res;
+  s->format = format;
+  s->unpack_size = 0;
+  s->pack_size = 0;
+  s->crc = CRC_INIT_VAL;
+  s->pend_pos = 0;
+  s->pend_size = 0;
+  s->stage = FL2_WASM_STAGE_DATA;
+  if (format == FL2_WASM_FORMAT_XZ) {
+    XzWriteHeaders(s);
+    s->stage = FL2_WASM_STAGE_HEADER;
+  }
+  return 0;
+}
+
+/* LZMA2 dictionary size property byte, valid after fl2_wasm_cstream_init(). */
+FL2_WASM_EXPORT unsigned fl2_wasm_cstream_dict_prop(Fl2WasmCStream *s) {
+  return FL2_getCCtxDictProp(s->cs);
+}
+
+/* Compresses input into dst and returns the number of bytes written to dst, or an
+   error code. *src_consumed receives the number of input bytes used.
+   Call it again with the rest of the input (or with no input) while dst comes back full. */
+FL2_WASM_EXPORT size_t fl2_wasm_cstream_compress(Fl2WasmCStream *s,
+                                                 const uint8_t *src,
+                                                 size_t src_size,
+                                                 uint8_t *dst,
+                                                 size_t dst_capacity,
+                                                 size_t *src_consumed) {
+  FL2_outBuffer out;
+  FL2_inBuffer in;
+  size_t res;
+
+  *src_consumed = 0;
+  if (s->stage != FL2_WASM_STAGE_HEADER && s->stage != FL2_WASM_STAGE_DATA)
+    return FL2_WASM_ERROR(stage_wrong);
+  out.dst = dst;
+  out.size = dst_capacity;
+  out.pos = 0;
+  if (s->stage == FL2_WASM_STAGE_HEADER) {
+    FlushPending(s, &out);
+    if (s->stage == FL2_WASM_STAGE_HEADER)
+      return out.pos;
+  }
+
+  in.src = src;
+  in.size = src_size;
+  in.pos = 0;
+  {
+    const size_t outStart = out.pos;
+    res = FL2_compressStream(s->cs, &out, &in);
+    s->pack_size += out.pos - outStart;
+  }
+  if (FL2_isError(res))
+    return res;
+  if (s->format == FL2_WASM_FORMAT_XZ)
+    s->crc = CrcUpdate(s->crc, src, in.pos);
+  s->unpack_size += in.pos;
+  *src_consumed = in.pos;
+  return out.pos;
+}
+
+/* Finishes the stream. Returns 0 when all output was written, 1 if it must be
+   called again with more output space, or an error code. */
+FL2_WASM_EXPORT size_t fl2_wasm_cstream_end(Fl2WasmCStream *s,
+                                            uint8_t *dst,
+                                            size_t dst_capacity,
+                                            size_t *dst_produced) {
+  FL2_outBuffer out;
+
+  *dst_produced = 0;
+  if (s->stage == FL2_WASM_STAGE_DONE)
+    return FL2_WASM_ERROR(stage_wrong);
+  out.dst = dst;
+  out.size = dst_capacity;
+  out.pos = 0;
+
+  if (s->stage == FL2_WASM_STAGE_HEADER)
+    FlushPending(s, &out);
+
+  if (s->stage == FL2_WASM_STAGE_DATA) {
+    const size_t outStart = out.pos;
+    const size_t res = FL2_endStream(s->cs, &out);
+    s->pack_size += out.pos - outStart;
+    *dst_produced = out.pos;
+    if (FL2_isError(res))
+      return res;
+    if (res != 0)
+      return 1;
+    if (s->format == FL2_WASM_FORMAT_XZ) {
+      XzWriteTrailer(s);
+      s->stage = FL2_WASM_STAGE_TRAILER;
+    }
+    else
+      s->stage = FL2_WASM_STAGE_DONE;
+  }
+
+  if (s->stage == FL2_WASM_STAGE_TRAILER) {
+    FlushPending(s, &out);
+    if (s->pend_pos == s->pend_size)
+      s->stage = FL2_WASM_STAGE_DONE;
+  }
+  *dst_produced = out.pos;
+  return s->stage == FL2_WASM_STAGE_DONE ? 0 : 1;
+}
+
+FL2_WASM_EXPORT size_t fl2_wasm_compress_bound(size_t src_size) {
+  /* xz headers and trailer are less than 64 bytes */
+  return FL2_compressBound(src_size) + 64;
+}
+
+FL2_WASM_EXPORT int fl2_wasm_max_level(void) {
+  return FL2_maxCLevel();
+}
+
+FL2_WASM_EXPORT unsigned fl2_wasm_is_error(size_t code) {
+  return FL2_isError(code);
+}
+
+FL2_WASM_EXPORT const char *fl2_wasm_get_error_name(size_t code) {
+  return FL2_getErrorName(code);
+}
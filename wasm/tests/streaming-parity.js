@@ -1,5 +1,7 @@
 const fs = require("node:fs");
+const os = require("node:os");
 const path = require("node:path");
+const { spawnSync } = require("node:child_process");
 
 async function loadModule() {
   const distDir = path.resolve(__dirname, "..", "dist");
@@ -151,6 +153,178 @@ async function verifyFixture(mod, wasm7z, fixturePath) {
   }
 }
 
+// compressible test data: words from small dictionary in pseudo-random order
+function makeTextData(size) {
+  const words = ["alpha ", "beta ", "gamma ", "delta ", "lzma2 ", "block ", "thread ", "stream\n"];
+  const out = new Uint8Array(size);
+  let x = 0x12345678;
+  let pos = 0;
+  while (pos < size) {
+    x ^= x << 13; x >>>= 0;
+    x ^= x >>> 17;
+    x ^= x << 5; x >>>= 0;
+    const w = words[x & 7];
+    for (let i = 0; i < w.length && pos < size; i++) {
+      out[pos++] = w.charCodeAt(i);
+    }
+  }
+  return out;
+}
+
+// it runs 7z from Z7_PATH in temporary directory. It returns null, if Z7_PATH is not set.
+function with7z(callback) {
+  const z7 = process.env.Z7_PATH;
+  if (!z7) {
+    return null;
+  }
+  const dir = fs.mkdtempSync(path.join(os.tmpdir(), "wasm7z-test-"));
+  try {
+    const run = (args) => {
+      const res = spawnSync(z7, args, { cwd: dir, maxBuffer: 1 << 30 });
+      if (res.status !== 0) {
+        throw new Error(`7z ${args.join(" ")} failed: ${res.error || res.status}\n${res.stderr}`);
+      }
+      return res.stdout;
+    };
+    return callback(dir, run);
+  } finally {
+    fs.rmSync(dir, { recursive: true, force: true });
+  }
+}
+
+/* LZMA2 stream with 1 MiB blocks (dictionary reset in each block).
+   The threaded build decodes such folder with Lzma2DecMt, if wasm7z_set_threads(n > 1)
+   was called and the folder is not smaller than 4 MiB.
+   The streaming extraction supports only zstd, so we check one-shot extraction. */
+async function verifyLzma2Blocks(mod, wasm7z) {
+  const data = makeTextData(6 << 20);
+  const archiveBytes = with7z((dir, run) => {
+    fs.writeFileSync(path.join(dir, "data.txt"), data);
+    run(["a", "-m0=lzma2:c=1m", "-mx1", "-mmt=4", "--", "test.7z", "data.txt"]);
+    return new Uint8Array(fs.readFileSync(path.join(dir, "test.7z")));
+  });
+  if (!archiveBytes) {
+    console.log("SKIP: lzma2 blocks (Z7_PATH is not set)");
+    return;
+  }
+  // the old builds don't export wasm7z_set_threads()
+  const threadsList = mod._wasm7z_set_threads ? [1, 4] : [1];
+  for (const numThreads of threadsList) {
+    if (mod._wasm7z_set_threads) {
+      mod._wasm7z_set_threads(numThreads);
+    }
+    const archivePtr = openArchive(mod, wasm7z, archiveBytes);
+    try {
+      const entry = getFirstFileEntry(wasm7z);
+      assertEqualBytes(data, oneShotExtract(mod, wasm7z, entry), `lzma2 blocks, threads=${numThreads}`);
+    } finally {
+      wasm7z.close();
+      mod._free(archivePtr);
+    }
+  }
+  if (mod._wasm7z_set_threads) {
+    mod._wasm7z_set_threads(1);
+  }
+  console.log(`OK: lzma2 blocks (${data.length} bytes, threads: ${threadsList.join(", ")})`);
+}
+
+// it decodes .xz data by xz, or by 7z from Z7_PATH. It returns null, if there is no decoder.
+function decodeXz(xzBytes) {
+  const res = spawnSync("xz", ["-dc"], { input: xzBytes, maxBuffer: 1 << 30 });
+  if (!res.error) {
+    if (res.status !== 0) {
+      throw new Error(`xz -dc failed: ${res.status}\n${res.stderr}`);
+    }
+    return new Uint8Array(res.stdout);
+  }
+  return with7z((dir, run) => {
+    fs.writeFileSync(path.join(dir, "test.xz"), xzBytes);
+    return new Uint8Array(run(["e", "-so", "--", "test.xz"]));
+  });
+}
+
+// Fast-LZMA2 compression to xz container in small input and output chunks
+function fl2CompressXz(mod, data, level) {
+  const fl2 = {
+    create: mod.cwrap("fl2_wasm_cstream_create", "number", ["number"]),
+    free: mod.cwrap("fl2_wasm_cstream_free", "void", ["number"]),
+    init: mod.cwrap("fl2_wasm_cstream_init", "number", ["number", "number", "number"]),
+    compress: mod.cwrap("fl2_wasm_cstream_compress", "number", ["number", "number", "number", "number", "number", "number"]),
+    end: mod.cwrap("fl2_wasm_cstream_end", "number", ["number", "number", "number", "number"]),
+    isError: mod.cwrap("fl2_wasm_is_error", "number", ["number"]),
+    errorName: mod.cwrap("fl2_wasm_get_error_name", "string", ["number"]),
+  };
+  const inChunk = 100000;
+  const outChunk = 4096;
+  const cs = fl2.create(1);
+  const srcPtr = mod._malloc(inChunk);
+  const dstPtr = mod._malloc(outChunk);
+  const sizePtr = mod._malloc(4);
+  const chunks = [];
+  const check = (res, name) => {
+    if (fl2.isError(res)) {
+      throw new Error(`${name} failed: ${fl2.errorName(res)}`);
+    }
+    return res >>> 0;
+  };
+  const takeOutput = (size) => {
+    chunks.push(mod.HEAPU8 ? mod.HEAPU8.slice(dstPtr, dstPtr + size)
+        : Uint8Array.from({ length: size }, (_, i) => mod.getValue(dstPtr + i, "i8") & 0xff));
+  };
+  try {
+    if (!cs || !srcPtr || !dstPtr || !sizePtr) {
+      throw new Error("alloc failed for fl2 stream");
+    }
+    check(fl2.init(cs, level, 1), "fl2_wasm_cstream_init");
+    for (let pos = 0; pos < data.length;) {
+      const cur = Math.min(inChunk, data.length - pos);
+      for (let i = 0; i < cur; i++) {
+        mod.setValue(srcPtr + i, data[pos + i], "i8");
+      }
+      let done = 0;
+      while (done < cur) {
+        const written = check(fl2.compress(cs, srcPtr + done, cur - done, dstPtr, outChunk, sizePtr), "fl2_wasm_cstream_compress");
+        takeOutput(written);
+        done += mod.getValue(sizePtr, "i32") >>> 0;
+      }
+      pos += cur;
+    }
+    for (;;) {
+      const res = check(fl2.end(cs, dstPtr, outChunk, sizePtr), "fl2_wasm_cstream_end");
+      takeOutput(mod.getValue(sizePtr, "i32") >>> 0);
+      if (res === 0) {
+        break;
+      }
+    }
+  } finally {
+    mod._free(srcPtr);
+    mod._free(dstPtr);
+    mod._free(sizePtr);
+    if (cs) {
+      fl2.free(cs);
+    }
+  }
+  return Buffer.concat(chunks);
+}
+
+async function verifyFl2Xz(mod) {
+  if (!mod._fl2_wasm_cstream_create) {
+    console.log("SKIP: fl2 xz (the module was built without Fast-LZMA2 exports)");
+    return;
+  }
+  const data = makeTextData(3 << 20);
+  for (const level of [1, 6]) {
+    const xzBytes = fl2CompressXz(mod, data, level);
+    const decoded = decodeXz(xzBytes);
+    if (!decoded) {
+      console.log("SKIP: fl2 xz (there is no xz, and Z7_PATH is not set)");
+      return;
+    }
+    assertEqualBytes(data, decoded, `fl2 xz, level ${level}`);
+    console.log(`OK: fl2 xz level ${level} (${data.length} -> ${xzBytes.length} bytes)`);
+  }
+}
+
 async function main() {
   const mod = await loadModule();
   const wasm7z = {
@@ -172,6 +346,8 @@ async function main() {
   for (const fixture of fixtures) {
     await verifyFixture(mod, wasm7z, fixture);
   }
+  await verifyLzma2Blocks(mod, wasm7z);
+  await verifyFl2Xz(mod);
 }
 
 main().catch((error) => {